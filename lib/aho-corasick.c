@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "aho-corasick.h"
+
+#include <string.h>
+
+struct _AhoCorasick
+{
+  gboolean ignore_case;
+  gboolean compiled;
+
+  /* patterns, as added */
+  GString *pattern_data;
+  GArray *pattern_offsets;
+  GArray *pattern_lengths;
+
+  /* the compiled automaton */
+  guint8 classes[256];
+  gint num_classes;
+  gint num_states;
+  guint32 *delta;
+  /* the patterns ending in state s are outputs[output_offsets[s]] ..
+   * outputs[output_offsets[s + 1] - 1], including the ones reachable via
+   * failure links */
+  guint32 *output_offsets;
+  gint *outputs;
+};
+
+AhoCorasick *
+aho_corasick_new(gboolean ignore_case)
+{
+  AhoCorasick *self = g_new0(AhoCorasick, 1);
+
+  self->ignore_case = ignore_case;
+  self->pattern_data = g_string_new("");
+  self->pattern_offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+  self->pattern_lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+  return self;
+}
+
+void
+aho_corasick_free(AhoCorasick *self)
+{
+  g_string_free(self->pattern_data, TRUE);
+  g_array_free(self->pattern_offsets, TRUE);
+  g_array_free(self->pattern_lengths, TRUE);
+  g_free(self->delta);
+  g_free(self->output_offsets);
+  g_free(self->outputs);
+  g_free(self);
+}
+
+gint
+aho_corasick_add_pattern(AhoCorasick *self, const gchar *pattern, gsize pattern_len)
+{
+  g_assert(!self->compiled);
+  g_assert(pattern_len > 0);
+
+  g_array_append_val(self->pattern_offsets, self->pattern_data->len);
+  g_array_append_val(self->pattern_lengths, pattern_len);
+  g_string_append_len(self->pattern_data, pattern, pattern_len);
+  return self->pattern_lengths->len - 1;
+}
+
+gint
+aho_corasick_get_num_patterns(AhoCorasick *self)
+{
+  return self->pattern_lengths->len;
+}
+
+static inline const guchar *
+_get_pattern(AhoCorasick *self, gint id, gsize *len)
+{
+  *len = g_array_index(self->pattern_lengths, gsize, id);
+  return (const guchar *) self->pattern_data->str + g_array_index(self->pattern_offsets, gsize, id);
+}
+
+static void
+_assign_classes(AhoCorasick *self)
+{
+  gsize i;
+
+  memset(self->classes, 0, sizeof(self->classes));
+  self->num_classes = 1;
+  for (i = 0; i < self->pattern_data->len; i++)
+    {
+      guchar c = self->pattern_data->str[i];
+
+      if (self->ignore_case)
+        c = g_ascii_tolower(c);
+      if (self->classes[c])
+        continue;
+
+      self->classes[c] = self->num_classes;
+      if (self->ignore_case)
+        self->classes[g_ascii_toupper(c)] = self->num_classes;
+      self->num_classes++;
+    }
+}
+
+static inline guint32 *
+_get_row(AhoCorasick *self, guint32 state)
+{
+  return &self->delta[state * self->num_classes];
+}
+
+/* builds the trie of the patterns, returns the per-state list of
+ * patterns ending there */
+static GArray **
+_build_trie(AhoCorasick *self)
+{
+  gsize total_len = self->pattern_data->len;
+  GArray **state_outputs;
+  gint id;
+
+  /* the trie can't have more states than the total length of the patterns */
+  self->delta = g_new0(guint32, (total_len + 1) * self->num_classes);
+  state_outputs = g_new0(GArray *, total_len + 1);
+  self->num_states = 1;
+
+  for (id = 0; id < aho_corasick_get_num_patterns(self); id++)
+    {
+      const guchar *pattern;
+      gsize len, i;
+      guint32 state = 0;
+
+      pattern = _get_pattern(self, id, &len);
+      for (i = 0; i < len; i++)
+        {
+          guint32 *next = &_get_row(self, state)[self->classes[pattern[i]]];
+
+          /* state 0 is the root, it is never the target of a trie edge */
+          if (*next == 0)
+            *next = self->num_states++;
+          state = *next;
+        }
+
+      if (!state_outputs[state])
+        state_outputs[state] = g_array_new(FALSE, FALSE, sizeof(gint));
+      g_array_append_val(state_outputs[state], id);
+    }
+  return state_outputs;
+}
+
+static void
+_append_outputs(GArray **state_outputs, guint32 target, guint32 source)
+{
+  if (!state_outputs[source])
+    return;
+  if (!state_outputs[target])
+    state_outputs[target] = g_array_new(FALSE, FALSE, sizeof(gint));
+  g_array_append_vals(state_outputs[target], state_outputs[source]->data, state_outputs[source]->len);
+}
+
+/* turns the trie into a DFA by following the failure links in BFS order,
+ * a state's failure state is always shallower, thus it is complete by the
+ * time it is needed */
+static void
+_build_dfa(AhoCorasick *self, GArray **state_outputs)
+{
+  guint32 *queue = g_new(guint32, self->num_states);
+  guint32 *fail = g_new0(guint32, self->num_states);
+  gint head = 0, tail = 0;
+  gint c;
+
+  queue[tail++] = 0;
+  while (head < tail)
+    {
+      guint32 state = queue[head++];
+      guint32 *row = _get_row(self, state);
+      guint32 *fail_row = _get_row(self, fail[state]);
+
+      for (c = 0; c < self->num_classes; c++)
+        {
+          guint32 child = row[c];
+
+          if (child == 0)
+            {
+              row[c] = state == 0 ? 0 : fail_row[c];
+              continue;
+            }
+
+          fail[child] = state == 0 ? 0 : fail_row[c];
+          _append_outputs(state_outputs, child, fail[child]);
+          queue[tail++] = child;
+        }
+    }
+  g_free(fail);
+  g_free(queue);
+}
+
+static void
+_flatten_outputs(AhoCorasick *self, GArray **state_outputs)
+{
+  gint num_outputs = 0;
+  gint state;
+
+  self->output_offsets = g_new(guint32, self->num_states + 1);
+  for (state = 0; state < self->num_states; state++)
+    {
+      self->output_offsets[state] = num_outputs;
+      if (state_outputs[state])
+        num_outputs += state_outputs[state]->len;
+    }
+  self->output_offsets[self->num_states] = num_outputs;
+
+  self->outputs = g_new(gint, MAX(num_outputs, 1));
+  for (state = 0; state < self->num_states; state++)
+    {
+      if (!state_outputs[state])
+        continue;
+      memcpy(&self->outputs[self->output_offsets[state]], state_outputs[state]->data,
+             state_outputs[state]->len * sizeof(gint));
+      g_array_free(state_outputs[state], TRUE);
+    }
+}
+
+void
+aho_corasick_compile(AhoCorasick *self)
+{
+  GArray **state_outputs;
+
+  g_assert(!self->compiled);
+
+  _assign_classes(self);
+  state_outputs = _build_trie(self);
+  self->delta = g_renew(guint32, self->delta, self->num_states * self->num_classes);
+  _build_dfa(self, state_outputs);
+  _flatten_outputs(self, state_outputs);
+  g_free(state_outputs);
+  self->compiled = TRUE;
+}
+
+void
+aho_corasick_scan(AhoCorasick *self, const gchar *input, gsize input_len,
+                  AhoCorasickMatchFunc func, gpointer user_data)
+{
+  const guint32 *delta = self->delta;
+  const guint8 *classes = self->classes;
+  gint num_classes = self->num_classes;
+  guint32 state = 0;
+  gsize i;
+
+  g_assert(self->compiled);
+
+  for (i = 0; i < input_len; i++)
+    {
+      guint32 o;
+
+      state = delta[state * num_classes + classes[(guchar) input[i]]];
+      for (o = self->output_offsets[state]; o < self->output_offsets[state + 1]; o++)
+        {
+          gint id = self->outputs[o];
+
+          func(id, i + 1 - g_array_index(self->pattern_lengths, gsize, id), i + 1, user_data);
+        }
+    }
+}
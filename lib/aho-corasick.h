@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+#ifndef AHO_CORASICK_H_INCLUDED
+#define AHO_CORASICK_H_INCLUDED 1
+
+#include "syslog-ng.h"
+
+/*
+ * Aho-Corasick automaton finding all occurrences of a set of literal
+ * patterns in a single pass over the input.
+ *
+ * Patterns are added first, then the automaton is compiled into a DFA
+ * whose transitions are indexed by byte classes (bytes not occurring in
+ * any of the patterns share a single class), which keeps the transition
+ * table small.  Case insensitive automata fold ASCII letters to the same
+ * class, so the input does not have to be lowercased while scanning.
+ */
+
+typedef struct _AhoCorasick AhoCorasick;
+
+/* called for every occurrence of a pattern, start/end are offsets in the
+ * input, end is exclusive */
+typedef void (*AhoCorasickMatchFunc)(gint pattern_id, gsize start, gsize end, gpointer user_data);
+
+AhoCorasick *aho_corasick_new(gboolean ignore_case);
+void aho_corasick_free(AhoCorasick *self);
+
+gint aho_corasick_add_pattern(AhoCorasick *self, const gchar *pattern, gsize pattern_len);
+gint aho_corasick_get_num_patterns(AhoCorasick *self);
+void aho_corasick_compile(AhoCorasick *self);
+void aho_corasick_scan(AhoCorasick *self, const gchar *input, gsize input_len,
+                       AhoCorasickMatchFunc func, gpointer user_data);
+
+#endif
@@ -40,6 +40,8 @@
 #include "service-management.h"
 #include "crypto.h"
 #include "value-pairs/value-pairs.h"
+#include "filter/filter-string-set.h"
+#include "regexp-jit.h"
 
 #include <iv.h>
 #include <iv_work.h>
@@ -164,6 +166,8 @@ app_shutdown(void)
   log_template_global_deinit();
   log_tags_global_deinit();
   log_msg_global_deinit();
+  filter_string_set_thread_deinit();
+  regexp_jit_thread_deinit();
 
   stats_destroy();
   child_manager_deinit();
@@ -195,11 +199,15 @@ app_thread_start(void)
   scratch_buffers_init();
   dns_caching_thread_init();
   main_loop_call_thread_init();
+  log_msg_pool_thread_init();
 }
 
 void
 app_thread_stop(void)
 {
+  log_msg_pool_thread_deinit();
+  filter_string_set_thread_deinit();
+  regexp_jit_thread_deinit();
   dns_caching_thread_deinit();
   scratch_buffers_free();
   main_loop_call_thread_deinit();
@@ -329,6 +329,12 @@ extern struct _StatsOptions *last_stats_options;
 %token KW_ON_ERROR                    10510
 
 %token KW_RETRIES                     10511
+%token KW_BATCH_LINES                 10512
+%token KW_BATCH_TIMEOUT               10513
+%token KW_WORKERS                     10514
+%token KW_WORKER_PARTITION_KEY        10515
+%token KW_LOG_FIFO_TYPE               10516
+%token KW_LOG_MSG_POOL_SIZE           10517
 
 /* END_DECLS */
 
@@ -907,6 +913,7 @@ options_item
 	| KW_LOG_IW_SIZE '(' LL_NUMBER ')'	{ msg_warning("WARNING: Support for the global log-iw-size() option was removed, please use a per-source log-iw-size()", cfg_lexer_format_location_tag(lexer, &@1)); }
 	| KW_LOG_FETCH_LIMIT '(' LL_NUMBER ')'	{ msg_warning("WARNING: Support for the global log-fetch-limit() option was removed, please use a per-source log-fetch-limit()", cfg_lexer_format_location_tag(lexer, &@1)); }
 	| KW_LOG_MSG_SIZE '(' LL_NUMBER ')'	{ configuration->log_msg_size = $3; }
+	| KW_LOG_MSG_POOL_SIZE '(' LL_NUMBER ')' { configuration->log_msg_pool_size = $3; }
 	| KW_KEEP_TIMESTAMP '(' yesno ')'	{ configuration->keep_timestamp = $3; }
 	| KW_CREATE_DIRS '(' yesno ')'		{ configuration->create_dirs = $3; }
         | KW_CUSTOM_DOMAIN '(' string ')'       { configuration->custom_domain = g_strdup($3); free($3); }
@@ -1091,11 +1098,35 @@ threaded_dest_driver_option
         {
           log_threaded_dest_driver_set_max_retries(last_driver, $3);
         }
+	| KW_BATCH_LINES '(' LL_NUMBER ')'
+        {
+          log_threaded_dest_driver_set_batch_lines(last_driver, $3);
+        }
+	| KW_BATCH_TIMEOUT '(' LL_NUMBER ')'
+        {
+          log_threaded_dest_driver_set_batch_timeout(last_driver, $3);
+        }
+	| KW_WORKERS '(' LL_NUMBER ')'
+        {
+          CHECK_ERROR($3 > 0, @3, "workers() must be a positive number");
+          log_threaded_dest_driver_set_num_workers(last_driver, $3);
+        }
+	| KW_WORKER_PARTITION_KEY '(' template_content ')'
+        {
+          log_threaded_dest_driver_set_worker_partition_key(last_driver, $3);
+          log_template_unref($3);
+        }
+	;
 
 dest_driver_option
         /* NOTE: plugins need to set "last_driver" in order to incorporate this rule in their grammar */
 
 	: KW_LOG_FIFO_SIZE '(' LL_NUMBER ')'	{ ((LogDestDriver *) last_driver)->log_fifo_size = $3; }
+	| KW_LOG_FIFO_TYPE '(' string ')'
+          {
+            CHECK_ERROR(log_dest_driver_set_log_fifo_type((LogDestDriver *) last_driver, $3), @3, "Unknown log-fifo-type() %s, expected fifo or mpsc", $3);
+            free($3);
+          }
 	| KW_THROTTLE '(' LL_NUMBER ')'         { ((LogDestDriver *) last_driver)->throttle = $3; }
         | LL_IDENTIFIER
           {
@@ -123,9 +123,11 @@ static CfgLexerKeyword main_keywords[] =
   { "use_uniqid",         KW_USE_UNIQID },
 
   { "log_fifo_size",      KW_LOG_FIFO_SIZE },
+  { "log_fifo_type",      KW_LOG_FIFO_TYPE },
   { "log_fetch_limit",    KW_LOG_FETCH_LIMIT },
   { "log_iw_size",        KW_LOG_IW_SIZE },
   { "log_msg_size",       KW_LOG_MSG_SIZE },
+  { "log_msg_pool_size",  KW_LOG_MSG_POOL_SIZE },
   { "log_prefix",         KW_LOG_PREFIX, KWS_OBSOLETE, "program_override" },
   { "program_override",   KW_PROGRAM_OVERRIDE },
   { "host_override",      KW_HOST_OVERRIDE },
@@ -154,6 +156,10 @@ static CfgLexerKeyword main_keywords[] =
   { "persist_name",            KW_PERSIST_NAME, VERSION_VALUE_3_8 },
 
   { "retries",            KW_RETRIES },
+  { "batch_lines",        KW_BATCH_LINES },
+  { "batch_timeout",      KW_BATCH_TIMEOUT },
+  { "workers",            KW_WORKERS },
+  { "worker_partition_key", KW_WORKER_PARTITION_KEY },
 
   /* filter items */
   { "type",               KW_TYPE },
@@ -208,6 +208,7 @@ cfg_init(GlobalConfig *cfg)
   log_tags_reinit_stats(cfg);
 
   dns_caching_update_options(&cfg->dns_cache_options);
+  log_msg_set_pool_size(cfg->log_msg_pool_size);
   hostname_reinit(cfg->custom_domain);
   host_resolve_options_init(&cfg->host_resolve_options, cfg);
   log_template_options_init(&cfg->template_options, cfg);
@@ -304,6 +305,7 @@ cfg_new(gint version)
 
   self->log_fifo_size = 10000;
   self->log_msg_size = 8192;
+  self->log_msg_pool_size = LOG_MSG_POOL_DEFAULT_SIZE;
 
   file_perm_options_global_defaults(&self->file_perm_options);
 
@@ -555,6 +557,12 @@ cfg_persist_config_fetch(GlobalConfig *cfg, const gchar *name)
   return res;
 }
 
+gboolean
+cfg_persist_config_exists(GlobalConfig *cfg, const gchar *name)
+{
+  return cfg->persist && g_hash_table_lookup(cfg->persist->keys, name) != NULL;
+}
+
 gint
 cfg_get_user_version(const GlobalConfig *cfg)
 {
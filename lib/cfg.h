@@ -92,6 +92,7 @@ struct _GlobalConfig
 
   gint log_fifo_size;
   gint log_msg_size;
+  gint log_msg_pool_size;
 
   gboolean create_dirs;
   FilePermOptions file_perm_options;
@@ -145,6 +146,7 @@ void persist_config_free(PersistConfig *self);
 void cfg_persist_config_move(GlobalConfig *src, GlobalConfig *dest);
 void cfg_persist_config_add(GlobalConfig *cfg, const gchar *name, gpointer value, GDestroyNotify destroy, gboolean force);
 gpointer cfg_persist_config_fetch(GlobalConfig *cfg, const gchar *name);
+gboolean cfg_persist_config_exists(GlobalConfig *cfg, const gchar *name);
 
 static inline gboolean
 cfg_is_config_version_older(GlobalConfig *cfg, gint req)
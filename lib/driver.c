@@ -24,6 +24,7 @@
 
 #include "driver.h"
 #include "logqueue-fifo.h"
+#include "logqueue-mpsc.h"
 #include "afinter.h"
 #include "cfg-tree.h"
 
@@ -205,7 +206,12 @@ log_dest_driver_acquire_queue_method(LogDestDriver *self, const gchar *persist_n
 
   if (!queue)
     {
-      queue = log_queue_fifo_new(self->log_fifo_size < 0 ? cfg->log_fifo_size : self->log_fifo_size, persist_name);
+      gint log_fifo_size = self->log_fifo_size < 0 ? cfg->log_fifo_size : self->log_fifo_size;
+
+      if (self->log_fifo_mpsc)
+        queue = log_queue_mpsc_new(log_fifo_size, persist_name);
+      else
+        queue = log_queue_fifo_new(log_fifo_size, persist_name);
       log_queue_set_throttle(queue, self->throttle);
     }
   return queue;
@@ -292,6 +298,18 @@ log_dest_driver_deinit_method(LogPipe *s)
   return TRUE;
 }
 
+gboolean
+log_dest_driver_set_log_fifo_type(LogDestDriver *self, const gchar *type)
+{
+  if (strcmp(type, "fifo") == 0)
+    self->log_fifo_mpsc = FALSE;
+  else if (strcmp(type, "mpsc") == 0)
+    self->log_fifo_mpsc = TRUE;
+  else
+    return FALSE;
+  return TRUE;
+}
+
 void
 log_dest_driver_init_instance(LogDestDriver *self, GlobalConfig *cfg)
 {
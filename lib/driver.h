@@ -160,6 +160,8 @@ struct _LogDestDriver
   GList *queues;
 
   gint log_fifo_size;
+  /* use the lock-free LogQueueMpsc instead of LogQueueFifo */
+  gboolean log_fifo_mpsc;
   gint throttle;
   StatsCounterItem *queued_global_messages;
 };
@@ -197,6 +199,7 @@ gboolean log_dest_driver_init_method(LogPipe *s);
 gboolean log_dest_driver_deinit_method(LogPipe *s);
 void log_dest_driver_queue_method(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data);
 
+gboolean log_dest_driver_set_log_fifo_type(LogDestDriver *self, const gchar *type);
 void log_dest_driver_init_instance(LogDestDriver *self, GlobalConfig *cfg);
 void log_dest_driver_free(LogPipe *s);
 
@@ -31,11 +31,22 @@
 struct _GlobalConfig;
 typedef struct _FilterExprNode FilterExprNode;
 
+/* rough relative evaluation costs of filter expressions, used to order
+ * the operands of AND/OR expressions so that cheap checks run first */
+enum
+{
+  FILTER_EXPR_COST_BITMASK = 1,   /* facility(), level(), tags() */
+  FILTER_EXPR_COST_LOOKUP = 4,    /* netmask(), in-list() */
+  FILTER_EXPR_COST_STRING = 16,   /* template comparisons, string and glob matches */
+  FILTER_EXPR_COST_REGEX = 64,    /* regular expressions */
+};
+
 struct _FilterExprNode
 {
   guint32 ref_cnt;
   guint32 comp:1,   /* this not is negated */
           modify:1; /* this filter changes the log message */
+  guint32 cost;     /* estimated evaluation cost, see FILTER_EXPR_COST_* */
   const gchar *type;
   void (*init)(FilterExprNode *self, GlobalConfig *cfg);
   gboolean (*eval)(FilterExprNode *self, LogMessage **msg, gint num_msg);
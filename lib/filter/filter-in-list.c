@@ -24,18 +24,465 @@
 
 #include "filter-in-list.h"
 #include "logmsg/logmsg.h"
-#include "str-utils.h"
+#include "cfg-parser.h"
+#include "messages.h"
 
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/*
+ * The list is stored in an open addressing hash table with linear
+ * probing.  The keys themselves are stored back to back in a single
+ * string pool, a slot only holds the hash, the position and the length
+ * of its key, which keeps the table compact even with millions of
+ * entries.
+ */
+
+#define IN_LIST_MIN_SLOTS 64
+
+typedef struct _InListSlot
+{
+  guint32 hash;
+  /* 0 marks an unused slot, as empty keys are never stored */
+  guint32 length;
+  gsize offset;
+} InListSlot;
+
+typedef struct _InListTable
+{
+  InListSlot *slots;
+  gsize num_slots;
+  gsize num_keys;
+  GString *pool;
+} InListTable;
+
+static inline guint32
+_hash_key(const gchar *key, gsize length, gboolean icase)
+{
+  guint32 hash = 2166136261U;
+  gsize i;
+
+  /* FNV-1a */
+  for (i = 0; i < length; i++)
+    {
+      guchar c = key[i];
+
+      if (icase)
+        c = g_ascii_tolower(c);
+      hash = (hash ^ c) * 16777619U;
+    }
+  return hash;
+}
+
+static inline gboolean
+_slot_matches(InListTable *self, InListSlot *slot, const gchar *key, gsize length, guint32 hash, gboolean icase)
+{
+  const gchar *stored_key;
+
+  if (slot->hash != hash || slot->length != length)
+    return FALSE;
+
+  stored_key = self->pool->str + slot->offset;
+  if (icase)
+    return g_ascii_strncasecmp(stored_key, key, length) == 0;
+  return memcmp(stored_key, key, length) == 0;
+}
+
+/* returns the slot of key, or the unused slot where it should be stored */
+static InListSlot *
+_table_find_slot(InListTable *self, const gchar *key, gsize length, guint32 hash, gboolean icase)
+{
+  gsize mask = self->num_slots - 1;
+  gsize i;
+
+  for (i = hash & mask; ; i = (i + 1) & mask)
+    {
+      InListSlot *slot = &self->slots[i];
+
+      if (slot->length == 0 || _slot_matches(self, slot, key, length, hash, icase))
+        return slot;
+    }
+}
+
+static void
+_table_init(InListTable *self)
+{
+  self->num_slots = IN_LIST_MIN_SLOTS;
+  self->num_keys = 0;
+  self->slots = g_new0(InListSlot, self->num_slots);
+  self->pool = g_string_sized_new(1024);
+}
+
+static void
+_table_destroy(InListTable *self)
+{
+  g_free(self->slots);
+  g_string_free(self->pool, TRUE);
+}
+
+static void
+_table_grow(InListTable *self)
+{
+  InListSlot *old_slots = self->slots;
+  gsize old_num_slots = self->num_slots;
+  gsize mask, i, j;
+
+  self->num_slots *= 2;
+  self->slots = g_new0(InListSlot, self->num_slots);
+  mask = self->num_slots - 1;
+
+  for (i = 0; i < old_num_slots; i++)
+    {
+      if (old_slots[i].length == 0)
+        continue;
+
+      for (j = old_slots[i].hash & mask; self->slots[j].length != 0; j = (j + 1) & mask)
+        ;
+      self->slots[j] = old_slots[i];
+    }
+  g_free(old_slots);
+}
+
+static void
+_table_insert(InListTable *self, const gchar *key, gsize length, gboolean icase)
+{
+  guint32 hash = _hash_key(key, length, icase);
+  InListSlot *slot;
+
+  g_assert(length > 0 && length <= G_MAXUINT32);
+
+  /* keep the load factor below 1/2, probe sequences stay short */
+  if ((self->num_keys + 1) * 2 > self->num_slots)
+    _table_grow(self);
+
+  slot = _table_find_slot(self, key, length, hash, icase);
+  if (slot->length != 0)
+    return;
+
+  slot->hash = hash;
+  slot->length = length;
+  slot->offset = self->pool->len;
+  g_string_append_len(self->pool, key, length);
+  self->num_keys++;
+}
+
+static inline gboolean
+_table_contains(InListTable *self, const gchar *key, gsize length, gboolean icase)
+{
+  if (length == 0 || self->num_keys == 0)
+    return FALSE;
+
+  return _table_find_slot(self, key, length, _hash_key(key, length, icase), icase)->length != 0;
+}
+
+/*
+ * Networks of the cidr mode are stored in a separate table, keyed by the
+ * address length, the prefix length and the masked address.  An address
+ * is looked up by masking it with each prefix length present in the list.
+ */
+
+#define IN_LIST_NETWORK_KEY_MAX (2 + sizeof(struct in6_addr))
+
+static void
+_mask_address(guint8 *address, gsize address_len, gint prefix)
+{
+  gsize i;
+
+  for (i = 0; i < address_len; i++)
+    {
+      if (prefix >= 8)
+        {
+          prefix -= 8;
+          continue;
+        }
+      address[i] &= (guint8) (0xff << (8 - prefix));
+      prefix = 0;
+    }
+}
+
+static gsize
+_format_network_key(gchar *key, const guint8 *address, gsize address_len, gint prefix)
+{
+  key[0] = address_len;
+  key[1] = prefix;
+  memcpy(&key[2], address, address_len);
+  _mask_address((guint8 *) &key[2], address_len, prefix);
+  return 2 + address_len;
+}
+
+typedef struct _InListSet
+{
+  gint ref_cnt;
+  gchar *key;
+  gint flags;
+
+  /* identifies the contents of the list file */
+  dev_t file_dev;
+  ino_t file_ino;
+  off_t file_size;
+  time_t file_mtime;
+  glong file_mtime_nsec;
+  time_t file_ctime;
+
+  InListTable strings;
+  InListTable networks;
+  guint8 ipv4_prefixes[33];
+  gint num_ipv4_prefixes;
+  guint8 ipv6_prefixes[129];
+  gint num_ipv6_prefixes;
+} InListSet;
+
+/* Sets loaded by the running (and during reload, the new) configuration,
+ * keyed by the flags and the filename.  When the configuration is
+ * reloaded (SIGHUP), in-list() filters whose list file did not change
+ * reuse the set in memory, only the changed files are read again.
+ * Configurations are parsed and freed in the main thread, so no locking
+ * is necessary. */
+static GHashTable *in_list_sets;
+
+static void
+_add_prefix(guint8 *prefixes, gint *num_prefixes, gint prefix)
+{
+  gint i;
+
+  for (i = 0; i < *num_prefixes; i++)
+    {
+      if (prefixes[i] == prefix)
+        return;
+    }
+  prefixes[(*num_prefixes)++] = prefix;
+}
+
+static gboolean
+_in_list_set_add_network(InListSet *self, const gchar *line)
+{
+  gchar address_str[INET6_ADDRSTRLEN];
+  gchar key[IN_LIST_NETWORK_KEY_MAX];
+  guint8 address[sizeof(struct in6_addr)];
+  const gchar *slash;
+  gsize address_len;
+  gint max_prefix;
+  gint prefix;
+
+  slash = strchr(line, '/');
+  if (slash)
+    {
+      if ((gsize) (slash - line) >= sizeof(address_str))
+        return FALSE;
+      memcpy(address_str, line, slash - line);
+      address_str[slash - line] = 0;
+    }
+  else
+    {
+      if (strlen(line) >= sizeof(address_str))
+        return FALSE;
+      strcpy(address_str, line);
+    }
+
+  if (inet_pton(AF_INET, address_str, address) == 1)
+    address_len = sizeof(struct in_addr);
+  else if (inet_pton(AF_INET6, address_str, address) == 1)
+    address_len = sizeof(struct in6_addr);
+  else
+    return FALSE;
+
+  max_prefix = address_len * 8;
+  prefix = max_prefix;
+  if (slash)
+    {
+      gchar *end;
+
+      prefix = strtol(slash + 1, &end, 10);
+      if (slash[1] == 0 || *end != 0 || prefix < 0 || prefix > max_prefix)
+        return FALSE;
+    }
+
+  _table_insert(&self->networks, key, _format_network_key(key, address, address_len, prefix), FALSE);
+  if (address_len == sizeof(struct in_addr))
+    _add_prefix(self->ipv4_prefixes, &self->num_ipv4_prefixes, prefix);
+  else
+    _add_prefix(self->ipv6_prefixes, &self->num_ipv6_prefixes, prefix);
+  return TRUE;
+}
+
+static gboolean
+_in_list_set_contains_network(InListSet *self, const guint8 *address, gsize address_len,
+                              const guint8 *prefixes, gint num_prefixes)
+{
+  gchar key[IN_LIST_NETWORK_KEY_MAX];
+  gint i;
+
+  for (i = 0; i < num_prefixes; i++)
+    {
+      if (_table_contains(&self->networks, key, _format_network_key(key, address, address_len, prefixes[i]), FALSE))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+static gboolean
+_in_list_set_contains_address(InListSet *self, const gchar *value, gssize value_len)
+{
+  gchar address_str[INET6_ADDRSTRLEN];
+  guint8 address[sizeof(struct in6_addr)];
+
+  if (self->networks.num_keys == 0 || (gsize) value_len >= sizeof(address_str))
+    return FALSE;
+
+  memcpy(address_str, value, value_len);
+  address_str[value_len] = 0;
+
+  if (self->num_ipv4_prefixes && inet_pton(AF_INET, address_str, address) == 1)
+    return _in_list_set_contains_network(self, address, sizeof(struct in_addr),
+                                         self->ipv4_prefixes, self->num_ipv4_prefixes);
+  if (self->num_ipv6_prefixes && inet_pton(AF_INET6, address_str, address) == 1)
+    return _in_list_set_contains_network(self, address, sizeof(struct in6_addr),
+                                         self->ipv6_prefixes, self->num_ipv6_prefixes);
+  return FALSE;
+}
+
+static inline gboolean
+_in_list_set_contains(InListSet *self, const gchar *value, gssize value_len)
+{
+  return _table_contains(&self->strings, value, value_len, self->flags & FILTER_IN_LIST_ICASE) ||
+         _in_list_set_contains_address(self, value, value_len);
+}
+
+static glong
+_stat_get_mtime_nsec(struct stat *st)
+{
+#if SYSLOG_NG_HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  return st->st_mtim.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+static InListSet *
+_in_list_set_load(const gchar *list_file, gint flags)
+{
+  InListSet *self;
+  FILE *stream;
+  struct stat st;
+  gchar line[16384];
+
+  stream = fopen(list_file, "r");
+  if (!stream || fstat(fileno(stream), &st) < 0)
+    {
+      msg_error("Error opening in-list filter list file",
+                evt_tag_str("file", list_file),
+                evt_tag_errno("errno", errno));
+      if (stream)
+        fclose(stream);
+      return NULL;
+    }
+
+  self = g_new0(InListSet, 1);
+  self->ref_cnt = 1;
+  self->flags = flags;
+  self->file_dev = st.st_dev;
+  self->file_ino = st.st_ino;
+  self->file_size = st.st_size;
+  self->file_mtime = st.st_mtime;
+  self->file_mtime_nsec = _stat_get_mtime_nsec(&st);
+  self->file_ctime = st.st_ctime;
+  _table_init(&self->strings);
+  _table_init(&self->networks);
+
+  while (fgets(line, sizeof(line), stream) != NULL)
+    {
+      gsize len = strlen(line);
+
+      if (len > 0 && line[len - 1] == '\n')
+        line[--len] = '\0';
+      if (len > 0 && line[len - 1] == '\r')
+        line[--len] = '\0';
+      if (len == 0)
+        continue;
+
+      if ((flags & FILTER_IN_LIST_CIDR) && _in_list_set_add_network(self, line))
+        continue;
+      _table_insert(&self->strings, line, len, flags & FILTER_IN_LIST_ICASE);
+    }
+  fclose(stream);
+
+  msg_debug("in-list() filter list file loaded",
+            evt_tag_str("file", list_file),
+            evt_tag_int("strings", self->strings.num_keys),
+            evt_tag_int("networks", self->networks.num_keys));
+  return self;
+}
+
+/* the file may be rewritten within the same second and keep its size,
+ * the nanoseconds of the mtime and the ctime (which cannot be set back
+ * with utime()) catch that */
+static gboolean
+_in_list_set_is_up_to_date(InListSet *self, struct stat *st)
+{
+  return self->file_dev == st->st_dev &&
+         self->file_ino == st->st_ino &&
+         self->file_size == st->st_size &&
+         self->file_mtime == st->st_mtime &&
+         self->file_mtime_nsec == _stat_get_mtime_nsec(st) &&
+         self->file_ctime == st->st_ctime;
+}
+
+static InListSet *
+_in_list_set_get(const gchar *list_file, gint flags)
+{
+  InListSet *self;
+  struct stat st;
+  gchar *key;
+
+  key = g_strdup_printf("%d:%s", flags, list_file);
+  self = in_list_sets ? g_hash_table_lookup(in_list_sets, key) : NULL;
+  if (self && stat(list_file, &st) == 0 && _in_list_set_is_up_to_date(self, &st))
+    {
+      g_free(key);
+      self->ref_cnt++;
+      return self;
+    }
+
+  self = _in_list_set_load(list_file, flags);
+  if (!self)
+    {
+      g_free(key);
+      return NULL;
+    }
+
+  self->key = key;
+  if (!in_list_sets)
+    in_list_sets = g_hash_table_new(g_str_hash, g_str_equal);
+  /* the outdated set, if any, is kept alive by the filters still using it */
+  g_hash_table_replace(in_list_sets, self->key, self);
+  return self;
+}
+
+static void
+_in_list_set_unref(InListSet *self)
+{
+  if (--self->ref_cnt > 0)
+    return;
+
+  if (g_hash_table_lookup(in_list_sets, self->key) == self)
+    g_hash_table_remove(in_list_sets, self->key);
+  _table_destroy(&self->strings);
+  _table_destroy(&self->networks);
+  g_free(self->key);
+  g_free(self);
+}
 
 typedef struct _FilterInList
 {
   FilterExprNode super;
   NVHandle value_handle;
-  GTree *tree;
+  InListSet *set;
 } FilterInList;
 
 static gboolean
@@ -47,9 +494,8 @@ filter_in_list_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   gssize len = 0;
 
   value = log_msg_get_value(msg, self->value_handle, &len);
-  APPEND_ZERO(value, value, len);
 
-  return (g_tree_lookup(self->tree, value) != NULL) ^ s->comp;
+  return _in_list_set_contains(self->set, value, len) ^ s->comp;
 }
 
 static void
@@ -57,39 +503,43 @@ filter_in_list_free(FilterExprNode *s)
 {
   FilterInList *self = (FilterInList *)s;
 
-  g_tree_destroy(self->tree);
+  _in_list_set_unref(self->set);
+}
+
+static CfgFlagHandler filter_in_list_flag_handlers[] =
+{
+  /* NOTE: underscores are automatically converted to dashes */
+
+  { "ignore-case",     CFH_SET, 0, FILTER_IN_LIST_ICASE },
+  { "icase",           CFH_SET, 0, FILTER_IN_LIST_ICASE },
+  { "cidr",            CFH_SET, 0, FILTER_IN_LIST_CIDR  },
+
+  { NULL },
+};
+
+gboolean
+filter_in_list_process_flag(guint32 *flags, const gchar *flag)
+{
+  return cfg_process_flag(filter_in_list_flag_handlers, flags, flag);
 }
 
 FilterExprNode *
-filter_in_list_new(const gchar *list_file, const gchar *property)
+filter_in_list_new(const gchar *list_file, const gchar *property, gint flags)
 {
   FilterInList *self;
-  FILE *stream;
-  gchar line[16384];
+  InListSet *set;
 
-  stream = fopen(list_file, "r");
-  if (!stream)
-    {
-      msg_error("Error opening in-list filter list file",
-                evt_tag_str("file", list_file),
-                evt_tag_errno("errno", errno));
-      return NULL;
-    }
+  set = _in_list_set_get(list_file, flags);
+  if (!set)
+    return NULL;
 
   self = g_new0(FilterInList, 1);
   filter_expr_node_init_instance(&self->super);
   self->value_handle = log_msg_get_value_handle(property);
-  self->tree = g_tree_new_full((GCompareDataFunc)strcmp, NULL, g_free, NULL);
-
-  while (fgets(line, sizeof(line), stream) != NULL)
-    {
-      line[strlen(line) - 1] = '\0';
-      if (line[0])
-        g_tree_insert(self->tree, g_strdup(line), GINT_TO_POINTER(1));
-    }
-  fclose(stream);
+  self->set = set;
 
   self->super.eval = filter_in_list_eval;
   self->super.free_fn = filter_in_list_free;
+  self->super.cost = FILTER_EXPR_COST_LOOKUP;
   return &self->super;
 }
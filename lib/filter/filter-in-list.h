@@ -27,7 +27,17 @@
 
 #include "filter-expr.h"
 
+enum
+{
+  /* compare the values case-insensitively */
+  FILTER_IN_LIST_ICASE = 0x0001,
+  /* treat IP addresses and networks in the list as CIDR ranges */
+  FILTER_IN_LIST_CIDR  = 0x0002,
+};
+
+gboolean filter_in_list_process_flag(guint32 *flags, const gchar *flag);
 FilterExprNode *filter_in_list_new(const gchar *list_file,
-                                   const gchar *property);
+                                   const gchar *property,
+                                   gint flags);
 
 #endif
@@ -94,5 +94,6 @@ filter_netmask_new(gchar *cidr)
     }
   self->address.s_addr &= self->netmask.s_addr;
   self->super.eval = filter_netmask_eval;
+  self->super.cost = FILTER_EXPR_COST_LOOKUP;
   return &self->super;
 }
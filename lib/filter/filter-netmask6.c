@@ -152,6 +152,7 @@ filter_netmask6_new(gchar *cidr)
     self->address = in6addr_loopback;
 
   self->super.eval = _eval;
+  self->super.cost = FILTER_EXPR_COST_LOOKUP;
   return &self->super;
 }
 #endif
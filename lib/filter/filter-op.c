@@ -23,48 +23,139 @@
  */
 #include "filter-op.h"
 
+/*
+ * AND/OR expressions are compiled when the configuration is initialized:
+ * nested operators of the same kind are flattened into a single list of
+ * operands (e.g. "a and (b and c)" becomes "and(a, b, c)"), evaluated in
+ * a loop instead of recursing through the tree.  Unless an operand has
+ * side effects on the message, the operands are also ordered by their
+ * estimated evaluation cost, so that cheap checks like facility() or
+ * level() get a chance to short-circuit the evaluation before regular
+ * expressions are run.
+ */
+
 typedef struct _FilterOp
 {
   FilterExprNode super;
-  FilterExprNode *left, *right;
+  FilterExprNode **operands;
+  gint num_operands;
 } FilterOp;
 
+static void
+fop_add_operand(FilterOp *self, FilterExprNode *operand)
+{
+  self->operands = g_renew(FilterExprNode *, self->operands, self->num_operands + 1);
+  self->operands[self->num_operands++] = operand;
+}
+
+static gboolean
+fop_can_absorb(FilterOp *self, FilterExprNode *operand)
+{
+  /* a non-negated operator of the same kind can be merged into ours */
+  return operand->eval == self->super.eval && !operand->comp;
+}
+
+static void
+fop_flatten(FilterOp *self)
+{
+  FilterExprNode **operands = self->operands;
+  gint num_operands = self->num_operands;
+  gint i, j;
+
+  self->operands = NULL;
+  self->num_operands = 0;
+  for (i = 0; i < num_operands; i++)
+    {
+      FilterExprNode *operand = operands[i];
+
+      if (fop_can_absorb(self, operand))
+        {
+          FilterOp *child = (FilterOp *) operand;
+
+          for (j = 0; j < child->num_operands; j++)
+            fop_add_operand(self, filter_expr_ref(child->operands[j]));
+          filter_expr_unref(operand);
+        }
+      else
+        {
+          fop_add_operand(self, operand);
+        }
+    }
+  g_free(operands);
+}
+
+static void
+fop_sort_by_cost(FilterOp *self)
+{
+  gint i, j;
+
+  /* insertion sort: stable and the number of operands is small */
+  for (i = 1; i < self->num_operands; i++)
+    {
+      FilterExprNode *operand = self->operands[i];
+
+      for (j = i; j > 0 && self->operands[j - 1]->cost > operand->cost; j--)
+        self->operands[j] = self->operands[j - 1];
+      self->operands[j] = operand;
+    }
+}
+
 static void
 fop_init(FilterExprNode *s, GlobalConfig *cfg)
 {
   FilterOp *self = (FilterOp *) s;
+  gint i;
+
+  self->super.modify = FALSE;
+  self->super.cost = 0;
+  for (i = 0; i < self->num_operands; i++)
+    filter_expr_init(self->operands[i], cfg);
+
+  fop_flatten(self);
+  for (i = 0; i < self->num_operands; i++)
+    {
+      self->super.modify |= self->operands[i]->modify;
+      self->super.cost += self->operands[i]->cost;
+    }
 
-  if (self->left && self->left->init)
-    self->left->init(self->left, cfg);
-  if (self->right && self->right->init)
-    self->right->init(self->right, cfg);
-  self->super.modify = self->left->modify || self->right->modify;
+  /* operands changing the message must be evaluated in the order they were specified */
+  if (!self->super.modify)
+    fop_sort_by_cost(self);
 }
 
 static void
 fop_free(FilterExprNode *s)
 {
   FilterOp *self = (FilterOp *) s;
+  gint i;
 
-  filter_expr_unref(self->left);
-  filter_expr_unref(self->right);
+  for (i = 0; i < self->num_operands; i++)
+    filter_expr_unref(self->operands[i]);
+  g_free(self->operands);
 }
 
 static void
-fop_init_instance(FilterOp *self)
+fop_init_instance(FilterOp *self, FilterExprNode *e1, FilterExprNode *e2)
 {
   filter_expr_node_init_instance(&self->super);
   self->super.init = fop_init;
   self->super.free_fn = fop_free;
+  fop_add_operand(self, e1);
+  fop_add_operand(self, e2);
 }
 
 static gboolean
 fop_or_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
 {
   FilterOp *self = (FilterOp *) s;
+  gint i;
 
-  return (filter_expr_eval_with_context(self->left, msgs, num_msg)
-          || filter_expr_eval_with_context(self->right, msgs, num_msg)) ^ s->comp;
+  for (i = 0; i < self->num_operands; i++)
+    {
+      if (filter_expr_eval_with_context(self->operands[i], msgs, num_msg))
+        return TRUE ^ s->comp;
+    }
+  return FALSE ^ s->comp;
 }
 
 FilterExprNode *
@@ -72,10 +163,8 @@ fop_or_new(FilterExprNode *e1, FilterExprNode *e2)
 {
   FilterOp *self = g_new0(FilterOp, 1);
 
-  fop_init_instance(self);
   self->super.eval = fop_or_eval;
-  self->left = e1;
-  self->right = e2;
+  fop_init_instance(self, e1, e2);
   self->super.type = "OR";
   return &self->super;
 }
@@ -84,9 +173,14 @@ static gboolean
 fop_and_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
 {
   FilterOp *self = (FilterOp *) s;
+  gint i;
 
-  return (filter_expr_eval_with_context(self->left, msgs, num_msg)
-          && filter_expr_eval_with_context(self->right, msgs, num_msg)) ^ s->comp;
+  for (i = 0; i < self->num_operands; i++)
+    {
+      if (!filter_expr_eval_with_context(self->operands[i], msgs, num_msg))
+        return FALSE ^ s->comp;
+    }
+  return TRUE ^ s->comp;
 }
 
 FilterExprNode *
@@ -94,10 +188,8 @@ fop_and_new(FilterExprNode *e1, FilterExprNode *e2)
 {
   FilterOp *self = g_new0(FilterOp, 1);
 
-  fop_init_instance(self);
   self->super.eval = fop_and_eval;
-  self->left = e1;
-  self->right = e2;
+  fop_init_instance(self, e1, e2);
   self->super.type = "AND";
   return &self->super;
 }
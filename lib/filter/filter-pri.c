@@ -58,6 +58,7 @@ filter_facility_new(guint32 facilities)
 
   filter_expr_node_init_instance(&self->super);
   self->super.eval = filter_facility_eval;
+  self->super.cost = FILTER_EXPR_COST_BITMASK;
   self->valid = facilities;
   self->super.type = "facility";
   return &self->super;
@@ -81,6 +82,7 @@ filter_level_new(guint32 levels)
 
   filter_expr_node_init_instance(&self->super);
   self->super.eval = filter_level_eval;
+  self->super.cost = FILTER_EXPR_COST_BITMASK;
   self->valid = levels;
   self->super.type = "level";
   return &self->super;
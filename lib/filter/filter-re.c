@@ -38,6 +38,16 @@ filter_re_eval_string(FilterExprNode *s, LogMessage *msg, gint value_handle, con
   return log_matcher_match(self->matcher, msg, value_handle, str, str_len) ^ self->super.comp;
 }
 
+static gboolean
+filter_re_eval_string_set(FilterRE *self, LogMessage *msg, const gchar *value, gssize len, gboolean *result)
+{
+  /* the glob matcher never matches invalid utf8, leave that to the matcher */
+  if (self->string_set_utf8_only && (msg->flags & LF_UTF8) == 0 && !g_utf8_validate(value, len, NULL))
+    return FALSE;
+
+  return filter_string_set_match(self->string_set, self->string_set_index, value, len, result);
+}
+
 static gboolean
 filter_re_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
 {
@@ -45,9 +55,13 @@ filter_re_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   const gchar *value;
   LogMessage *msg = msgs[0];
   gssize len = 0;
+  gboolean result;
 
   value = log_msg_get_value(msg, self->value_handle, &len);
 
+  if (self->string_set && filter_re_eval_string_set(self, msg, value, len, &result))
+    return result ^ s->comp;
+
   APPEND_ZERO(value, value, len);
   return filter_re_eval_string(s, msg, self->value_handle, value, len);
 }
@@ -61,13 +75,40 @@ filter_re_free(FilterExprNode *s)
   log_matcher_options_destroy(&self->matcher_options);
 }
 
+static void
+filter_re_add_to_string_set(FilterRE *self, GlobalConfig *cfg)
+{
+  LogMatcherLiteral literal;
+  FilterStringSet *string_set;
+
+  if (self->string_set || !cfg || self->value_handle == LM_V_NONE ||
+      !self->matcher || !log_matcher_get_literal(self->matcher, &literal))
+    return;
+
+  string_set = filter_string_set_get(cfg, self->value_handle);
+  self->string_set_index = filter_string_set_add(string_set, &literal);
+  if (self->string_set_index < 0)
+    return;
+
+  self->string_set = string_set;
+  self->string_set_utf8_only = literal.utf8_only;
+}
+
 static void
 filter_re_init(FilterExprNode *s, GlobalConfig *cfg)
 {
   FilterRE *self = (FilterRE *) s;
 
+  filter_re_add_to_string_set(self, cfg);
+
   if (self->matcher_options.flags & LMF_STORE_MATCHES)
     self->super.modify = TRUE;
+
+  if (self->matcher_options.type &&
+      (strcmp(self->matcher_options.type, "string") == 0 || strcmp(self->matcher_options.type, "glob") == 0))
+    self->super.cost = FILTER_EXPR_COST_STRING;
+  else
+    self->super.cost = FILTER_EXPR_COST_REGEX;
 }
 
 gboolean
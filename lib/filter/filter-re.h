@@ -27,6 +27,7 @@
 
 #include "filter-expr.h"
 #include "logmatcher.h"
+#include "filter-string-set.h"
 
 typedef struct _FilterRE
 {
@@ -34,6 +35,10 @@ typedef struct _FilterRE
   NVHandle value_handle;
   LogMatcherOptions matcher_options;
   LogMatcher *matcher;
+  /* literal string/glob matches are looked up in a shared set, see filter-string-set.h */
+  FilterStringSet *string_set;
+  gint string_set_index;
+  gboolean string_set_utf8_only;
 } FilterRE;
 
 typedef struct _FilterMatch FilterMatch;
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "filter-string-set.h"
+#include "aho-corasick.h"
+#include "module-config.h"
+#include "tls-support.h"
+#include "cfg.h"
+
+#include <string.h>
+
+#define FILTER_STRING_SETS_KEY "filter-string-sets"
+
+/* below this number of literals, the filters are evaluated one by one */
+#define FILTER_STRING_SET_MIN_LITERALS 4
+
+/* number of sets cached per thread, must be a power of 2 */
+#define FILTER_STRING_SET_CACHE_SLOTS 4
+
+enum
+{
+  FSS_COLLECTING,
+  FSS_ACTIVE,
+  FSS_DISABLED,
+};
+
+typedef struct _FilterStringSetLiteral
+{
+  LogMatcherLiteralAnchor anchor;
+  /* the automaton and the pattern id within it */
+  gboolean ignore_case;
+  gint pattern_id;
+} FilterStringSetLiteral;
+
+struct _FilterStringSet
+{
+  /* unique within the process, identifies the set in the per-thread caches */
+  gint id;
+  GStaticMutex lock;
+  volatile gint state;
+  GArray *literals;
+  /* case sensitive and case insensitive literals, indexed by ignore_case */
+  AhoCorasick *automata[2];
+  /* maps the pattern ids of the automata back to literal indexes */
+  GArray *literal_indexes[2];
+  /* if all literals are anchored to the beginning, the rest of the value
+   * doesn't need to be scanned */
+  gboolean anchored_at_start;
+  gsize max_literal_len;
+};
+
+typedef struct _FilterStringSets
+{
+  ModuleConfig super;
+  GHashTable *sets;
+} FilterStringSets;
+
+typedef struct _FilterStringSetCache
+{
+  gint set_id;
+  GString *value;
+  guint32 *hits;
+  gint hits_size;
+} FilterStringSetCache;
+
+TLS_BLOCK_START
+{
+  FilterStringSetCache filter_string_set_caches[FILTER_STRING_SET_CACHE_SLOTS];
+}
+TLS_BLOCK_END;
+
+#define filter_string_set_caches __tls_deref(filter_string_set_caches)
+
+static gint filter_string_set_next_id;
+
+static FilterStringSet *
+filter_string_set_new(void)
+{
+  FilterStringSet *self = g_new0(FilterStringSet, 1);
+
+  self->id = __sync_add_and_fetch(&filter_string_set_next_id, 1);
+  g_static_mutex_init(&self->lock);
+  self->state = FSS_COLLECTING;
+  self->literals = g_array_new(FALSE, FALSE, sizeof(FilterStringSetLiteral));
+  self->anchored_at_start = TRUE;
+  return self;
+}
+
+static void
+filter_string_set_free(FilterStringSet *self)
+{
+  gint i;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (self->automata[i])
+        aho_corasick_free(self->automata[i]);
+      if (self->literal_indexes[i])
+        g_array_free(self->literal_indexes[i], TRUE);
+    }
+  g_array_free(self->literals, TRUE);
+  g_static_mutex_free(&self->lock);
+  g_free(self);
+}
+
+static void
+filter_string_sets_free(ModuleConfig *s)
+{
+  FilterStringSets *self = (FilterStringSets *) s;
+
+  g_hash_table_destroy(self->sets);
+  module_config_free_method(s);
+}
+
+static FilterStringSets *
+filter_string_sets_new(void)
+{
+  FilterStringSets *self = g_new0(FilterStringSets, 1);
+
+  self->super.free_fn = filter_string_sets_free;
+  self->sets = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) filter_string_set_free);
+  return self;
+}
+
+FilterStringSet *
+filter_string_set_get(GlobalConfig *cfg, NVHandle value_handle)
+{
+  FilterStringSets *sets = g_hash_table_lookup(cfg->module_config, FILTER_STRING_SETS_KEY);
+  FilterStringSet *self;
+
+  if (!sets)
+    {
+      sets = filter_string_sets_new();
+      g_hash_table_insert(cfg->module_config, g_strdup(FILTER_STRING_SETS_KEY), sets);
+    }
+
+  self = g_hash_table_lookup(sets->sets, GUINT_TO_POINTER(value_handle));
+  if (!self)
+    {
+      self = filter_string_set_new();
+      g_hash_table_insert(sets->sets, GUINT_TO_POINTER(value_handle), self);
+    }
+  return self;
+}
+
+/* returns the index of the literal, or -1 if the set was already compiled */
+gint
+filter_string_set_add(FilterStringSet *self, const LogMatcherLiteral *literal)
+{
+  FilterStringSetLiteral l;
+  gint index = -1;
+
+  g_static_mutex_lock(&self->lock);
+  if (self->state == FSS_COLLECTING)
+    {
+      l.anchor = literal->anchor;
+      l.ignore_case = !!literal->ignore_case;
+      if (!self->automata[l.ignore_case])
+        {
+          self->automata[l.ignore_case] = aho_corasick_new(l.ignore_case);
+          self->literal_indexes[l.ignore_case] = g_array_new(FALSE, FALSE, sizeof(gint));
+        }
+      l.pattern_id = aho_corasick_add_pattern(self->automata[l.ignore_case], literal->pattern, literal->pattern_len);
+
+      index = self->literals->len;
+      g_array_append_val(self->literals, l);
+      g_array_append_val(self->literal_indexes[l.ignore_case], index);
+
+      if (l.anchor != LML_EXACT && l.anchor != LML_PREFIX)
+        self->anchored_at_start = FALSE;
+      self->max_literal_len = MAX(self->max_literal_len, literal->pattern_len);
+    }
+  g_static_mutex_unlock(&self->lock);
+  return index;
+}
+
+static void
+filter_string_set_compile(FilterStringSet *self)
+{
+  gint i;
+
+  g_static_mutex_lock(&self->lock);
+  if (self->state == FSS_COLLECTING)
+    {
+      if (self->literals->len >= FILTER_STRING_SET_MIN_LITERALS)
+        {
+          for (i = 0; i < 2; i++)
+            {
+              if (self->automata[i])
+                aho_corasick_compile(self->automata[i]);
+            }
+          g_atomic_int_set(&self->state, FSS_ACTIVE);
+        }
+      else
+        {
+          g_atomic_int_set(&self->state, FSS_DISABLED);
+        }
+    }
+  g_static_mutex_unlock(&self->lock);
+}
+
+typedef struct _FilterStringSetScanState
+{
+  FilterStringSet *set;
+  GArray *literal_indexes;
+  guint32 *hits;
+  gsize value_len;
+} FilterStringSetScanState;
+
+static void
+_record_hit(gint pattern_id, gsize start, gsize end, gpointer user_data)
+{
+  FilterStringSetScanState *state = (FilterStringSetScanState *) user_data;
+  gint index = g_array_index(state->literal_indexes, gint, pattern_id);
+  FilterStringSetLiteral *literal = &g_array_index(state->set->literals, FilterStringSetLiteral, index);
+
+  switch (literal->anchor)
+    {
+    case LML_EXACT:
+      if (start != 0 || end != state->value_len)
+        return;
+      break;
+    case LML_PREFIX:
+      if (start != 0)
+        return;
+      break;
+    case LML_SUFFIX:
+      if (end != state->value_len)
+        return;
+      break;
+    case LML_SUBSTRING:
+      break;
+    }
+  state->hits[index / 32] |= 1U << (index % 32);
+}
+
+static void
+filter_string_set_scan(FilterStringSet *self, FilterStringSetCache *cache)
+{
+  FilterStringSetScanState state;
+  gsize scan_len = cache->value->len;
+  gint i;
+
+  if (self->anchored_at_start)
+    scan_len = MIN(scan_len, self->max_literal_len);
+
+  state.set = self;
+  state.hits = cache->hits;
+  state.value_len = cache->value->len;
+  for (i = 0; i < 2; i++)
+    {
+      if (!self->automata[i])
+        continue;
+      state.literal_indexes = self->literal_indexes[i];
+      aho_corasick_scan(self->automata[i], cache->value->str, scan_len, _record_hit, &state);
+    }
+}
+
+/* the hits only depend on the value, so the cache is validated by
+ * comparing the value itself, which is much cheaper than scanning it */
+static FilterStringSetCache *
+filter_string_set_lookup_cache(FilterStringSet *self, const gchar *value, gsize value_len)
+{
+  FilterStringSetCache *cache = &filter_string_set_caches[self->id & (FILTER_STRING_SET_CACHE_SLOTS - 1)];
+  gint hits_size = (self->literals->len + 31) / 32;
+
+  if (cache->set_id == self->id && cache->value->len == value_len && memcmp(cache->value->str, value, value_len) == 0)
+    return cache;
+
+  if (!cache->value)
+    cache->value = g_string_sized_new(value_len);
+  g_string_truncate(cache->value, 0);
+  g_string_append_len(cache->value, value, value_len);
+
+  if (cache->hits_size < hits_size)
+    {
+      cache->hits = g_renew(guint32, cache->hits, hits_size);
+      cache->hits_size = hits_size;
+    }
+  memset(cache->hits, 0, hits_size * sizeof(guint32));
+  cache->set_id = self->id;
+
+  filter_string_set_scan(self, cache);
+  return cache;
+}
+
+/* returns FALSE if the set is not in use, the caller has to evaluate the
+ * literal on its own in that case */
+gboolean
+filter_string_set_match(FilterStringSet *self, gint index, const gchar *value, gsize value_len, gboolean *result)
+{
+  FilterStringSetCache *cache;
+
+  if (G_UNLIKELY(g_atomic_int_get(&self->state) == FSS_COLLECTING))
+    filter_string_set_compile(self);
+
+  if (g_atomic_int_get(&self->state) != FSS_ACTIVE)
+    return FALSE;
+
+  cache = filter_string_set_lookup_cache(self, value, value_len);
+  *result = !!(cache->hits[index / 32] & (1U << (index % 32)));
+  return TRUE;
+}
+
+void
+filter_string_set_thread_deinit(void)
+{
+  gint i;
+
+  for (i = 0; i < FILTER_STRING_SET_CACHE_SLOTS; i++)
+    {
+      FilterStringSetCache *cache = &filter_string_set_caches[i];
+
+      if (cache->value)
+        g_string_free(cache->value, TRUE);
+      g_free(cache->hits);
+      memset(cache, 0, sizeof(*cache));
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+#ifndef FILTER_STRING_SET_H_INCLUDED
+#define FILTER_STRING_SET_H_INCLUDED
+
+#include "logmatcher.h"
+
+/*
+ * String and glob filters on the same value are often used in large
+ * numbers (e.g. a log path per application, each selecting its messages
+ * with a match() filter).  Instead of scanning the value once for every
+ * filter, the literals of these filters are collected per value into a
+ * FilterStringSet, which finds all of them in a single pass using an
+ * Aho-Corasick automaton.  The result is cached per thread, so the rest
+ * of the filters evaluated on the same value only look up their bit.
+ *
+ * The sets belong to the configuration, filters add their literals while
+ * the configuration is initialized and the set is compiled when it is
+ * first used.  Filters that come too late (or if the set is too small to
+ * be worth it) keep using their own LogMatcher.
+ */
+typedef struct _FilterStringSet FilterStringSet;
+
+FilterStringSet *filter_string_set_get(GlobalConfig *cfg, NVHandle value_handle);
+gint filter_string_set_add(FilterStringSet *self, const LogMatcherLiteral *literal);
+gboolean filter_string_set_match(FilterStringSet *self, gint index, const gchar *value, gsize value_len,
+                                 gboolean *result);
+
+void filter_string_set_thread_deinit(void);
+
+#endif
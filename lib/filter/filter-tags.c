@@ -82,6 +82,7 @@ filter_tags_new(GList *tags)
   filter_tags_add(&self->super, tags);
 
   self->super.eval = filter_tags_eval;
+  self->super.cost = FILTER_EXPR_COST_BITMASK;
   self->super.free_fn = filter_tags_free;
   return &self->super;
 }
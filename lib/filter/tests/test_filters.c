@@ -112,6 +112,13 @@ create_pcre_regexp_match(gchar *regexp, gint flags)
   return compile_pattern(filter_match_new(), regexp, "pcre", flags);
 }
 
+FilterExprNode *
+negate_filter(FilterExprNode *f)
+{
+  f->comp = !f->comp;
+  return f;
+}
+
 LogTemplate *
 create_template(const gchar *template)
 {
@@ -408,6 +415,26 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
            fop_and_new(create_posix_regexp_match(" PAD ", 0), create_posix_regexp_match("^PTHREAD$", 0)), 0);
 
+  /* nested operators are flattened and reordered by cost */
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           fop_and_new(create_posix_regexp_match("PTHREAD", 0),
+                       fop_and_new(filter_facility_new(facility_bits("user")), filter_level_new(level_bits("debug")))), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           fop_and_new(create_posix_regexp_match("PTHREAD", 0),
+                       fop_and_new(filter_facility_new(facility_bits("user")), filter_level_new(level_bits("emerg")))), 0);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           fop_or_new(fop_or_new(create_posix_regexp_match("^PTHREAD$", 0), filter_facility_new(facility_bits("daemon"))),
+                      filter_level_new(level_bits("debug"))), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           fop_or_new(fop_or_new(create_posix_regexp_match("^PTHREAD$", 0), filter_facility_new(facility_bits("daemon"))),
+                      filter_level_new(level_bits("emerg"))), 0);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           fop_and_new(create_posix_regexp_match("PTHREAD", 0),
+                       negate_filter(fop_and_new(filter_facility_new(facility_bits("user")), filter_level_new(level_bits("emerg"))))), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           fop_and_new(fop_or_new(filter_facility_new(facility_bits("daemon")), create_posix_regexp_match("PTHREAD", 0)),
+                       fop_and_new(filter_level_new(level_bits("debug")), create_posix_regexp_match("support", 0))), 1);
+
   /* LEVEL_NUM is 7 */
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
            fop_cmp_new(create_template("$LEVEL_NUM"), create_template("7"), KW_NUM_EQ), 1);
@@ -23,6 +23,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 #include <glib.h>
 
 #include "cfg.h"
@@ -65,7 +66,7 @@ test_filter_returns_false_when_list_is_empty(const char *top_srcdir)
 {
   gchar *list_file_with_zero_lines = g_strdup_printf(LIST_FILE_DIR "empty.list", top_srcdir);
 
-  assert_gboolean(evaluate_testcase(MSG_1, filter_in_list_new(list_file_with_zero_lines, "PROGRAM")),
+  assert_gboolean(evaluate_testcase(MSG_1, filter_in_list_new(list_file_with_zero_lines, "PROGRAM", 0)),
                   FALSE,
                   "in-list filter matches");
 
@@ -76,7 +77,7 @@ void
 test_string_searched_for_is_not_in_the_list(const char *top_srcdir)
 {
   gchar *list_file_with_one_line = g_strdup_printf(LIST_FILE_DIR "test.list", top_srcdir);
-  assert_gboolean(evaluate_testcase(MSG_2, filter_in_list_new(list_file_with_one_line, "PROGRAM")),
+  assert_gboolean(evaluate_testcase(MSG_2, filter_in_list_new(list_file_with_one_line, "PROGRAM", 0)),
                   FALSE,
                   "in-list filter matches");
   g_free(list_file_with_one_line);
@@ -86,7 +87,7 @@ void
 test_given_macro_is_not_available_in_this_message(const char *top_srcdir)
 {
   gchar *list_file_with_one_line = g_strdup_printf(LIST_FILE_DIR "test.list", top_srcdir);
-  assert_gboolean(evaluate_testcase(MSG_2, filter_in_list_new(list_file_with_one_line, "FOO_MACRO")),
+  assert_gboolean(evaluate_testcase(MSG_2, filter_in_list_new(list_file_with_one_line, "FOO_MACRO", 0)),
                   FALSE,
                   "in-list filter matches");
   g_free(list_file_with_one_line);
@@ -96,7 +97,7 @@ void
 test_list_file_doesnt_exist(const char *top_srcdir)
 {
   gchar *list_file_which_doesnt_exist = g_strdup_printf(LIST_FILE_DIR "notexisting.list", top_srcdir);
-  assert_null(filter_in_list_new(list_file_which_doesnt_exist, "PROGRAM"),
+  assert_null(filter_in_list_new(list_file_which_doesnt_exist, "PROGRAM", 0),
               "in-list filter should fail, when the list file does not exist");
   g_free(list_file_which_doesnt_exist);
 }
@@ -105,7 +106,7 @@ void
 test_list_file_contains_only_one_line(const char *top_srcdir)
 {
   gchar *list_file_with_one_line = g_strdup_printf(LIST_FILE_DIR "test.list", top_srcdir);
-  assert_gboolean(evaluate_testcase(MSG_1, filter_in_list_new(list_file_with_one_line, "PROGRAM")),
+  assert_gboolean(evaluate_testcase(MSG_1, filter_in_list_new(list_file_with_one_line, "PROGRAM", 0)),
                   TRUE,
                   "in-list filter matches");
   g_free(list_file_with_one_line);
@@ -115,7 +116,7 @@ void
 test_list_file_contains_lot_of_lines(const char *top_srcdir)
 {
   gchar *list_file_which_has_a_lot_of_lines = g_strdup_printf(LIST_FILE_DIR "lot_of_lines.list", top_srcdir);
-  assert_gboolean(evaluate_testcase(MSG_1, filter_in_list_new(list_file_which_has_a_lot_of_lines, "PROGRAM")),
+  assert_gboolean(evaluate_testcase(MSG_1, filter_in_list_new(list_file_which_has_a_lot_of_lines, "PROGRAM", 0)),
                   TRUE,
                   "in-list filter matches");
   g_free(list_file_which_has_a_lot_of_lines);
@@ -125,7 +126,7 @@ void
 test_filter_with_ip_address(const char *top_srcdir)
 {
   gchar *list_file_with_ip_address = g_strdup_printf(LIST_FILE_DIR "ip.list", top_srcdir);
-  assert_gboolean(evaluate_testcase(MSG_3, filter_in_list_new(list_file_with_ip_address, "HOST")),
+  assert_gboolean(evaluate_testcase(MSG_3, filter_in_list_new(list_file_with_ip_address, "HOST", 0)),
                   TRUE,
                   "in-list filter matches");
   g_free(list_file_with_ip_address);
@@ -135,12 +136,102 @@ void
 test_filter_with_long_line(const char *top_srcdir)
 {
   gchar *list_file_with_long_line = g_strdup_printf(LIST_FILE_DIR "long_line.list", top_srcdir);
-  assert_gboolean(evaluate_testcase(MSG_LONG, filter_in_list_new(list_file_with_long_line, "HOST")),
+  assert_gboolean(evaluate_testcase(MSG_LONG, filter_in_list_new(list_file_with_long_line, "HOST", 0)),
                   TRUE,
                   "in-list filter matches");
   g_free(list_file_with_long_line);
 }
 
+gboolean
+evaluate_value_testcase(const gchar *value, FilterExprNode *filter_node)
+{
+  LogMessage *log_msg;
+  gboolean result;
+
+  assert_not_null(filter_node, "Constructing an in-list filter");
+  log_msg = log_msg_new_empty();
+  log_msg_set_value_by_name(log_msg, "VALUE", value, -1);
+  result = filter_expr_eval(filter_node, log_msg);
+
+  log_msg_unref(log_msg);
+  filter_expr_unref(filter_node);
+  return result;
+}
+
+void
+test_filter_with_ignore_case(const char *top_srcdir)
+{
+  gchar *list_file = g_strdup_printf(LIST_FILE_DIR "lot_of_lines.list", top_srcdir);
+
+  assert_gboolean(evaluate_value_testcase("FOO-Bar42", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_ICASE)),
+                  TRUE,
+                  "in-list filter does not match case-insensitively");
+  assert_gboolean(evaluate_value_testcase("FOO-Bar42", filter_in_list_new(list_file, "VALUE", 0)),
+                  FALSE,
+                  "in-list filter matches case-insensitively without the ignore-case flag");
+  assert_gboolean(evaluate_value_testcase("foo-bar", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_ICASE)),
+                  FALSE,
+                  "in-list filter matches a prefix of an entry");
+  g_free(list_file);
+}
+
+void
+test_filter_with_cidr(const char *top_srcdir)
+{
+  gchar *list_file = g_strdup_printf(LIST_FILE_DIR "cidr.list", top_srcdir);
+
+  assert_gboolean(evaluate_value_testcase("10.20.30.40", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_CIDR)),
+                  TRUE,
+                  "in-list filter does not match an address in a network");
+  assert_gboolean(evaluate_value_testcase("192.168.1.1", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_CIDR)),
+                  TRUE,
+                  "in-list filter does not match a single address");
+  assert_gboolean(evaluate_value_testcase("192.168.1.2", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_CIDR)),
+                  FALSE,
+                  "in-list filter matches an address outside of the networks");
+  assert_gboolean(evaluate_value_testcase("2001:db8:1::1", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_CIDR)),
+                  TRUE,
+                  "in-list filter does not match an IPv6 address in a network");
+  assert_gboolean(evaluate_value_testcase("2001:db9::1", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_CIDR)),
+                  FALSE,
+                  "in-list filter matches an IPv6 address outside of the networks");
+  assert_gboolean(evaluate_value_testcase("localhost", filter_in_list_new(list_file, "VALUE", FILTER_IN_LIST_CIDR)),
+                  TRUE,
+                  "in-list filter does not match plain strings in cidr mode");
+  assert_gboolean(evaluate_value_testcase("10.20.30.40", filter_in_list_new(list_file, "VALUE", 0)),
+                  FALSE,
+                  "in-list filter matches networks without the cidr flag");
+  g_free(list_file);
+}
+
+void
+test_changed_list_file_is_reloaded(void)
+{
+  gchar list_file[] = "test_filters_in_list.XXXXXX";
+  FilterExprNode *old_filter;
+  gint fd;
+
+  fd = mkstemp(list_file);
+  assert_true(fd >= 0, "Error creating temporary list file");
+  assert_true(write(fd, "foo\n", 4) == 4, "Error writing temporary list file");
+
+  old_filter = filter_in_list_new(list_file, "VALUE", 0);
+  assert_gboolean(evaluate_value_testcase("foo", filter_expr_ref(old_filter)), TRUE,
+                  "in-list filter does not match");
+  assert_gboolean(evaluate_value_testcase("foo", filter_in_list_new(list_file, "VALUE", 0)), TRUE,
+                  "in-list filter sharing the list does not match");
+
+  assert_true(write(fd, "barbaz\n", 7) == 7, "Error writing temporary list file");
+  close(fd);
+
+  assert_gboolean(evaluate_value_testcase("barbaz", filter_in_list_new(list_file, "VALUE", 0)), TRUE,
+                  "in-list filter does not pick up the changed list file");
+  assert_gboolean(evaluate_value_testcase("barbaz", old_filter), FALSE,
+                  "in-list filter created earlier sees the changed list file");
+
+  unlink(list_file);
+}
+
 void
 run_testcases(const char *top_srcdir)
 {
@@ -152,6 +243,9 @@ run_testcases(const char *top_srcdir)
   test_list_file_contains_lot_of_lines(top_srcdir);
   test_filter_with_ip_address(top_srcdir);
   test_filter_with_long_line(top_srcdir);
+  test_filter_with_ignore_case(top_srcdir);
+  test_filter_with_cidr(top_srcdir);
+  test_changed_list_file_is_reloaded();
 }
 
 int
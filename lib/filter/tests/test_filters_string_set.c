@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "cfg.h"
+#include "logmsg/logmsg.h"
+#include "apphook.h"
+#include "plugin.h"
+#include "filter/filter-re.h"
+#include "filter/filter-op.h"
+
+#include "testutils.h"
+
+#include <string.h>
+
+#define MSG_1 "<15>Sep  4 15:03:55 localhost foo[3086]: some random message"
+#define MSG_2 "<15>Sep  4 15:03:55 localhost foo[3086]: Some Random MESSAGE"
+#define MSG_3 "<15>Sep  4 15:03:55 localhost foo[3086]: random"
+
+static MsgFormatOptions parse_options;
+
+typedef struct _StringSetTestCase
+{
+  const gchar *type;
+  const gchar *pattern;
+  gint flags;
+  gboolean expected[3];
+} StringSetTestCase;
+
+static StringSetTestCase string_set_testcases[] =
+{
+  { "string", "random", 0, { FALSE, FALSE, TRUE } },
+  { "string", "random", LMF_SUBSTRING, { TRUE, FALSE, TRUE } },
+  { "string", "random", LMF_SUBSTRING | LMF_ICASE, { TRUE, TRUE, TRUE } },
+  { "string", "some", LMF_PREFIX, { TRUE, FALSE, FALSE } },
+  { "string", "some", LMF_PREFIX | LMF_ICASE, { TRUE, TRUE, FALSE } },
+  { "string", "some random message", 0, { TRUE, FALSE, FALSE } },
+  { "string", "some random message", LMF_ICASE, { TRUE, TRUE, FALSE } },
+  { "string", "message", LMF_SUBSTRING, { TRUE, FALSE, FALSE } },
+  { "string", "dom", LMF_SUBSTRING, { TRUE, TRUE, TRUE } },
+  { "string", "andom", LMF_PREFIX, { FALSE, FALSE, FALSE } },
+  { "glob", "*message", 0, { TRUE, FALSE, FALSE } },
+  { "glob", "*random*", 0, { TRUE, FALSE, TRUE } },
+  { "glob", "some*", 0, { TRUE, FALSE, FALSE } },
+  { "glob", "random", 0, { FALSE, FALSE, TRUE } },
+  { "glob", "*r?ndom*", 0, { TRUE, FALSE, TRUE } },
+  { "pcre", "rand.m", 0, { TRUE, FALSE, TRUE } },
+};
+
+static FilterExprNode *
+create_filter(GlobalConfig *cfg, const StringSetTestCase *tc)
+{
+  FilterRE *f = filter_re_new(LM_V_MESSAGE);
+
+  log_matcher_options_defaults(&f->matcher_options);
+  f->matcher_options.flags = tc->flags;
+  log_matcher_options_set_type(&f->matcher_options, tc->type);
+  assert_true(filter_re_compile_pattern(f, cfg, (gchar *) tc->pattern, NULL),
+              "error compiling pattern: %s", tc->pattern);
+  return &f->super;
+}
+
+static void
+assert_filters_match(FilterExprNode **filters, gint num_filters, gint msg_index, const gchar *msg)
+{
+  LogMessage *logmsg = log_msg_new(msg, strlen(msg), NULL, &parse_options);
+  gint i;
+
+  for (i = 0; i < num_filters; i++)
+    {
+      const StringSetTestCase *tc = &string_set_testcases[i];
+
+      assert_gboolean(filter_expr_eval(filters[i], logmsg), tc->expected[msg_index],
+                      "filter mismatch, type: %s, pattern: %s, flags: %d, msg: %s",
+                      tc->type, tc->pattern, tc->flags, msg);
+      filters[i]->comp = TRUE;
+      assert_gboolean(filter_expr_eval(filters[i], logmsg), !tc->expected[msg_index],
+                      "negated filter mismatch, type: %s, pattern: %s, flags: %d, msg: %s",
+                      tc->type, tc->pattern, tc->flags, msg);
+      filters[i]->comp = FALSE;
+    }
+  log_msg_unref(logmsg);
+}
+
+static void
+assert_string_set_matches_individual_matchers(gint num_filters)
+{
+  GlobalConfig *cfg = cfg_new(0x0305);
+  FilterExprNode *filters[G_N_ELEMENTS(string_set_testcases)];
+  gint i;
+
+  for (i = 0; i < num_filters; i++)
+    filters[i] = create_filter(cfg, &string_set_testcases[i]);
+  for (i = 0; i < num_filters; i++)
+    filter_expr_init(filters[i], cfg);
+
+  /* evaluate twice, the second round is served from the cache */
+  assert_filters_match(filters, num_filters, 0, MSG_1);
+  assert_filters_match(filters, num_filters, 0, MSG_1);
+  assert_filters_match(filters, num_filters, 1, MSG_2);
+  assert_filters_match(filters, num_filters, 2, MSG_3);
+  assert_filters_match(filters, num_filters, 1, MSG_2);
+
+  for (i = 0; i < num_filters; i++)
+    filter_expr_unref(filters[i]);
+  cfg_free(cfg);
+}
+
+static void
+test_string_set_with_all_literals(void)
+{
+  assert_string_set_matches_individual_matchers(G_N_ELEMENTS(string_set_testcases));
+}
+
+static void
+test_small_string_set_falls_back_to_individual_matchers(void)
+{
+  assert_string_set_matches_individual_matchers(2);
+}
+
+static void
+test_filters_added_after_first_use_are_evaluated_individually(void)
+{
+  GlobalConfig *cfg = cfg_new(0x0305);
+  FilterExprNode *filters[G_N_ELEMENTS(string_set_testcases)];
+  gint num_filters = G_N_ELEMENTS(string_set_testcases);
+  gint half = num_filters / 2;
+  gint i;
+
+  for (i = 0; i < half; i++)
+    {
+      filters[i] = create_filter(cfg, &string_set_testcases[i]);
+      filter_expr_init(filters[i], cfg);
+    }
+  assert_filters_match(filters, half, 0, MSG_1);
+
+  for (i = half; i < num_filters; i++)
+    {
+      filters[i] = create_filter(cfg, &string_set_testcases[i]);
+      filter_expr_init(filters[i], cfg);
+    }
+  assert_filters_match(filters, num_filters, 0, MSG_1);
+  assert_filters_match(filters, num_filters, 2, MSG_3);
+
+  for (i = 0; i < num_filters; i++)
+    filter_expr_unref(filters[i]);
+  cfg_free(cfg);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0305);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  test_string_set_with_all_literals();
+  test_small_string_set_falls_back_to_individual_matchers();
+  test_filters_added_after_first_use_are_evaluated_individually();
+
+  app_shutdown();
+  return 0;
+}
@@ -26,6 +26,9 @@
 #include "messages.h"
 #include "cfg.h"
 #include "str-utils.h"
+#include "regexp-jit.h"
+#include "timeutils.h"
+#include "stats/stats-registry.h"
 #include "compat/string.h"
 
 #include <pcre.h>
@@ -373,6 +376,27 @@ log_matcher_string_replace(LogMatcher *s, LogMessage *msg, gint value_handle, co
   return NULL;
 }
 
+static gboolean
+log_matcher_string_get_literal(LogMatcher *s, LogMatcherLiteral *literal)
+{
+  LogMatcherString *self = (LogMatcherString *) s;
+
+  if (self->pattern_len == 0)
+    return FALSE;
+
+  literal->pattern = self->pattern;
+  literal->pattern_len = self->pattern_len;
+  if (self->super.flags & LMF_PREFIX)
+    literal->anchor = LML_PREFIX;
+  else if (self->super.flags & LMF_SUBSTRING)
+    literal->anchor = LML_SUBSTRING;
+  else
+    literal->anchor = LML_EXACT;
+  literal->ignore_case = !!(self->super.flags & LMF_ICASE);
+  literal->utf8_only = FALSE;
+  return TRUE;
+}
+
 static void
 log_matcher_string_free(LogMatcher *s)
 {
@@ -390,6 +414,7 @@ log_matcher_string_new(const LogMatcherOptions *options)
   self->super.compile = log_matcher_string_compile;
   self->super.match = log_matcher_string_match;
   self->super.replace = log_matcher_string_replace;
+  self->super.get_literal = log_matcher_string_get_literal;
   self->super.free_fn = log_matcher_string_free;
 
   return &self->super;
@@ -399,8 +424,41 @@ typedef struct _LogMatcherGlob
 {
   LogMatcher super;
   GPatternSpec *pattern;
+  /* set if the pattern is a literal with optional leading/trailing '*' */
+  gchar *literal;
+  LogMatcherLiteralAnchor literal_anchor;
 } LogMatcherGlob;
 
+static void
+log_matcher_glob_extract_literal(LogMatcherGlob *self, const gchar *pattern)
+{
+  gboolean leading_star, trailing_star;
+  gsize len = strlen(pattern);
+
+  leading_star = len > 0 && pattern[0] == '*';
+  trailing_star = len > 1 && pattern[len - 1] == '*';
+  if (leading_star)
+    {
+      pattern++;
+      len--;
+    }
+  if (trailing_star)
+    len--;
+
+  if (len == 0 || memchr(pattern, '*', len) || memchr(pattern, '?', len))
+    return;
+
+  self->literal = g_strndup(pattern, len);
+  if (leading_star && trailing_star)
+    self->literal_anchor = LML_SUBSTRING;
+  else if (leading_star)
+    self->literal_anchor = LML_SUFFIX;
+  else if (trailing_star)
+    self->literal_anchor = LML_PREFIX;
+  else
+    self->literal_anchor = LML_EXACT;
+}
+
 static gboolean
 log_matcher_glob_compile(LogMatcher *s, const gchar *pattern, GError **error)
 {
@@ -409,6 +467,7 @@ log_matcher_glob_compile(LogMatcher *s, const gchar *pattern, GError **error)
   g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
   self->pattern = g_pattern_spec_new(pattern);
+  log_matcher_glob_extract_literal(self, pattern);
   return TRUE;
 }
 
@@ -442,11 +501,28 @@ log_matcher_glob_match(LogMatcher *s, LogMessage *msg, gint value_handle, const
   return FALSE;
 }
 
+static gboolean
+log_matcher_glob_get_literal(LogMatcher *s, LogMatcherLiteral *literal)
+{
+  LogMatcherGlob *self = (LogMatcherGlob *) s;
+
+  if (!self->literal)
+    return FALSE;
+
+  literal->pattern = self->literal;
+  literal->pattern_len = strlen(self->literal);
+  literal->anchor = self->literal_anchor;
+  literal->ignore_case = FALSE;
+  literal->utf8_only = TRUE;
+  return TRUE;
+}
+
 static void
 log_matcher_glob_free(LogMatcher *s)
 {
   LogMatcherGlob *self = (LogMatcherGlob *)s;
   g_pattern_spec_free(self->pattern);
+  g_free(self->literal);
 }
 
 LogMatcher *
@@ -458,6 +534,7 @@ log_matcher_glob_new(const LogMatcherOptions *options)
   self->super.compile = log_matcher_glob_compile;
   self->super.match = log_matcher_glob_match;
   self->super.replace = NULL;
+  self->super.get_literal = log_matcher_glob_get_literal;
   self->super.free_fn = log_matcher_glob_free;
 
   return &self->super;
@@ -471,8 +548,73 @@ typedef struct _LogMatcherPcreRe
   pcre *pattern;
   pcre_extra *extra;
   gint match_options;
+
+  /* pattern properties, queried once at compile time instead of on every match */
+  gint capture_count;
+  gint name_count;
+  gint name_entry_size;
+  gchar *name_table;
+
+  /* per-regexp evaluation statistics, registered on first evaluation */
+  gchar *source;
+  gint stats_registered;
+  StatsCounterItem *evaluations;
+  StatsCounterItem *eval_time;
 } LogMatcherPcreRe;
 
+static void
+log_matcher_pcre_re_register_stats(LogMatcherPcreRe *self)
+{
+  /* the first evaluating thread does the registration, the counters are
+   * NULL (and thus ignored) until it is done */
+  if (!__sync_bool_compare_and_swap(&self->stats_registered, FALSE, TRUE))
+    return;
+
+  stats_lock();
+  stats_register_counter(3, SCS_REGEXP, self->source, NULL, SC_TYPE_EVAL_TIME, &self->eval_time);
+  stats_register_counter(3, SCS_REGEXP, self->source, NULL, SC_TYPE_PROCESSED, &self->evaluations);
+  stats_unlock();
+}
+
+static void
+log_matcher_pcre_re_unregister_stats(LogMatcherPcreRe *self)
+{
+  if (!self->stats_registered)
+    return;
+
+  stats_lock();
+  stats_unregister_counter(SCS_REGEXP, self->source, NULL, SC_TYPE_EVAL_TIME, &self->eval_time);
+  stats_unregister_counter(SCS_REGEXP, self->source, NULL, SC_TYPE_PROCESSED, &self->evaluations);
+  stats_unlock();
+}
+
+static inline void
+log_matcher_pcre_re_stats_start(LogMatcherPcreRe *self, struct timespec *start)
+{
+  if (G_UNLIKELY(!self->stats_registered))
+    log_matcher_pcre_re_register_stats(self);
+
+  /* a zero start marks an untimed evaluation, even if another thread
+   * registers eval_time while we are running */
+  if (self->eval_time)
+    clock_gettime(CLOCK_MONOTONIC, start);
+  else
+    start->tv_sec = start->tv_nsec = 0;
+}
+
+static inline void
+log_matcher_pcre_re_stats_stop(LogMatcherPcreRe *self, struct timespec *start)
+{
+  struct timespec stop;
+
+  stats_counter_inc(self->evaluations);
+  if (self->eval_time && (start->tv_sec || start->tv_nsec))
+    {
+      clock_gettime(CLOCK_MONOTONIC, &stop);
+      stats_counter_add(self->eval_time, timespec_diff_nsec(&stop, start));
+    }
+}
+
 static gboolean
 log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re, GError **error)
 {
@@ -482,7 +624,6 @@ log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re, GError **error)
   const gchar *errptr;
   gint erroffset;
   gint flags = 0;
-  gint optflags = 0;
 
   g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
@@ -526,18 +667,27 @@ log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re, GError **error)
       return FALSE;
     }
 
-#ifdef PCRE_STUDY_JIT_COMPILE
-  optflags = PCRE_STUDY_JIT_COMPILE;
-#endif
-
   /* optimize regexp */
-  self->extra = pcre_study(self->pattern, optflags, &errptr);
+  self->extra = regexp_jit_study(self->pattern, &errptr);
   if (errptr != NULL)
     {
       g_set_error(error, LOG_TEMPLATE_ERROR, 0, "Error while optimizing regular expression, error=%s", errptr);
       return FALSE;
     }
 
+  if (pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_CAPTURECOUNT, &self->capture_count) < 0)
+    g_assert_not_reached();
+  if (self->capture_count > RE_MAX_MATCHES)
+    self->capture_count = RE_MAX_MATCHES;
+
+  pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_NAMECOUNT, &self->name_count);
+  if (self->name_count > 0)
+    {
+      pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_NAMETABLE, &self->name_table);
+      pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_NAMEENTRYSIZE, &self->name_entry_size);
+    }
+
+  self->source = g_strdup(re);
   return TRUE;
 }
 
@@ -563,30 +713,21 @@ log_matcher_pcre_re_feed_backrefs(LogMatcher *s, LogMessage *msg, gint value_han
 static void
 log_matcher_pcre_re_feed_named_substrings(LogMatcher *s, LogMessage *msg, int *matches, const gchar *value)
 {
-  gchar *name_table = NULL;
   gint i = 0;
-  gint namecount = 0;
-  gint name_entry_size = 0;
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s;
 
-  pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_NAMECOUNT, &namecount);
-  if (namecount > 0)
+  if (self->name_count > 0)
     {
       gchar *tabptr;
-      /* Before we can access the substrings, we must extract the table for
-         translating names to numbers, and the size of each entry in the table.
-       */
-      pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_NAMETABLE, &name_table);
-      pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_NAMEENTRYSIZE, &name_entry_size);
-      /* Now we can scan the table and, for each entry, print the number, the name,
-         and the substring itself.
+      /* The name table was extracted at compile time, scan it and, for
+         each entry, set the value named by the entry to the substring.
        */
-      tabptr = name_table;
-      for (i = 0; i < namecount; i++)
+      tabptr = self->name_table;
+      for (i = 0; i < self->name_count; i++)
         {
           int n = (tabptr[0] << 8) | tabptr[1];
           log_msg_set_value_by_name(msg, tabptr + 2, value + matches[2*n], matches[2*n+1] - matches[2*n]);
-          tabptr += name_entry_size;
+          tabptr += self->name_entry_size;
         }
     }
 }
@@ -595,24 +736,21 @@ static gboolean
 log_matcher_pcre_re_match(LogMatcher *s, LogMessage *msg, gint value_handle, const gchar *value, gssize value_len)
 {
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s;
+  struct timespec start;
   gint *matches;
   gsize matches_size;
-  gint num_matches;
   gint rc;
 
   if (value_len == -1)
     value_len = strlen(value);
 
-  if (pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_CAPTURECOUNT, &num_matches) < 0)
-    g_assert_not_reached();
-  if (num_matches > RE_MAX_MATCHES)
-    num_matches = RE_MAX_MATCHES;
-
-  matches_size = 3 * (num_matches + 1);
+  matches_size = 3 * (self->capture_count + 1);
   matches = g_alloca(matches_size * sizeof(gint));
 
+  log_matcher_pcre_re_stats_start(self, &start);
   rc = pcre_exec(self->pattern, self->extra,
                  value, value_len, 0, self->match_options, matches, matches_size);
+  log_matcher_pcre_re_stats_stop(self, &start);
   if (rc < 0)
     {
       switch (rc)
@@ -649,20 +787,15 @@ log_matcher_pcre_re_replace(LogMatcher *s, LogMessage *msg, gint value_handle, c
 {
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s;
   GString *new_value = NULL;
+  struct timespec start;
   gint *matches;
   gsize matches_size;
-  gint num_matches;
   gint rc;
   gint start_offset, last_offset;
   gint options;
   gboolean last_match_was_empty;
 
-  if (pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_CAPTURECOUNT, &num_matches) < 0)
-    g_assert_not_reached();
-  if (num_matches > RE_MAX_MATCHES)
-    num_matches = RE_MAX_MATCHES;
-
-  matches_size = 3 * (num_matches + 1);
+  matches_size = 3 * (self->capture_count + 1);
   matches = g_alloca(matches_size * sizeof(gint));
 
   /* we need zero initialized offsets for the last match as the
@@ -712,9 +845,11 @@ log_matcher_pcre_re_replace(LogMatcher *s, LogMessage *msg, gint value_handle, c
           options = 0;
         }
 
+      log_matcher_pcre_re_stats_start(self, &start);
       rc = pcre_exec(self->pattern, self->extra,
                      value, value_len,
                      start_offset, (self->match_options | options), matches, matches_size);
+      log_matcher_pcre_re_stats_stop(self, &start);
       if (rc < 0 && rc != PCRE_ERROR_NOMATCH)
         {
           msg_error("Error while matching regexp",
@@ -778,8 +913,11 @@ static void
 log_matcher_pcre_re_free(LogMatcher *s)
 {
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s;
-  pcre_free(self->extra);
+
+  log_matcher_pcre_re_unregister_stats(self);
+  regexp_jit_free_study(self->extra);
   pcre_free(self->pattern);
+  g_free(self->source);
 }
 
 LogMatcher *
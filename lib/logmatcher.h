@@ -60,6 +60,26 @@ typedef struct _LogMatcherOptions
 
 typedef struct _LogMatcher LogMatcher;
 
+/* the literal a string or glob matcher is equivalent to, see
+ * log_matcher_get_literal() */
+typedef enum
+{
+  LML_EXACT,
+  LML_PREFIX,
+  LML_SUFFIX,
+  LML_SUBSTRING,
+} LogMatcherLiteralAnchor;
+
+typedef struct _LogMatcherLiteral
+{
+  const gchar *pattern;
+  gsize pattern_len;
+  LogMatcherLiteralAnchor anchor;
+  gboolean ignore_case;
+  /* the matcher never matches non-utf8 input */
+  gboolean utf8_only;
+} LogMatcherLiteral;
+
 struct _LogMatcher
 {
   gint ref_cnt;
@@ -69,6 +89,8 @@ struct _LogMatcher
   gboolean (*match)(LogMatcher *s, LogMessage *msg, gint value_handle, const gchar *value, gssize value_len);
   /* value_len can be -1 to indicate unknown length, new_length can be returned as -1 to indicate unknown length */
   gchar *(*replace)(LogMatcher *s, LogMessage *msg, gint value_handle, const gchar *value, gssize value_len, LogTemplate *replacement, gssize *new_length);
+  /* optional, returns TRUE if matching is equivalent to looking for a literal */
+  gboolean (*get_literal)(LogMatcher *s, LogMatcherLiteral *literal);
   void (*free_fn)(LogMatcher *s);
 };
 
@@ -92,6 +114,15 @@ log_matcher_replace(LogMatcher *s, LogMessage *msg, gint value_handle, const gch
   return NULL;
 }
 
+/* used to merge literal matchers into a single multi-pattern automaton */
+static inline gboolean
+log_matcher_get_literal(LogMatcher *s, LogMatcherLiteral *literal)
+{
+  if (s->get_literal)
+    return s->get_literal(s, literal);
+  return FALSE;
+}
+
 static inline void
 log_matcher_set_flags(LogMatcher *s, gint flags)
 {
@@ -113,6 +113,9 @@
  * stuff, but that shouldn't have that much of an overhead.
  */
 
+/* number of LogMessage size classes recycled by the per-thread pools, see log_msg_alloc() */
+#define LOG_MSG_POOL_CLASSES 5
+
 TLS_BLOCK_START
 {
   /* message that is being processed by the current thread. Its ack/ref changes are cached */
@@ -129,6 +132,13 @@ TLS_BLOCK_START
   gboolean logmsg_cached_abort;
   /* suspend flag in the current thread for acks */
   gboolean logmsg_cached_suspend;
+
+  /* per-thread free lists of LogMessage allocations, linked through ->original */
+  gboolean logmsg_pool_registered;
+  LogMessage *logmsg_pool[LOG_MSG_POOL_CLASSES];
+  gint logmsg_pool_len[LOG_MSG_POOL_CLASSES];
+  gint logmsg_pool_hits;
+  gint logmsg_pool_misses;
 }
 TLS_BLOCK_END;
 
@@ -138,6 +148,11 @@ TLS_BLOCK_END;
 #define logmsg_cached_ack_needed    __tls_deref(logmsg_cached_ack_needed)
 #define logmsg_cached_abort         __tls_deref(logmsg_cached_abort)
 #define logmsg_cached_suspend       __tls_deref(logmsg_cached_suspend)
+#define logmsg_pool_registered      __tls_deref(logmsg_pool_registered)
+#define logmsg_pool                 __tls_deref(logmsg_pool)
+#define logmsg_pool_len             __tls_deref(logmsg_pool_len)
+#define logmsg_pool_hits            __tls_deref(logmsg_pool_hits)
+#define logmsg_pool_misses          __tls_deref(logmsg_pool_misses)
 
 #define LOGMSG_REFCACHE_SUSPEND_SHIFT                 31 /* number of bits to shift to get the SUSPEND flag */
 #define LOGMSG_REFCACHE_SUSPEND_MASK          0x80000000 /* bit mask to extract the SUSPEND flag */
@@ -210,6 +225,8 @@ gint logmsg_queue_node_max = 1;
 static StatsCounterItem *count_msg_clones;
 static StatsCounterItem *count_payload_reallocs;
 static StatsCounterItem *count_sdata_updates;
+static StatsCounterItem *count_msg_pool_hits;
+static StatsCounterItem *count_msg_pool_misses;
 static GStaticPrivate priv_macro_value = G_STATIC_PRIVATE_INIT;
 
 static inline gboolean
@@ -554,9 +571,20 @@ log_msg_unset_value_by_name(LogMessage *self, const gchar *name)
   log_msg_unset_value(self, log_msg_get_value_handle(name));
 }
 
+/* built-in values are used as NUL terminated strings all over the place, so
+ * they may only reference the tail of another value */
+static gboolean
+_is_reference_to_the_tail_of_a_value(LogMessage *self, NVHandle ref_handle, guint32 ofs, guint32 len)
+{
+  gssize ref_len;
+
+  log_msg_get_value(self, ref_handle, &ref_len);
+  return ofs + len == ref_len;
+}
+
 void
-log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs,
-                           guint16 len)
+log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint32 ofs,
+                           guint32 len)
 {
   const gchar *name;
   gssize name_len;
@@ -567,7 +595,7 @@ log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handl
   if (handle == LM_V_NONE)
     return;
 
-  g_assert(handle >= LM_V_MAX);
+  g_assert(handle >= LM_V_MAX || _is_reference_to_the_tail_of_a_value(self, ref_handle, ofs, len));
 
   name = log_msg_get_value_name(handle, &name_len);
 
@@ -1065,32 +1093,344 @@ log_msg_clear(LogMessage *self)
   self->flags |= LF_STATE_OWN_MASK;
 }
 
+/*
+ * LogMessage pools
+ *
+ * A LogMessage is allocated as a single block (the LogMessage, its
+ * preallocated queue nodes and the initial NVTable payload).  To avoid
+ * going to malloc() for every message, blocks are recycled through
+ * per-thread free lists when the last reference is dropped.  Payloads are
+ * rounded up to a few size classes (clones have no payload at all), larger
+ * messages are allocated and freed the old way.
+ *
+ * Messages are usually allocated in one thread (e.g. a LogReader) and
+ * freed in another one (e.g. a LogWriter), so once a thread collects more
+ * than two magazines' worth of blocks, one magazine is handed over to a
+ * global depot, where threads that ran out of blocks pick them up.  The
+ * depot lock is only taken once per magazine.  The memory retained in the
+ * depot is capped by log_msg_set_pool_size().
+ */
+
+#define LOG_MSG_POOL_MIN_PAYLOAD    256
+#define LOG_MSG_POOL_MAGAZINE_SIZE  32
+#define LOG_MSG_POOL_STATS_BATCH    256
+
+static GStaticMutex logmsg_pool_depot_lock = G_STATIC_MUTEX_INIT;
+static GPtrArray *logmsg_pool_depot[LOG_MSG_POOL_CLASSES];
+static gsize logmsg_pool_depot_size;
+static gsize logmsg_pool_max_size = LOG_MSG_POOL_DEFAULT_SIZE;
+/* checked by every thread on each allocation, so that a change of the pool
+ * size applies to threads that are already running */
+static volatile gint logmsg_pool_enabled = TRUE;
+
+/* the thread registered with log_msg_pool_thread_init() and the pool is on */
+static inline gboolean
+log_msg_pool_is_enabled(void)
+{
+  return logmsg_pool_registered && g_atomic_int_get(&logmsg_pool_enabled);
+}
+
+static inline gsize
+log_msg_get_alloc_size(gsize payload_size, gint nodes, gsize *payload_ofs)
+{
+  gsize alloc_size;
+
+  alloc_size = sizeof(LogMessage) + sizeof(LogMessageQueueNode) * nodes;
+  /* align to 8 boundary */
+  if (payload_size)
+    {
+      alloc_size = (alloc_size + 7) & ~7;
+      *payload_ofs = alloc_size;
+      alloc_size += nv_table_get_alloc_size(LM_V_MAX, 16, payload_size);
+    }
+  return alloc_size;
+}
+
+/* returns the pool class for @payload_size and rounds it up to the size of the class */
+static inline gint
+log_msg_pool_lookup_class(gsize *payload_size)
+{
+  gsize class_size = LOG_MSG_POOL_MIN_PAYLOAD;
+  gint pool_class;
+
+  if (*payload_size == 0)
+    return 0;
+
+  for (pool_class = 1; pool_class < LOG_MSG_POOL_CLASSES; pool_class++, class_size <<= 1)
+    {
+      if (*payload_size <= class_size)
+        {
+          *payload_size = class_size;
+          return pool_class;
+        }
+    }
+  return -1;
+}
+
+static inline gsize
+log_msg_pool_get_class_payload_size(gint pool_class)
+{
+  return pool_class == 0 ? 0 : LOG_MSG_POOL_MIN_PAYLOAD << (pool_class - 1);
+}
+
+static inline gsize
+log_msg_pool_get_magazine_size(gint pool_class, gint nodes)
+{
+  gsize payload_ofs;
+
+  return LOG_MSG_POOL_MAGAZINE_SIZE *
+         log_msg_get_alloc_size(log_msg_pool_get_class_payload_size(pool_class), nodes, &payload_ofs);
+}
+
+static void
+log_msg_pool_free_chain(LogMessage *chain)
+{
+  while (chain)
+    {
+      LogMessage *next = chain->original;
+
+      g_free(chain);
+      chain = next;
+    }
+}
+
+static void
+log_msg_pool_update_stats(gboolean force)
+{
+  if (force || logmsg_pool_hits >= LOG_MSG_POOL_STATS_BATCH || logmsg_pool_misses >= LOG_MSG_POOL_STATS_BATCH)
+    {
+      stats_counter_add(count_msg_pool_hits, logmsg_pool_hits);
+      stats_counter_add(count_msg_pool_misses, logmsg_pool_misses);
+      logmsg_pool_hits = 0;
+      logmsg_pool_misses = 0;
+    }
+}
+
+/* hand the first magazine of the per-thread free list over to the depot */
+static void
+log_msg_pool_release_magazine(gint pool_class)
+{
+  LogMessage *magazine, *last;
+  gsize magazine_size;
+  gint i;
+
+  magazine = last = logmsg_pool[pool_class];
+  for (i = 1; i < LOG_MSG_POOL_MAGAZINE_SIZE; i++)
+    last = last->original;
+  logmsg_pool[pool_class] = last->original;
+  logmsg_pool_len[pool_class] -= LOG_MSG_POOL_MAGAZINE_SIZE;
+  last->original = NULL;
+
+  magazine_size = log_msg_pool_get_magazine_size(pool_class, magazine->num_nodes);
+
+  g_static_mutex_lock(&logmsg_pool_depot_lock);
+  if (logmsg_pool_depot_size + magazine_size <= logmsg_pool_max_size)
+    {
+      g_ptr_array_add(logmsg_pool_depot[pool_class], magazine);
+      logmsg_pool_depot_size += magazine_size;
+      magazine = NULL;
+    }
+  g_static_mutex_unlock(&logmsg_pool_depot_lock);
+
+  /* the depot is full */
+  log_msg_pool_free_chain(magazine);
+}
+
+/* refill the empty per-thread free list with a magazine from the depot */
+static void
+log_msg_pool_acquire_magazine(gint pool_class)
+{
+  GPtrArray *magazines = logmsg_pool_depot[pool_class];
+  LogMessage *magazine = NULL;
+
+  g_static_mutex_lock(&logmsg_pool_depot_lock);
+  if (magazines->len > 0)
+    {
+      magazine = g_ptr_array_remove_index_fast(magazines, magazines->len - 1);
+      logmsg_pool_depot_size -= log_msg_pool_get_magazine_size(pool_class, magazine->num_nodes);
+    }
+  g_static_mutex_unlock(&logmsg_pool_depot_lock);
+
+  if (magazine)
+    {
+      logmsg_pool[pool_class] = magazine;
+      logmsg_pool_len[pool_class] = LOG_MSG_POOL_MAGAZINE_SIZE;
+    }
+}
+
 static inline LogMessage *
-log_msg_alloc(gsize payload_size)
+log_msg_pool_get(gint pool_class)
 {
   LogMessage *msg;
-  gsize payload_space = payload_size ? nv_table_get_alloc_size(LM_V_MAX, 16, payload_size) : 0;
+
+  if (!logmsg_pool[pool_class])
+    log_msg_pool_acquire_magazine(pool_class);
+
+  msg = logmsg_pool[pool_class];
+  if (msg)
+    {
+      logmsg_pool[pool_class] = msg->original;
+      logmsg_pool_len[pool_class]--;
+      logmsg_pool_hits++;
+    }
+  else
+    {
+      logmsg_pool_misses++;
+    }
+  log_msg_pool_update_stats(FALSE);
+  return msg;
+}
+
+static inline gboolean
+log_msg_pool_put(LogMessage *msg)
+{
+  gint pool_class = msg->pool_class - 1;
+
+  if (pool_class < 0)
+    return FALSE;
+
+  if (!log_msg_pool_is_enabled())
+    {
+      /* the pool was switched off while this thread held blocks */
+      if (logmsg_pool[pool_class])
+        {
+          log_msg_pool_free_chain(logmsg_pool[pool_class]);
+          logmsg_pool[pool_class] = NULL;
+          logmsg_pool_len[pool_class] = 0;
+        }
+      return FALSE;
+    }
+
+  /* blocks allocated before logmsg_queue_node_max grew are not recycled,
+   * so that the pool converges to the new size */
+  if (msg->num_nodes < (volatile gint) logmsg_queue_node_max)
+    return FALSE;
+
+  if (logmsg_pool_len[pool_class] >= 2 * LOG_MSG_POOL_MAGAZINE_SIZE)
+    log_msg_pool_release_magazine(pool_class);
+
+  msg->original = logmsg_pool[pool_class];
+  logmsg_pool[pool_class] = msg;
+  logmsg_pool_len[pool_class]++;
+  return TRUE;
+}
+
+/* can be called from any thread, running threads pick up the change with
+ * their next allocation */
+void
+log_msg_set_pool_size(gsize pool_size)
+{
+  GSList *trimmed = NULL;
+  gint i;
+
+  g_static_mutex_lock(&logmsg_pool_depot_lock);
+  logmsg_pool_max_size = pool_size;
+  g_atomic_int_set(&logmsg_pool_enabled, pool_size > 0);
+
+  /* shrink the depot to the new cap */
+  for (i = 0; i < LOG_MSG_POOL_CLASSES && logmsg_pool_depot[i]; i++)
+    {
+      GPtrArray *magazines = logmsg_pool_depot[i];
+
+      while (logmsg_pool_depot_size > logmsg_pool_max_size && magazines->len > 0)
+        {
+          LogMessage *magazine = g_ptr_array_remove_index_fast(magazines, magazines->len - 1);
+
+          logmsg_pool_depot_size -= log_msg_pool_get_magazine_size(i, magazine->num_nodes);
+          trimmed = g_slist_prepend(trimmed, magazine);
+        }
+    }
+  g_static_mutex_unlock(&logmsg_pool_depot_lock);
+
+  g_slist_foreach(trimmed, (GFunc) log_msg_pool_free_chain, NULL);
+  g_slist_free(trimmed);
+}
+
+/* Registers the current thread with the LogMessage pool, whether the pool
+ * is used is decided by log_msg_set_pool_size().  Threads that register
+ * must call log_msg_pool_thread_deinit() before exiting. */
+void
+log_msg_pool_thread_init(void)
+{
+  logmsg_pool_registered = TRUE;
+}
+
+void
+log_msg_pool_thread_deinit(void)
+{
+  gint i;
+
+  for (i = 0; i < LOG_MSG_POOL_CLASSES; i++)
+    {
+      log_msg_pool_free_chain(logmsg_pool[i]);
+      logmsg_pool[i] = NULL;
+      logmsg_pool_len[i] = 0;
+    }
+  log_msg_pool_update_stats(TRUE);
+  logmsg_pool_registered = FALSE;
+}
+
+static void
+log_msg_pool_global_init(void)
+{
+  gint i;
+
+  for (i = 0; i < LOG_MSG_POOL_CLASSES; i++)
+    logmsg_pool_depot[i] = g_ptr_array_new();
+  log_msg_pool_thread_init();
+}
+
+static void
+log_msg_pool_global_deinit(void)
+{
+  gint i;
+
+  log_msg_pool_thread_deinit();
+  for (i = 0; i < LOG_MSG_POOL_CLASSES; i++)
+    {
+      g_ptr_array_foreach(logmsg_pool_depot[i], (GFunc) log_msg_pool_free_chain, NULL);
+      g_ptr_array_free(logmsg_pool_depot[i], TRUE);
+      logmsg_pool_depot[i] = NULL;
+    }
+  logmsg_pool_depot_size = 0;
+}
+
+static inline LogMessage *
+log_msg_alloc(gsize payload_size)
+{
+  LogMessage *msg = NULL;
   gsize alloc_size, payload_ofs = 0;
+  gint pool_class = -1;
 
   /* NOTE: logmsg_node_max is updated from parallel threads without locking. */
   gint nodes = (volatile gint) logmsg_queue_node_max;
 
-  alloc_size = sizeof(LogMessage) + sizeof(LogMessageQueueNode) * nodes;
-  /* align to 8 boundary */
-  if (payload_size)
+  if (log_msg_pool_is_enabled())
     {
-      alloc_size = (alloc_size + 7) & ~7;
-      payload_ofs = alloc_size;
-      alloc_size += payload_space;
+      pool_class = log_msg_pool_lookup_class(&payload_size);
+      if (pool_class >= 0)
+        msg = log_msg_pool_get(pool_class);
+    }
+
+  if (msg)
+    {
+      /* recycled blocks might have been allocated with less nodes */
+      nodes = msg->num_nodes;
+      alloc_size = log_msg_get_alloc_size(payload_size, nodes, &payload_ofs);
+    }
+  else
+    {
+      alloc_size = log_msg_get_alloc_size(payload_size, nodes, &payload_ofs);
+      msg = g_malloc(alloc_size);
     }
-  msg = g_malloc(alloc_size);
 
   memset(msg, 0, sizeof(LogMessage));
 
   if (payload_size)
-    msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, payload_space, LM_V_MAX);
+    msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, alloc_size - payload_ofs, LM_V_MAX);
 
   msg->num_nodes = nodes;
+  msg->pool_class = pool_class + 1;
   return msg;
 }
 
@@ -1136,6 +1476,8 @@ LogMessage *
 log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
 {
   LogMessage *self = log_msg_alloc(0);
+  guint8 num_nodes = self->num_nodes;
+  guint8 pool_class = self->pool_class;
 
   stats_counter_inc(count_msg_clones);
   log_msg_write_protect(msg);
@@ -1149,8 +1491,10 @@ log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
   self->original = log_msg_ref(msg);
   self->ack_and_ref_and_abort_and_suspended = LOGMSG_REFCACHE_REF_TO_VALUE(1) + LOGMSG_REFCACHE_ACK_TO_VALUE(
         0) + LOGMSG_REFCACHE_ABORT_TO_VALUE(0);
+  self->num_nodes = num_nodes;
   self->cur_node = 0;
   self->protect_cnt = 0;
+  self->pool_class = pool_class;
 
   log_msg_add_ack(self, path_options);
   if (!path_options->ack_needed)
@@ -1283,7 +1627,8 @@ log_msg_free(LogMessage *self)
   if (self->original)
     log_msg_unref(self->original);
 
-  g_free(self);
+  if (!log_msg_pool_put(self))
+    g_free(self);
 }
 
 /**
@@ -1714,10 +2059,13 @@ void
 log_msg_global_init(void)
 {
   log_msg_registry_init();
+  log_msg_pool_global_init();
   stats_lock();
   stats_register_counter(0, SCS_GLOBAL, "msg_clones", NULL, SC_TYPE_PROCESSED, &count_msg_clones);
   stats_register_counter(0, SCS_GLOBAL, "payload_reallocs", NULL, SC_TYPE_PROCESSED, &count_payload_reallocs);
   stats_register_counter(0, SCS_GLOBAL, "sdata_updates", NULL, SC_TYPE_PROCESSED, &count_sdata_updates);
+  stats_register_counter(0, SCS_GLOBAL, "msg_pool_hits", NULL, SC_TYPE_PROCESSED, &count_msg_pool_hits);
+  stats_register_counter(0, SCS_GLOBAL, "msg_pool_misses", NULL, SC_TYPE_PROCESSED, &count_msg_pool_misses);
   stats_unlock();
 }
 
@@ -1730,6 +2078,7 @@ log_msg_get_handle_name(NVHandle handle, gssize *length)
 void
 log_msg_global_deinit(void)
 {
+  log_msg_pool_global_deinit();
   log_msg_registry_deinit();
 }
 
@@ -62,6 +62,9 @@ typedef void (*LMAckFunc)(LogMessage *lm, AckType ack_type);
 
 #define RE_MAX_MATCHES 256
 
+/* default cap of the memory retained by the global LogMessage pool, see log_msg_set_pool_size() */
+#define LOG_MSG_POOL_DEFAULT_SIZE (16 * 1024 * 1024)
+
 typedef enum
 {
   LM_TS_STAMP = 0,
@@ -135,6 +138,10 @@ typedef struct _LogMessageQueueNode
   struct iv_list_head list;
   LogMessage *msg;
   gboolean ack_needed:1, embedded:1, flow_control_requested:1;
+  /* enqueue time in milliseconds, see log_queue_get_enqueue_stamp().
+   * Always set, as the queue_latency counter may be registered while
+   * the node is in the queue (e.g. the queue is kept across a reload) */
+  guint32 enqueued;
 } LogMessageQueueNode;
 
 
@@ -192,6 +199,8 @@ struct _LogMessage
   guint8 num_nodes;
   guint8 cur_node;
   guint8 protect_cnt;
+  /* size class of the LogMessage pool this instance is recycled to, 0 if not pooled */
+  guint8 pool_class;
 
   guint64 rcptid;
 
@@ -272,7 +281,7 @@ log_msg_get_value_name(NVHandle handle, gssize *name_len)
 typedef gboolean (*LogMessageTagsForeachFunc)(const LogMessage *self, LogTagId tag_id, const gchar *name, gpointer user_data);
 
 void log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *new_value, gssize length);
-void log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len);
+void log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint32 ofs, guint32 len);
 void log_msg_unset_value(LogMessage *self, NVHandle handle);
 void log_msg_unset_value_by_name(LogMessage *self, const gchar *name);
 gboolean log_msg_values_foreach(const LogMessage *self, NVTableForeachFunc func, gpointer user_data);
@@ -328,6 +337,9 @@ void log_msg_registry_init(void);
 void log_msg_registry_deinit(void);
 void log_msg_global_init(void);
 void log_msg_global_deinit(void);
+void log_msg_set_pool_size(gsize pool_size);
+void log_msg_pool_thread_init(void);
+void log_msg_pool_thread_deinit(void);
 void log_msg_registry_foreach(GHFunc func, gpointer user_data);
 
 gint log_msg_lookup_time_stamp_name(const gchar *name);
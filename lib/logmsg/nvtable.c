@@ -185,9 +185,12 @@ nv_table_resolve_indirect(NVTable *self, NVEntry *entry, gssize *length)
 
   /* here we assume that indirect references are only looked up with
    * non-zero terminated strings properly handled, thus the caller has
-   * to supply a non-NULL value_len */
+   * to supply a non-NULL value_len.  The only exception are references
+   * to the tail of a value (see log_msg_set_value_indirect()), which are
+   * terminated by the NUL of the referenced value. */
 
-  *length = MIN(entry->vindirect.ofs + entry->vindirect.len, referenced_length) - entry->vindirect.ofs;
+  if (length)
+    *length = MIN(entry->vindirect.ofs + entry->vindirect.len, referenced_length) - entry->vindirect.ofs;
   return referenced_value + entry->vindirect.ofs;
 }
 
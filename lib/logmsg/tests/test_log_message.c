@@ -382,3 +382,20 @@ Test(log_message, test_sdata_value_omits_unset_values)
   assert_sdata_value_equals(msg, "");
   log_msg_unref(msg);
 }
+
+Test(log_message, test_freed_log_message_is_recycled_by_the_pool)
+{
+  LogMessage *msg, *recycled;
+
+  msg = log_msg_new_empty();
+  log_msg_set_value_by_name(msg, "FOO", "value", -1);
+  log_msg_set_tag_by_name(msg, "footag");
+  log_msg_unref(msg);
+
+  recycled = log_msg_new_empty();
+  cr_assert_eq(recycled, msg, "freed LogMessage was not recycled");
+  cr_assert_str_empty(log_msg_get_value_by_name(recycled, "FOO", NULL),
+                      "recycled LogMessage still contains a value");
+  cr_assert_not(log_msg_is_tag_by_name(recycled, "footag"), "recycled LogMessage still contains a tag");
+  log_msg_unref(recycled);
+}
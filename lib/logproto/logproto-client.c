@@ -61,6 +61,7 @@ log_proto_client_init(LogProtoClient *self, LogTransport *transport, const LogPr
 void
 log_proto_client_options_defaults(LogProtoClientOptions *options)
 {
+  options->flush_lines = 0;
 }
 
 void
@@ -34,6 +34,8 @@ typedef struct _LogProtoClient LogProtoClient;
 
 typedef struct _LogProtoClientOptions
 {
+  /* number of messages to gather into a single vectored write, 0 or 1 disables batching */
+  gint flush_lines;
 } LogProtoClientOptions;
 
 typedef union _LogProtoClientOptionsStorage
@@ -23,6 +23,12 @@
  */
 #include "logproto-dgram-server.h"
 #include "logproto-buffered-server.h"
+#include "messages.h"
+
+#include <errno.h>
+
+/* number of datagrams read by a single syscall, if the transport supports it */
+#define LOG_PROTO_DGRAM_SERVER_BATCH_SIZE 16
 
 /* proto that reads the input in datagrams (e.g. the underlying transport
  * determines record sizes, such as UDP) */
@@ -30,6 +36,16 @@ typedef struct _LogProtoDGramServer LogProtoDGramServer;
 struct _LogProtoDGramServer
 {
   LogProtoBufferedServer super;
+
+  /* datagrams of the last batched read, batch[batch_pos..batch_len) are
+   * yet to be returned */
+  LogTransportDatagram *batch;
+  guchar *batch_buffer;
+  gint batch_pos;
+  gint batch_len;
+
+  guint64 batched_reads;
+  guint64 batched_datagrams;
 };
 
 static gboolean
@@ -48,6 +64,134 @@ log_proto_dgram_server_fetch_from_buffer(LogProtoBufferedServer *s, const guchar
   return TRUE;
 }
 
+static void
+log_proto_dgram_server_allocate_batch(LogProtoDGramServer *self)
+{
+  gsize buffer_size = self->super.super.options->init_buffer_size;
+  gint i;
+
+  self->batch = g_new0(LogTransportDatagram, LOG_PROTO_DGRAM_SERVER_BATCH_SIZE);
+  self->batch_buffer = g_malloc(LOG_PROTO_DGRAM_SERVER_BATCH_SIZE * buffer_size);
+  for (i = 0; i < LOG_PROTO_DGRAM_SERVER_BATCH_SIZE; i++)
+    {
+      self->batch[i].buf = self->batch_buffer + i * buffer_size;
+      self->batch[i].buflen = buffer_size;
+      log_transport_aux_data_init(&self->batch[i].aux);
+    }
+}
+
+static LogProtoStatus
+log_proto_dgram_server_read_batch(LogProtoDGramServer *self)
+{
+  gint rc, i;
+
+  if (G_UNLIKELY(!self->batch))
+    log_proto_dgram_server_allocate_batch(self);
+
+  for (i = 0; i < LOG_PROTO_DGRAM_SERVER_BATCH_SIZE; i++)
+    log_transport_aux_data_reinit(&self->batch[i].aux);
+
+  self->batch_pos = self->batch_len = 0;
+  rc = log_transport_read_batch(self->super.super.transport, self->batch, LOG_PROTO_DGRAM_SERVER_BATCH_SIZE);
+  if (rc < 0)
+    {
+      if (errno == EAGAIN)
+        return LPS_SUCCESS;
+
+      msg_error("I/O error occurred while reading",
+                evt_tag_int(EVT_TAG_FD, self->super.super.transport->fd),
+                evt_tag_errno(EVT_TAG_OSERROR, errno));
+      return LPS_ERROR;
+    }
+
+  self->batch_len = rc;
+  self->batched_reads++;
+  self->batched_datagrams += rc;
+  return LPS_SUCCESS;
+}
+
+static gboolean
+log_proto_dgram_server_prepare_batched(LogProtoServer *s, GIOCondition *cond)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+
+  log_proto_buffered_server_prepare(s, cond);
+
+  /* datagrams of the last read are still waiting to be processed */
+  return self->batch_pos < self->batch_len;
+}
+
+/* Returns the datagrams of a batched read one by one, reading the next
+ * batch when all of them have been processed.  Datagrams have no stream
+ * position to track, so bookmarks are left alone. */
+static LogProtoStatus
+log_proto_dgram_server_fetch_batched(LogProtoServer *s, const guchar **msg, gsize *msg_len, gboolean *may_read,
+                                     LogTransportAuxData *aux, Bookmark *bookmark)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+  LogTransportDatagram *dgram;
+
+  do
+    {
+      while (self->batch_pos == self->batch_len)
+        {
+          LogProtoStatus status;
+
+          if (!(*may_read))
+            return LPS_SUCCESS;
+
+          status = log_proto_dgram_server_read_batch(self);
+          if (status != LPS_SUCCESS)
+            {
+              self->super.super.status = status;
+              return status;
+            }
+
+          if (self->batch_len == 0)
+            return LPS_SUCCESS;
+
+          if (self->super.no_multi_read)
+            *may_read = FALSE;
+        }
+
+      dgram = &self->batch[self->batch_pos++];
+    }
+  /* empty datagrams are skipped, just like in the single read case */
+  while (dgram->len == 0);
+
+  *msg = dgram->buf;
+  *msg_len = dgram->len;
+  if (aux)
+    log_transport_aux_data_copy(aux, &dgram->aux);
+  return LPS_SUCCESS;
+}
+
+static guint32
+log_proto_dgram_server_get_average_batch_size(LogProtoServer *s)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+
+  if (self->batched_reads == 0)
+    return 0;
+  return self->batched_datagrams / self->batched_reads;
+}
+
+static void
+log_proto_dgram_server_free(LogProtoServer *s)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+  gint i;
+
+  if (self->batch)
+    {
+      for (i = 0; i < LOG_PROTO_DGRAM_SERVER_BATCH_SIZE; i++)
+        log_transport_aux_data_destroy(&self->batch[i].aux);
+      g_free(self->batch);
+      g_free(self->batch_buffer);
+    }
+  log_proto_buffered_server_free_method(s);
+}
+
 LogProtoServer *
 log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions *options)
 {
@@ -56,5 +200,14 @@ log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions
   log_proto_buffered_server_init(&self->super, transport, options);
   self->super.fetch_from_buffer = log_proto_dgram_server_fetch_from_buffer;
   self->super.stream_based = FALSE;
+  self->super.super.free_fn = log_proto_dgram_server_free;
+
+  /* character set conversion is only done by the buffered code path */
+  if (log_transport_can_read_batch(transport) && !options->encoding)
+    {
+      self->super.super.prepare = log_proto_dgram_server_prepare_batched;
+      self->super.super.fetch = log_proto_dgram_server_fetch_batched;
+      self->super.super.get_average_batch_size = log_proto_dgram_server_get_average_batch_size;
+    }
   return &self->super.super;
 }
@@ -23,6 +23,7 @@
 
 #include "logproto-regexp-multiline-server.h"
 #include "messages.h"
+#include "regexp-jit.h"
 
 #include <string.h>
 #include <pcre.h>
@@ -37,7 +38,6 @@ MultiLineRegexp *
 multi_line_regexp_compile(const gchar *regexp, GError **error)
 {
   MultiLineRegexp *self = g_new0(MultiLineRegexp, 1);
-  gint optflags = 0;
   gint rc;
   const gchar *errptr;
   gint erroffset;
@@ -53,12 +53,8 @@ multi_line_regexp_compile(const gchar *regexp, GError **error)
       goto error;
     }
 
-#ifdef PCRE_STUDY_JIT_COMPILE
-  optflags = PCRE_STUDY_JIT_COMPILE;
-#endif
-
   /* optimize regexp */
-  self->extra = pcre_study(self->pattern, optflags, &errptr);
+  self->extra = regexp_jit_study(self->pattern, &errptr);
   if (errptr != NULL)
     {
       g_set_error(error, 0, 0, "Error while studying multi-line regexp, error=%s", errptr);
@@ -80,8 +76,7 @@ multi_line_regexp_free(MultiLineRegexp *self)
     {
       if (self->pattern)
         pcre_free(self->pattern);
-      if (self->extra)
-        pcre_free(self->extra);
+      regexp_jit_free_study(self->extra);
       g_free(self);
     }
 }
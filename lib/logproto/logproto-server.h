@@ -71,6 +71,9 @@ struct _LogProtoServer
   gboolean (*restart_with_state)(LogProtoServer *s, PersistState *state, const gchar *persist_name);
   LogProtoStatus (*fetch)(LogProtoServer *s, const guchar **msg, gsize *msg_len, gboolean *may_read, LogTransportAuxData *aux, Bookmark *bookmark);
   gboolean (*validate_options)(LogProtoServer *s);
+  /* optional, for protocols that receive several messages with a single
+   * read, returns the average number of messages per read */
+  guint32 (*get_average_batch_size)(LogProtoServer *s);
   void (*free_fn)(LogProtoServer *s);
 };
 
@@ -116,6 +119,20 @@ log_proto_server_fetch(LogProtoServer *s, const guchar **msg, gsize *msg_len, gb
   return s->status;
 }
 
+static inline gboolean
+log_proto_server_reads_in_batches(LogProtoServer *s)
+{
+  return s->get_average_batch_size != NULL;
+}
+
+static inline guint32
+log_proto_server_get_average_batch_size(LogProtoServer *s)
+{
+  if (s->get_average_batch_size)
+    return s->get_average_batch_size(s);
+  return 0;
+}
+
 static inline gint
 log_proto_server_get_fd(LogProtoServer *s)
 {
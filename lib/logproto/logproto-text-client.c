@@ -25,6 +25,8 @@
 #include "messages.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <string.h>
 
 static gboolean
 log_proto_text_client_prepare(LogProtoClient *s, gint *fd, GIOCondition *cond)
@@ -37,7 +39,88 @@ log_proto_text_client_prepare(LogProtoClient *s, gint *fd, GIOCondition *cond)
   /* if there's no pending I/O in the transport layer, then we want to do a write */
   if (*cond == 0)
     *cond = G_IO_OUT;
-  return self->partial != NULL;
+  return self->partial != NULL || self->batch_msg_count > 0;
+}
+
+static void
+log_proto_text_client_reset_batch(LogProtoTextClient *self)
+{
+  gint i;
+
+  for (i = self->batch_msg_acked; i < self->batch_msg_count; i++)
+    g_free(self->batch_msgs[i]);
+  self->batch_iov_count = self->batch_iov_pos = 0;
+  self->batch_msg_count = self->batch_msg_acked = 0;
+  self->batch_len = self->batch_written = 0;
+  self->batch_sealed = FALSE;
+}
+
+/* account for @written bytes of the batch: skip the iovecs sent
+ * completely, adjust the one sent partially so that the next write resumes
+ * from there and ack the messages that went out in full */
+static void
+log_proto_text_client_consume_batch(LogProtoTextClient *self, gsize written)
+{
+  gint acked = 0;
+
+  self->batch_written += written;
+  while (written > 0)
+    {
+      struct iovec *iov = &self->batch_iov[self->batch_iov_pos];
+
+      if (written < iov->iov_len)
+        {
+          iov->iov_base = ((guchar *) iov->iov_base) + written;
+          iov->iov_len -= written;
+          break;
+        }
+      written -= iov->iov_len;
+      self->batch_iov_pos++;
+    }
+
+  while (self->batch_msg_acked < self->batch_msg_count &&
+         self->batch_msg_ends[self->batch_msg_acked] <= self->batch_written)
+    {
+      g_free(self->batch_msgs[self->batch_msg_acked]);
+      self->batch_msgs[self->batch_msg_acked] = NULL;
+      self->batch_msg_acked++;
+      acked++;
+    }
+
+  if (acked)
+    log_proto_client_msg_ack(&self->super, acked);
+}
+
+static LogProtoStatus
+log_proto_text_client_flush_batch(LogProtoTextClient *self)
+{
+  gssize rc;
+
+  if (self->batch_msg_count == 0)
+    return LPS_SUCCESS;
+
+  /* once a write was attempted, the batch is not extended until it is sent
+   * completely, libssl insists on getting the same data when retrying */
+  self->batch_sealed = TRUE;
+
+  rc = log_transport_writev(self->super.transport, &self->batch_iov[self->batch_iov_pos],
+                            self->batch_iov_count - self->batch_iov_pos);
+  if (rc < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        {
+          msg_error("I/O error occurred while writing",
+                    evt_tag_int("fd", self->super.transport->fd),
+                    evt_tag_errno(EVT_TAG_OSERROR, errno));
+          return LPS_ERROR;
+        }
+      return LPS_SUCCESS;
+    }
+
+  log_proto_text_client_consume_batch(self, rc);
+  if (self->batch_written == self->batch_len)
+    log_proto_text_client_reset_batch(self);
+  return LPS_SUCCESS;
 }
 
 static LogProtoStatus
@@ -46,6 +129,9 @@ log_proto_text_client_flush(LogProtoClient *s)
   LogProtoTextClient *self = (LogProtoTextClient *) s;
   gint rc;
 
+  if (log_proto_text_client_is_batched(self))
+    return log_proto_text_client_flush_batch(self);
+
   /* attempt to flush previously buffered data */
   if (self->partial)
     {
@@ -103,6 +189,58 @@ log_proto_text_client_submit_write(LogProtoClient *s, guchar *msg, gsize msg_len
   return log_proto_text_client_flush(s);
 }
 
+/*
+ * log_proto_text_client_post_batched:
+ * @hdr: optional header to send in front of @msg, copied by this function
+ * @msg: formatted log message to send (this might be consumed by this function)
+ * @consumed: pointer to a gboolean that gets set if the message was consumed by this function
+ *
+ * Adds a message to the current batch, which is written when it reaches
+ * batch_lines messages or when the client is flushed.  Messages are acked
+ * once they are written completely.  If a previous batch is still being
+ * written, the message is not consumed and should be resent by the caller.
+ **/
+LogProtoStatus
+log_proto_text_client_post_batched(LogProtoClient *s, const guchar *hdr, gsize hdr_len,
+                                   guchar *msg, gsize msg_len, gboolean *consumed)
+{
+  LogProtoTextClient *self = (LogProtoTextClient *) s;
+  gint rc;
+
+  *consumed = FALSE;
+  if (self->batch_sealed)
+    {
+      rc = log_proto_text_client_flush_batch(self);
+      if (rc == LPS_ERROR || self->batch_sealed)
+        return rc;
+    }
+
+  g_assert(self->batch_msg_count < self->batch_lines);
+  g_assert(hdr_len <= LOG_PROTO_TEXT_CLIENT_BATCH_HDR_MAX);
+
+  if (hdr_len > 0)
+    {
+      guchar *hdr_slot = &self->batch_hdrs[self->batch_msg_count * LOG_PROTO_TEXT_CLIENT_BATCH_HDR_MAX];
+
+      memcpy(hdr_slot, hdr, hdr_len);
+      self->batch_iov[self->batch_iov_count].iov_base = hdr_slot;
+      self->batch_iov[self->batch_iov_count].iov_len = hdr_len;
+      self->batch_iov_count++;
+    }
+  self->batch_iov[self->batch_iov_count].iov_base = msg;
+  self->batch_iov[self->batch_iov_count].iov_len = msg_len;
+  self->batch_iov_count++;
+
+  self->batch_len += hdr_len + msg_len;
+  self->batch_msgs[self->batch_msg_count] = msg;
+  self->batch_msg_ends[self->batch_msg_count] = self->batch_len;
+  self->batch_msg_count++;
+  *consumed = TRUE;
+
+  if (self->batch_msg_count == self->batch_lines)
+    return log_proto_text_client_flush_batch(self);
+  return LPS_SUCCESS;
+}
 
 /*
  * log_proto_text_client_post:
@@ -121,6 +259,9 @@ log_proto_text_client_post(LogProtoClient *s, guchar *msg, gsize msg_len, gboole
   LogProtoTextClient *self = (LogProtoTextClient *) s;
   gint rc;
 
+  if (log_proto_text_client_is_batched(self))
+    return log_proto_text_client_post_batched(s, NULL, 0, msg, msg_len, consumed);
+
   /* try to flush already buffered data */
   *consumed = FALSE;
   rc = log_proto_text_client_flush(s);
@@ -157,9 +298,30 @@ log_proto_text_client_free(LogProtoClient *s)
   if (self->partial_free)
     self->partial_free(self->partial);
   self->partial = NULL;
+  log_proto_text_client_reset_batch(self);
+  g_free(self->batch_iov);
+  g_free(self->batch_hdrs);
+  g_free(self->batch_msgs);
+  g_free(self->batch_msg_ends);
   log_proto_client_free_method(s);
 };
 
+static void
+log_proto_text_client_init_batch(LogProtoTextClient *self, gint flush_lines)
+{
+  /* a message might take two iovecs: a header and the payload */
+#ifdef IOV_MAX
+  if (flush_lines > IOV_MAX / 2)
+    flush_lines = IOV_MAX / 2;
+#endif
+
+  self->batch_lines = flush_lines;
+  self->batch_iov = g_new(struct iovec, flush_lines * 2);
+  self->batch_hdrs = g_new(guchar, flush_lines * LOG_PROTO_TEXT_CLIENT_BATCH_HDR_MAX);
+  self->batch_msgs = g_new0(guchar *, flush_lines);
+  self->batch_msg_ends = g_new(gsize, flush_lines);
+}
+
 void
 log_proto_text_client_init(LogProtoTextClient *self, LogTransport *transport, const LogProtoClientOptions *options)
 {
@@ -170,6 +332,10 @@ log_proto_text_client_init(LogProtoTextClient *self, LogTransport *transport, co
   self->super.free_fn = log_proto_text_client_free;
   self->super.transport = transport;
   self->next_state = -1;
+
+  /* gather flush_lines messages into a single write if the transport can do vectored writes */
+  if (options->flush_lines > 1 && log_transport_can_writev(transport))
+    log_proto_text_client_init_batch(self, options->flush_lines);
 }
 
 LogProtoClient *
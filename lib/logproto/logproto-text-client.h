@@ -26,6 +26,9 @@
 
 #include "logproto-client.h"
 
+/* maximum length of a per-message header in batched mode (e.g. a frame header) */
+#define LOG_PROTO_TEXT_CLIENT_BATCH_HDR_MAX 16
+
 typedef struct _LogProtoTextClient
 {
   LogProtoClient super;
@@ -33,9 +36,29 @@ typedef struct _LogProtoTextClient
   guchar *partial;
   GDestroyNotify partial_free;
   gsize partial_len, partial_pos;
+
+  /* batched mode: up to batch_lines messages are gathered and written
+   * with a single vectored write, see log_proto_text_client_post_batched() */
+  gint batch_lines;
+  struct iovec *batch_iov;
+  gint batch_iov_count, batch_iov_pos;
+  guchar *batch_hdrs;
+  guchar **batch_msgs;
+  gsize *batch_msg_ends;
+  gint batch_msg_count, batch_msg_acked;
+  gsize batch_len, batch_written;
+  gboolean batch_sealed;
 } LogProtoTextClient;
 
+static inline gboolean
+log_proto_text_client_is_batched(LogProtoTextClient *self)
+{
+  return self->batch_lines > 0;
+}
+
 LogProtoStatus log_proto_text_client_submit_write(LogProtoClient *s, guchar *msg, gsize msg_len, GDestroyNotify msg_free, gint next_state);
+LogProtoStatus log_proto_text_client_post_batched(LogProtoClient *s, const guchar *hdr, gsize hdr_len,
+                                                 guchar *msg, gsize msg_len, gboolean *consumed);
 void log_proto_text_client_init(LogProtoTextClient *self, LogTransport *transport, const LogProtoClientOptions *options);
 LogProtoClient *log_proto_text_client_new(LogTransport *transport, const LogProtoClientOptions *options);
 
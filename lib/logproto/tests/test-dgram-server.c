@@ -163,6 +163,51 @@ test_log_proto_dgram_server_eof_handling(void)
   log_proto_server_free(proto);
 }
 
+static void
+test_log_proto_dgram_server_batched_read(void)
+{
+  LogProtoServer *proto;
+
+  proto_server_options.max_msg_size = 32;
+  proto = log_proto_dgram_server_new(
+            log_transport_mock_endless_batched_records_new(
+              "01234567", -1,
+              "89ABCDEF", -1,
+              "0123456789ABCDEF0123456789ABCDEF", -1,
+              "01234", 5,
+              LTM_EOF),
+            get_inited_proto_server_options());
+
+  assert_true(log_proto_server_reads_in_batches(proto), "dgram server should read in batches");
+  assert_proto_server_fetch(proto, "01234567", -1);
+  assert_proto_server_fetch(proto, "89ABCDEF", -1);
+  assert_proto_server_fetch(proto, "0123456789ABCDEF0123456789ABCDEF", -1);
+  assert_proto_server_fetch(proto, "01234", -1);
+  assert_proto_server_fetch_ignored_eof(proto);
+
+  /* all 4 datagrams were received by a single read */
+  assert_gint(log_proto_server_get_average_batch_size(proto), 4, "average batch size mismatch");
+  log_proto_server_free(proto);
+}
+
+static void
+test_log_proto_dgram_server_batched_read_with_encoding_falls_back(void)
+{
+  LogProtoServer *proto;
+
+  proto_server_options.max_msg_size = 32;
+  log_proto_server_options_set_encoding(&proto_server_options, "iso-8859-2");
+  proto = log_proto_dgram_server_new(
+            log_transport_mock_endless_batched_records_new(
+              "\xe1\x72\x76\xed\x7a", -1,
+              LTM_EOF),
+            get_inited_proto_server_options());
+
+  assert_false(log_proto_server_reads_in_batches(proto), "batched reads should be disabled with encoding()");
+  assert_proto_server_fetch(proto, "árvíz", -1);
+  log_proto_server_free(proto);
+}
+
 void
 test_log_proto_dgram_server(void)
 {
@@ -171,4 +216,6 @@ test_log_proto_dgram_server(void)
   PROTO_TESTCASE(test_log_proto_dgram_server_invalid_ucs4);
   PROTO_TESTCASE(test_log_proto_dgram_server_iso_8859_2);
   PROTO_TESTCASE(test_log_proto_dgram_server_eof_handling);
+  PROTO_TESTCASE(test_log_proto_dgram_server_batched_read);
+  PROTO_TESTCASE(test_log_proto_dgram_server_batched_read_with_encoding_falls_back);
 }
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "proto_lib.h"
+#include "logproto/logproto-text-client.h"
+#include "logproto/logproto-framed-client.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* a transport that captures everything written to it, accepting at most
+ * write_limit bytes per write if set, or failing with EAGAIN if blocked */
+typedef struct _LogTransportCapture
+{
+  LogTransport super;
+  GString *output;
+  gsize write_limit;
+  gboolean blocked;
+  gint writes;
+} LogTransportCapture;
+
+static gssize
+log_transport_capture_writev_method(LogTransport *s, const struct iovec *iov, gint iov_count)
+{
+  LogTransportCapture *self = (LogTransportCapture *) s;
+  gsize written = 0;
+  gint i;
+
+  if (self->blocked)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+
+  self->writes++;
+  for (i = 0; i < iov_count; i++)
+    {
+      gsize len = iov[i].iov_len;
+
+      if (self->write_limit && written + len > self->write_limit)
+        len = self->write_limit - written;
+      g_string_append_len(self->output, iov[i].iov_base, len);
+      written += len;
+      if (len < iov[i].iov_len)
+        break;
+    }
+  return written;
+}
+
+static gssize
+log_transport_capture_write_method(LogTransport *s, const gpointer buf, gsize count)
+{
+  struct iovec iov = { .iov_base = buf, .iov_len = count };
+
+  return log_transport_capture_writev_method(s, &iov, 1);
+}
+
+static LogTransportCapture *
+log_transport_capture_new(GString *output)
+{
+  LogTransportCapture *self = g_new0(LogTransportCapture, 1);
+
+  log_transport_init_instance(&self->super, -1);
+  self->super.write = log_transport_capture_write_method;
+  self->super.writev = log_transport_capture_writev_method;
+  self->output = output;
+  return self;
+}
+
+static gint acked_messages;
+
+static void
+_count_acks(gint num_msg_acked, gpointer user_data)
+{
+  acked_messages += num_msg_acked;
+}
+
+static LogProtoClient *
+_construct_client(LogProtoClient *(*construct)(LogTransport *, const LogProtoClientOptions *),
+                  LogTransportCapture *transport, LogProtoClientOptions *options, gint flush_lines)
+{
+  LogProtoClientFlowControlFuncs flow_control_funcs = { .ack_callback = _count_acks };
+  LogProtoClient *proto;
+
+  log_proto_client_options_defaults(options);
+  options->flush_lines = flush_lines;
+  proto = construct(&transport->super, options);
+  log_proto_client_set_client_flow_control(proto, &flow_control_funcs);
+  acked_messages = 0;
+  return proto;
+}
+
+static LogProtoStatus
+_post(LogProtoClient *proto, const gchar *msg, gboolean expected_consumed)
+{
+  gboolean consumed;
+  gchar *buf = g_strdup(msg);
+  LogProtoStatus status;
+
+  status = log_proto_client_post(proto, (guchar *) buf, strlen(buf), &consumed);
+  assert_gboolean(consumed, expected_consumed, "unexpected consumed state; msg=%s", msg);
+  if (!consumed)
+    g_free(buf);
+  return status;
+}
+
+static gboolean
+_has_pending_output(LogProtoClient *proto)
+{
+  gint fd;
+  GIOCondition cond;
+
+  return log_proto_client_prepare(proto, &fd, &cond);
+}
+
+static void
+test_log_proto_text_client_unbatched_writes_every_message(void)
+{
+  GString *output = g_string_new("");
+  LogTransportCapture *transport = log_transport_capture_new(output);
+  LogProtoClientOptions options;
+  LogProtoClient *proto = _construct_client(log_proto_text_client_new, transport, &options, 1);
+
+  _post(proto, "foo\n", TRUE);
+  _post(proto, "bar\n", TRUE);
+  assert_gint(transport->writes, 2, "messages should be written one by one without batching");
+  assert_gint(acked_messages, 2, "written messages should be acked");
+  assert_string(output->str, "foo\nbar\n", "unexpected output");
+
+  log_proto_client_free(proto);
+  g_string_free(output, TRUE);
+}
+
+static void
+test_log_proto_text_client_batches_flush_lines_messages(void)
+{
+  GString *output = g_string_new("");
+  LogTransportCapture *transport = log_transport_capture_new(output);
+  LogProtoClientOptions options;
+  LogProtoClient *proto = _construct_client(log_proto_text_client_new, transport, &options, 3);
+
+  _post(proto, "foo\n", TRUE);
+  _post(proto, "bar\n", TRUE);
+  assert_gint(transport->writes, 0, "nothing should be written until the batch is full");
+  assert_gint(acked_messages, 0, "nothing should be acked until written");
+  assert_true(_has_pending_output(proto), "a partial batch should be reported as pending");
+
+  _post(proto, "baz\n", TRUE);
+  assert_gint(transport->writes, 1, "a full batch should be sent with a single write");
+  assert_gint(acked_messages, 3, "all messages of the batch should be acked");
+  assert_false(_has_pending_output(proto), "no output should be pending after the batch was written");
+
+  _post(proto, "qux\n", TRUE);
+  log_proto_client_flush(proto);
+  assert_gint(transport->writes, 2, "flush should send a partial batch");
+  assert_gint(acked_messages, 4, "the flushed message should be acked");
+  assert_string(output->str, "foo\nbar\nbaz\nqux\n", "unexpected output");
+
+  log_proto_client_free(proto);
+  g_string_free(output, TRUE);
+}
+
+static void
+test_log_proto_text_client_resumes_partial_batch_writes(void)
+{
+  GString *output = g_string_new("");
+  LogTransportCapture *transport = log_transport_capture_new(output);
+  LogProtoClientOptions options;
+  LogProtoClient *proto = _construct_client(log_proto_text_client_new, transport, &options, 3);
+
+  transport->write_limit = 5;
+  _post(proto, "aaaa", TRUE);
+  _post(proto, "bbbb", TRUE);
+  _post(proto, "cccc", TRUE);
+  assert_gint(acked_messages, 1, "only the completely written message should be acked");
+
+  _post(proto, "dddd", FALSE);
+  assert_gint(acked_messages, 2, "resumed write should ack the next completed message");
+
+  assert_gint(log_proto_client_flush(proto), LPS_SUCCESS, "flush failed");
+  assert_gint(acked_messages, 3, "all messages of the batch should be acked");
+  assert_false(_has_pending_output(proto), "no output should be pending after the batch was written");
+  assert_string(output->str, "aaaabbbbcccc", "partial writes should resume at the right position");
+
+  log_proto_client_free(proto);
+  g_string_free(output, TRUE);
+}
+
+static void
+test_log_proto_text_client_blocked_batch_is_retried(void)
+{
+  GString *output = g_string_new("");
+  LogTransportCapture *transport = log_transport_capture_new(output);
+  LogProtoClientOptions options;
+  LogProtoClient *proto = _construct_client(log_proto_text_client_new, transport, &options, 2);
+
+  transport->blocked = TRUE;
+  _post(proto, "foo\n", TRUE);
+  assert_gint(_post(proto, "bar\n", TRUE), LPS_SUCCESS, "EAGAIN should not be reported as an error");
+  _post(proto, "baz\n", FALSE);
+  assert_gint(acked_messages, 0, "nothing should be acked while the transport is blocked");
+
+  transport->blocked = FALSE;
+  log_proto_client_flush(proto);
+  assert_gint(acked_messages, 2, "the batch should be acked after the retry");
+  _post(proto, "baz\n", TRUE);
+  log_proto_client_flush(proto);
+  assert_string(output->str, "foo\nbar\nbaz\n", "unexpected output");
+
+  log_proto_client_free(proto);
+  g_string_free(output, TRUE);
+}
+
+static void
+test_log_proto_framed_client_batches_frames(void)
+{
+  GString *output = g_string_new("");
+  LogTransportCapture *transport = log_transport_capture_new(output);
+  LogProtoClientOptions options;
+  LogProtoClient *proto = _construct_client(log_proto_framed_client_new, transport, &options, 2);
+
+  transport->write_limit = 4;
+  _post(proto, "foo", TRUE);
+  _post(proto, "barbaz", TRUE);
+  assert_gint(acked_messages, 0, "a message should not be acked until its payload is written");
+  while (_has_pending_output(proto))
+    assert_gint(log_proto_client_flush(proto), LPS_SUCCESS, "flush failed");
+  assert_gint(acked_messages, 2, "all frames should be acked");
+  assert_string(output->str, "3 foo6 barbaz", "unexpected framed output");
+
+  log_proto_client_free(proto);
+  g_string_free(output, TRUE);
+}
+
+void
+test_log_proto_text_client(void)
+{
+  PROTO_TESTCASE(test_log_proto_text_client_unbatched_writes_every_message);
+  PROTO_TESTCASE(test_log_proto_text_client_batches_flush_lines_messages);
+  PROTO_TESTCASE(test_log_proto_text_client_resumes_partial_batch_writes);
+  PROTO_TESTCASE(test_log_proto_text_client_blocked_batch_is_retried);
+  PROTO_TESTCASE(test_log_proto_framed_client_batches_frames);
+}
@@ -276,6 +276,7 @@ log_queue_fifo_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
         }
 
       node = log_msg_alloc_queue_node(msg, path_options);
+      node->enqueued = log_queue_get_enqueue_stamp();
       iv_list_add_tail(&node->list, &self->qoverflow_input[thread_id].items);
       self->qoverflow_input[thread_id].len++;
       log_msg_unref(msg);
@@ -292,6 +293,7 @@ log_queue_fifo_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
   if (log_queue_fifo_get_length(s) < self->qoverflow_size)
     {
       node = log_msg_alloc_queue_node(msg, path_options);
+      node->enqueued = log_queue_get_enqueue_stamp();
 
       iv_list_add_tail(&node->list, &self->qoverflow_wait);
       self->qoverflow_wait_len++;
@@ -338,6 +340,7 @@ log_queue_fifo_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
    * can't deliver it. No checks, no drops either. */
 
   node = log_msg_alloc_dynamic_queue_node(msg, path_options);
+  node->enqueued = log_queue_get_enqueue_stamp();
   iv_list_add(&node->list, &self->qoverflow_output);
   self->qoverflow_output_len++;
   log_msg_unref(msg);
@@ -374,6 +377,8 @@ log_queue_fifo_pop_head(LogQueue *s, LogPathOptions *path_options)
       msg = node->msg;
       path_options->ack_needed = node->ack_needed;
       self->qoverflow_output_len--;
+      if (self->super.queue_latency)
+        log_queue_record_queue_latency(&self->super, node->enqueued);
       if (!self->super.use_backlog)
         {
           iv_list_del(&node->list);
@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "logqueue-mpsc.h"
+#include "logpipe.h"
+#include "messages.h"
+#include "mainloop-worker.h"
+
+#include <iv_list.h>
+
+const QueueType log_queue_mpsc_type = "MPSC";
+
+/*
+ * LogQueueMpsc is an alternative to LogQueueFifo, built around a bounded
+ * lock-free multi-producer single-consumer ring:
+ *
+ *   - input threads put their items directly to the ring, reserving a slot
+ *     with a compare-and-swap on the enqueue position. There's no per-thread
+ *     input queue to splice and no wait queue mutex on the fastpath.
+ *
+ *   - the output thread takes items from the head of the ring, without
+ *     locking.
+ *
+ *   - items put back by push_head() or rewound from the backlog go to an
+ *     output-thread-private list, which is consumed before the ring.
+ *
+ *   - the ring is allocated upfront, so it is never larger than
+ *     log_fifo_size (rounded down to a power of two) and is capped at
+ *     LOG_QUEUE_MPSC_MAX_RING_SIZE slots (24 bytes each on 64 bit
+ *     platforms).  Items that do not fit spill over to a list protected by
+ *     LogQueue->lock, which is consumed after the ring.  Once something
+ *     spilled over, input threads keep using the list until the output
+ *     thread emptied it, so that the order of items pushed by the same
+ *     thread is kept.  The spill list only costs a lock and an allocation
+ *     per item when the queue is backed up.
+ *
+ * Each slot carries a sequence number, which tells whether the slot is free
+ * to be written for a given enqueue position or ready to be read for a
+ * given dequeue position (see Dmitry Vyukov's bounded MPMC queue, which
+ * this is a single-consumer variant of).
+ *
+ * The only lock taken is LogQueue->lock, once per input batch, to wake up
+ * the output thread via log_queue_push_notify().  That can't be avoided
+ * without a lost wakeup, as log_queue_check_items() registers the notify
+ * callback under the lock.
+ *
+ * Threading assumptions are the same as with LogQueueFifo:
+ *   - the head of the queue is only manipulated from the output thread
+ *   - the tail of the queue is only manipulated from the input threads
+ */
+
+#define LOG_QUEUE_MPSC_MAX_RING_SIZE 16384
+
+typedef struct _LogQueueMpscSlot
+{
+  guint sequence;
+  LogMessage *msg;
+  gboolean ack_needed:1, flow_control_requested:1;
+  /* see LogMessageQueueNode->enqueued */
+  guint32 enqueued;
+} LogQueueMpscSlot;
+
+typedef struct _LogQueueMpsc
+{
+  LogQueue super;
+
+  LogQueueMpscSlot *ring;
+  guint ring_mask;
+  gint qoverflow_size; /* in number of elements */
+
+  /* input threads, keep them on a separate cacheline from the output thread's fields */
+  guint enqueue_pos;
+  gchar __enqueue_padding[64 - sizeof(guint)];
+
+  /* items that did not fit into the ring, protected by LogQueue->lock */
+  struct iv_list_head qspill;
+  gint qspill_len;
+
+  /* output thread */
+  guint dequeue_pos;
+  struct iv_list_head qoutput;     /* entries put back to the front of the queue */
+  gint qoutput_len;
+  struct iv_list_head qbacklog;    /* entries that were sent but not acked yet */
+  gint qbacklog_len;
+
+  struct
+  {
+    WorkerBatchCallback cb;
+    gboolean notify_cb_registered;
+  } input_threads[0];
+} LogQueueMpsc;
+
+/* positions and sequence numbers are free running counters, compared by
+ * their difference so that wrapping around is handled */
+static inline guint
+_atomic_pos_get(guint *pos)
+{
+  return (guint) g_atomic_int_get((volatile gint *) pos);
+}
+
+static inline void
+_atomic_pos_set(guint *pos, guint value)
+{
+  g_atomic_int_set((volatile gint *) pos, (gint) value);
+}
+
+static inline gboolean
+_atomic_pos_compare_and_exchange(guint *pos, guint old_value, guint new_value)
+{
+  return g_atomic_int_compare_and_exchange((volatile gint *) pos, (gint) old_value, (gint) new_value);
+}
+
+/* NOTE: this is racy when called from an input thread, but it is exact in
+ * the output thread, the only racy element being new items being added to
+ * the ring. */
+static gint64
+log_queue_mpsc_get_length(LogQueue *s)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  gint ring_len;
+
+  ring_len = (gint) (_atomic_pos_get(&self->enqueue_pos) - _atomic_pos_get(&self->dequeue_pos));
+  return MAX(ring_len, 0) + g_atomic_int_get(&self->qspill_len) + self->qoutput_len;
+}
+
+/* NOTE: this is inherently racy, can only be called if log processing is suspended (e.g. reload time) */
+static gboolean
+log_queue_mpsc_keep_on_reload(LogQueue *s)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+
+  return log_queue_mpsc_get_length(s) > 0 || self->qbacklog_len > 0;
+}
+
+static gboolean
+log_queue_mpsc_ring_enqueue(LogQueueMpsc *self, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMpscSlot *slot;
+  guint pos;
+  gint diff;
+
+  pos = _atomic_pos_get(&self->enqueue_pos);
+  while (1)
+    {
+      slot = &self->ring[pos & self->ring_mask];
+      diff = (gint) (_atomic_pos_get(&slot->sequence) - pos);
+
+      if (diff == 0)
+        {
+          /* the slot is free, try to reserve it */
+          if (_atomic_pos_compare_and_exchange(&self->enqueue_pos, pos, pos + 1))
+            break;
+        }
+      else if (diff < 0)
+        {
+          /* the slot still holds an item one lap behind: the ring is full */
+          return FALSE;
+        }
+      pos = _atomic_pos_get(&self->enqueue_pos);
+    }
+
+  slot->msg = msg;
+  slot->ack_needed = path_options->ack_needed;
+  slot->flow_control_requested = path_options->flow_control_requested;
+  slot->enqueued = log_queue_get_enqueue_stamp();
+
+  /* publish the item to the output thread */
+  _atomic_pos_set(&slot->sequence, pos + 1);
+  return TRUE;
+}
+
+static LogMessage *
+log_queue_mpsc_ring_dequeue(LogQueueMpsc *self, LogPathOptions *path_options, guint32 *enqueued)
+{
+  LogQueueMpscSlot *slot = &self->ring[self->dequeue_pos & self->ring_mask];
+  LogMessage *msg;
+
+  if ((gint) (_atomic_pos_get(&slot->sequence) - (self->dequeue_pos + 1)) < 0)
+    return NULL;
+
+  msg = slot->msg;
+  path_options->ack_needed = slot->ack_needed;
+  path_options->flow_control_requested = slot->flow_control_requested;
+  *enqueued = slot->enqueued;
+  slot->msg = NULL;
+
+  /* release the slot for the enqueue position one lap ahead */
+  _atomic_pos_set(&slot->sequence, self->dequeue_pos + self->ring_mask + 1);
+  _atomic_pos_set(&self->dequeue_pos, self->dequeue_pos + 1);
+  return msg;
+}
+
+static void
+log_queue_mpsc_spill_enqueue(LogQueueMpsc *self, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogMessageQueueNode *node = log_msg_alloc_dynamic_queue_node(msg, path_options);
+
+  node->enqueued = log_queue_get_enqueue_stamp();
+  g_static_mutex_lock(&self->super.lock);
+  iv_list_add_tail(&node->list, &self->qspill);
+  g_atomic_int_inc(&self->qspill_len);
+  g_static_mutex_unlock(&self->super.lock);
+  log_msg_unref(msg);
+}
+
+/* only consumed when the ring is empty, see the ordering note at the top */
+static LogMessageQueueNode *
+log_queue_mpsc_spill_dequeue(LogQueueMpsc *self)
+{
+  LogMessageQueueNode *node = NULL;
+
+  if (g_atomic_int_get(&self->qspill_len) == 0)
+    return NULL;
+
+  g_static_mutex_lock(&self->super.lock);
+  if (!iv_list_empty(&self->qspill))
+    {
+      node = iv_list_entry(self->qspill.next, LogMessageQueueNode, list);
+      iv_list_del_init(&node->list);
+      g_atomic_int_add(&self->qspill_len, -1);
+    }
+  g_static_mutex_unlock(&self->super.lock);
+  return node;
+}
+
+static void
+log_queue_mpsc_notify_output_unlocked(LogQueueMpsc *self)
+{
+  g_static_mutex_lock(&self->super.lock);
+  log_queue_push_notify(&self->super);
+  g_static_mutex_unlock(&self->super.lock);
+}
+
+/* wake up the output thread once the input worker thread finished its
+ * batch, registered as a batch callback by log_queue_mpsc_push_tail() */
+static gpointer
+log_queue_mpsc_notify_output(gpointer user_data)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) user_data;
+  gint thread_id;
+
+  thread_id = main_loop_worker_get_thread_id();
+
+  g_assert(thread_id >= 0);
+
+  log_queue_mpsc_notify_output_unlocked(self);
+  self->input_threads[thread_id].notify_cb_registered = FALSE;
+  log_queue_unref(&self->super);
+  return NULL;
+}
+
+/*
+ * Can be called from any of the input threads.
+ *
+ * NOTE: It consumes the reference passed by the caller.
+ */
+static void
+log_queue_mpsc_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  gint thread_id;
+
+  thread_id = main_loop_worker_get_thread_id();
+
+  g_assert(thread_id < 0 || log_queue_max_threads > thread_id);
+
+  /* NOTE: the length check is racy, the result is the same as with
+   * LogQueueFifo: a couple of messages more might be stored than permitted
+   * by log_fifo_size, the ring itself is never overrun */
+  if (log_queue_mpsc_get_length(s) >= self->qoverflow_size)
+    {
+      stats_counter_inc(self->super.dropped_messages);
+
+      if (path_options->flow_control_requested)
+        log_msg_drop(msg, path_options, AT_SUSPENDED);
+      else
+        log_msg_drop(msg, path_options, AT_PROCESSED);
+
+      msg_debug("Destination queue full, dropping message",
+                evt_tag_int("queue_len", log_queue_mpsc_get_length(&self->super)),
+                evt_tag_int("log_fifo_size", self->qoverflow_size),
+                evt_tag_str("persist_name", self->super.persist_name));
+      return;
+    }
+
+  if (g_atomic_int_get(&self->qspill_len) > 0 ||
+      !log_queue_mpsc_ring_enqueue(self, msg, path_options))
+    log_queue_mpsc_spill_enqueue(self, msg, path_options);
+  stats_counter_inc(self->super.stored_messages);
+
+  if (thread_id < 0)
+    {
+      /* not a worker thread, notify the output thread right away */
+      log_queue_mpsc_notify_output_unlocked(self);
+      return;
+    }
+
+  if (!self->input_threads[thread_id].notify_cb_registered)
+    {
+      /* first item in this batch, notify the output thread at the end of
+       * the batch, holding a reference while the callback is registered */
+      main_loop_worker_register_batch_callback(&self->input_threads[thread_id].cb);
+      self->input_threads[thread_id].notify_cb_registered = TRUE;
+      log_queue_ref(&self->super);
+    }
+}
+
+/*
+ * Put an item back to the front of the queue.
+ *
+ * This is assumed to be called only from the output thread.
+ *
+ * NOTE: It consumes the reference passed by the caller.
+ */
+static void
+log_queue_mpsc_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  LogMessageQueueNode *node;
+
+  /* no limits are checked when putting items "in-front", the same way as LogQueueFifo */
+  node = log_msg_alloc_dynamic_queue_node(msg, path_options);
+  node->enqueued = log_queue_get_enqueue_stamp();
+  iv_list_add(&node->list, &self->qoutput);
+  self->qoutput_len++;
+  log_msg_unref(msg);
+
+  stats_counter_inc(self->super.stored_messages);
+}
+
+/* common tail of pop_head(), @node is NULL unless the backlog is used */
+static LogMessage *
+log_queue_mpsc_track_popped(LogQueueMpsc *self, LogMessage *msg, LogMessageQueueNode *node, guint32 enqueued)
+{
+  stats_counter_dec(self->super.stored_messages);
+  if (self->super.queue_latency)
+    log_queue_record_queue_latency(&self->super, enqueued);
+
+  if (self->super.use_backlog)
+    {
+      log_msg_ref(msg);
+      iv_list_add_tail(&node->list, &self->qbacklog);
+      self->qbacklog_len++;
+    }
+
+  return msg;
+}
+
+/*
+ * Can only run from the output thread.
+ *
+ * NOTE: this returns a reference which the caller must take care to free.
+ */
+static LogMessage *
+log_queue_mpsc_pop_head(LogQueue *s, LogPathOptions *path_options)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  LogMessageQueueNode *node;
+  LogMessage *msg;
+  guint32 enqueued;
+
+  if (self->qoutput_len > 0)
+    {
+      node = iv_list_entry(self->qoutput.next, LogMessageQueueNode, list);
+      iv_list_del_init(&node->list);
+      self->qoutput_len--;
+    }
+  else
+    {
+      LogPathOptions slot_path_options = LOG_PATH_OPTIONS_INIT;
+
+      msg = log_queue_mpsc_ring_dequeue(self, &slot_path_options, &enqueued);
+      if (msg)
+        {
+          path_options->ack_needed = slot_path_options.ack_needed;
+          node = NULL;
+          if (self->super.use_backlog)
+            {
+              node = log_msg_alloc_queue_node(msg, &slot_path_options);
+              node->enqueued = enqueued;
+            }
+          return log_queue_mpsc_track_popped(self, msg, node, enqueued);
+        }
+
+      /* a slot is reserved but not published yet: the input thread that
+       * reserved it may have spilled its next items already, which must
+       * not overtake this one.  It notifies us once it is published. */
+      if (_atomic_pos_get(&self->enqueue_pos) != self->dequeue_pos)
+        return NULL;
+
+      node = log_queue_mpsc_spill_dequeue(self);
+      if (!node)
+        return NULL;
+    }
+
+  msg = node->msg;
+  path_options->ack_needed = node->ack_needed;
+  enqueued = node->enqueued;
+  if (!self->super.use_backlog)
+    {
+      log_msg_free_queue_node(node);
+      node = NULL;
+    }
+  return log_queue_mpsc_track_popped(self, msg, node, enqueued);
+}
+
+/*
+ * Can only run from the output thread.
+ */
+static void
+log_queue_mpsc_ack_backlog(LogQueue *s, gint rewind_count)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  LogMessage *msg;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint pos;
+
+  for (pos = 0; pos < rewind_count && self->qbacklog_len > 0; pos++)
+    {
+      LogMessageQueueNode *node;
+      node = iv_list_entry(self->qbacklog.next, LogMessageQueueNode, list);
+      msg = node->msg;
+
+      iv_list_del(&node->list);
+      self->qbacklog_len--;
+      path_options.ack_needed = node->ack_needed;
+      log_msg_ack(msg, &path_options, AT_PROCESSED);
+      log_msg_free_queue_node(node);
+      log_msg_unref(msg);
+    }
+}
+
+/*
+ * Move items on our backlog back to the front of the queue, ignoring
+ * log_fifo_size, the same way as LogQueueFifo does.
+ *
+ * NOTE: this is assumed to be called from the output thread.
+ */
+static void
+log_queue_mpsc_rewind_backlog_all(LogQueue *s)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+
+  iv_list_splice_tail_init(&self->qbacklog, &self->qoutput);
+  self->qoutput_len += self->qbacklog_len;
+  stats_counter_add(self->super.stored_messages, self->qbacklog_len);
+  self->qbacklog_len = 0;
+}
+
+static void
+log_queue_mpsc_rewind_backlog(LogQueue *s, guint rewind_count)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  guint pos;
+
+  if (rewind_count > self->qbacklog_len)
+    rewind_count = self->qbacklog_len;
+
+  for (pos = 0; pos < rewind_count; pos++)
+    {
+      LogMessageQueueNode *node = iv_list_entry(self->qbacklog.prev, LogMessageQueueNode, list);
+
+      iv_list_del_init(&node->list);
+      iv_list_add(&node->list, &self->qoutput);
+
+      self->qbacklog_len--;
+      self->qoutput_len++;
+      stats_counter_inc(self->super.stored_messages);
+    }
+}
+
+static void
+log_queue_mpsc_free_queue(struct iv_list_head *q)
+{
+  while (!iv_list_empty(q))
+    {
+      LogMessageQueueNode *node;
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg;
+
+      node = iv_list_entry(q->next, LogMessageQueueNode, list);
+      iv_list_del(&node->list);
+
+      path_options.ack_needed = node->ack_needed;
+      msg = node->msg;
+      log_msg_free_queue_node(node);
+      log_msg_ack(msg, &path_options, AT_ABORTED);
+      log_msg_unref(msg);
+    }
+}
+
+static void
+log_queue_mpsc_free_ring(LogQueueMpsc *self)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  guint32 enqueued;
+
+  while ((msg = log_queue_mpsc_ring_dequeue(self, &path_options, &enqueued)))
+    {
+      log_msg_ack(msg, &path_options, AT_ABORTED);
+      log_msg_unref(msg);
+    }
+  g_free(self->ring);
+}
+
+static void
+log_queue_mpsc_free(LogQueue *s)
+{
+  LogQueueMpsc *self = (LogQueueMpsc *) s;
+  gint i;
+
+  for (i = 0; i < log_queue_max_threads; i++)
+    g_assert(self->input_threads[i].notify_cb_registered == FALSE);
+
+  log_queue_mpsc_free_queue(&self->qoutput);
+  log_queue_mpsc_free_queue(&self->qbacklog);
+  log_queue_mpsc_free_ring(self);
+  log_queue_mpsc_free_queue(&self->qspill);
+  log_queue_free_method(s);
+}
+
+LogQueue *
+log_queue_mpsc_new(gint qoverflow_size, const gchar *persist_name)
+{
+  LogQueueMpsc *self;
+  guint ring_size, pos;
+  gint i;
+
+  self = g_malloc0(sizeof(LogQueueMpsc) + log_queue_max_threads * sizeof(self->input_threads[0]));
+
+  log_queue_init_instance(&self->super, persist_name);
+  self->super.type = log_queue_mpsc_type;
+  self->super.use_backlog = FALSE;
+  self->super.get_length = log_queue_mpsc_get_length;
+  self->super.keep_on_reload = log_queue_mpsc_keep_on_reload;
+  self->super.push_tail = log_queue_mpsc_push_tail;
+  self->super.push_head = log_queue_mpsc_push_head;
+  self->super.pop_head = log_queue_mpsc_pop_head;
+  self->super.ack_backlog = log_queue_mpsc_ack_backlog;
+  self->super.rewind_backlog = log_queue_mpsc_rewind_backlog;
+  self->super.rewind_backlog_all = log_queue_mpsc_rewind_backlog_all;
+
+  self->super.free_fn = log_queue_mpsc_free;
+
+  for (i = 0; i < log_queue_max_threads; i++)
+    {
+      worker_batch_callback_init(&self->input_threads[i].cb);
+      self->input_threads[i].cb.func = log_queue_mpsc_notify_output;
+      self->input_threads[i].cb.user_data = self;
+    }
+  INIT_IV_LIST_HEAD(&self->qoutput);
+  INIT_IV_LIST_HEAD(&self->qbacklog);
+  INIT_IV_LIST_HEAD(&self->qspill);
+
+  /* the ring is preallocated, its size is a power of two to make
+   * wrapping around a simple mask, the rest of log_fifo_size is served by
+   * the spill list */
+  qoverflow_size = MAX(qoverflow_size, 1);
+  for (ring_size = 1;
+       ring_size * 2 <= (guint) MIN(qoverflow_size, LOG_QUEUE_MPSC_MAX_RING_SIZE);
+       ring_size <<= 1)
+    ;
+  self->ring = g_new0(LogQueueMpscSlot, ring_size);
+  for (pos = 0; pos < ring_size; pos++)
+    self->ring[pos].sequence = pos;
+  self->ring_mask = ring_size - 1;
+
+  self->qoverflow_size = qoverflow_size;
+  return &self->super;
+}
@@ -24,6 +24,7 @@
 
 #include "logqueue.h"
 #include "stats/stats-registry.h"
+#include "stats/stats-histogram.h"
 #include "messages.h"
 
 gint log_queue_max_threads = 0;
@@ -176,6 +177,46 @@ log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsC
   stats_counter_set(self->stored_messages, log_queue_get_length(self));
 }
 
+void
+log_queue_set_latency_counters(LogQueue *self, StatsCounterItem *ingest_latency, StatsCounterItem *queue_latency)
+{
+  self->ingest_latency = ingest_latency;
+  self->queue_latency = queue_latency;
+}
+
+/* time between receiving the message and putting it into this queue,
+ * which covers the parsing, filtering and rewriting done in the log
+ * path */
+void
+log_queue_record_ingest_latency(LogQueue *self, LogMessage *msg)
+{
+  GTimeVal recvd;
+
+  recvd.tv_sec = msg->timestamps[LM_TS_RECVD].tv_sec;
+  recvd.tv_usec = msg->timestamps[LM_TS_RECVD].tv_usec;
+  stats_counter_record_latency_since(self->ingest_latency, &recvd);
+}
+
+/* the enqueue time is stored in milliseconds in LogMessageQueueNode,
+ * truncated to 32 bits, the difference is still correct as long as the
+ * message spends less than ~49 days in the queue */
+guint32
+log_queue_get_enqueue_stamp(void)
+{
+  GTimeVal now;
+
+  g_get_current_time(&now);
+  return (guint32) ((guint64) now.tv_sec * 1000 + now.tv_usec / 1000);
+}
+
+void
+log_queue_record_queue_latency(LogQueue *self, guint32 enqueued)
+{
+  guint32 waited = log_queue_get_enqueue_stamp() - enqueued;
+
+  stats_counter_record_latency(self->queue_latency, (guint64) waited * 1000);
+}
+
 void
 log_queue_init_instance(LogQueue *self, const gchar *persist_name)
 {
@@ -49,6 +49,9 @@ struct _LogQueue
   gchar *persist_name;
   StatsCounterItem *stored_messages;
   StatsCounterItem *dropped_messages;
+  /* latency histograms, only set if registered, see log_queue_set_latency_counters() */
+  StatsCounterItem *ingest_latency;
+  StatsCounterItem *queue_latency;
 
   GStaticMutex lock;
   LogQueuePushNotifyFunc parallel_push_notify;
@@ -92,9 +95,13 @@ log_queue_is_empty_racy(LogQueue *self)
     return (self->get_length(self) == 0);
 }
 
+void log_queue_record_ingest_latency(LogQueue *self, LogMessage *msg);
+
 static inline void
 log_queue_push_tail(LogQueue *self, LogMessage *msg, const LogPathOptions *path_options)
 {
+  if (self->ingest_latency)
+    log_queue_record_ingest_latency(self, msg);
   self->push_tail(self, msg, path_options);
 }
 
@@ -196,6 +203,9 @@ void log_queue_reset_parallel_push(LogQueue *self);
 void log_queue_set_parallel_push(LogQueue *self, LogQueuePushNotifyFunc parallel_push_notify, gpointer user_data, GDestroyNotify user_data_destroy);
 gboolean log_queue_check_items(LogQueue *self, gint *timeout, LogQueuePushNotifyFunc parallel_push_notify, gpointer user_data, GDestroyNotify user_data_destroy);
 void log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsCounterItem *dropped_messages);
+void log_queue_set_latency_counters(LogQueue *self, StatsCounterItem *ingest_latency, StatsCounterItem *queue_latency);
+guint32 log_queue_get_enqueue_stamp(void);
+void log_queue_record_queue_latency(LogQueue *self, guint32 enqueued);
 void log_queue_init_instance(LogQueue *self, const gchar *persist_name);
 void log_queue_free_method(LogQueue *self);
 
@@ -25,7 +25,9 @@
 #include "logreader.h"
 #include "mainloop-io-worker.h"
 #include "mainloop-call.h"
+#include "mainloop-event-loop.h"
 #include "ack_tracker.h"
+#include "stats/stats-registry.h"
 
 #include <iv_event.h>
 
@@ -41,6 +43,7 @@ struct _LogReader
   GSockAddr *peer_addr;
   ino_t inode;
   gint64 size;
+  StatsCounterItem *average_batch_size;
 
   /* NOTE: these used to be LogReaderWatch members, which were merged into
    * LogReader with the multi-thread refactorization */
@@ -48,6 +51,8 @@ struct _LogReader
   struct iv_task restart_task;
   struct iv_event schedule_wakeup;
   MainLoopIOWorkerJob io_job;
+  /* the event loop owning our watches, NULL if it is the main thread */
+  MainLoopEventLoop *event_loop;
   gboolean watches_running:1, suspended:1;
   gint notify_code;
 
@@ -63,6 +68,12 @@ struct _LogReader
   PollEvents *pending_poll_events;
 };
 
+typedef struct _LogReaderNotification
+{
+  LogReader *reader;
+  gint notify_code;
+} LogReaderNotification;
+
 static gboolean log_reader_fetch_log(LogReader *self);
 
 static void log_reader_stop_watches(LogReader *self);
@@ -129,6 +140,48 @@ log_reader_work_finished(void *s)
   log_pipe_unref(&self->super.super);
 }
 
+/* NOTE: runs in the main thread, posted by the reader's event loop */
+static gpointer
+log_reader_deliver_notification(gpointer s)
+{
+  LogReaderNotification *notification = (LogReaderNotification *) s;
+  LogReader *self = notification->reader;
+
+  /* the reader might have been deinitialized since the notification was
+   * posted (e.g. reload), in which case its control pipe must not be
+   * notified.  Watches are restarted by the next init, which delivers
+   * the condition again. */
+  if (self->super.super.flags & PIF_INITIALIZED)
+    log_pipe_notify(self->control, notification->notify_code, self);
+
+  log_pipe_unref(&self->super.super);
+  g_free(notification);
+  return NULL;
+}
+
+/* NOTE: runs in the event loop thread, the counterpart of log_reader_work_finished() */
+static void
+log_reader_work_finished_in_event_loop(LogReader *self)
+{
+  if (self->notify_code)
+    {
+      LogReaderNotification *notification = g_new0(LogReaderNotification, 1);
+
+      /* the watches are not restarted, the notification usually results
+       * in the reader being closed */
+      notification->reader = (LogReader *) log_pipe_ref(&self->super.super);
+      notification->notify_code = self->notify_code;
+      self->notify_code = 0;
+      main_loop_event_loop_post_to_main(self->event_loop, log_reader_deliver_notification, notification);
+      return;
+    }
+  if (self->super.super.flags & PIF_INITIALIZED)
+    {
+      log_proto_server_reset_error(self->proto);
+      log_reader_update_watches(self);
+    }
+}
+
 static void
 log_reader_wakeup_triggered(gpointer s)
 {
@@ -173,6 +226,23 @@ log_reader_io_process_input(gpointer s)
   LogReader *self = (LogReader *) s;
 
   log_reader_stop_watches(self);
+  if (self->event_loop)
+    {
+      /* the event loop is our worker thread, input is processed in-line.
+       * main_loop_worker_sync_call() waits for the current batch to
+       * finish, after which no new batches are started until reload
+       * finishes and the watches are restarted by init */
+      if (!main_loop_worker_job_quit())
+        {
+          log_pipe_ref(&self->super.super);
+          log_reader_work_perform(self);
+          main_loop_worker_invoke_batch_callbacks();
+          log_reader_work_finished_in_event_loop(self);
+          log_pipe_unref(&self->super.super);
+        }
+      return;
+    }
+
   log_pipe_ref(&self->super.super);
   if ((self->options->flags & LR_THREADED))
     {
@@ -236,6 +306,25 @@ log_reader_start_watches_if_stopped(LogReader *self)
     }
 }
 
+static void
+log_reader_assert_owner_thread(LogReader *self)
+{
+  if (self->event_loop)
+    main_loop_event_loop_assert_current(self->event_loop);
+  else
+    main_loop_assert_main_thread();
+}
+
+/* executes @func in the thread owning our watches, waiting for its completion */
+static void
+log_reader_call_in_owner_thread(LogReader *self, MainLoopTaskFunc func, gpointer user_data)
+{
+  if (self->event_loop)
+    main_loop_event_loop_call(self->event_loop, func, user_data);
+  else
+    main_loop_call(func, user_data, TRUE);
+}
+
 static gboolean
 log_reader_is_opened(LogReader *self)
 {
@@ -270,7 +359,7 @@ log_reader_update_watches(LogReader *self)
   gboolean free_to_send;
   gboolean line_is_ready_in_buffer;
 
-  main_loop_assert_main_thread();
+  log_reader_assert_owner_thread(self);
 
   if (!log_reader_is_opened(self))
     return;
@@ -400,9 +489,30 @@ log_reader_fetch_log(LogReader *self)
     }
   if (msg_count == self->options->fetch_limit)
     self->immediate_check = TRUE;
+  stats_counter_set(self->average_batch_size, log_proto_server_get_average_batch_size(self->proto));
   return 0;
 }
 
+static gpointer
+log_reader_start_watches(gpointer s)
+{
+  LogReader *self = (LogReader *) s;
+
+  log_reader_update_watches(self);
+  iv_event_register(&self->schedule_wakeup);
+  return NULL;
+}
+
+static gpointer
+log_reader_cancel_watches(gpointer s)
+{
+  LogReader *self = (LogReader *) s;
+
+  iv_event_unregister(&self->schedule_wakeup);
+  log_reader_stop_watches(self);
+  return NULL;
+}
+
 static gboolean
 log_reader_init(LogPipe *s)
 {
@@ -414,6 +524,14 @@ log_reader_init(LogPipe *s)
   if (!log_proto_server_validate_options(self->proto))
     return FALSE;
 
+  if (log_proto_server_reads_in_batches(self->proto))
+    {
+      stats_lock();
+      stats_register_counter(self->super.stats_level, self->super.stats_source | SCS_SOURCE, self->super.stats_id,
+                             self->super.stats_instance, SC_TYPE_BATCH_SIZE, &self->average_batch_size);
+      stats_unlock();
+    }
+
   if (!self->options->parse_options.format_handler)
     {
       msg_error("Unknown format plugin specified",
@@ -423,8 +541,7 @@ log_reader_init(LogPipe *s)
 
   poll_events_set_callback(self->poll_events, log_reader_io_process_input, self);
 
-  log_reader_update_watches(self);
-  iv_event_register(&self->schedule_wakeup);
+  log_reader_call_in_owner_thread(self, log_reader_start_watches, self);
 
   return TRUE;
 }
@@ -436,8 +553,16 @@ log_reader_deinit(LogPipe *s)
 
   main_loop_assert_main_thread();
 
-  iv_event_unregister(&self->schedule_wakeup);
-  log_reader_stop_watches(self);
+  log_reader_call_in_owner_thread(self, log_reader_cancel_watches, self);
+
+  if (self->average_batch_size)
+    {
+      stats_lock();
+      stats_unregister_counter(self->super.stats_source | SCS_SOURCE, self->super.stats_id, self->super.stats_instance,
+                               SC_TYPE_BATCH_SIZE, &self->average_batch_size);
+      stats_unlock();
+    }
+
   if (!log_source_deinit(s))
     return FALSE;
 
@@ -484,10 +609,9 @@ log_reader_set_options(LogReader *s, LogPipe *control, LogReaderOptions *options
     log_proto_server_set_options(self->proto, &self->options->proto_options.super);
 }
 
-/* run in the main thread in reaction to a log_reader_reopen to change
- * the source LogProtoServer instance. It needs to be ran in the main
- * thread as it reregisters the watches associated with the main
- * thread. */
+/* run in the main thread (or the reader's event loop) in reaction to a
+ * log_reader_reopen to change the source LogProtoServer instance. It needs
+ * to be ran in the thread owning the watches as it reregisters them. */
 void
 log_reader_reopen_deferred(gpointer s)
 {
@@ -516,7 +640,7 @@ log_reader_reopen(LogReader *self, LogProtoServer *proto, PollEvents *poll_event
 
   log_source_deinit(&self->super.super);
 
-  main_loop_call((MainLoopTaskFunc) log_reader_reopen_deferred, args, TRUE);
+  log_reader_call_in_owner_thread(self, (MainLoopTaskFunc) log_reader_reopen_deferred, args);
 
   if (!main_loop_is_main_thread())
     {
@@ -530,6 +654,15 @@ log_reader_reopen(LogReader *self, LogProtoServer *proto, PollEvents *poll_event
   log_source_init(&self->super.super);
 }
 
+/* NOTE: needs to be called before the reader is opened or initialized */
+void
+log_reader_set_event_loop(LogReader *self, MainLoopEventLoop *event_loop)
+{
+  g_assert(!log_reader_is_opened(self));
+
+  self->event_loop = event_loop;
+}
+
 void
 log_reader_set_peer_addr(LogReader *s, GSockAddr *peer_addr)
 {
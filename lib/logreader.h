@@ -28,6 +28,7 @@
 #include "logsource.h"
 #include "logproto/logproto-server.h"
 #include "poll-events.h"
+#include "mainloop-event-loop.h"
 #include "timeutils.h"
 
 /* flags */
@@ -57,6 +58,7 @@ typedef struct _LogReader LogReader;
 void log_reader_set_options(LogReader *s, LogPipe *control, LogReaderOptions *options, gint stats_level, gint stats_source, const gchar *stats_id, const gchar *stats_instance);
 void log_reader_set_follow_filename(LogReader *self, const gchar *follow_filename);
 void log_reader_set_peer_addr(LogReader *s, GSockAddr *peer_addr);
+void log_reader_set_event_loop(LogReader *self, MainLoopEventLoop *event_loop);
 void log_reader_set_immediate_check(LogReader *s);
 void log_reader_reopen(LogReader *s, LogProtoServer *proto, PollEvents *poll_events);
 LogReader *log_reader_new(GlobalConfig *cfg);
@@ -22,11 +22,24 @@
  *
  */
 
+
 #include "logthrdestdrv.h"
+#include "stats/stats-histogram.h"
 #include "seqnum.h"
+#include "scratch-buffers.h"
+#include "tls-support.h"
+#include "persist-state.h"
 
 #define MAX_RETRIES_OF_FAILED_INSERT_DEFAULT 3
 
+TLS_BLOCK_START
+{
+  LogThrDestWorker *current_worker;
+}
+TLS_BLOCK_END;
+
+#define current_worker __tls_deref(current_worker)
+
 static gchar *
 log_threaded_dest_driver_format_seqnum_for_persist(LogThrDestDriver *self)
 {
@@ -38,26 +51,90 @@ log_threaded_dest_driver_format_seqnum_for_persist(LogThrDestDriver *self)
   return persist_name;
 }
 
-void
-log_threaded_dest_driver_suspend(LogThrDestDriver *self)
+/* the first worker uses the name of the driver, so that the queue of a
+ * single-worker destination is kept across upgrades */
+static gchar *
+_format_queue_persist_name(LogThrDestDriver *self, gint index)
+{
+  const gchar *persist_name = self->super.super.super.generate_persist_name((const LogPipe *)self);
+
+  if (index == 0)
+    return g_strdup(persist_name);
+  return g_strdup_printf("%s.%d", persist_name, index);
+}
+
+static gchar *
+_format_worker_stats_instance(LogThrDestDriver *self, gint index, gchar *buf, gsize buf_len)
+{
+  g_snprintf(buf, buf_len, "%s#%d", self->format.stats_instance(self), index);
+  return buf;
+}
+
+LogThrDestWorker *
+log_threaded_dest_driver_get_worker(LogThrDestDriver *self)
+{
+  LogThrDestWorker *worker = current_worker;
+
+  if (worker && worker->owner == self)
+    return worker;
+
+  /* not called from one of our worker threads */
+  return self->workers.list ? self->workers.list[0] : NULL;
+}
+
+gint
+log_threaded_dest_driver_get_batch_size(LogThrDestDriver *self)
+{
+  LogThrDestWorker *worker = log_threaded_dest_driver_get_worker(self);
+
+  return worker ? worker->batch.size : 0;
+}
+
+static void
+_step_sequence_number(LogThrDestDriver *self, gint n)
+{
+  if (self->workers.num <= 1)
+    {
+      gint i;
+
+      for (i = 0; i < n; i++)
+        step_sequence_number(&self->seq_num);
+      return;
+    }
+
+  /* a wrap-around race between workers is harmless, the sequence number
+   * only needs to stay positive */
+  g_atomic_int_add(&self->seq_num, n);
+  if (g_atomic_int_get(&self->seq_num) <= 0)
+    g_atomic_int_set(&self->seq_num, 1);
+}
+
+static void
+_worker_suspend(LogThrDestWorker *self)
 {
   iv_validate_now();
   self->timer_reopen.expires  = iv_now;
-  self->timer_reopen.expires.tv_sec += self->time_reopen;
+  self->timer_reopen.expires.tv_sec += self->owner->time_reopen;
   iv_timer_register(&self->timer_reopen);
 }
 
+void
+log_threaded_dest_driver_suspend(LogThrDestDriver *self)
+{
+  _worker_suspend(log_threaded_dest_driver_get_worker(self));
+}
+
 static void
 log_threaded_dest_driver_message_became_available_in_the_queue(gpointer user_data)
 {
-  LogThrDestDriver *self = (LogThrDestDriver *) user_data;
+  LogThrDestWorker *self = (LogThrDestWorker *) user_data;
   iv_event_post(&self->wake_up_event);
 }
 
 static void
 log_threaded_dest_driver_wake_up(gpointer data)
 {
-  LogThrDestDriver *self = (LogThrDestDriver *)data;
+  LogThrDestWorker *self = (LogThrDestWorker *)data;
 
   if (!iv_task_registered(&self->do_work))
     {
@@ -66,13 +143,13 @@ log_threaded_dest_driver_wake_up(gpointer data)
 }
 
 static void
-log_threaded_dest_driver_start_watches(LogThrDestDriver *self)
+log_threaded_dest_driver_start_watches(LogThrDestWorker *self)
 {
   iv_task_register(&self->do_work);
 }
 
 static void
-log_threaded_dest_driver_stop_watches(LogThrDestDriver *self)
+log_threaded_dest_driver_stop_watches(LogThrDestWorker *self)
 {
   if (iv_task_registered(&self->do_work))
     {
@@ -86,30 +163,36 @@ log_threaded_dest_driver_stop_watches(LogThrDestDriver *self)
     {
       iv_timer_unregister(&self->timer_throttle);
     }
+  if (iv_timer_registered(&self->timer_flush))
+    {
+      iv_timer_unregister(&self->timer_flush);
+    }
 }
 
 static void
 log_threaded_dest_driver_shutdown(gpointer data)
 {
-  LogThrDestDriver *self = (LogThrDestDriver *)data;
+  LogThrDestWorker *self = (LogThrDestWorker *)data;
   log_threaded_dest_driver_stop_watches(self);
   iv_quit();
 }
 
 
 static void
-__connect(LogThrDestDriver *self)
+__connect(LogThrDestWorker *self)
 {
-  self->worker.connected = TRUE;
-  if (self->worker.connect)
+  LogThrDestDriver *owner = self->owner;
+
+  self->connected = TRUE;
+  if (owner->worker.connect)
     {
-      self->worker.connected = self->worker.connect(self);
+      self->connected = owner->worker.connect(owner);
     }
 
-  if (!self->worker.connected)
+  if (!self->connected)
     {
       log_queue_reset_parallel_push(self->queue);
-      log_threaded_dest_driver_suspend(self);
+      _worker_suspend(self);
     }
   else
     {
@@ -118,89 +201,344 @@ __connect(LogThrDestDriver *self)
 }
 
 static void
-__disconnect(LogThrDestDriver *self)
+__disconnect(LogThrDestWorker *self)
 {
-  if (self->worker.disconnect)
+  LogThrDestDriver *owner = self->owner;
+
+  if (owner->worker.disconnect)
     {
-      self->worker.disconnect(self);
+      owner->worker.disconnect(owner);
     }
-  self->worker.connected = FALSE;
+  self->connected = FALSE;
 }
 
 
 
+/* the in-flight messages precede the current batch in the backlog, so this
+ * has to be called after the current batch was rewound */
 static void
-_disconnect_and_suspend(LogThrDestDriver *self)
+_rewind_inflight(LogThrDestWorker *self)
+{
+  log_queue_rewind_backlog(self->queue, self->inflight.messages);
+  self->inflight.messages = 0;
+  self->inflight.batches = 0;
+}
+
+static void
+_disconnect_and_suspend(LogThrDestWorker *self)
 {
   self->suspended = TRUE;
   __disconnect(self);
+  _rewind_inflight(self);
   log_queue_reset_parallel_push(self->queue);
-  log_threaded_dest_driver_suspend(self);
+  _worker_suspend(self);
 }
 
 static void
-log_threaded_dest_driver_do_insert(LogThrDestDriver *self)
+_accept_batch(LogThrDestWorker *self)
 {
-  LogMessage *msg;
-  worker_insert_result_t result;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  self->retries_counter = 0;
+  _step_sequence_number(self->owner, self->batch.size);
+  log_queue_ack_backlog(self->queue, self->batch.size);
+  self->batch.size = 0;
+}
 
-  while (!self->suspended &&
-         (msg = log_queue_pop_head(self->queue, &path_options)) != NULL)
+static void
+_drop_batch(LogThrDestWorker *self)
+{
+  stats_counter_add(self->dropped_messages, self->batch.size);
+  _accept_batch(self);
+}
+
+static void
+_rewind_batch(LogThrDestWorker *self)
+{
+  log_queue_rewind_backlog(self->queue, self->batch.size);
+  self->batch.size = 0;
+}
+
+static void
+_process_result(LogThrDestWorker *self, worker_insert_result_t result, LogMessage *msg)
+{
+  LogThrDestDriver *owner = self->owner;
+
+  switch (result)
     {
-      msg_set_context(msg);
-      log_msg_refcache_start_consumer(msg, &path_options);
+    case WORKER_INSERT_RESULT_DROP:
+      _drop_batch(self);
+      _disconnect_and_suspend(self);
+      break;
 
-      result = self->worker.insert(self, msg);
+    case WORKER_INSERT_RESULT_ERROR:
+      self->retries_counter++;
 
-      switch (result)
+      if (self->retries_counter >= owner->retries.max)
+        {
+          if (owner->messages.retry_over && msg)
+            owner->messages.retry_over(owner, msg);
+          _drop_batch(self);
+        }
+      else
         {
-        case WORKER_INSERT_RESULT_DROP:
-          log_threaded_dest_driver_message_drop(self, msg);
+          _rewind_batch(self);
           _disconnect_and_suspend(self);
-          break;
+        }
+      break;
 
-        case WORKER_INSERT_RESULT_ERROR:
-          self->retries.counter++;
+    case WORKER_INSERT_RESULT_NOT_CONNECTED:
+      _rewind_batch(self);
+      _disconnect_and_suspend(self);
+      break;
 
-          if (self->retries.counter >= self->retries.max)
-            {
-              if (self->messages.retry_over)
-                self->messages.retry_over(self, msg);
-              log_threaded_dest_driver_message_drop(self, msg);
-            }
-          else
-            {
-              log_threaded_dest_driver_message_rewind(self, msg);
-              _disconnect_and_suspend(self);
-            }
-          break;
+    case WORKER_INSERT_RESULT_REWIND:
+      _rewind_batch(self);
+      break;
 
-        case WORKER_INSERT_RESULT_NOT_CONNECTED:
-          log_threaded_dest_driver_message_rewind(self, msg);
-          _disconnect_and_suspend(self);
-          break;
+    case WORKER_INSERT_RESULT_SUCCESS:
+      _accept_batch(self);
+      break;
 
-        case WORKER_INSERT_RESULT_REWIND:
-          log_threaded_dest_driver_message_rewind(self, msg);
-          break;
+    case WORKER_INSERT_RESULT_QUEUED:
+    default:
+      break;
+    }
+}
 
-        case WORKER_INSERT_RESULT_SUCCESS:
-          log_threaded_dest_driver_message_accept(self, msg);
-          break;
+static gboolean
+_is_saturated(LogThrDestWorker *self)
+{
+  return self->owner->batch.max_inflight > 0 && self->inflight.batches >= self->owner->batch.max_inflight;
+}
 
-        default:
-          break;
+static gboolean
+_batch_is_full(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+
+  if (owner->batch.lines > 0 && self->batch.size >= owner->batch.lines)
+    return TRUE;
+
+  return owner->worker.batch_full && owner->worker.batch_full(owner);
+}
+
+static gboolean
+_batch_timeout_expired(LogThrDestWorker *self)
+{
+  if (self->owner->batch.timeout <= 0)
+    return TRUE;
+
+  iv_validate_now();
+  return timespec_diff_msec(&iv_now, &self->batch.opened) >= self->owner->batch.timeout;
+}
+
+/* write_latency covers both insert() and flush(): with batching, insert()
+ * usually only formats the message and the actual write happens here */
+static worker_insert_result_t
+_call_flush(LogThrDestDriver *owner)
+{
+  worker_insert_result_t result;
+  GTimeVal started;
+
+  if (!owner->write_latency)
+    return owner->worker.flush(owner);
+
+  g_get_current_time(&started);
+  result = owner->worker.flush(owner);
+  stats_counter_record_latency_since(owner->write_latency, &started);
+  return result;
+}
+
+static void
+_flush_batch(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+  worker_insert_result_t result = WORKER_INSERT_RESULT_SUCCESS;
+
+  if (self->batch.size == 0)
+    return;
+
+  if (owner->worker.flush)
+    result = _call_flush(owner);
+
+  if (result == WORKER_INSERT_RESULT_QUEUED)
+    {
+      self->inflight.messages += self->batch.size;
+      self->inflight.batches++;
+      self->batch.size = 0;
+      return;
+    }
+
+  _process_result(self, result, NULL);
+}
+
+static void
+_start_flush_timer(LogThrDestWorker *self)
+{
+  self->timer_flush.expires = self->batch.opened;
+  timespec_add_msec(&self->timer_flush.expires, self->owner->batch.timeout);
+  iv_timer_register(&self->timer_flush);
+}
+
+/* called after the worker thread's main loop has exited, the outcome is not
+ * retried, failed messages are left in the queue, just like the ones in
+ * flight, which are abandoned by the disconnect() that follows */
+static void
+_flush_batch_on_exit(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+  worker_insert_result_t result = WORKER_INSERT_RESULT_SUCCESS;
+
+  if (self->batch.size == 0)
+    return;
+
+  if (self->inflight.batches > 0)
+    result = WORKER_INSERT_RESULT_REWIND;
+  else if (self->connected && owner->worker.flush)
+    result = _call_flush(owner);
+  else if (!self->connected)
+    result = WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  if (result == WORKER_INSERT_RESULT_SUCCESS)
+    _accept_batch(self);
+  else if (result == WORKER_INSERT_RESULT_QUEUED)
+    {
+      self->inflight.messages += self->batch.size;
+      self->inflight.batches++;
+      self->batch.size = 0;
+    }
+  else
+    _rewind_batch(self);
+}
+
+static void
+_complete_inflight_batch(LogThrDestWorker *self, gint batch_size, gboolean dropped)
+{
+  self->inflight.messages -= batch_size;
+  self->inflight.batches--;
+
+  if (dropped)
+    stats_counter_add(self->dropped_messages, batch_size);
+  else
+    self->retries_counter = 0;
+
+  _step_sequence_number(self->owner, batch_size);
+  log_queue_ack_backlog(self->queue, batch_size);
+}
+
+/* called from a synchronous flush(), the messages are at the head of the
+ * backlog only if no batches are in flight */
+void
+log_threaded_dest_driver_batch_ack_messages(LogThrDestDriver *owner, gint num_messages, gboolean dropped)
+{
+  LogThrDestWorker *self = log_threaded_dest_driver_get_worker(owner);
+
+  g_assert(self->inflight.batches == 0);
+  g_assert(num_messages <= self->batch.size);
+
+  if (dropped)
+    stats_counter_add(self->dropped_messages, num_messages);
+  else
+    self->retries_counter = 0;
+
+  _step_sequence_number(owner, num_messages);
+  log_queue_ack_backlog(self->queue, num_messages);
+  self->batch.size -= num_messages;
+}
+
+static void
+_rewind_all_and_suspend(LogThrDestWorker *self)
+{
+  log_threaded_dest_driver_stop_watches(self);
+  _rewind_batch(self);
+  _disconnect_and_suspend(self);
+}
+
+void
+log_threaded_dest_driver_batch_completed(LogThrDestDriver *owner, gint batch_size,
+                                         worker_insert_result_t result)
+{
+  LogThrDestWorker *self = log_threaded_dest_driver_get_worker(owner);
+
+  g_assert(batch_size <= self->inflight.messages);
+
+  switch (result)
+    {
+    case WORKER_INSERT_RESULT_SUCCESS:
+      _complete_inflight_batch(self, batch_size, FALSE);
+      break;
+
+    case WORKER_INSERT_RESULT_ERROR:
+      self->retries_counter++;
+      if (self->retries_counter < owner->retries.max)
+        {
+          _rewind_all_and_suspend(self);
+          return;
+        }
+      _complete_inflight_batch(self, batch_size, TRUE);
+      break;
+
+    case WORKER_INSERT_RESULT_DROP:
+      _complete_inflight_batch(self, batch_size, TRUE);
+      _rewind_all_and_suspend(self);
+      return;
+
+    default:
+      _rewind_all_and_suspend(self);
+      return;
+    }
+
+  /* there is room for another batch, resume consuming the queue */
+  if (!self->suspended)
+    log_threaded_dest_driver_wake_up(self);
+}
+
+static void
+log_threaded_dest_driver_do_insert(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+  LogMessage *msg;
+  worker_insert_result_t result;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+  while (!self->suspended && !_is_saturated(self) &&
+         (msg = log_queue_pop_head(self->queue, &path_options)) != NULL)
+    {
+      msg_set_context(msg);
+      log_msg_refcache_start_consumer(msg, &path_options);
+
+      if (self->batch.size == 0)
+        {
+          iv_validate_now();
+          self->batch.opened = iv_now;
         }
+      self->batch.size++;
+
+      if (owner->write_latency)
+        {
+          GTimeVal popped;
+
+          g_get_current_time(&popped);
+          result = owner->worker.insert(owner, msg);
+          stats_counter_record_latency_since(owner->write_latency, &popped);
+        }
+      else
+        {
+          result = owner->worker.insert(owner, msg);
+        }
+      _process_result(self, result, msg);
+
+      if (result == WORKER_INSERT_RESULT_QUEUED && _batch_is_full(self))
+        _flush_batch(self);
 
+      log_msg_unref(msg);
       msg_set_context(NULL);
       log_msg_refcache_stop();
     }
   if (!self->suspended)
     {
-      if (self->worker.worker_message_queue_empty)
+      if (owner->worker.worker_message_queue_empty)
         {
-          self->worker.worker_message_queue_empty(self);
+          owner->worker.worker_message_queue_empty(owner);
         }
     }
 }
@@ -208,17 +546,22 @@ log_threaded_dest_driver_do_insert(LogThrDestDriver *self)
 static void
 log_threaded_dest_driver_do_work(gpointer data)
 {
-  LogThrDestDriver *self = (LogThrDestDriver *)data;
+  LogThrDestWorker *self = (LogThrDestWorker *)data;
   gint timeout_msec = 0;
 
   self->suspended = FALSE;
   log_threaded_dest_driver_stop_watches(self);
 
-  if (!self->worker.connected)
+  if (!self->connected)
     {
       __connect(self);
     }
 
+  else if (_is_saturated(self))
+    {
+      /* log_threaded_dest_driver_batch_completed() restarts us */
+    }
+
   else if (log_queue_check_items(self->queue, &timeout_msec,
                                  log_threaded_dest_driver_message_became_available_in_the_queue,
                                  self, NULL))
@@ -227,18 +570,31 @@ log_threaded_dest_driver_do_work(gpointer data)
       if (!self->suspended)
         log_threaded_dest_driver_start_watches(self);
     }
-  else if (timeout_msec != 0)
+  else
     {
-      log_queue_reset_parallel_push(self->queue);
-      iv_validate_now();
-      self->timer_throttle.expires = iv_now;
-      timespec_add_msec(&self->timer_throttle.expires, timeout_msec);
-      iv_timer_register(&self->timer_throttle);
+      if (self->batch.size > 0)
+        {
+          /* the queue is empty: flush what we have, or wait for more
+           * messages until the batch timeout expires */
+          if (_batch_timeout_expired(self))
+            _flush_batch(self);
+          else
+            _start_flush_timer(self);
+        }
+
+      if (timeout_msec != 0 && !self->suspended)
+        {
+          log_queue_reset_parallel_push(self->queue);
+          iv_validate_now();
+          self->timer_throttle.expires = iv_now;
+          timespec_add_msec(&self->timer_throttle.expires, timeout_msec);
+          iv_timer_register(&self->timer_throttle);
+        }
     }
 }
 
 static void
-log_threaded_dest_driver_init_watches(LogThrDestDriver *self)
+log_threaded_dest_driver_init_watches(LogThrDestWorker *self)
 {
   IV_EVENT_INIT(&self->wake_up_event);
   self->wake_up_event.cookie = self;
@@ -258,6 +614,10 @@ log_threaded_dest_driver_init_watches(LogThrDestDriver *self)
   self->timer_throttle.cookie = self;
   self->timer_throttle.handler = log_threaded_dest_driver_do_work;
 
+  IV_TIMER_INIT(&self->timer_flush);
+  self->timer_flush.cookie = self;
+  self->timer_flush.handler = log_threaded_dest_driver_do_work;
+
   IV_TASK_INIT(&self->do_work);
   self->do_work.cookie = self;
   self->do_work.handler = log_threaded_dest_driver_do_work;
@@ -266,12 +626,16 @@ log_threaded_dest_driver_init_watches(LogThrDestDriver *self)
 static void
 log_threaded_dest_driver_worker_thread_main(gpointer arg)
 {
-  LogThrDestDriver *self = (LogThrDestDriver *)arg;
+  LogThrDestWorker *self = (LogThrDestWorker *)arg;
+  LogThrDestDriver *owner = self->owner;
 
   iv_init();
 
+  current_worker = self;
+
   msg_debug("Worker thread started",
-            evt_tag_str("driver", self->super.super.id));
+            evt_tag_str("driver", owner->super.super.id),
+            evt_tag_int("worker", self->index));
 
   log_queue_set_use_backlog(self->queue, TRUE);
 
@@ -279,50 +643,217 @@ log_threaded_dest_driver_worker_thread_main(gpointer arg)
 
   log_threaded_dest_driver_start_watches(self);
 
-  if (self->worker.thread_init)
-    self->worker.thread_init(self);
+  if (owner->worker.thread_init)
+    owner->worker.thread_init(owner);
 
   iv_main();
 
+  _flush_batch_on_exit(self);
   __disconnect(self);
-  if (self->worker.thread_deinit)
-    self->worker.thread_deinit(self);
+  _rewind_inflight(self);
+  if (owner->worker.thread_deinit)
+    owner->worker.thread_deinit(owner);
 
   msg_debug("Worker thread finished",
-            evt_tag_str("driver", self->super.super.id));
+            evt_tag_str("driver", owner->super.super.id),
+            evt_tag_int("worker", self->index));
+
+  current_worker = NULL;
   iv_deinit();
 }
 
 static void
 log_threaded_dest_driver_stop_thread(gpointer s)
 {
-  LogThrDestDriver *self = (LogThrDestDriver *) s;
+  LogThrDestWorker *self = (LogThrDestWorker *) s;
 
   iv_event_post(&self->shutdown_event);
 }
 
 static void
-log_threaded_dest_driver_start_thread(LogThrDestDriver *self)
+log_threaded_dest_driver_start_thread(LogThrDestWorker *self)
 {
   main_loop_create_worker_thread(log_threaded_dest_driver_worker_thread_main,
                                  log_threaded_dest_driver_stop_thread,
-                                 self, &self->worker_options);
+                                 self, &self->owner->worker_options);
+}
+
+static void
+_register_worker_counters(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+  gchar instance[1024];
+
+  /* the queues of all workers share the stored and dropped counters of
+   * the driver, so those add up to the same as with a single worker */
+  self->stored_messages = owner->stored_messages;
+  self->dropped_messages = owner->dropped_messages;
+
+  if (owner->workers.num == 1)
+    {
+      self->processed_messages = owner->processed_messages;
+      return;
+    }
+
+  _format_worker_stats_instance(owner, self->index, instance, sizeof(instance));
+  stats_register_counter(0, owner->stats_source | SCS_DESTINATION, owner->super.super.id, instance,
+                         SC_TYPE_PROCESSED, &self->processed_messages);
+}
+
+static void
+_unregister_worker_counters(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+  gchar instance[1024];
+
+  self->stored_messages = NULL;
+  self->dropped_messages = NULL;
+
+  if (owner->workers.num == 1)
+    {
+      self->processed_messages = NULL;
+      return;
+    }
+
+  _format_worker_stats_instance(owner, self->index, instance, sizeof(instance));
+  stats_unregister_counter(owner->stats_source | SCS_DESTINATION, owner->super.super.id, instance,
+                           SC_TYPE_PROCESSED, &self->processed_messages);
+}
+
+static LogThrDestWorker *
+_worker_new(LogThrDestDriver *owner, gint index)
+{
+  LogThrDestWorker *self = g_new0(LogThrDestWorker, 1);
+
+  self->owner = owner;
+  self->index = index;
+  return self;
+}
+
+/* a queue left behind by a worker that no longer exists, either kept in
+ * memory across a reload or, for disk queues, registered in the persist
+ * file */
+static gboolean
+_orphaned_queue_exists(LogThrDestDriver *self, const gchar *persist_name)
+{
+  GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
+  gsize size;
+  guint8 version;
+
+  if (cfg_persist_config_exists(cfg, persist_name))
+    return TRUE;
+  return cfg->state && persist_state_lookup_entry(cfg->state, persist_name, &size, &version) != 0;
+}
+
+/* when workers() is lowered, the messages of the queues of the removed
+ * workers are moved to the remaining ones, so they are not lost */
+static void
+_drain_orphaned_queues(LogThrDestDriver *self)
+{
+  gint i;
+
+  for (i = self->workers.num; ; i++)
+    {
+      gchar *persist_name = _format_queue_persist_name(self, i);
+      LogThrDestWorker *target = self->workers.list[i % self->workers.num];
+      LogQueue *orphan;
+      LogMessage *msg;
+      gint moved = 0;
+
+      if (!_orphaned_queue_exists(self, persist_name))
+        {
+          g_free(persist_name);
+          break;
+        }
+
+      orphan = log_dest_driver_acquire_queue(&self->super, persist_name);
+      g_free(persist_name);
+      if (!orphan)
+        continue;
+
+      while (TRUE)
+        {
+          LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+          msg = log_queue_pop_head(orphan, &path_options);
+          if (!msg)
+            break;
+          log_queue_push_tail(target->queue, msg, &path_options);
+          moved++;
+        }
+
+      if (moved > 0)
+        msg_warning("The number of workers was lowered, moving the messages of a removed worker",
+                    evt_tag_str("driver", self->super.super.id),
+                    evt_tag_int("removed_worker", i),
+                    evt_tag_int("worker", target->index),
+                    evt_tag_int("messages", moved));
+
+      /* empty now, it is dropped or, for disk queues, kept as an empty file */
+      log_dest_driver_release_queue(&self->super, log_queue_ref(orphan));
+    }
 }
 
+static gboolean
+_acquire_worker_queues(LogThrDestDriver *self)
+{
+  gint i;
+
+  self->workers.list = g_new0(LogThrDestWorker *, self->workers.num);
+  for (i = 0; i < self->workers.num; i++)
+    {
+      LogThrDestWorker *worker = _worker_new(self, i);
+      gchar *persist_name = _format_queue_persist_name(self, i);
+
+      self->workers.list[i] = worker;
+      worker->queue = log_dest_driver_acquire_queue(&self->super, persist_name);
+      g_free(persist_name);
+
+      if (!worker->queue)
+        return FALSE;
+    }
+  _drain_orphaned_queues(self);
+  return TRUE;
+}
+
+static void
+_free_workers(LogThrDestDriver *self)
+{
+  gint i;
+
+  if (!self->workers.list)
+    return;
+
+  /* the queues themselves are released by LogDestDriver */
+  for (i = 0; i < self->workers.num; i++)
+    g_free(self->workers.list[i]);
+  g_free(self->workers.list);
+  self->workers.list = NULL;
+}
 
 gboolean
 log_threaded_dest_driver_start(LogPipe *s)
 {
   LogThrDestDriver *self = (LogThrDestDriver *)s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  gint64 stored = 0;
+  gint i;
 
   if (cfg && self->time_reopen == -1)
     self->time_reopen = cfg->time_reopen;
 
-  self->queue = log_dest_driver_acquire_queue(
-                  &self->super, self->super.super.super.generate_persist_name((const LogPipe *)self));
+  if (self->workers.num > 1 && !self->workers.supported)
+    {
+      msg_warning("This destination does not support multiple workers, using a single one",
+                  evt_tag_int("workers", self->workers.num),
+                  evt_tag_str("driver", self->super.super.id));
+      self->workers.num = 1;
+    }
+  if (self->workers.num < 1)
+    self->workers.num = 1;
 
-  if (self->queue == NULL)
+  _free_workers(self);
+  if (!_acquire_worker_queues(self))
     {
       return FALSE;
     }
@@ -346,17 +877,38 @@ log_threaded_dest_driver_start(LogPipe *s)
   stats_register_counter(0, self->stats_source | SCS_DESTINATION, self->super.super.id,
                          self->format.stats_instance(self),
                          SC_TYPE_PROCESSED, &self->processed_messages);
+  stats_register_counter(3, self->stats_source | SCS_DESTINATION, self->super.super.id,
+                         self->format.stats_instance(self),
+                         SC_TYPE_INGEST_LATENCY, &self->ingest_latency);
+  stats_register_counter(3, self->stats_source | SCS_DESTINATION, self->super.super.id,
+                         self->format.stats_instance(self),
+                         SC_TYPE_QUEUE_LATENCY, &self->queue_latency);
+  stats_register_counter(3, self->stats_source | SCS_DESTINATION, self->super.super.id,
+                         self->format.stats_instance(self),
+                         SC_TYPE_WRITE_LATENCY, &self->write_latency);
+  for (i = 0; i < self->workers.num; i++)
+    _register_worker_counters(self->workers.list[i]);
   stats_unlock();
 
-  log_queue_set_counters(self->queue, self->stored_messages,
-                         self->dropped_messages);
+  for (i = 0; i < self->workers.num; i++)
+    {
+      LogThrDestWorker *worker = self->workers.list[i];
+
+      log_queue_set_counters(worker->queue, worker->stored_messages,
+                             worker->dropped_messages);
+      log_queue_set_latency_counters(worker->queue, self->ingest_latency, self->queue_latency);
+      stored += log_queue_get_length(worker->queue);
+    }
+  /* each queue set the shared counter to its own length */
+  stats_counter_set(self->stored_messages, stored);
 
   self->seq_num = GPOINTER_TO_INT(cfg_persist_config_fetch(cfg,
                                   log_threaded_dest_driver_format_seqnum_for_persist(self)));
   if (!self->seq_num)
     init_sequence_number(&self->seq_num);
 
-  log_threaded_dest_driver_start_thread(self);
+  for (i = 0; i < self->workers.num; i++)
+    log_threaded_dest_driver_start_thread(self->workers.list[i]);
 
   return TRUE;
 }
@@ -365,16 +917,24 @@ gboolean
 log_threaded_dest_driver_deinit_method(LogPipe *s)
 {
   LogThrDestDriver *self = (LogThrDestDriver *)s;
+  gint i;
 
-  log_queue_reset_parallel_push(self->queue);
+  for (i = 0; i < self->workers.num; i++)
+    {
+      LogThrDestWorker *worker = self->workers.list[i];
 
-  log_queue_set_counters(self->queue, NULL, NULL);
+      log_queue_reset_parallel_push(worker->queue);
+      log_queue_set_counters(worker->queue, NULL, NULL);
+      log_queue_set_latency_counters(worker->queue, NULL, NULL);
+    }
 
   cfg_persist_config_add(log_pipe_get_config(s),
                          log_threaded_dest_driver_format_seqnum_for_persist(self),
                          GINT_TO_POINTER(self->seq_num), NULL, FALSE);
 
   stats_lock();
+  for (i = 0; i < self->workers.num; i++)
+    _unregister_worker_counters(self->workers.list[i]);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id,
                            self->format.stats_instance(self),
                            SC_TYPE_STORED, &self->stored_messages);
@@ -384,8 +944,19 @@ log_threaded_dest_driver_deinit_method(LogPipe *s)
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id,
                            self->format.stats_instance(self),
                            SC_TYPE_PROCESSED, &self->processed_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id,
+                           self->format.stats_instance(self),
+                           SC_TYPE_INGEST_LATENCY, &self->ingest_latency);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id,
+                           self->format.stats_instance(self),
+                           SC_TYPE_QUEUE_LATENCY, &self->queue_latency);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id,
+                           self->format.stats_instance(self),
+                           SC_TYPE_WRITE_LATENCY, &self->write_latency);
   stats_unlock();
 
+  _free_workers(self);
+
   if (!log_dest_driver_deinit_method(s))
     return FALSE;
 
@@ -397,15 +968,43 @@ log_threaded_dest_driver_free(LogPipe *s)
 {
   LogThrDestDriver *self = (LogThrDestDriver *)s;
 
+  _free_workers(self);
+  log_template_unref(self->workers.partition_key);
   log_dest_driver_free((LogPipe *)self);
 }
 
+static LogThrDestWorker *
+_choose_worker(LogThrDestDriver *self, LogMessage *msg)
+{
+  guint index;
+
+  if (self->workers.num == 1)
+    return self->workers.list[0];
+
+  if (self->workers.partition_key)
+    {
+      SBGString *key = sb_gstring_acquire();
+
+      log_template_format(self->workers.partition_key, msg, NULL, LTZ_SEND, 0, NULL,
+                          sb_gstring_string(key));
+      index = g_str_hash(sb_gstring_string(key)->str);
+      sb_gstring_release(key);
+    }
+  else
+    {
+      index = (guint) g_atomic_counter_exchange_and_add(&self->workers.next, 1);
+    }
+
+  return self->workers.list[index % self->workers.num];
+}
+
 static void
 log_threaded_dest_driver_queue(LogPipe *s, LogMessage *msg,
                                const LogPathOptions *path_options,
                                gpointer user_data)
 {
   LogThrDestDriver *self = (LogThrDestDriver *)s;
+  LogThrDestWorker *worker;
   LogPathOptions local_options;
 
   if (!path_options->flow_control_requested)
@@ -414,10 +1013,14 @@ log_threaded_dest_driver_queue(LogPipe *s, LogMessage *msg,
   if (self->queue_method)
     self->queue_method(self);
 
+  worker = _choose_worker(self, msg);
+
   log_msg_add_ack(msg, path_options);
-  log_queue_push_tail(self->queue, log_msg_ref(msg), path_options);
+  log_queue_push_tail(worker->queue, log_msg_ref(msg), path_options);
 
   stats_counter_inc(self->processed_messages);
+  if (self->workers.num > 1)
+    stats_counter_inc(worker->processed_messages);
 
   log_dest_driver_queue_method(s, msg, path_options, user_data);
 }
@@ -436,15 +1039,18 @@ log_threaded_dest_driver_init_instance(LogThrDestDriver *self, GlobalConfig *cfg
   self->time_reopen = -1;
 
   self->retries.max = MAX_RETRIES_OF_FAILED_INSERT_DEFAULT;
+  self->workers.num = 1;
 }
 
 void
 log_threaded_dest_driver_message_accept(LogThrDestDriver *self,
                                         LogMessage *msg)
 {
-  self->retries.counter = 0;
-  step_sequence_number(&self->seq_num);
-  log_queue_ack_backlog(self->queue, 1);
+  LogThrDestWorker *worker = log_threaded_dest_driver_get_worker(self);
+
+  worker->retries_counter = 0;
+  _step_sequence_number(self, 1);
+  log_queue_ack_backlog(worker->queue, 1);
   log_msg_unref(msg);
 }
 
@@ -452,7 +1058,9 @@ void
 log_threaded_dest_driver_message_drop(LogThrDestDriver *self,
                                       LogMessage *msg)
 {
-  stats_counter_inc(self->dropped_messages);
+  LogThrDestWorker *worker = log_threaded_dest_driver_get_worker(self);
+
+  stats_counter_inc(worker->dropped_messages);
   log_threaded_dest_driver_message_accept(self, msg);
 }
 
@@ -460,7 +1068,9 @@ void
 log_threaded_dest_driver_message_rewind(LogThrDestDriver *self,
                                         LogMessage *msg)
 {
-  log_queue_rewind_backlog(self->queue, 1);
+  LogThrDestWorker *worker = log_threaded_dest_driver_get_worker(self);
+
+  log_queue_rewind_backlog(worker->queue, 1);
   log_msg_unref(msg);
 }
 
@@ -471,3 +1081,36 @@ log_threaded_dest_driver_set_max_retries(LogDriver *s, gint max_retries)
 
   self->retries.max = max_retries;
 }
+
+void
+log_threaded_dest_driver_set_batch_lines(LogDriver *s, gint batch_lines)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *)s;
+
+  self->batch.lines = batch_lines;
+}
+
+void
+log_threaded_dest_driver_set_batch_timeout(LogDriver *s, glong batch_timeout)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *)s;
+
+  self->batch.timeout = batch_timeout;
+}
+
+void
+log_threaded_dest_driver_set_num_workers(LogDriver *s, gint num_workers)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *)s;
+
+  self->workers.num = num_workers;
+}
+
+void
+log_threaded_dest_driver_set_worker_partition_key(LogDriver *s, LogTemplate *partition_key)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *)s;
+
+  log_template_unref(self->workers.partition_key);
+  self->workers.partition_key = log_template_ref(partition_key);
+}
@@ -30,6 +30,8 @@
 #include "stats/stats-registry.h"
 #include "logqueue.h"
 #include "mainloop-worker.h"
+#include "template/templates.h"
+#include "atomic.h"
 #include <iv.h>
 #include <iv_event.h>
 
@@ -39,10 +41,58 @@ typedef enum
   WORKER_INSERT_RESULT_ERROR,
   WORKER_INSERT_RESULT_REWIND,
   WORKER_INSERT_RESULT_SUCCESS,
+  /* the message was added to the current batch, it stays in the backlog
+   * until the batch is flushed */
+  WORKER_INSERT_RESULT_QUEUED,
   WORKER_INSERT_RESULT_NOT_CONNECTED
 } worker_insert_result_t;
 
 typedef struct _LogThrDestDriver LogThrDestDriver;
+typedef struct _LogThrDestWorker LogThrDestWorker;
+
+/* The state of one worker thread of a LogThrDestDriver.  Each worker
+ * consumes its own LogQueue, so acknowledgements and rewinds of one
+ * worker never touch the backlog of another. */
+struct _LogThrDestWorker
+{
+  LogThrDestDriver *owner;
+  gint index;
+
+  LogQueue *queue;
+  gboolean connected;
+  gboolean suspended;
+  gint retries_counter;
+
+  struct
+  {
+    /* number of messages in the current batch, including the one being
+     * passed to insert() */
+    gint size;
+    struct timespec opened;
+  } batch;
+
+  /* batches submitted asynchronously, whose outcome is not known yet */
+  struct
+  {
+    gint messages;
+    gint batches;
+  } inflight;
+
+  StatsCounterItem *dropped_messages;
+  StatsCounterItem *stored_messages;
+  StatsCounterItem *processed_messages;
+
+  /* per-worker state of the driver, e.g. its connection */
+  gpointer user_data;
+
+  struct iv_event wake_up_event;
+  struct iv_event shutdown_event;
+  struct iv_timer timer_reopen;
+  struct iv_timer timer_throttle;
+  struct iv_timer timer_flush;
+  struct iv_task  do_work;
+};
+
 struct _LogThrDestDriver
 {
   LogDestDriver super;
@@ -50,19 +100,22 @@ struct _LogThrDestDriver
   StatsCounterItem *dropped_messages;
   StatsCounterItem *stored_messages;
   StatsCounterItem *processed_messages;
+  /* shared by the workers, histograms can be recorded from several threads */
+  StatsCounterItem *ingest_latency;
+  StatsCounterItem *queue_latency;
+  /* the time spent in worker.insert() and worker.flush() */
+  StatsCounterItem *write_latency;
 
-  gboolean suspended;
   time_t time_reopen;
 
-  LogQueue *queue;
-
-  /* Worker stuff */
+  /* Worker stuff, the callbacks are invoked from the worker threads */
   struct
   {
-    gboolean connected;
     void (*thread_init) (LogThrDestDriver *s);
     void (*thread_deinit) (LogThrDestDriver *s);
     worker_insert_result_t (*insert) (LogThrDestDriver *s, LogMessage *msg);
+    worker_insert_result_t (*flush) (LogThrDestDriver *s);
+    gboolean (*batch_full) (LogThrDestDriver *s);
     gboolean (*connect) (LogThrDestDriver *s);
     void (*worker_message_queue_empty)(LogThrDestDriver *s);
     void (*disconnect) (LogThrDestDriver *s);
@@ -82,17 +135,51 @@ struct _LogThrDestDriver
 
   struct
   {
-    gint counter;
     gint max;
   } retries;
 
+  /* Batching: insert() may return WORKER_INSERT_RESULT_QUEUED to keep the
+   * message in the backlog, any other result applies to the whole batch.
+   * flush() is called when the batch is full, when batch.timeout expires
+   * or when the queue becomes empty.  Drivers that limit their batches by
+   * something other than the number of lines can end a batch early with
+   * batch_full().
+   *
+   * flush() may also return WORKER_INSERT_RESULT_QUEUED, meaning that the
+   * batch was submitted asynchronously.  The driver then reports the
+   * outcome of each batch, in submission order, using
+   * log_threaded_dest_driver_batch_completed().  While batches are in
+   * flight, insert() and flush() may only return QUEUED, REWIND or
+   * NOT_CONNECTED, and disconnect() must abandon every in-flight batch.
+   * At most batch.max_inflight batches are submitted at a time.
+   *
+   * A synchronous flush() that learns the outcome of each message
+   * separately can resolve the head of the batch with
+   * log_threaded_dest_driver_batch_ack_messages(), its return value then
+   * applies to the rest of the batch. */
+  struct
+  {
+    gint lines;
+    glong timeout;
+    gint max_inflight;
+  } batch;
+
+  /* Multiple workers: drivers that keep their connection state in
+   * LogThrDestWorker.user_data set workers.supported; messages are
+   * distributed between the workers in a round-robin fashion, or by
+   * workers.partition_key to keep the ordering of messages with the same
+   * key. */
+  struct
+  {
+    gboolean supported;
+    gint num;
+    LogTemplate *partition_key;
+    LogThrDestWorker **list;
+    GAtomicCounter next;
+  } workers;
+
   void (*queue_method) (LogThrDestDriver *s);
   WorkerOptions worker_options;
-  struct iv_event wake_up_event;
-  struct iv_event shutdown_event;
-  struct iv_timer timer_reopen;
-  struct iv_timer timer_throttle;
-  struct iv_task  do_work;
 };
 
 gboolean log_threaded_dest_driver_deinit_method(LogPipe *s);
@@ -111,5 +198,27 @@ void log_threaded_dest_driver_message_rewind(LogThrDestDriver *self,
                                              LogMessage *msg);
 
 void log_threaded_dest_driver_set_max_retries(LogDriver *s, gint max_retries);
+void log_threaded_dest_driver_set_batch_lines(LogDriver *s, gint batch_lines);
+void log_threaded_dest_driver_set_batch_timeout(LogDriver *s, glong batch_timeout);
+void log_threaded_dest_driver_set_num_workers(LogDriver *s, gint num_workers);
+void log_threaded_dest_driver_set_worker_partition_key(LogDriver *s, LogTemplate *partition_key);
+
+LogThrDestWorker *log_threaded_dest_driver_get_worker(LogThrDestDriver *self);
+gint log_threaded_dest_driver_get_batch_size(LogThrDestDriver *self);
+void log_threaded_dest_driver_batch_completed(LogThrDestDriver *self, gint batch_size,
+                                              worker_insert_result_t result);
+void log_threaded_dest_driver_batch_ack_messages(LogThrDestDriver *self, gint num_messages, gboolean dropped);
+
+static inline gpointer
+log_threaded_dest_worker_get_user_data(LogThrDestWorker *self)
+{
+  return self->user_data;
+}
+
+static inline void
+log_threaded_dest_worker_set_user_data(LogThrDestWorker *self, gpointer user_data)
+{
+  self->user_data = user_data;
+}
 
 #endif
@@ -25,6 +25,7 @@
 #include "logwriter.h"
 #include "messages.h"
 #include "stats/stats-registry.h"
+#include "stats/stats-histogram.h"
 #include "hostname.h"
 #include "host-resolve.h"
 #include "seqnum.h"
@@ -66,6 +67,12 @@ struct _LogWriter
   StatsCounterItem *suppressed_messages;
   StatsCounterItem *processed_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *ingest_latency;
+  StatsCounterItem *queue_latency;
+  StatsCounterItem *write_latency;
+  /* pop times of the messages posted since the last flush, only tracked
+   * when write_latency is registered */
+  GArray *write_started;
   LogPipe *control;
   LogWriterOptions *options;
   LogMessage *last_msg;
@@ -1161,6 +1168,18 @@ log_writer_write_message(LogWriter *self, LogMessage *msg, LogPathOptions *path_
     }
 }
 
+/* the messages are only written out when the proto is flushed, so that's
+ * where their write latency ends */
+static void
+log_writer_record_write_latency(LogWriter *self)
+{
+  gint i;
+
+  for (i = 0; i < self->write_started->len; i++)
+    stats_counter_record_latency_since(self->write_latency, &g_array_index(self->write_started, GTimeVal, i));
+  g_array_set_size(self->write_started, 0);
+}
+
 static inline LogMessage *
 log_writer_queue_pop_message(LogWriter *self, LogPathOptions *path_options, gboolean force_flush)
 {
@@ -1196,18 +1215,30 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
     {
       LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
       LogMessage *msg = log_writer_queue_pop_message(self, &path_options, flush_mode == LW_FLUSH_FORCE);
+      GTimeVal popped = { 0, 0 };
 
       if (!msg)
         break;
 
+      if (self->write_latency)
+        g_get_current_time(&popped);
+
       if (!log_writer_write_message(self, msg, &path_options, &write_error))
         break;
+
+      if (self->write_latency)
+        g_array_append_val(self->write_started, popped);
     }
 
-  if (write_error)
-    return FALSE;
+  if (write_error || !log_writer_flush_finalize(self))
+    {
+      /* the pending messages are rewound or dropped, don't time them */
+      g_array_set_size(self->write_started, 0);
+      return FALSE;
+    }
 
-  return log_writer_flush_finalize(self);
+  log_writer_record_write_latency(self);
+  return TRUE;
 }
 
 static void
@@ -1281,9 +1312,19 @@ log_writer_init(LogPipe *s)
 
       stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance,
                              SC_TYPE_STORED, &self->stored_messages);
+
+      /* latency histograms cost a clock read per message and stage, they
+       * are only measured at the most detailed stats-level() */
+      stats_register_counter(MAX(self->stats_level, 3), self->stats_source | SCS_DESTINATION, self->stats_id,
+                             self->stats_instance, SC_TYPE_INGEST_LATENCY, &self->ingest_latency);
+      stats_register_counter(MAX(self->stats_level, 3), self->stats_source | SCS_DESTINATION, self->stats_id,
+                             self->stats_instance, SC_TYPE_QUEUE_LATENCY, &self->queue_latency);
+      stats_register_counter(MAX(self->stats_level, 3), self->stats_source | SCS_DESTINATION, self->stats_id,
+                             self->stats_instance, SC_TYPE_WRITE_LATENCY, &self->write_latency);
       stats_unlock();
     }
   log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_latency_counters(self->queue, self->ingest_latency, self->queue_latency);
   if (self->proto)
     {
       LogProtoClient *proto;
@@ -1324,6 +1365,7 @@ log_writer_deinit(LogPipe *s)
   ml_batched_timer_unregister(&self->mark_timer);
 
   log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_latency_counters(self->queue, NULL, NULL);
 
   stats_lock();
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_DROPPED,
@@ -1334,6 +1376,12 @@ log_writer_deinit(LogPipe *s)
                            &self->processed_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_STORED,
                            &self->stored_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance,
+                           SC_TYPE_INGEST_LATENCY, &self->ingest_latency);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance,
+                           SC_TYPE_QUEUE_LATENCY, &self->queue_latency);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance,
+                           SC_TYPE_WRITE_LATENCY, &self->write_latency);
   stats_unlock();
 
   return TRUE;
@@ -1348,6 +1396,7 @@ log_writer_free(LogPipe *s)
 
   if (self->line_buffer)
     g_string_free(self->line_buffer, TRUE);
+  g_array_free(self->write_started, TRUE);
 
   log_queue_unref(self->queue);
   if (self->last_msg)
@@ -1529,6 +1578,7 @@ log_writer_new(guint32 flags, GlobalConfig *cfg)
   self->super.free_fn = log_writer_free;
   self->flags = flags;
   self->line_buffer = g_string_sized_new(128);
+  self->write_started = g_array_new(FALSE, FALSE, sizeof(GTimeVal));
   self->pollable_state = -1;
   init_sequence_number(&self->seq_num);
 
@@ -1553,6 +1603,7 @@ log_writer_options_defaults(LogWriterOptions *options)
   options->mark_mode = MM_GLOBAL;
   options->mark_freq = -1;
   host_resolve_options_defaults(&options->host_resolve_options);
+  log_proto_client_options_defaults(&options->proto_options.super);
 }
 
 void
@@ -1611,6 +1662,7 @@ log_writer_options_init(LogWriterOptions *options, GlobalConfig *cfg, guint32 op
 
   if (options->flush_lines == -1)
     options->flush_lines = cfg->flush_lines;
+  options->proto_options.super.flush_lines = options->flush_lines;
   if (options->flush_timeout == -1)
     options->flush_timeout = cfg->flush_timeout;
   if (options->suppress == -1)
@@ -22,6 +22,7 @@
  *
  */
 #include "mainloop-call.h"
+#include "mainloop-event-loop.h"
 #include "tls-support.h"
 
 #include <iv.h>
@@ -88,6 +89,7 @@ main_loop_call(MainLoopTaskFunc func, gpointer user_data, gboolean wait)
   call_info.wait = wait;
   iv_list_add(&call_info.list, &main_task_queue);
   iv_event_post(&main_task_posted);
+  main_loop_event_loop_notify_main_call();
   if (wait)
     {
       while (call_info.pending)
@@ -124,6 +126,17 @@ main_loop_call_handler(gpointer user_data)
   g_static_mutex_unlock(&main_task_lock);
 }
 
+/* executes the pending calls without waiting for the main loop to do so,
+ * for the main thread blocked on another thread that might be waiting for
+ * one of them */
+void
+main_loop_call_run_pending(void)
+{
+  main_loop_assert_main_thread();
+
+  main_loop_call_handler(NULL);
+}
+
 void
 main_loop_call_thread_init(void)
 {
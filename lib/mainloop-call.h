@@ -27,6 +27,7 @@
 #include "mainloop.h"
 
 gpointer main_loop_call(MainLoopTaskFunc func, gpointer user_data, gboolean wait);
+void main_loop_call_run_pending(void);
 
 void main_loop_call_thread_init(void);
 void main_loop_call_thread_deinit(void);
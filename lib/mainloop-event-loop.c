@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+#include "mainloop-event-loop.h"
+#include "mainloop-worker.h"
+#include "mainloop-call.h"
+#include "logqueue.h"
+#include "tls-support.h"
+
+#include <iv.h>
+#include <iv_list.h>
+#include <iv_event.h>
+
+/************************************************************************************
+ * Event loop threads
+ ************************************************************************************/
+
+typedef struct _MainLoopEventLoopCall
+{
+  struct iv_list_head list;
+  MainLoopTaskFunc func;
+  gpointer user_data;
+  gpointer result;
+  /* the caller waits for the result, otherwise the call is freed once executed */
+  gboolean wait;
+  gboolean done;
+} MainLoopEventLoopCall;
+
+struct _MainLoopEventLoop
+{
+  GThread *thread;
+  GStaticMutex lock;
+  GCond *cond;
+  gboolean running;
+
+  /* calls into the event loop, posted by the main thread */
+  struct iv_event call_posted;
+  struct iv_list_head calls;
+  /* the event loop posted a main_loop_call() while the main thread
+   * might be waiting for one of our calls */
+  gboolean main_call_posted;
+
+  /* calls into the main thread, posted by the event loop, never waited for */
+  struct iv_event main_posted;
+  struct iv_list_head main_calls;
+};
+
+TLS_BLOCK_START
+{
+  MainLoopEventLoop *current_event_loop;
+}
+TLS_BLOCK_END;
+
+#define current_event_loop __tls_deref(current_event_loop)
+
+static gint main_loop_event_loops_num;
+static MainLoopEventLoop *main_loop_event_loops;
+static gint main_loop_event_loops_next;
+
+gboolean
+main_loop_event_loop_is_current(MainLoopEventLoop *self)
+{
+  return current_event_loop == self;
+}
+
+/* NOTE: runs in the main thread, the returned event loop is used for the
+ * lifetime of the connection */
+MainLoopEventLoop *
+main_loop_event_loop_assign(void)
+{
+  MainLoopEventLoop *self;
+
+  main_loop_assert_main_thread();
+
+  if (main_loop_event_loops_num == 0)
+    return NULL;
+
+  self = &main_loop_event_loops[main_loop_event_loops_next];
+  main_loop_event_loops_next = (main_loop_event_loops_next + 1) % main_loop_event_loops_num;
+  return self;
+}
+
+gboolean
+main_loop_event_loops_active(void)
+{
+  return main_loop_event_loops_num > 0;
+}
+
+static void
+_post_call(MainLoopEventLoop *self, MainLoopEventLoopCall *call)
+{
+  g_static_mutex_lock(&self->lock);
+  iv_list_add_tail(&call->list, &self->calls);
+  iv_event_post(&self->call_posted);
+  g_static_mutex_unlock(&self->lock);
+}
+
+/* NOTE: runs in the main thread, @func is executed asynchronously in the event loop */
+void
+main_loop_event_loop_post(MainLoopEventLoop *self, MainLoopTaskFunc func, gpointer user_data)
+{
+  MainLoopEventLoopCall *call = g_new0(MainLoopEventLoopCall, 1);
+
+  INIT_IV_LIST_HEAD(&call->list);
+  call->func = func;
+  call->user_data = user_data;
+  call->wait = FALSE;
+  _post_call(self, call);
+}
+
+/*
+ * Execute @func in the event loop thread and wait for its completion.
+ *
+ * The event loop may be in the middle of a batch that calls
+ * main_loop_call() and waits for the main thread (e.g. a file destination
+ * opening its writer), so the main thread keeps executing those calls
+ * while it waits, see main_loop_event_loop_notify_main_call().
+ */
+gpointer
+main_loop_event_loop_call(MainLoopEventLoop *self, MainLoopTaskFunc func, gpointer user_data)
+{
+  MainLoopEventLoopCall call;
+
+  if (main_loop_event_loop_is_current(self))
+    return func(user_data);
+
+  INIT_IV_LIST_HEAD(&call.list);
+  call.func = func;
+  call.user_data = user_data;
+  call.result = NULL;
+  call.wait = TRUE;
+  call.done = FALSE;
+
+  _post_call(self, &call);
+
+  g_static_mutex_lock(&self->lock);
+  while (!call.done)
+    {
+      if (self->main_call_posted && main_loop_is_main_thread())
+        {
+          self->main_call_posted = FALSE;
+          g_static_mutex_unlock(&self->lock);
+          main_loop_call_run_pending();
+          g_static_mutex_lock(&self->lock);
+          continue;
+        }
+      g_cond_wait(self->cond, g_static_mutex_get_mutex(&self->lock));
+    }
+  g_static_mutex_unlock(&self->lock);
+  return call.result;
+}
+
+/* NOTE: runs in the thread calling main_loop_call(), wakes up the main
+ * thread if it is waiting in main_loop_event_loop_call() for the event
+ * loop of the caller */
+void
+main_loop_event_loop_notify_main_call(void)
+{
+  MainLoopEventLoop *self = current_event_loop;
+
+  if (!self)
+    return;
+
+  g_static_mutex_lock(&self->lock);
+  self->main_call_posted = TRUE;
+  g_cond_broadcast(self->cond);
+  g_static_mutex_unlock(&self->lock);
+}
+
+/* NOTE: runs in the event loop thread */
+static void
+_handle_calls(gpointer s)
+{
+  MainLoopEventLoop *self = (MainLoopEventLoop *) s;
+
+  g_static_mutex_lock(&self->lock);
+  while (!iv_list_empty(&self->calls))
+    {
+      MainLoopEventLoopCall *call = iv_list_entry(self->calls.next, MainLoopEventLoopCall, list);
+      gpointer result;
+
+      iv_list_del_init(&call->list);
+      g_static_mutex_unlock(&self->lock);
+
+      result = call->func(call->user_data);
+
+      g_static_mutex_lock(&self->lock);
+      if (!call->wait)
+        {
+          g_free(call);
+          continue;
+        }
+      call->result = result;
+      call->done = TRUE;
+      g_cond_broadcast(self->cond);
+    }
+  g_static_mutex_unlock(&self->lock);
+}
+
+/* NOTE: runs in the event loop thread, @func is executed asynchronously in the main thread */
+void
+main_loop_event_loop_post_to_main(MainLoopEventLoop *self, MainLoopTaskFunc func, gpointer user_data)
+{
+  MainLoopEventLoopCall *call = g_new0(MainLoopEventLoopCall, 1);
+
+  INIT_IV_LIST_HEAD(&call->list);
+  call->func = func;
+  call->user_data = user_data;
+
+  g_static_mutex_lock(&self->lock);
+  iv_list_add_tail(&call->list, &self->main_calls);
+  g_static_mutex_unlock(&self->lock);
+  iv_event_post(&self->main_posted);
+}
+
+/* NOTE: runs in the main thread */
+static void
+_handle_main_calls(gpointer s)
+{
+  MainLoopEventLoop *self = (MainLoopEventLoop *) s;
+
+  g_static_mutex_lock(&self->lock);
+  while (!iv_list_empty(&self->main_calls))
+    {
+      MainLoopEventLoopCall *call = iv_list_entry(self->main_calls.next, MainLoopEventLoopCall, list);
+
+      iv_list_del_init(&call->list);
+      g_static_mutex_unlock(&self->lock);
+
+      call->func(call->user_data);
+      g_free(call);
+
+      g_static_mutex_lock(&self->lock);
+    }
+  g_static_mutex_unlock(&self->lock);
+}
+
+/* NOTE: runs in the main thread */
+static gpointer
+_sync_point_reached(gpointer user_data)
+{
+  main_loop_worker_job_complete();
+  return NULL;
+}
+
+/* NOTE: runs in the event loop thread, calls are handled in between batches */
+static gpointer
+_sync_point(gpointer s)
+{
+  MainLoopEventLoop *self = (MainLoopEventLoop *) s;
+
+  main_loop_event_loop_post_to_main(self, _sync_point_reached, NULL);
+  return NULL;
+}
+
+/*
+ * Account each event loop as a running job until it finishes the batch it
+ * is currently processing. Called by main_loop_worker_sync_call() once
+ * main_loop_workers_quit is set, after which event loops don't start new
+ * batches until the quit flag is cleared again.
+ *
+ * The main thread does not wait here: the event loop might be waiting for
+ * the main thread in main_loop_call() to finish its batch. The
+ * synchronized function is called by main_loop_worker_job_complete() when
+ * the last job, event loop or I/O worker, is finished.
+ */
+void
+main_loop_event_loops_sync(void)
+{
+  gint i;
+
+  main_loop_assert_main_thread();
+
+  for (i = 0; i < main_loop_event_loops_num; i++)
+    {
+      main_loop_worker_job_start();
+      main_loop_event_loop_post(&main_loop_event_loops[i], _sync_point, &main_loop_event_loops[i]);
+    }
+}
+
+static gpointer
+_quit(gpointer user_data)
+{
+  iv_quit();
+  return NULL;
+}
+
+static gpointer
+_event_loop_thread(gpointer s)
+{
+  MainLoopEventLoop *self = (MainLoopEventLoop *) s;
+
+  iv_init();
+  main_loop_worker_thread_start(NULL);
+  current_event_loop = self;
+
+  IV_EVENT_INIT(&self->call_posted);
+  self->call_posted.cookie = self;
+  self->call_posted.handler = _handle_calls;
+  iv_event_register(&self->call_posted);
+
+  g_static_mutex_lock(&self->lock);
+  self->running = TRUE;
+  g_cond_broadcast(self->cond);
+  g_static_mutex_unlock(&self->lock);
+
+  iv_main();
+
+  iv_event_unregister(&self->call_posted);
+  current_event_loop = NULL;
+  main_loop_worker_thread_stop();
+  iv_deinit();
+  return NULL;
+}
+
+static void
+_event_loop_start(MainLoopEventLoop *self)
+{
+  g_static_mutex_init(&self->lock);
+  self->cond = g_cond_new();
+  INIT_IV_LIST_HEAD(&self->calls);
+  INIT_IV_LIST_HEAD(&self->main_calls);
+
+  IV_EVENT_INIT(&self->main_posted);
+  self->main_posted.cookie = self;
+  self->main_posted.handler = _handle_main_calls;
+  iv_event_register(&self->main_posted);
+
+  self->thread = g_thread_create_full(_event_loop_thread, self, 1024 * 1024, TRUE, TRUE, G_THREAD_PRIORITY_NORMAL, NULL);
+  g_assert(self->thread != NULL);
+
+  /* calls can only be posted once the thread registered its event */
+  g_static_mutex_lock(&self->lock);
+  while (!self->running)
+    g_cond_wait(self->cond, g_static_mutex_get_mutex(&self->lock));
+  g_static_mutex_unlock(&self->lock);
+}
+
+static void
+_event_loop_stop(MainLoopEventLoop *self)
+{
+  main_loop_event_loop_post(self, _quit, NULL);
+  g_thread_join(self->thread);
+
+  /* notifications still in flight are delivered, they hold references
+   * that would be leaked otherwise */
+  _handle_main_calls(self);
+  iv_event_unregister(&self->main_posted);
+
+  g_cond_free(self->cond);
+  g_static_mutex_free(&self->lock);
+}
+
+void
+main_loop_event_loop_init(void)
+{
+  gint i;
+
+  /* event loop threads take part in LogQueue's per-thread input queues,
+   * along with the I/O worker threads */
+  main_loop_event_loops_num = MIN(main_loop_event_loops_num, MAIN_LOOP_MAX_WORKER_THREADS - log_queue_max_threads);
+  if (main_loop_event_loops_num <= 0)
+    {
+      main_loop_event_loops_num = 0;
+      return;
+    }
+  log_queue_set_max_threads(log_queue_max_threads + main_loop_event_loops_num);
+
+  main_loop_event_loops = g_new0(MainLoopEventLoop, main_loop_event_loops_num);
+  for (i = 0; i < main_loop_event_loops_num; i++)
+    _event_loop_start(&main_loop_event_loops[i]);
+}
+
+void
+main_loop_event_loop_deinit(void)
+{
+  gint i;
+
+  for (i = 0; i < main_loop_event_loops_num; i++)
+    _event_loop_stop(&main_loop_event_loops[i]);
+
+  g_free(main_loop_event_loops);
+  main_loop_event_loops = NULL;
+  main_loop_event_loops_num = 0;
+}
+
+static GOptionEntry main_loop_event_loop_options[] =
+{
+  { "event-loop-threads",  0,         0, G_OPTION_ARG_INT, &main_loop_event_loops_num, "Set the number of threads polling accepted connections, 0 polls them in the main thread", "<num>" },
+  { NULL },
+};
+
+void
+main_loop_event_loop_add_options(GOptionContext *ctx)
+{
+  g_option_context_add_main_entries(ctx, main_loop_event_loop_options, NULL);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+#ifndef MAINLOOP_EVENT_LOOP_H_INCLUDED
+#define MAINLOOP_EVENT_LOOP_H_INCLUDED 1
+
+#include "mainloop.h"
+
+/*
+ * Event loop threads run their own ivykis loop and own the I/O watches of
+ * the LogReader instances bound to them (see log_reader_set_event_loop()).
+ * Input processing for those readers happens in-line in the event loop
+ * thread, so neither polling nor watch updates go through the main thread.
+ *
+ * Initialization/deinitialization still happens in the main thread, the
+ * parts that touch ivykis state are executed in the owning event loop
+ * using main_loop_event_loop_call().  While waiting for those, the main
+ * thread keeps executing main_loop_call() requests, as the event loop may
+ * be waiting for one of them to finish its batch.
+ */
+typedef struct _MainLoopEventLoop MainLoopEventLoop;
+
+MainLoopEventLoop *main_loop_event_loop_assign(void);
+gboolean main_loop_event_loop_is_current(MainLoopEventLoop *self);
+
+gpointer main_loop_event_loop_call(MainLoopEventLoop *self, MainLoopTaskFunc func, gpointer user_data);
+void main_loop_event_loop_post(MainLoopEventLoop *self, MainLoopTaskFunc func, gpointer user_data);
+void main_loop_event_loop_notify_main_call(void);
+void main_loop_event_loop_post_to_main(MainLoopEventLoop *self, MainLoopTaskFunc func, gpointer user_data);
+
+gboolean main_loop_event_loops_active(void);
+void main_loop_event_loops_sync(void);
+
+void main_loop_event_loop_add_options(GOptionContext *ctx);
+
+void main_loop_event_loop_init(void);
+void main_loop_event_loop_deinit(void);
+
+static inline void
+main_loop_event_loop_assert_current(MainLoopEventLoop *self)
+{
+#if SYSLOG_NG_ENABLE_DEBUG
+  g_assert(main_loop_event_loop_is_current(self));
+#endif
+}
+
+#endif
@@ -23,6 +23,7 @@
  */
 #include "mainloop-worker.h"
 #include "mainloop-call.h"
+#include "mainloop-event-loop.h"
 #include "tls-support.h"
 #include "apphook.h"
 
@@ -340,7 +341,7 @@ main_loop_worker_sync_call(void (*func)(void))
 
   g_assert(main_loop_workers_sync_func == NULL || main_loop_workers_sync_func == func);
 
-  if (main_loop_workers_running == 0)
+  if (main_loop_workers_running == 0 && !main_loop_event_loops_active())
     {
       func();
     }
@@ -348,6 +349,12 @@ main_loop_worker_sync_call(void (*func)(void))
     {
       main_loop_workers_sync_func = func;
       _request_all_threads_to_exit();
+
+      /* event loop threads keep running across reloads, they are
+       * accounted as jobs until they finish their current batch, after
+       * which they see main_loop_workers_quit and don't process input
+       * until jobs are reenabled. */
+      main_loop_event_loops_sync();
     }
 }
 
@@ -24,6 +24,7 @@
 #include "mainloop.h"
 #include "mainloop-worker.h"
 #include "mainloop-io-worker.h"
+#include "mainloop-event-loop.h"
 #include "mainloop-call.h"
 #include "apphook.h"
 #include "cfg.h"
@@ -83,7 +84,25 @@
  *     of worker threads, everything else remains in the main thread
  *     (internal messages, incoming connections, etc).
  *   - _all_ I/O polling must be registered in the main thread (update_watches
- *     and friends)
+ *     and friends), except for LogReader instances bound to an event loop
+ *     thread (--event-loop-threads), see below
+ *
+ * Event loop threads
+ * ==================
+ *   - event loop threads run their own ivykis loop, accepted connections
+ *     are distributed among them at accept time
+ *   - a LogReader bound to an event loop registers its watches and
+ *     processes its input in that thread, the main thread is not involved
+ *     on a per-message basis
+ *   - init/deinit is still driven by the main thread, but the ivykis
+ *     related parts are executed synchronously in the event loop.  The
+ *     main thread keeps executing main_loop_call() requests while it
+ *     waits, as destinations fed by the event loop may block on them
+ *   - notifications (e.g. NC_CLOSE) are posted to the main thread
+ *     asynchronously
+ *   - main_loop_worker_sync_call() stops event loops from processing
+ *     further input until the reload/termination is finished, they are
+ *     accounted as running jobs until they finish their current batch
  *
  */
 
@@ -426,6 +445,7 @@ main_loop_init(void)
   main_thread_handle = get_thread_id();
   main_loop_worker_init();
   main_loop_io_worker_init();
+  main_loop_event_loop_init();
   main_loop_call_init();
 
   main_loop_init_events();
@@ -476,6 +496,7 @@ main_loop_deinit(void)
   iv_event_unregister(&exit_requested);
   iv_event_unregister(&reload_config_requested);
   main_loop_call_deinit();
+  main_loop_event_loop_deinit();
   main_loop_io_worker_deinit();
   main_loop_worker_deinit();
 }
@@ -515,4 +536,5 @@ main_loop_add_options(GOptionContext *ctx)
 {
   g_option_context_add_main_entries(ctx, main_loop_options, NULL);
   main_loop_io_worker_add_options(ctx);
+  main_loop_event_loop_add_options(ctx);
 }
@@ -55,6 +55,8 @@ enum
   LP_LOCAL = 0x0200,
   /* for the date part of a message, only skip it, don't fully parse - recommended for keep_timestamp(no) */
   LP_NO_PARSE_DATE = 0x0400,
+  /* store the raw message in RAWMSG, values are referenced from it instead of copied where possible */
+  LP_STORE_RAW_MESSAGE = 0x0800,
 };
 
 typedef struct _MsgFormatHandler MsgFormatHandler;
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "regexp-jit.h"
+#include "tls-support.h"
+
+/* PCRE allocates a 32k machine stack for JIT code by default, which is
+ * not enough for patterns with deep backtracking.  Each thread gets its
+ * own stack that grows up to REGEXP_JIT_STACK_MAX on demand. */
+#define REGEXP_JIT_STACK_START (32 * 1024)
+#define REGEXP_JIT_STACK_MAX   (512 * 1024)
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+
+TLS_BLOCK_START
+{
+  pcre_jit_stack *regexp_jit_stack;
+}
+TLS_BLOCK_END;
+
+#define regexp_jit_stack  __tls_deref(regexp_jit_stack)
+
+static pcre_jit_stack *
+_get_thread_jit_stack(void *user_data)
+{
+  if (!regexp_jit_stack)
+    regexp_jit_stack = pcre_jit_stack_alloc(REGEXP_JIT_STACK_START, REGEXP_JIT_STACK_MAX);
+
+  /* returning NULL makes PCRE fall back to its builtin stack */
+  return regexp_jit_stack;
+}
+
+pcre_extra *
+regexp_jit_study(pcre *pattern, const gchar **errptr)
+{
+  pcre_extra *extra;
+
+  extra = pcre_study(pattern, PCRE_STUDY_JIT_COMPILE, errptr);
+  if (extra)
+    pcre_assign_jit_stack(extra, _get_thread_jit_stack, NULL);
+  return extra;
+}
+
+void
+regexp_jit_free_study(pcre_extra *extra)
+{
+  if (extra)
+    pcre_free_study(extra);
+}
+
+gboolean
+regexp_jit_is_compiled(pcre *pattern, pcre_extra *extra)
+{
+  gint jit = 0;
+
+  if (!extra)
+    return FALSE;
+  if (pcre_fullinfo(pattern, extra, PCRE_INFO_JIT, &jit) < 0)
+    return FALSE;
+  return !!jit;
+}
+
+void
+regexp_jit_thread_deinit(void)
+{
+  if (regexp_jit_stack)
+    {
+      pcre_jit_stack_free(regexp_jit_stack);
+      regexp_jit_stack = NULL;
+    }
+}
+
+#else
+
+pcre_extra *
+regexp_jit_study(pcre *pattern, const gchar **errptr)
+{
+  return pcre_study(pattern, 0, errptr);
+}
+
+void
+regexp_jit_free_study(pcre_extra *extra)
+{
+  if (extra)
+    pcre_free(extra);
+}
+
+gboolean
+regexp_jit_is_compiled(pcre *pattern, pcre_extra *extra)
+{
+  return FALSE;
+}
+
+void
+regexp_jit_thread_deinit(void)
+{
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef REGEXP_JIT_H_INCLUDED
+#define REGEXP_JIT_H_INCLUDED
+
+#include "syslog-ng.h"
+
+#include <pcre.h>
+
+/*
+ * Thin wrappers around pcre_study() that always request JIT compilation
+ * when the PCRE library supports it.  JIT-compiled patterns execute on a
+ * per-thread JIT stack that is allocated on first use and released by
+ * regexp_jit_thread_deinit(), so pcre_exec() callers need not care about
+ * stack sizing.
+ */
+pcre_extra *regexp_jit_study(pcre *pattern, const gchar **errptr);
+void regexp_jit_free_study(pcre_extra *extra);
+gboolean regexp_jit_is_compiled(pcre *pattern, pcre_extra *extra);
+
+void regexp_jit_thread_deinit(void);
+
+#endif
@@ -22,6 +22,7 @@
  *
  */
 #include "stats/stats-cluster.h"
+#include "stats/stats-histogram.h"
 
 #include <string.h>
 
@@ -49,6 +50,13 @@ stats_cluster_get_type_name(gint type)
     /* [SC_TYPE_STORED]   = */  "stored",
     /* [SC_TYPE_SUPPRESSED] = */ "suppressed",
     /* [SC_TYPE_STAMP] = */ "stamp",
+    /* [SC_TYPE_BATCH_SIZE] = */ "batch_size",
+    /* [SC_TYPE_WRITE_SIZE] = */ "write_size",
+    /* [SC_TYPE_COMPRESSION_RATIO] = */ "compression_ratio",
+    /* [SC_TYPE_INGEST_LATENCY] = */ "ingest_latency",
+    /* [SC_TYPE_QUEUE_LATENCY] = */ "queue_latency",
+    /* [SC_TYPE_WRITE_LATENCY] = */ "write_latency",
+    /* [SC_TYPE_EVAL_TIME] = */ "eval_time_ns",
   };
 
   return tag_names[type];
@@ -95,7 +103,9 @@ _get_module_name(gint source)
     "riemann",
     "journald",
     "java",
-    "http"
+    "http",
+    "regexp",
+    "correllation"
   };
   return module_names[source & SCS_SOURCE_MASK];
 }
@@ -142,6 +152,32 @@ stats_cluster_hash(const StatsCluster *self)
   return g_str_hash(self->id) + g_str_hash(self->instance) + self->component;
 }
 
+/* message counters of a static cluster (e.g. a destination driver) are
+ * bumped by every worker thread that processes its messages, they are
+ * sharded to avoid contending on them.  Dynamic clusters are too many to
+ * spend the memory on that, the rest of the types are set, not
+ * incremented. */
+static gboolean
+_is_counter_sharded(StatsCluster *self, gint type)
+{
+  if (self->dynamic)
+    return FALSE;
+
+  return type == SC_TYPE_PROCESSED ||
+         type == SC_TYPE_DROPPED ||
+         type == SC_TYPE_STORED ||
+         type == SC_TYPE_SUPPRESSED ||
+         type == SC_TYPE_EVAL_TIME;
+}
+
+static gboolean
+_is_counter_histogram(gint type)
+{
+  return type == SC_TYPE_INGEST_LATENCY ||
+         type == SC_TYPE_QUEUE_LATENCY ||
+         type == SC_TYPE_WRITE_LATENCY;
+}
+
 StatsCounterItem *
 stats_cluster_track_counter(StatsCluster *self, gint type)
 {
@@ -149,6 +185,11 @@ stats_cluster_track_counter(StatsCluster *self, gint type)
 
   g_assert(type < SC_TYPE_MAX);
 
+  if (_is_counter_sharded(self, type))
+    stats_counter_enable_sharding(&self->counters[type]);
+  if (_is_counter_histogram(type) && !self->counters[type].histogram)
+    self->counters[type].histogram = stats_histogram_new();
+
   self->live_mask |= type_mask;
   self->use_count++;
   return &self->counters[type];
@@ -179,6 +220,14 @@ stats_cluster_new(gint component, const gchar *id, const gchar *instance)
 void
 stats_cluster_free(StatsCluster *self)
 {
+  gint type;
+
+  for (type = 0; type < SC_TYPE_MAX; type++)
+    {
+      stats_counter_free_shards(&self->counters[type]);
+      if (self->counters[type].histogram)
+        stats_histogram_free(self->counters[type].histogram);
+    }
   g_free(self->id);
   g_free(self->instance);
   g_free(self);
@@ -34,6 +34,13 @@ typedef enum
   SC_TYPE_STORED,    /* number of messages on disk */
   SC_TYPE_SUPPRESSED,/* number of messages suppressed */
   SC_TYPE_STAMP,     /* timestamp */
+  SC_TYPE_BATCH_SIZE,/* average number of messages received by a single read or written by a single write */
+  SC_TYPE_WRITE_SIZE,/* average number of bytes written by a single write */
+  SC_TYPE_COMPRESSION_RATIO, /* size of the stored data in percent of its uncompressed size */
+  SC_TYPE_INGEST_LATENCY, /* histogram of the time between receiving a message and putting it into a destination queue */
+  SC_TYPE_QUEUE_LATENCY,  /* histogram of the time a message spends in a destination queue */
+  SC_TYPE_WRITE_LATENCY,  /* histogram of the time between taking a message off the queue and writing it */
+  SC_TYPE_EVAL_TIME, /* cumulative time spent evaluating an expression, in nanoseconds */
   SC_TYPE_MAX
 } StatsCounterType;
 
@@ -80,6 +87,8 @@ enum
   SCS_JOURNALD       = 34,
   SCS_JAVA           = 35,
   SCS_HTTP           = 36,
+  SCS_REGEXP         = 37,
+  SCS_CORRELLATION   = 38,
   SCS_MAX,
   SCS_SOURCE_MASK    = 0xff
 };
@@ -24,11 +24,65 @@
 #include "stats/stats-counter.h"
 #include "stats/stats-cluster.h"
 #include "stats/stats-registry.h"
+#include "stats/stats-histogram.h"
+#include "tls-support.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TLS_BLOCK_START
+{
+  /* the shard index is shifted by one, to make 0 the unassigned state */
+  gint stats_counter_shard_index;
+}
+TLS_BLOCK_END;
+
+#define stats_counter_shard_index __tls_deref(stats_counter_shard_index)
+
+static gint stats_counter_next_shard_index;
+
+/* threads are assigned shards in a round-robin fashion as they first
+ * increment a sharded counter, a shard is only shared if there are more
+ * threads than STATS_COUNTER_SHARDS */
+gint
+stats_counter_get_shard_index(void)
+{
+  if (G_UNLIKELY(!stats_counter_shard_index))
+    stats_counter_shard_index = (__sync_fetch_and_add(&stats_counter_next_shard_index, 1) & (STATS_COUNTER_SHARDS - 1)) + 1;
+  return stats_counter_shard_index - 1;
+}
+
+/* must be called before the counter is handed out to the threads
+ * incrementing it */
+void
+stats_counter_enable_sharding(StatsCounterItem *counter)
+{
+  if (counter->shards)
+    return;
+
+  /* align to the cacheline, otherwise neighbouring shards would share one */
+  if (posix_memalign((void **) &counter->shards, sizeof(StatsCounterShard),
+                     sizeof(StatsCounterShard) * STATS_COUNTER_SHARDS) != 0)
+    {
+      counter->shards = NULL;
+      return;
+    }
+  memset(counter->shards, 0, sizeof(StatsCounterShard) * STATS_COUNTER_SHARDS);
+}
+
+void
+stats_counter_free_shards(StatsCounterItem *counter)
+{
+  free(counter->shards);
+  counter->shards = NULL;
+}
 
 static void
 _reset_counter(StatsCluster *sc, gint type, StatsCounterItem *counter, gpointer user_data)
 {
   stats_counter_set(counter, 0);
+  if (counter->histogram)
+    stats_histogram_reset(counter->histogram);
 }
 
 static inline void
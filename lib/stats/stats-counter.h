@@ -26,49 +26,99 @@
 
 #include "syslog-ng.h"
 
+/* number of per-thread slots of a sharded counter, must be a power of 2 */
+#define STATS_COUNTER_SHARDS 16
+
+/* each shard is on a cacheline of its own, so that threads incrementing
+ * the same counter via different shards do not contend */
+typedef struct _StatsCounterShard
+{
+  guint64 value;
+  gchar __padding[64 - sizeof(guint64)];
+} StatsCounterShard;
+
+typedef struct _StatsHistogram StatsHistogram;
+
 typedef struct _StatsCounterItem
 {
-  gint value;
+  guint64 value;
+  /* counters incremented by several worker threads spread their
+   * increments over these slots, which are only summed up when the
+   * counter is queried, see stats_counter_enable_sharding() */
+  StatsCounterShard *shards;
+  /* latency counters record into a histogram instead of value, see
+   * stats-histogram.h */
+  StatsHistogram *histogram;
 } StatsCounterItem;
 
+gint stats_counter_get_shard_index(void);
+void stats_counter_enable_sharding(StatsCounterItem *counter);
+void stats_counter_free_shards(StatsCounterItem *counter);
+
+static inline guint64 *
+_stats_counter_get_slot(StatsCounterItem *counter)
+{
+  if (counter->shards)
+    return &counter->shards[stats_counter_get_shard_index()].value;
+  return &counter->value;
+}
 
 static inline void
 stats_counter_add(StatsCounterItem *counter, gint add)
 {
   if (counter)
-    g_atomic_int_add(&counter->value, add);
+    __sync_fetch_and_add(_stats_counter_get_slot(counter), (gint64) add);
 }
 
 static inline void
 stats_counter_inc(StatsCounterItem *counter)
 {
   if (counter)
-    g_atomic_int_inc(&counter->value);
+    __sync_fetch_and_add(_stats_counter_get_slot(counter), 1);
 }
 
 static inline void
 stats_counter_dec(StatsCounterItem *counter)
 {
   if (counter)
-    g_atomic_int_add(&counter->value, -1);
+    __sync_fetch_and_sub(_stats_counter_get_slot(counter), 1);
 }
 
 /* NOTE: this is _not_ atomic and doesn't have to be as sets would race anyway */
 static inline void
-stats_counter_set(StatsCounterItem *counter, guint32 value)
+stats_counter_set(StatsCounterItem *counter, guint64 value)
 {
+  gint i;
+
   if (counter)
-    counter->value = value;
+    {
+      counter->value = value;
+      if (counter->shards)
+        {
+          for (i = 0; i < STATS_COUNTER_SHARDS; i++)
+            counter->shards[i].value = 0;
+        }
+    }
 }
 
-/* NOTE: this is _not_ atomic and doesn't have to be as sets would race anyway */
-static inline guint32
+/* NOTE: this is _not_ atomic and doesn't have to be as sets would race
+ * anyway, the shards are summed without synchronization, the result may
+ * miss increments that happen concurrently */
+static inline guint64
 stats_counter_get(StatsCounterItem *counter)
 {
-  guint32 result = 0;
+  guint64 result = 0;
+  gint i;
 
   if (counter)
-    result = counter->value;
+    {
+      result = counter->value;
+      if (counter->shards)
+        {
+          for (i = 0; i < STATS_COUNTER_SHARDS; i++)
+            result += counter->shards[i].value;
+        }
+    }
   return result;
 }
 
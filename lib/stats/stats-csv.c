@@ -23,6 +23,7 @@
  */
 #include "stats/stats-csv.h"
 #include "stats/stats-registry.h"
+#include "stats/stats-histogram.h"
 #include "utf8utils.h"
 
 #include <string.h>
@@ -57,29 +58,66 @@ stats_format_csv_escapevar(const gchar *var)
   return escaped_result;
 }
 
+typedef struct _StatsCsvRow
+{
+  GString *csv;
+  const gchar *component;
+  const gchar *id;
+  const gchar *instance;
+  gchar state;
+  const gchar *type_name;
+} StatsCsvRow;
+
+static void
+stats_format_csv_row(StatsCsvRow *row, const gchar *type_name, guint64 value)
+{
+  gchar *tag_name;
+
+  tag_name = stats_format_csv_escapevar(type_name);
+  g_string_append_printf(row->csv, "%s;%s;%s;%c;%s;%" G_GUINT64_FORMAT "\n",
+                         row->component, row->id, row->instance, row->state, tag_name, value);
+  g_free(tag_name);
+}
+
+static void
+stats_format_csv_histogram_summary(const gchar *name, guint64 value, gpointer user_data)
+{
+  StatsCsvRow *row = (StatsCsvRow *) user_data;
+  gchar type_name[64];
+
+  g_snprintf(type_name, sizeof(type_name), "%s_%s", row->type_name, name);
+  stats_format_csv_row(row, type_name, value);
+}
+
 static void
 stats_format_csv(StatsCluster *sc, gint type, StatsCounterItem *counter, gpointer user_data)
 {
-  GString *csv = (GString *) user_data;
-  gchar *s_id, *s_instance, *tag_name;
+  StatsCsvRow row;
+  gchar *s_id, *s_instance;
   gchar buf[32];
-  gchar state;
 
   s_id = stats_format_csv_escapevar(sc->id);
   s_instance = stats_format_csv_escapevar(sc->instance);
 
+  row.csv = (GString *) user_data;
+  row.component = stats_cluster_get_component_name(sc, buf, sizeof(buf));
+  row.id = s_id;
+  row.instance = s_instance;
+  row.type_name = stats_cluster_get_type_name(type);
+
   if (sc->dynamic)
-    state = 'd';
+    row.state = 'd';
   else if (sc->use_count == 0)
-    state = 'o';
+    row.state = 'o';
   else
-    state = 'a';
+    row.state = 'a';
+
+  /* histograms are summarized in a row per summary value, e.g. write_latency_p99 */
+  if (counter->histogram)
+    stats_histogram_foreach_summary(counter->histogram, stats_format_csv_histogram_summary, &row);
+  else
+    stats_format_csv_row(&row, row.type_name, stats_counter_get(&sc->counters[type]));
 
-  tag_name = stats_format_csv_escapevar(stats_cluster_get_type_name(type));
-  g_string_append_printf(csv, "%s;%s;%s;%c;%s;%u\n",
-                         stats_cluster_get_component_name(sc, buf, sizeof(buf)),
-                         s_id, s_instance, state, tag_name, stats_counter_get(&sc->counters[type]));
-  g_free(tag_name);
   g_free(s_id);
   g_free(s_instance);
 }
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "stats/stats-histogram.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+StatsHistogram *
+stats_histogram_new(void)
+{
+  StatsHistogram *self = g_new0(StatsHistogram, 1);
+
+  if (posix_memalign((void **) &self->shards, 64, sizeof(StatsHistogramShard) * STATS_HISTOGRAM_SHARDS) != 0)
+    g_assert_not_reached();
+  stats_histogram_reset(self);
+  return self;
+}
+
+void
+stats_histogram_free(StatsHistogram *self)
+{
+  free(self->shards);
+  g_free(self);
+}
+
+/* NOTE: not atomic, samples recorded concurrently may get lost, just
+ * like with stats_counter_set() */
+void
+stats_histogram_reset(StatsHistogram *self)
+{
+  memset(self->shards, 0, sizeof(StatsHistogramShard) * STATS_HISTOGRAM_SHARDS);
+}
+
+guint64
+stats_histogram_get_bucket_upper_bound(gint index)
+{
+  gint shift;
+  guint64 lower;
+
+  if (index < STATS_HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  shift = index / STATS_HISTOGRAM_SUB_BUCKETS - 1;
+  lower = ((guint64) STATS_HISTOGRAM_SUB_BUCKETS + index % STATS_HISTOGRAM_SUB_BUCKETS) << shift;
+  return lower + (G_GUINT64_CONSTANT(1) << shift) - 1;
+}
+
+guint64
+stats_histogram_get_count(StatsHistogram *self)
+{
+  guint64 count = 0;
+  gint i;
+
+  for (i = 0; i < STATS_HISTOGRAM_SHARDS; i++)
+    count += self->shards[i].count;
+  return count;
+}
+
+guint64
+stats_histogram_get_max(StatsHistogram *self)
+{
+  guint64 max = 0;
+  gint i;
+
+  for (i = 0; i < STATS_HISTOGRAM_SHARDS; i++)
+    max = MAX(max, self->shards[i].max);
+  return max;
+}
+
+/* returns the upper bound of the bucket the requested percentile falls
+ * into, capped at the largest value recorded.  The shards are summed up
+ * without synchronization, the same way as sharded counters are. */
+guint64
+stats_histogram_get_percentile(StatsHistogram *self, gint percentile)
+{
+  guint64 count, rank, seen = 0;
+  gint bucket, i;
+
+  count = stats_histogram_get_count(self);
+  if (count == 0)
+    return 0;
+
+  rank = (count * percentile + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+
+  for (bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; bucket++)
+    {
+      for (i = 0; i < STATS_HISTOGRAM_SHARDS; i++)
+        seen += self->shards[i].buckets[bucket];
+
+      if (seen >= rank)
+        return MIN(stats_histogram_get_bucket_upper_bound(bucket), stats_histogram_get_max(self));
+    }
+  return stats_histogram_get_max(self);
+}
+
+void
+stats_histogram_foreach_summary(StatsHistogram *self, StatsHistogramSummaryFunc func, gpointer user_data)
+{
+  func("count", stats_histogram_get_count(self), user_data);
+  func("p50", stats_histogram_get_percentile(self, 50), user_data);
+  func("p90", stats_histogram_get_percentile(self, 90), user_data);
+  func("p99", stats_histogram_get_percentile(self, 99), user_data);
+  func("max", stats_histogram_get_max(self), user_data);
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+#ifndef STATS_HISTOGRAM_H_INCLUDED
+#define STATS_HISTOGRAM_H_INCLUDED 1
+
+#include "stats/stats-counter.h"
+
+/*
+ * Log-linear latency histogram, in the spirit of HdrHistogram: values
+ * below STATS_HISTOGRAM_SUB_BUCKETS are counted exactly, above that each
+ * power of two is split into STATS_HISTOGRAM_SUB_BUCKETS equally sized
+ * buckets, so the relative error of a reported value is at most 1/8.
+ *
+ * Values are in microseconds, anything above 2^STATS_HISTOGRAM_MAX_MAGNITUDE
+ * (~19 hours) ends up in the last bucket.
+ */
+#define STATS_HISTOGRAM_SUB_BUCKET_BITS 3
+#define STATS_HISTOGRAM_SUB_BUCKETS     (1 << STATS_HISTOGRAM_SUB_BUCKET_BITS)
+#define STATS_HISTOGRAM_MAX_MAGNITUDE   36
+#define STATS_HISTOGRAM_BUCKETS \
+  ((STATS_HISTOGRAM_MAX_MAGNITUDE - STATS_HISTOGRAM_SUB_BUCKET_BITS + 1) * STATS_HISTOGRAM_SUB_BUCKETS)
+
+/* number of per-thread slots, must be a power of 2 */
+#define STATS_HISTOGRAM_SHARDS 4
+
+/* the shard header occupies a cacheline, the buckets follow on cachelines
+ * of their own */
+typedef struct _StatsHistogramShard
+{
+  guint64 count;
+  guint64 sum;
+  guint64 max;
+  gchar __padding[64 - 3 * sizeof(guint64)];
+  guint64 buckets[STATS_HISTOGRAM_BUCKETS];
+} StatsHistogramShard;
+
+struct _StatsHistogram
+{
+  StatsHistogramShard *shards;
+};
+
+StatsHistogram *stats_histogram_new(void);
+void stats_histogram_free(StatsHistogram *self);
+void stats_histogram_reset(StatsHistogram *self);
+
+guint64 stats_histogram_get_count(StatsHistogram *self);
+guint64 stats_histogram_get_max(StatsHistogram *self);
+guint64 stats_histogram_get_percentile(StatsHistogram *self, gint percentile);
+
+typedef void (*StatsHistogramSummaryFunc)(const gchar *name, guint64 value, gpointer user_data);
+void stats_histogram_foreach_summary(StatsHistogram *self, StatsHistogramSummaryFunc func, gpointer user_data);
+
+guint64 stats_histogram_get_bucket_upper_bound(gint index);
+
+static inline gint
+stats_histogram_get_bucket_index(guint64 value)
+{
+  gint magnitude, shift;
+
+  if (value < STATS_HISTOGRAM_SUB_BUCKETS)
+    return value;
+
+  magnitude = 63 - __builtin_clzll(value);
+  if (magnitude >= STATS_HISTOGRAM_MAX_MAGNITUDE)
+    return STATS_HISTOGRAM_BUCKETS - 1;
+
+  shift = magnitude - STATS_HISTOGRAM_SUB_BUCKET_BITS;
+  return (shift + 1) * STATS_HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (STATS_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static inline void
+stats_histogram_record(StatsHistogram *self, guint64 value)
+{
+  StatsHistogramShard *shard = &self->shards[stats_counter_get_shard_index() & (STATS_HISTOGRAM_SHARDS - 1)];
+  guint64 max;
+
+  __sync_fetch_and_add(&shard->buckets[stats_histogram_get_bucket_index(value)], 1);
+  __sync_fetch_and_add(&shard->sum, value);
+  __sync_fetch_and_add(&shard->count, 1);
+
+  max = shard->max;
+  while (value > max && !__sync_bool_compare_and_swap(&shard->max, max, value))
+    max = shard->max;
+}
+
+/* latency counters are only instrumented when they were registered,
+ * i.e. when the stats-level() is high enough */
+static inline void
+stats_counter_record_latency(StatsCounterItem *counter, guint64 usec)
+{
+  if (counter && counter->histogram)
+    stats_histogram_record(counter->histogram, usec);
+}
+
+static inline void
+stats_counter_record_latency_since(StatsCounterItem *counter, const GTimeVal *since)
+{
+  GTimeVal now;
+  gint64 diff;
+
+  if (!counter || !counter->histogram)
+    return;
+
+  g_get_current_time(&now);
+  diff = ((gint64) now.tv_sec - since->tv_sec) * G_USEC_PER_SEC + (now.tv_usec - since->tv_usec);
+  stats_histogram_record(counter->histogram, diff > 0 ? diff : 0);
+}
+
+#endif
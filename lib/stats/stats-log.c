@@ -23,6 +23,31 @@
  */
 #include "stats/stats-log.h"
 #include "stats/stats.h"
+#include "stats/stats-histogram.h"
+
+typedef struct _StatsLogHistogramState
+{
+  EVTREC *e;
+  StatsCluster *sc;
+  gint type;
+} StatsLogHistogramState;
+
+static void
+stats_log_format_histogram_summary(const gchar *name, guint64 value, gpointer user_data)
+{
+  StatsLogHistogramState *state = (StatsLogHistogramState *) user_data;
+  gchar tag_name[64];
+  gchar buf[32];
+
+  g_snprintf(tag_name, sizeof(tag_name), "%s_%s", stats_cluster_get_type_name(state->type), name);
+  evt_rec_add_tag(state->e,
+                  evt_tag_printf(tag_name, "%s(%s%s%s)=%" G_GUINT64_FORMAT,
+                                 stats_cluster_get_component_name(state->sc, buf, sizeof(buf)),
+                                 state->sc->id,
+                                 (state->sc->id[0] && state->sc->instance[0]) ? "," : "",
+                                 state->sc->instance,
+                                 value));
+}
 
 static void
 stats_log_format_counter(StatsCluster *sc, gint type, StatsCounterItem *item, gpointer user_data)
@@ -31,7 +56,15 @@ stats_log_format_counter(StatsCluster *sc, gint type, StatsCounterItem *item, gp
   EVTTAG *tag;
   gchar buf[32];
 
-  tag = evt_tag_printf(stats_cluster_get_type_name(type), "%s(%s%s%s)=%u",
+  if (item->histogram)
+    {
+      StatsLogHistogramState state = { e, sc, type };
+
+      stats_histogram_foreach_summary(item->histogram, stats_log_format_histogram_summary, &state);
+      return;
+    }
+
+  tag = evt_tag_printf(stats_cluster_get_type_name(type), "%s(%s%s%s)=%" G_GUINT64_FORMAT,
                        stats_cluster_get_component_name(sc, buf, sizeof(buf)),
                        sc->id,
                        (sc->id[0] && sc->instance[0]) ? "," : "",
@@ -158,6 +158,65 @@ test_stats_foreach_counter_never_forgets_untracked_counters(void)
   stats_cluster_free(sc);
 }
 
+static void
+test_message_counters_of_static_clusters_are_sharded(void)
+{
+  StatsCluster *sc = stats_cluster_new(SCS_SOURCE | SCS_FILE, "id", "instance");
+  StatsCounterItem *processed, *stamp;
+
+  processed = stats_cluster_track_counter(sc, SC_TYPE_PROCESSED);
+  stamp = stats_cluster_track_counter(sc, SC_TYPE_STAMP);
+  assert_not_null(processed->shards, "processed counter of a static cluster is not sharded");
+  assert_true(stamp->shards == NULL, "stamp counter is sharded");
+  stats_cluster_free(sc);
+
+  sc = stats_cluster_new(SCS_SOURCE | SCS_FILE, "id", "instance");
+  sc->dynamic = TRUE;
+  processed = stats_cluster_track_counter(sc, SC_TYPE_PROCESSED);
+  assert_true(processed->shards == NULL, "processed counter of a dynamic cluster is sharded");
+  stats_cluster_free(sc);
+}
+
+static void
+test_sharded_counter_is_aggregated_on_query(void)
+{
+  StatsCounterItem counter = { 0 };
+  gint i;
+
+  stats_counter_enable_sharding(&counter);
+  stats_counter_set(&counter, 10);
+  for (i = 0; i < STATS_COUNTER_SHARDS; i++)
+    counter.shards[i].value = i;
+
+  assert_guint64(stats_counter_get(&counter), 10 + STATS_COUNTER_SHARDS * (STATS_COUNTER_SHARDS - 1) / 2,
+                 "sharded counter is not summed properly");
+
+  stats_counter_inc(&counter);
+  stats_counter_add(&counter, 5);
+  stats_counter_dec(&counter);
+  assert_guint64(stats_counter_get(&counter), 10 + STATS_COUNTER_SHARDS * (STATS_COUNTER_SHARDS - 1) / 2 + 5,
+                 "sharded counter increments are lost");
+
+  stats_counter_set(&counter, 0);
+  assert_guint64(stats_counter_get(&counter), 0, "setting a sharded counter does not reset its shards");
+  stats_counter_free_shards(&counter);
+}
+
+static void
+test_counters_do_not_wrap_at_32_bits(void)
+{
+  StatsCounterItem counter = { 0 };
+
+  stats_counter_set(&counter, G_MAXUINT32);
+  stats_counter_inc(&counter);
+  assert_guint64(stats_counter_get(&counter), ((guint64) G_MAXUINT32) + 1, "counter wrapped at 32 bits");
+
+  stats_counter_enable_sharding(&counter);
+  stats_counter_add(&counter, 1);
+  assert_guint64(stats_counter_get(&counter), ((guint64) G_MAXUINT32) + 2, "sharded counter wrapped at 32 bits");
+  stats_counter_free_shards(&counter);
+}
+
 static void
 assert_stats_component_name(gint component, const gchar *expected)
 {
@@ -188,6 +247,9 @@ test_stats_cluster(void)
   STATS_CLUSTER_TESTCASE(test_stats_foreach_counter_yields_tracked_counters);
   STATS_CLUSTER_TESTCASE(test_stats_foreach_counter_never_forgets_untracked_counters);
   STATS_CLUSTER_TESTCASE(test_get_component_name_translates_component_to_name_properly);
+  STATS_CLUSTER_TESTCASE(test_message_counters_of_static_clusters_are_sharded);
+  STATS_CLUSTER_TESTCASE(test_sharded_counter_is_aggregated_on_query);
+  STATS_CLUSTER_TESTCASE(test_counters_do_not_wrap_at_32_bits);
 }
 
 int
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "testutils.h"
+#include "stats/stats-cluster.h"
+#include "stats/stats-histogram.h"
+
+#define STATS_HISTOGRAM_TESTCASE(x) x()
+
+static void
+test_small_values_are_counted_exactly(void)
+{
+  gint i;
+
+  for (i = 0; i < STATS_HISTOGRAM_SUB_BUCKETS; i++)
+    {
+      assert_gint(stats_histogram_get_bucket_index(i), i, "small value is not in a bucket of its own");
+      assert_guint64(stats_histogram_get_bucket_upper_bound(i), i, "upper bound of an exact bucket mismatch");
+    }
+}
+
+static void
+test_buckets_cover_values_with_bounded_relative_error(void)
+{
+  guint64 values[] = { 8, 9, 15, 16, 17, 100, 1000, 1023, 1024, 65535, 1000000, G_GUINT64_CONSTANT(60000000000) };
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS(values); i++)
+    {
+      gint index = stats_histogram_get_bucket_index(values[i]);
+      guint64 upper = stats_histogram_get_bucket_upper_bound(index);
+
+      assert_true(upper >= values[i], "bucket upper bound is below the value: %" G_GUINT64_FORMAT, values[i]);
+      assert_true(upper - values[i] <= values[i] / STATS_HISTOGRAM_SUB_BUCKETS,
+                  "bucket is too wide for value: %" G_GUINT64_FORMAT, values[i]);
+      assert_true(stats_histogram_get_bucket_upper_bound(index - 1) < values[i],
+                  "value would fit into the previous bucket: %" G_GUINT64_FORMAT, values[i]);
+    }
+}
+
+static void
+test_huge_values_end_up_in_the_last_bucket(void)
+{
+  assert_gint(stats_histogram_get_bucket_index(G_MAXUINT64), STATS_HISTOGRAM_BUCKETS - 1,
+              "huge value is not clamped to the last bucket");
+  assert_gint(stats_histogram_get_bucket_index(G_GUINT64_CONSTANT(1) << STATS_HISTOGRAM_MAX_MAGNITUDE),
+              STATS_HISTOGRAM_BUCKETS - 1, "huge value is not clamped to the last bucket");
+}
+
+static void
+test_percentiles_are_reported_as_bucket_upper_bounds(void)
+{
+  StatsHistogram *histogram = stats_histogram_new();
+  guint64 v;
+
+  assert_guint64(stats_histogram_get_percentile(histogram, 50), 0, "percentile of an empty histogram is not 0");
+
+  for (v = 1; v <= 100; v++)
+    stats_histogram_record(histogram, v);
+
+  assert_guint64(stats_histogram_get_count(histogram), 100, "histogram count mismatch");
+  assert_guint64(stats_histogram_get_max(histogram), 100, "histogram max mismatch");
+  assert_guint64(stats_histogram_get_percentile(histogram, 50), 51, "p50 mismatch");
+  assert_guint64(stats_histogram_get_percentile(histogram, 90), 95, "p90 mismatch");
+  assert_guint64(stats_histogram_get_percentile(histogram, 99), 100, "p99 is not capped at max");
+
+  stats_histogram_reset(histogram);
+  assert_guint64(stats_histogram_get_count(histogram), 0, "reset does not clear the histogram");
+  assert_guint64(stats_histogram_get_max(histogram), 0, "reset does not clear the max");
+  stats_histogram_free(histogram);
+}
+
+static void
+test_latency_counters_are_backed_by_histograms(void)
+{
+  StatsCluster *sc = stats_cluster_new(SCS_DESTINATION | SCS_FILE, "id", "instance");
+  StatsCounterItem *write_latency, *processed;
+
+  write_latency = stats_cluster_track_counter(sc, SC_TYPE_WRITE_LATENCY);
+  processed = stats_cluster_track_counter(sc, SC_TYPE_PROCESSED);
+  assert_true(write_latency->histogram != NULL, "latency counter has no histogram");
+  assert_true(processed->histogram == NULL, "processed counter has a histogram");
+
+  stats_counter_record_latency(write_latency, 1000);
+  stats_counter_record_latency(processed, 1000);
+  stats_counter_record_latency(NULL, 1000);
+  assert_guint64(stats_histogram_get_count(write_latency->histogram), 1, "latency is not recorded");
+  assert_guint64(stats_counter_get(processed), 0, "latency is recorded into a plain counter");
+  stats_cluster_free(sc);
+}
+
+static void
+test_stats_histogram(void)
+{
+  STATS_HISTOGRAM_TESTCASE(test_small_values_are_counted_exactly);
+  STATS_HISTOGRAM_TESTCASE(test_buckets_cover_values_with_bounded_relative_error);
+  STATS_HISTOGRAM_TESTCASE(test_huge_values_end_up_in_the_last_bucket);
+  STATS_HISTOGRAM_TESTCASE(test_percentiles_are_reported_as_bucket_upper_bounds);
+  STATS_HISTOGRAM_TESTCASE(test_latency_counters_are_backed_by_histograms);
+}
+
+int
+main(int argc, char *argv[])
+{
+  test_stats_histogram();
+  return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "aho-corasick.h"
+#include "testutils.h"
+
+#include <string.h>
+
+static void
+_collect_match(gint pattern_id, gsize start, gsize end, gpointer user_data)
+{
+  GString *matches = (GString *) user_data;
+
+  g_string_append_printf(matches, "%s%d@%" G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT,
+                         matches->len ? "," : "", pattern_id, start, end);
+}
+
+static void
+assert_scan(AhoCorasick *ac, const gchar *input, const gchar *expected)
+{
+  GString *matches = g_string_new("");
+
+  aho_corasick_scan(ac, input, strlen(input), _collect_match, matches);
+  assert_string(matches->str, expected, "unexpected matches for input: %s", input);
+  g_string_free(matches, TRUE);
+}
+
+static void
+test_overlapping_patterns_are_all_found(void)
+{
+  AhoCorasick *ac = aho_corasick_new(FALSE);
+
+  aho_corasick_add_pattern(ac, "he", 2);
+  aho_corasick_add_pattern(ac, "she", 3);
+  aho_corasick_add_pattern(ac, "his", 3);
+  aho_corasick_add_pattern(ac, "hers", 4);
+  aho_corasick_compile(ac);
+
+  assert_gint(aho_corasick_get_num_patterns(ac), 4, "number of patterns mismatch");
+  assert_scan(ac, "ushers", "1@1-4,0@2-4,3@2-6");
+  assert_scan(ac, "ahishe", "2@1-4,1@3-6,0@4-6");
+  assert_scan(ac, "USHERS", "");
+  assert_scan(ac, "", "");
+  aho_corasick_free(ac);
+}
+
+static void
+test_ignore_case_folds_ascii_letters(void)
+{
+  AhoCorasick *ac = aho_corasick_new(TRUE);
+
+  aho_corasick_add_pattern(ac, "Error", 5);
+  aho_corasick_add_pattern(ac, "fail", 4);
+  aho_corasick_compile(ac);
+
+  assert_scan(ac, "ERROR: FAILED", "0@0-5,1@7-11");
+  assert_scan(ac, "error: failed", "0@0-5,1@7-11");
+  assert_scan(ac, "err: fai", "");
+  aho_corasick_free(ac);
+}
+
+static void
+test_duplicate_and_nested_patterns(void)
+{
+  AhoCorasick *ac = aho_corasick_new(FALSE);
+
+  aho_corasick_add_pattern(ac, "aa", 2);
+  aho_corasick_add_pattern(ac, "a", 1);
+  aho_corasick_add_pattern(ac, "aa", 2);
+  aho_corasick_compile(ac);
+
+  assert_scan(ac, "aaa", "1@0-1,0@0-2,2@0-2,1@1-2,0@1-3,2@1-3,1@2-3");
+  aho_corasick_free(ac);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  test_overlapping_patterns_are_all_found();
+  test_ignore_case_folds_ascii_letters();
+  test_duplicate_and_nested_patterns();
+  return 0;
+}
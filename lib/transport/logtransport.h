@@ -28,14 +28,30 @@
 #include "syslog-ng.h"
 #include "transport/transport-aux-data.h"
 
+#include <sys/uio.h>
+
 typedef struct _LogTransport LogTransport;
 
+/* a single datagram in a batch read by log_transport_read_batch(), buf and
+ * buflen are set up by the caller, len and aux are filled by the transport */
+typedef struct _LogTransportDatagram
+{
+  gpointer buf;
+  gsize buflen;
+  gsize len;
+  LogTransportAuxData aux;
+} LogTransportDatagram;
+
 struct _LogTransport
 {
   gint fd;
   GIOCondition cond;
   gssize (*read)(LogTransport *self, gpointer buf, gsize count, LogTransportAuxData *aux);
+  /* optional, reads up to count datagrams with a single syscall */
+  gint (*read_batch)(LogTransport *self, LogTransportDatagram *dgrams, gint count);
   gssize (*write)(LogTransport *self, const gpointer buf, gsize count);
+  /* optional, writes a series of buffers with a single syscall */
+  gssize (*writev)(LogTransport *self, const struct iovec *iov, gint iov_count);
   void (*free_fn)(LogTransport *self);
 };
 
@@ -45,12 +61,37 @@ log_transport_write(LogTransport *self, const gpointer buf, gsize count)
   return self->write(self, buf, count);
 }
 
+static inline gboolean
+log_transport_can_writev(LogTransport *self)
+{
+  return self->writev != NULL;
+}
+
+static inline gssize
+log_transport_writev(LogTransport *self, const struct iovec *iov, gint iov_count)
+{
+  return self->writev(self, iov, iov_count);
+}
+
 static inline gssize
 log_transport_read(LogTransport *self, gpointer buf, gsize count, LogTransportAuxData *aux)
 {
   return self->read(self, buf, count, aux);
 }
 
+static inline gboolean
+log_transport_can_read_batch(LogTransport *self)
+{
+  return self->read_batch != NULL;
+}
+
+/* returns the number of datagrams read, or -1 with errno set */
+static inline gint
+log_transport_read_batch(LogTransport *self, LogTransportDatagram *dgrams, gint count)
+{
+  return self->read_batch(self, dgrams, count);
+}
+
 void log_transport_init_instance(LogTransport *s, gint fd);
 void log_transport_free_method(LogTransport *s);
 void log_transport_free(LogTransport *s);
@@ -25,6 +25,7 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
 
 static gssize
 log_transport_dgram_socket_read_method(LogTransport *s, gpointer buf, gsize buflen, LogTransportAuxData *aux)
@@ -52,6 +53,48 @@ log_transport_dgram_socket_read_method(LogTransport *s, gpointer buf, gsize bufl
   return rc;
 }
 
+#ifdef SYSLOG_NG_HAVE_RECVMMSG
+
+static gint
+log_transport_dgram_socket_read_batch_method(LogTransport *s, LogTransportDatagram *dgrams, gint count)
+{
+  LogTransportSocket *self = (LogTransportSocket *) s;
+  struct mmsghdr *msgs = g_alloca(count * sizeof(struct mmsghdr));
+  struct iovec *iovs = g_alloca(count * sizeof(struct iovec));
+  struct sockaddr_storage *addrs = g_alloca(count * sizeof(struct sockaddr_storage));
+  gint rc, i;
+
+  memset(msgs, 0, count * sizeof(struct mmsghdr));
+  for (i = 0; i < count; i++)
+    {
+      iovs[i].iov_base = dgrams[i].buf;
+      iovs[i].iov_len = dgrams[i].buflen;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+  /* MSG_WAITFORONE: return whatever is available once we have the first one */
+  do
+    {
+      rc = recvmmsg(self->super.fd, msgs, count, MSG_WAITFORONE, NULL);
+    }
+  while (rc == -1 && errno == EINTR);
+
+  for (i = 0; i < rc; i++)
+    {
+      dgrams[i].len = msgs[i].msg_len;
+      if (msgs[i].msg_hdr.msg_namelen)
+        log_transport_aux_data_set_peer_addr_ref(&dgrams[i].aux,
+                                                 g_sockaddr_new((struct sockaddr *) &addrs[i],
+                                                                msgs[i].msg_hdr.msg_namelen));
+    }
+  return rc;
+}
+
+#endif
+
 static gssize
 log_transport_dgram_socket_write_method(LogTransport *s, const gpointer buf, gsize buflen)
 {
@@ -83,6 +126,9 @@ log_transport_dgram_socket_init_instance(LogTransportSocket *self, gint fd)
 {
   log_transport_init_instance(&self->super, fd);
   self->super.read = log_transport_dgram_socket_read_method;
+#ifdef SYSLOG_NG_HAVE_RECVMMSG
+  self->super.read_batch = log_transport_dgram_socket_read_batch_method;
+#endif
   self->super.write = log_transport_dgram_socket_write_method;
 }
 
@@ -123,6 +169,25 @@ log_transport_stream_socket_write_method(LogTransport *s, const gpointer buf, gs
   return rc;
 }
 
+static gssize
+log_transport_stream_socket_writev_method(LogTransport *s, const struct iovec *iov, gint iov_count)
+{
+  LogTransportSocket *self = (LogTransportSocket *) s;
+  struct msghdr msg;
+  gint rc;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *) iov;
+  msg.msg_iovlen = iov_count;
+
+  do
+    {
+      rc = sendmsg(self->super.fd, &msg, 0);
+    }
+  while (rc == -1 && errno == EINTR);
+  return rc;
+}
+
 static void
 log_transport_stream_socket_free_method(LogTransport *s)
 {
@@ -136,6 +201,7 @@ log_transport_stream_socket_init_instance(LogTransportSocket *self, gint fd)
   log_transport_init_instance(&self->super, fd);
   self->super.read = log_transport_stream_socket_read_method;
   self->super.write = log_transport_stream_socket_write_method;
+  self->super.writev = log_transport_stream_socket_writev_method;
   self->super.free_fn = log_transport_stream_socket_free_method;
 }
 
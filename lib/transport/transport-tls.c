@@ -33,6 +33,7 @@ typedef struct _LogTransportTLS
 {
   LogTransport super;
   TLSSession *tls_session;
+  GString *write_buffer;
 } LogTransportTLS;
 
 static gssize
@@ -146,6 +147,23 @@ tls_error:
   return -1;
 }
 
+/* libssl has no vectored write, so coalesce the buffers and send them with
+ * a single SSL_write(), which also means fewer TLS records on the wire.  A
+ * retried write after EAGAIN is passed the same data again by the caller,
+ * and as the length is the same, the buffer is not reallocated either, as
+ * required by SSL_write(). */
+static gssize
+log_transport_tls_writev_method(LogTransport *s, const struct iovec *iov, gint iov_count)
+{
+  LogTransportTLS *self = (LogTransportTLS *) s;
+  gint i;
+
+  g_string_truncate(self->write_buffer, 0);
+  for (i = 0; i < iov_count; i++)
+    g_string_append_len(self->write_buffer, iov[i].iov_base, iov[i].iov_len);
+
+  return log_transport_tls_write_method(s, self->write_buffer->str, self->write_buffer->len);
+}
 
 static void log_transport_tls_free_method(LogTransport *s);
 
@@ -158,8 +176,10 @@ log_transport_tls_new(TLSSession *tls_session, gint fd)
   self->super.cond = G_IO_IN | G_IO_OUT;
   self->super.read = log_transport_tls_read_method;
   self->super.write = log_transport_tls_write_method;
+  self->super.writev = log_transport_tls_writev_method;
   self->super.free_fn = log_transport_tls_free_method;
   self->tls_session = tls_session;
+  self->write_buffer = g_string_sized_new(0);
 
   SSL_set_fd(self->tls_session->ssl, fd);
   return &self->super;
@@ -171,6 +191,7 @@ log_transport_tls_free_method(LogTransport *s)
   LogTransportTLS *self = (LogTransportTLS *) s;
 
   tls_session_free(self->tls_session);
+  g_string_free(self->write_buffer, TRUE);
   log_transport_free_method(s);
 }
 
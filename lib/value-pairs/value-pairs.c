@@ -37,6 +37,7 @@
 typedef struct
 {
   GPatternSpec *pattern;
+  gchar *glob;
   gboolean include;
 } VPPatternSpec;
 
@@ -46,6 +47,8 @@ typedef struct
   LogTemplate *template;
 } VPPairConf;
 
+typedef struct _VPPlan VPPlan;
+
 struct _ValuePairs
 {
   GAtomicCounter ref_cnt;
@@ -54,6 +57,10 @@ struct _ValuePairs
   GPtrArray *vpairs;
   GPtrArray *transforms;
 
+  /* precompiled form of the value-pairs used by value_pairs_walk(), NULL
+   * if the set of keys depends on the message, see vp_plan_new() */
+  VPPlan *plan;
+
   /* guint32 as CfgFlagHandler only supports 32 bit integers */
   guint32 scopes;
 };
@@ -74,6 +81,7 @@ enum
 {
   VPT_MACRO,
   VPT_NVPAIR,
+  VPT_TEMPLATE,
 };
 
 typedef struct
@@ -140,6 +148,7 @@ static void
 vp_pattern_spec_free(VPPatternSpec *self)
 {
   g_pattern_spec_free(self->pattern);
+  g_free(self->glob);
   g_free(self);
 }
 
@@ -149,6 +158,7 @@ vp_pattern_spec_new(const gchar *pattern, gboolean include)
   VPPatternSpec *self = g_new0(VPPatternSpec, 1);
 
   self->pattern = g_pattern_spec_new(pattern);
+  self->glob = g_strdup(pattern);
   self->include = include;
   return self;
 }
@@ -295,6 +305,8 @@ vp_merge_set(ValuePairs *vp, ValuePairSpec *set)
 }
 
 
+static void vp_update_plan(ValuePairs *vp);
+
 static void
 vp_update_builtin_list_of_values(ValuePairs *vp)
 {
@@ -314,6 +326,8 @@ vp_update_builtin_list_of_values(ValuePairs *vp)
 
   if (vp->scopes & VPS_ALL_MACROS)
     vp_merge_set(vp, all_macros);
+
+  vp_update_plan(vp);
 }
 
 static void
@@ -734,6 +748,339 @@ vp_walk_cmp(const gchar *s1, const gchar *s2)
   return strcmp(s2, s1);
 }
 
+/*******************************************************************************
+ * vp_plan (represented by VPPlan)
+ *
+ * Unless the set of keys depends on the message (nv-pair based scopes or
+ * wildcard patterns), the keys are transformed, sorted and split into
+ * containers once, when the configuration is parsed.  value_pairs_walk()
+ * then formats the values in order, without building a GTree of scratch
+ * buffers and splitting every name for each message.
+ *******************************************************************************/
+
+typedef struct
+{
+  gint type;
+  gint id;
+  LogTemplate *template;
+} VPPlanSource;
+
+typedef struct
+{
+  gchar *name;
+  /* the name split at the container boundaries, the last one is the key */
+  GPtrArray *tokens;
+  /* prefixes[i] is the full name of the container tokens[i] */
+  gchar **prefixes;
+  gint *prefix_lens;
+  /* the sources of the value, the first one that produces a value wins */
+  GArray *sources;
+} VPPlanEntry;
+
+struct _VPPlan
+{
+  GPtrArray *entries;
+  gint max_depth;
+};
+
+static void
+vp_plan_entry_free(VPPlanEntry *entry)
+{
+  gint i;
+
+  if (entry->tokens)
+    {
+      for (i = 0; i < entry->tokens->len - 1; i++)
+        g_free(entry->prefixes[i]);
+      g_ptr_array_foreach(entry->tokens, (GFunc) g_free, NULL);
+      g_ptr_array_free(entry->tokens, TRUE);
+    }
+  g_free(entry->prefixes);
+  g_free(entry->prefix_lens);
+  g_array_free(entry->sources, TRUE);
+  g_free(entry->name);
+  g_free(entry);
+}
+
+static void
+vp_plan_free(VPPlan *self)
+{
+  if (!self)
+    return;
+
+  g_ptr_array_foreach(self->entries, (GFunc) vp_plan_entry_free, NULL);
+  g_ptr_array_free(self->entries, TRUE);
+  g_free(self);
+}
+
+static void
+vp_plan_add_source(VPPlan *self, GHashTable *index, ValuePairs *vp,
+                   gchar *name, gint type, gint id, LogTemplate *template)
+{
+  VPPlanSource source = { type, id, template };
+  VPPlanEntry *entry;
+  gchar *key;
+
+  key = vp_transform_apply(vp, name);
+  entry = g_hash_table_lookup(index, key);
+  if (entry)
+    {
+      g_free(key);
+    }
+  else
+    {
+      entry = g_new0(VPPlanEntry, 1);
+      entry->name = key;
+      entry->sources = g_array_new(FALSE, FALSE, sizeof(VPPlanSource));
+      g_hash_table_insert(index, entry->name, entry);
+      g_ptr_array_add(self->entries, entry);
+    }
+
+  /* sources added later override the earlier ones, just like g_tree_insert() in value_pairs_foreach_sorted() */
+  g_array_prepend_val(entry->sources, source);
+}
+
+static gboolean
+vp_plan_entry_split(VPPlan *self, VPPlanEntry *entry)
+{
+  gint i;
+
+  entry->tokens = vp_walker_split_name_to_tokens(NULL, entry->name);
+  if (!entry->tokens)
+    return FALSE;
+
+  entry->prefixes = g_new(gchar *, entry->tokens->len);
+  entry->prefix_lens = g_new(gint, entry->tokens->len);
+  for (i = 0; i < entry->tokens->len - 1; i++)
+    {
+      entry->prefixes[i] = vp_walker_name_combine_prefix(entry->tokens, i);
+      entry->prefix_lens[i] = strlen(entry->prefixes[i]);
+    }
+  self->max_depth = MAX(self->max_depth, entry->tokens->len - 1);
+  return TRUE;
+}
+
+static gint
+vp_plan_entry_cmp(VPPlanEntry **e1, VPPlanEntry **e2)
+{
+  return vp_walk_cmp((*e1)->name, (*e2)->name);
+}
+
+static VPPlan *
+vp_plan_new(ValuePairs *vp)
+{
+  VPPlan *self;
+  GHashTable *index;
+  gint i;
+
+  if (vp->scopes & (VPS_NV_PAIRS + VPS_DOT_NV_PAIRS + VPS_SDATA + VPS_RFC5424))
+    return NULL;
+
+  for (i = 0; i < vp->patterns->len; i++)
+    {
+      VPPatternSpec *vps = (VPPatternSpec *) g_ptr_array_index(vp->patterns, i);
+
+      if (vps->include && strpbrk(vps->glob, "*?"))
+        return NULL;
+    }
+
+  self = g_new0(VPPlan, 1);
+  self->entries = g_ptr_array_new();
+  index = g_hash_table_new(g_str_hash, g_str_equal);
+
+  /* a pattern without wildcards selects a single name-value pair, macros
+   * were already added to the builtins by vp_merge_macros() */
+  for (i = 0; i < vp->patterns->len; i++)
+    {
+      VPPatternSpec *vps = (VPPatternSpec *) g_ptr_array_index(vp->patterns, i);
+
+      if (vps->include && vp_find_in_set(vp, vps->glob, FALSE) &&
+          !log_macro_lookup(vps->glob, strlen(vps->glob)))
+        vp_plan_add_source(self, index, vp, vps->glob, VPT_NVPAIR, log_msg_get_value_handle(vps->glob), NULL);
+    }
+
+  for (i = 0; i < vp->builtins->len; i++)
+    {
+      ValuePairSpec *spec = (ValuePairSpec *) g_ptr_array_index(vp->builtins, i);
+
+      vp_plan_add_source(self, index, vp, spec->name, spec->type, spec->id, NULL);
+    }
+
+  for (i = 0; i < vp->vpairs->len; i++)
+    {
+      VPPairConf *vpc = (VPPairConf *) g_ptr_array_index(vp->vpairs, i);
+
+      vp_plan_add_source(self, index, vp, vpc->name, VPT_TEMPLATE, 0, vpc->template);
+    }
+  g_hash_table_destroy(index);
+
+  for (i = 0; i < self->entries->len; )
+    {
+      VPPlanEntry *entry = (VPPlanEntry *) g_ptr_array_index(self->entries, i);
+
+      if (vp_plan_entry_split(self, entry))
+        {
+          i++;
+          continue;
+        }
+      vp_plan_entry_free(entry);
+      g_ptr_array_remove_index(self->entries, i);
+    }
+  g_ptr_array_sort(self->entries, (GCompareFunc) vp_plan_entry_cmp);
+
+  return self;
+}
+
+static void
+vp_update_plan(ValuePairs *vp)
+{
+  vp_plan_free(vp->plan);
+  vp->plan = vp_plan_new(vp);
+}
+
+static gboolean
+vp_plan_entry_format(VPPlanEntry *entry, LogMessage *msg, gint32 seq_num, gint time_zone_mode,
+                     const LogTemplateOptions *template_options, GString *value, TypeHint *type)
+{
+  gint i;
+
+  for (i = 0; i < entry->sources->len; i++)
+    {
+      VPPlanSource *source = &g_array_index(entry->sources, VPPlanSource, i);
+
+      g_string_truncate(value, 0);
+      switch (source->type)
+        {
+        case VPT_TEMPLATE:
+          /* explicitly specified pairs are included even if empty */
+          log_template_append_format(source->template, msg, template_options,
+                                     time_zone_mode, seq_num, NULL, value);
+          *type = source->template->type_hint;
+          return TRUE;
+        case VPT_MACRO:
+          log_macro_expand(value, source->id, FALSE,
+                           template_options, time_zone_mode, seq_num, NULL, msg);
+          break;
+        case VPT_NVPAIR:
+        {
+          const gchar *nv;
+          gssize len;
+
+          nv = log_msg_get_value(msg, (NVHandle) source->id, &len);
+          g_string_append_len(value, nv, len);
+          break;
+        }
+        default:
+          g_assert_not_reached();
+        }
+
+      if (value->len > 0)
+        {
+          *type = TYPE_HINT_STRING;
+          return TRUE;
+        }
+    }
+  return FALSE;
+}
+
+static void
+vp_plan_end_container(VPWalkCallbackFunc obj_end, VPPlanEntry **containers, gpointer *container_data,
+                      gint depth, gpointer user_data)
+{
+  VPPlanEntry *entry = containers[depth];
+
+  if (depth > 0)
+    obj_end(g_ptr_array_index(entry->tokens, depth), entry->prefixes[depth], &container_data[depth],
+            containers[depth - 1]->prefixes[depth - 1], &container_data[depth - 1],
+            user_data);
+  else
+    obj_end(g_ptr_array_index(entry->tokens, depth), entry->prefixes[depth], &container_data[depth],
+            NULL, NULL,
+            user_data);
+}
+
+static void
+vp_plan_start_container(VPWalkCallbackFunc obj_start, VPPlanEntry **containers, gpointer *container_data,
+                        gint depth, gpointer user_data)
+{
+  VPPlanEntry *entry = containers[depth];
+
+  container_data[depth] = NULL;
+  if (depth > 0)
+    obj_start(g_ptr_array_index(entry->tokens, depth), entry->prefixes[depth], &container_data[depth],
+              containers[depth - 1]->prefixes[depth - 1], &container_data[depth - 1],
+              user_data);
+  else
+    obj_start(g_ptr_array_index(entry->tokens, depth), entry->prefixes[depth], &container_data[depth],
+              NULL, NULL,
+              user_data);
+}
+
+/* same semantics as value_pairs_walker() over the GTree built by value_pairs_foreach_sorted() */
+static gboolean
+vp_plan_walk(VPPlan *self,
+             VPWalkCallbackFunc obj_start_func,
+             VPWalkValueCallbackFunc process_value_func,
+             VPWalkCallbackFunc obj_end_func,
+             LogMessage *msg, gint32 seq_num, gint time_zone_mode,
+             const LogTemplateOptions *template_options,
+             gpointer user_data)
+{
+  /* containers[i] is the entry that opened the container at depth i */
+  VPPlanEntry **containers = g_newa(VPPlanEntry *, self->max_depth + 1);
+  gpointer *container_data = g_newa(gpointer, self->max_depth + 1);
+  SBGString *sb = sb_gstring_acquire();
+  GString *value = sb_gstring_string(sb);
+  gboolean result = TRUE;
+  gint depth = 0;
+  gint i;
+
+  for (i = 0; result && i < self->entries->len; i++)
+    {
+      VPPlanEntry *entry = (VPPlanEntry *) g_ptr_array_index(self->entries, i);
+      gint key_index = entry->tokens->len - 1;
+      TypeHint type;
+
+      if (!vp_plan_entry_format(entry, msg, seq_num, time_zone_mode, template_options, value, &type))
+        continue;
+
+      while (depth > 0 &&
+             strncmp(entry->name, containers[depth - 1]->prefixes[depth - 1],
+                     containers[depth - 1]->prefix_lens[depth - 1]) != 0)
+        {
+          depth--;
+          vp_plan_end_container(obj_end_func, containers, container_data, depth, user_data);
+        }
+
+      for (; depth < key_index; depth++)
+        {
+          containers[depth] = entry;
+          vp_plan_start_container(obj_start_func, containers, container_data, depth, user_data);
+        }
+
+      if (depth > 0)
+        result = !process_value_func(g_ptr_array_index(entry->tokens, key_index),
+                                     containers[depth - 1]->prefixes[depth - 1],
+                                     type, value->str, value->len,
+                                     &container_data[depth - 1],
+                                     user_data);
+      else
+        result = !process_value_func(g_ptr_array_index(entry->tokens, key_index), NULL,
+                                     type, value->str, value->len,
+                                     NULL,
+                                     user_data);
+    }
+
+  while (depth > 0)
+    {
+      depth--;
+      vp_plan_end_container(obj_end_func, containers, container_data, depth, user_data);
+    }
+
+  sb_gstring_release(sb);
+  return result;
+}
+
 /*******************************************************************************
  * Public API
  *******************************************************************************/
@@ -750,6 +1097,15 @@ value_pairs_walk(ValuePairs *vp,
   vp_walk_state_t state;
   gboolean result;
 
+  if (vp->plan)
+    {
+      obj_start_func(NULL, NULL, NULL, NULL, NULL, user_data);
+      result = vp_plan_walk(vp->plan, obj_start_func, process_value_func, obj_end_func,
+                            msg, seq_num, time_zone_mode, template_options, user_data);
+      obj_end_func(NULL, NULL, NULL, NULL, NULL, user_data);
+      return result;
+    }
+
   state.user_data = user_data;
   state.obj_start = obj_start_func;
   state.obj_end = obj_end_func;
@@ -863,6 +1219,7 @@ value_pairs_free (ValuePairs *vp)
     }
   g_ptr_array_free(vp->transforms, TRUE);
   g_ptr_array_free(vp->builtins, TRUE);
+  vp_plan_free(vp->plan);
   g_free(vp);
 }
 
@@ -99,6 +99,30 @@ exit:
   return count;
 }
 
+/* reads consecutive records without injecting EAGAIN between them */
+static gint
+log_transport_mock_read_batch_method(LogTransport *s, LogTransportDatagram *dgrams, gint count)
+{
+  LogTransportMock *self = (LogTransportMock *) s;
+  gint i;
+
+  for (i = 0; i < count; i++)
+    {
+      gssize rc;
+
+      if (i > 0)
+        self->inject_eagain = FALSE;
+
+      rc = log_transport_mock_read_method(s, dgrams[i].buf, dgrams[i].buflen, &dgrams[i].aux);
+      if (rc < 0)
+        return i > 0 ? i : -1;
+      if (rc == 0)
+        break;
+      dgrams[i].len = rc;
+    }
+  return i;
+}
+
 static void
 log_transport_mock_init(LogTransportMock *self, gchar *read_buffer1, gssize read_buffer_length1, va_list va)
 {
@@ -182,3 +206,17 @@ log_transport_mock_endless_records_new(gchar *read_buffer1, gssize read_buffer_l
   self->eof_is_eagain = TRUE;
   return &self->super;
 }
+
+LogTransport *
+log_transport_mock_endless_batched_records_new(gchar *read_buffer1, gssize read_buffer_length1, ...)
+{
+  LogTransportMock *self = g_new0(LogTransportMock, 1);
+  va_list va;
+
+  va_start(va, read_buffer_length1);
+  log_transport_mock_init(self, read_buffer1, read_buffer_length1, va);
+  va_end(va);
+  self->super.read_batch = log_transport_mock_read_batch_method;
+  self->eof_is_eagain = TRUE;
+  return &self->super;
+}
@@ -45,4 +45,7 @@ log_transport_mock_records_new(gchar *read_buffer1, gssize read_buffer_length1,
 LogTransport *
 log_transport_mock_endless_records_new(gchar *read_buffer1, gssize read_buffer_length1, ...);
 
+LogTransport *
+log_transport_mock_endless_batched_records_new(gchar *read_buffer1, gssize read_buffer_length1, ...);
+
 #endif
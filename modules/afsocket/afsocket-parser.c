@@ -75,6 +75,8 @@ static CfgLexerKeyword afsocket_keywords[] =
   { "ip_protocol",        KW_IP_PROTOCOL },
   { "max_connections",    KW_MAX_CONNECTIONS },
   { "listen_backlog",     KW_LISTEN_BACKLOG },
+  { "listeners",          KW_LISTENERS },
+  { "so_reuseport",       KW_LISTENERS }, /* alias, listeners() is implemented using SO_REUSEPORT */
   { "keep_alive",         KW_KEEP_ALIVE },
   { "systemd_syslog",     KW_SYSTEMD_SYSLOG  },
   { NULL }
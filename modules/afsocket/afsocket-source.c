@@ -27,6 +27,7 @@
 #include "gsocket.h"
 #include "stats/stats-registry.h"
 #include "mainloop.h"
+#include "mainloop-event-loop.h"
 #include "poll-fd-events.h"
 
 #include <string.h>
@@ -46,6 +47,10 @@ typedef struct _AFSocketSourceConnection
   LogReader *reader;
   int sock;
   GSockAddr *peer_addr;
+  /* the listener that received the connection */
+  gint listener_index;
+  /* the event loop polling the connection, NULL for the main thread */
+  MainLoopEventLoop *event_loop;
 } AFSocketSourceConnection;
 
 static void afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnection *sc);
@@ -62,6 +67,13 @@ afsocket_sc_stats_instance(AFSocketSourceConnection *self)
       if (self->owner->bind_addr)
         {
           g_sockaddr_format(self->owner->bind_addr, buf, sizeof(buf), GSA_ADDRESS_ONLY);
+          /* each listener socket has its own counters */
+          if (self->owner->num_listeners > 1)
+            {
+              gsize len = strlen(buf);
+
+              g_snprintf(buf + len, sizeof(buf) - len, "#%d", self->listener_index);
+            }
           return buf;
         }
       else
@@ -96,6 +108,7 @@ afsocket_sc_init(LogPipe *s)
       proto = log_proto_server_factory_construct(self->owner->proto_factory, transport,
               &self->owner->reader_options.proto_options.super);
       self->reader = log_reader_new(s->cfg);
+      log_reader_set_event_loop(self->reader, self->event_loop);
       log_reader_reopen(self->reader, proto, poll_fd_events_new(self->sock));
       log_reader_set_peer_addr(self->reader, self->peer_addr);
     }
@@ -180,7 +193,7 @@ afsocket_sc_free(LogPipe *s)
 }
 
 AFSocketSourceConnection *
-afsocket_sc_new(GSockAddr *peer_addr, int fd, GlobalConfig *cfg)
+afsocket_sc_new(GSockAddr *peer_addr, int fd, gint listener_index, GlobalConfig *cfg)
 {
   AFSocketSourceConnection *self = g_new0(AFSocketSourceConnection, 1);
 
@@ -191,6 +204,7 @@ afsocket_sc_new(GSockAddr *peer_addr, int fd, GlobalConfig *cfg)
   self->super.free_fn = afsocket_sc_free;
   self->peer_addr = g_sockaddr_ref(peer_addr);
   self->sock = fd;
+  self->listener_index = listener_index;
   return self;
 }
 
@@ -261,6 +275,14 @@ afsocket_sd_set_listen_backlog(LogDriver *s, gint listen_backlog)
   self->listen_backlog = listen_backlog;
 }
 
+void
+afsocket_sd_set_num_listeners(LogDriver *s, gint num_listeners)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+
+  self->num_listeners = num_listeners;
+}
+
 static const gchar *
 afsocket_sd_format_name(const LogPipe *s)
 {
@@ -285,12 +307,17 @@ afsocket_sd_format_name(const LogPipe *s)
 }
 
 static const gchar *
-afsocket_sd_format_listener_name(const AFSocketSourceDriver *self)
+afsocket_sd_format_listener_name(const AFSocketSourceDriver *self, gint index)
 {
   static gchar persist_name[1024];
 
-  g_snprintf(persist_name, sizeof(persist_name), "%s.listen_fd",
-             afsocket_sd_format_name((const LogPipe *)self));
+  /* the first listener keeps the name used before listeners() was introduced */
+  if (index == 0)
+    g_snprintf(persist_name, sizeof(persist_name), "%s.listen_fd",
+               afsocket_sd_format_name((const LogPipe *)self));
+  else
+    g_snprintf(persist_name, sizeof(persist_name), "%s.listen_fd.%d",
+               afsocket_sd_format_name((const LogPipe *)self), index);
 
   return persist_name;
 }
@@ -307,7 +334,8 @@ afsocket_sd_format_connections_name(const AFSocketSourceDriver *self)
 }
 
 static gboolean
-afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_addr, GSockAddr *local_addr, gint fd)
+afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_addr, GSockAddr *local_addr, gint fd,
+                               gint listener_index)
 {
   gchar buf[MAX_SOCKADDR_STRING], buf2[MAX_SOCKADDR_STRING];
 #if SYSLOG_NG_ENABLE_TCP_WRAPPER
@@ -333,7 +361,9 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 
 #endif
 
-  if (self->num_connections >= self->max_connections)
+  /* dgram sources have a connection per listener, the limit only applies
+   * to the accepted ones */
+  if (client_addr && self->num_connections >= self->max_connections)
     {
       msg_error("Number of allowed concurrent connections reached, rejecting connection",
                 evt_tag_str("client", g_sockaddr_format(client_addr, buf, sizeof(buf), GSA_FULL)),
@@ -345,7 +375,10 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
     {
       AFSocketSourceConnection *conn;
 
-      conn = afsocket_sc_new(client_addr, fd, self->super.super.super.cfg);
+      conn = afsocket_sc_new(client_addr, fd, listener_index, self->super.super.super.cfg);
+      /* accepted connections are spread among the event loop threads, if any */
+      if (client_addr)
+        conn->event_loop = main_loop_event_loop_assign();
       afsocket_sc_set_owner(conn, self);
       if (log_pipe_init(&conn->super))
         {
@@ -367,7 +400,8 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 static void
 afsocket_sd_accept(gpointer s)
 {
-  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+  AFSocketSourceListener *listener = (AFSocketSourceListener *) s;
+  AFSocketSourceDriver *self = listener->owner;
   GSockAddr *peer_addr;
   gchar buf1[256], buf2[256];
   gint new_fd;
@@ -378,7 +412,7 @@ afsocket_sd_accept(gpointer s)
     {
       GIOStatus status;
 
-      status = g_accept(self->fd, &new_fd, &peer_addr);
+      status = g_accept(listener->listen_fd.fd, &new_fd, &peer_addr);
       if (status == G_IO_STATUS_AGAIN)
         {
           /* no more connections to accept */
@@ -394,7 +428,7 @@ afsocket_sd_accept(gpointer s)
       g_fd_set_nonblock(new_fd, TRUE);
       g_fd_set_cloexec(new_fd, TRUE);
 
-      res = afsocket_sd_process_connection(self, peer_addr, self->bind_addr, new_fd);
+      res = afsocket_sd_process_connection(self, peer_addr, self->bind_addr, new_fd, listener->index);
 
       if (res)
         {
@@ -442,20 +476,16 @@ afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnectio
 }
 
 static void
-afsocket_sd_start_watches(AFSocketSourceDriver *self)
+afsocket_sd_start_watches(AFSocketSourceListener *listener)
 {
-  IV_FD_INIT(&self->listen_fd);
-  self->listen_fd.fd = self->fd;
-  self->listen_fd.cookie = self;
-  self->listen_fd.handler_in = afsocket_sd_accept;
-  iv_fd_register(&self->listen_fd);
+  iv_fd_register(&listener->listen_fd);
 }
 
 static void
-afsocket_sd_stop_watches(AFSocketSourceDriver *self)
+afsocket_sd_stop_watches(AFSocketSourceListener *listener)
 {
-  if (iv_fd_registered (&self->listen_fd))
-    iv_fd_unregister(&self->listen_fd);
+  if (iv_fd_registered (&listener->listen_fd))
+    iv_fd_unregister(&listener->listen_fd);
 }
 
 static gboolean
@@ -538,66 +568,157 @@ afsocket_sd_restore_kept_alive_connections(AFSocketSourceDriver *self)
 }
 
 static gboolean
-afsocket_sd_open_listener(AFSocketSourceDriver *self)
+afsocket_sd_setup_listeners(AFSocketSourceDriver *self)
+{
+  gint i;
+
+  if (self->num_listeners > 1)
+    {
+#ifdef SO_REUSEPORT
+      self->socket_options->so_reuseport = TRUE;
+#else
+      msg_warning("WARNING: listeners() requires SO_REUSEPORT, which is not supported on this platform, using a single listener",
+                  evt_tag_str("id", self->super.super.id));
+      self->num_listeners = 1;
+#endif
+    }
+
+  g_free(self->listeners);
+  self->listeners = g_new0(AFSocketSourceListener, self->num_listeners);
+  for (i = 0; i < self->num_listeners; i++)
+    {
+      AFSocketSourceListener *listener = &self->listeners[i];
+
+      listener->owner = self;
+      listener->index = i;
+      IV_FD_INIT(&listener->listen_fd);
+      listener->listen_fd.fd = -1;
+      listener->listen_fd.cookie = listener;
+      listener->listen_fd.handler_in = afsocket_sd_accept;
+    }
+  return TRUE;
+}
+
+/* returns FALSE if the source failed to initialize, a fd of -1 with a TRUE
+ * return value means that the failure is ignored as the source is optional */
+static gboolean
+afsocket_sd_open_socket(AFSocketSourceDriver *self, gint index, gint *sock)
+{
+  *sock = -1;
+
+  /* a socket acquired from the environment (e.g. systemd) is not shared */
+  if (index == 0 && !afsocket_sd_acquire_socket(self, sock))
+    return self->super.super.optional;
+  if (*sock == -1
+      && !transport_mapper_open_socket(self->transport_mapper, self->socket_options, self->bind_addr, AFSOCKET_DIR_RECV,
+                                       sock))
+    return self->super.super.optional;
+  return TRUE;
+}
+
+/* listeners 1..N-1 can only bind if the first socket has SO_REUSEPORT set,
+ * which is not the case for a socket inherited from systemd or one kept
+ * from a configuration without listeners() */
+static void
+afsocket_sd_limit_listeners_to_socket(AFSocketSourceDriver *self, gint sock)
+{
+  gint reuseport = 0;
+
+  if (self->num_listeners <= 1 || sock == -1)
+    return;
+
+#ifdef SO_REUSEPORT
+  {
+    socklen_t len = sizeof(reuseport);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuseport, &len) < 0)
+      reuseport = 0;
+  }
+#endif
+
+  if (!reuseport)
+    {
+      msg_warning("WARNING: the listening socket was inherited or kept from a previous configuration without SO_REUSEPORT, using a single listener",
+                  evt_tag_str("id", self->super.super.id),
+                  evt_tag_int("fd", sock),
+                  evt_tag_int("listeners", self->num_listeners));
+      self->num_listeners = 1;
+    }
+}
+
+static gboolean
+afsocket_sd_open_stream_listener(AFSocketSourceDriver *self, AFSocketSourceListener *listener)
 {
   GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
-  gint sock;
-  gboolean res = FALSE;
+  gint sock = -1;
 
-  /* ok, we have connection list, check if we need to open a listener */
-  sock = -1;
-  if (self->transport_mapper->sock_type == SOCK_STREAM)
+  if (self->connections_kept_alive_accross_reloads)
     {
-      if (self->connections_kept_alive_accross_reloads)
-        {
-          /* NOTE: this assumes that fd 0 will never be used for listening fds,
-           * main.c opens fd 0 so this assumption can hold */
-          sock = GPOINTER_TO_UINT(
-                   cfg_persist_config_fetch(cfg, afsocket_sd_format_listener_name(self))) -
-                 1;
-        }
+      /* NOTE: this assumes that fd 0 will never be used for listening fds,
+       * main.c opens fd 0 so this assumption can hold */
+      sock = GPOINTER_TO_UINT(
+               cfg_persist_config_fetch(cfg, afsocket_sd_format_listener_name(self, listener->index))) -
+             1;
+    }
 
+  if (sock == -1)
+    {
+      if (!afsocket_sd_open_socket(self, listener->index, &sock))
+        return FALSE;
       if (sock == -1)
-        {
-          if (!afsocket_sd_acquire_socket(self, &sock))
-            return self->super.super.optional;
-          if (sock == -1
-              && !transport_mapper_open_socket(self->transport_mapper, self->socket_options, self->bind_addr, AFSOCKET_DIR_RECV,
-                                               &sock))
-            return self->super.super.optional;
-        }
+        return TRUE;
+    }
+
+  /* set up listening source */
+  if (listen(sock, self->listen_backlog) < 0)
+    {
+      msg_error("Error during listen()",
+                evt_tag_errno(EVT_TAG_OSERROR, errno));
+      close(sock);
+      return FALSE;
+    }
 
-      /* set up listening source */
-      if (listen(sock, self->listen_backlog) < 0)
+  listener->listen_fd.fd = sock;
+  afsocket_sd_start_watches(listener);
+  return TRUE;
+}
+
+static gboolean
+afsocket_sd_open_listener(AFSocketSourceDriver *self)
+{
+  gint sock;
+  gint i;
+
+  if (self->transport_mapper->sock_type == SOCK_STREAM)
+    {
+      for (i = 0; i < self->num_listeners; i++)
         {
-          msg_error("Error during listen()",
-                    evt_tag_errno(EVT_TAG_OSERROR, errno));
-          close(sock);
-          return FALSE;
+          if (!afsocket_sd_open_stream_listener(self, &self->listeners[i]))
+            return FALSE;
+          if (i == 0)
+            afsocket_sd_limit_listeners_to_socket(self, self->listeners[0].listen_fd.fd);
         }
-
-      self->fd = sock;
-      afsocket_sd_start_watches(self);
-      res = TRUE;
     }
   else
     {
-      if (!self->connections)
+      /* kept alive connections are reused, only the missing listeners
+       * are opened */
+      if (self->connections)
+        afsocket_sd_limit_listeners_to_socket(self, ((AFSocketSourceConnection *) self->connections->data)->sock);
+      for (i = g_list_length(self->connections); i < self->num_listeners; i++)
         {
-          if (!afsocket_sd_acquire_socket(self, &sock))
-            return self->super.super.optional;
-          if (sock == -1
-              && !transport_mapper_open_socket(self->transport_mapper, self->socket_options, self->bind_addr, AFSOCKET_DIR_RECV,
-                                               &sock))
-            return self->super.super.optional;
+          if (!afsocket_sd_open_socket(self, i, &sock))
+            return FALSE;
+          if (sock == -1)
+            return TRUE;
+
+          if (!afsocket_sd_process_connection(self, NULL, self->bind_addr, sock, i))
+            return FALSE;
+          if (i == 0)
+            afsocket_sd_limit_listeners_to_socket(self, sock);
         }
-      self->fd = -1;
-
-      /* we either have self->connections != NULL, or sock contains a new fd */
-      if (self->connections || afsocket_sd_process_connection(self, NULL, self->bind_addr, sock))
-        res = TRUE;
     }
-  return res;
+  return TRUE;
 }
 
 static void
@@ -634,28 +755,44 @@ afsocket_sd_save_connections(AFSocketSourceDriver *self)
 }
 
 static void
-afsocket_sd_save_listener(AFSocketSourceDriver *self)
+afsocket_sd_save_listener(AFSocketSourceDriver *self, AFSocketSourceListener *listener)
 {
   GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
+  gint fd = listener->listen_fd.fd;
 
-  if (self->transport_mapper->sock_type == SOCK_STREAM)
+  afsocket_sd_stop_watches(listener);
+  if (fd == -1)
+    return;
+
+  if (!self->connections_kept_alive_accross_reloads)
     {
-      afsocket_sd_stop_watches(self);
-      if (!self->connections_kept_alive_accross_reloads)
-        {
-          msg_verbose("Closing listener fd",
-                      evt_tag_int("fd", self->fd));
-          close(self->fd);
-        }
-      else
-        {
-          /* NOTE: the fd is incremented by one when added to persistent config
-           * as persist config cannot store NULL */
+      msg_verbose("Closing listener fd",
+                  evt_tag_int("fd", fd));
+      close(fd);
+    }
+  else
+    {
+      /* NOTE: the fd is incremented by one when added to persistent config
+       * as persist config cannot store NULL */
 
-          cfg_persist_config_add(cfg, afsocket_sd_format_listener_name(self),
-                                 GUINT_TO_POINTER(self->fd + 1), afsocket_sd_close_fd, FALSE);
-        }
+      cfg_persist_config_add(cfg, afsocket_sd_format_listener_name(self, listener->index),
+                             GUINT_TO_POINTER(fd + 1), afsocket_sd_close_fd, FALSE);
+    }
+  listener->listen_fd.fd = -1;
+}
+
+static void
+afsocket_sd_save_listeners(AFSocketSourceDriver *self)
+{
+  gint i;
+
+  if (self->transport_mapper->sock_type == SOCK_STREAM)
+    {
+      for (i = 0; i < self->num_listeners; i++)
+        afsocket_sd_save_listener(self, &self->listeners[i]);
     }
+  g_free(self->listeners);
+  self->listeners = NULL;
 }
 
 
@@ -673,6 +810,7 @@ afsocket_sd_init_method(LogPipe *s)
   return log_src_driver_init_method(s) &&
          afsocket_sd_setup_transport(self) &&
          afsocket_sd_setup_addresses(self) &&
+         afsocket_sd_setup_listeners(self) &&
          afsocket_sd_restore_kept_alive_connections(self) &&
          afsocket_sd_open_listener(self);
 }
@@ -683,7 +821,7 @@ afsocket_sd_deinit_method(LogPipe *s)
   AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
 
   afsocket_sd_save_connections(self);
-  afsocket_sd_save_listener(self);
+  afsocket_sd_save_listeners(self);
 
   return log_src_driver_deinit_method(s);
 }
@@ -707,6 +845,7 @@ afsocket_sd_free_method(LogPipe *s)
 {
   AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
 
+  g_free(self->listeners);
   log_reader_options_destroy(&self->reader_options);
   transport_mapper_free(self->transport_mapper);
   socket_options_free(self->socket_options);
@@ -733,6 +872,7 @@ afsocket_sd_init_instance(AFSocketSourceDriver *self,
   self->transport_mapper = transport_mapper;
   self->max_connections = 10;
   self->listen_backlog = 255;
+  self->num_listeners = 1;
   self->connections_kept_alive_accross_reloads = TRUE;
   log_reader_options_defaults(&self->reader_options);
 
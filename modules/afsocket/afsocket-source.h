@@ -36,6 +36,14 @@
 
 typedef struct _AFSocketSourceDriver AFSocketSourceDriver;
 
+/* a listening socket of a stream based source */
+typedef struct _AFSocketSourceListener
+{
+  AFSocketSourceDriver *owner;
+  struct iv_fd listen_fd;
+  gint index;
+} AFSocketSourceListener;
+
 struct _AFSocketSourceDriver
 {
   LogSrcDriver super;
@@ -43,8 +51,11 @@ struct _AFSocketSourceDriver
     connections_kept_alive_accross_reloads:1,
     require_tls:1,
     window_size_initialized:1;
-  struct iv_fd listen_fd;
-  gint fd;
+  /* with listeners(N) > 1, N sockets are bound to the same address using
+   * SO_REUSEPORT, so that the kernel distributes the incoming connections
+   * (or datagrams) between them, each having its own LogReader */
+  gint num_listeners;
+  AFSocketSourceListener *listeners;
   LogReaderOptions reader_options;
   LogProtoServerFactory *proto_factory;
   GSockAddr *bind_addr;
@@ -74,6 +85,7 @@ struct _AFSocketSourceDriver
 void afsocket_sd_set_keep_alive(LogDriver *self, gint enable);
 void afsocket_sd_set_max_connections(LogDriver *self, gint max_connections);
 void afsocket_sd_set_listen_backlog(LogDriver *self, gint listen_backlog);
+void afsocket_sd_set_num_listeners(LogDriver *self, gint num_listeners);
 
 static inline gboolean
 afsocket_sd_acquire_socket(AFSocketSourceDriver *s, gint *fd)
@@ -40,6 +40,8 @@ struct _SocketOptions
   gint so_rcvbuf;
   gint so_broadcast;
   gint so_keepalive;
+  /* set before bind(), allows multiple sockets to be bound to the same address */
+  gint so_reuseport;
   gboolean (*setup_socket)(SocketOptions *s, gint sock, GSockAddr *bind_addr, AFSocketDirection dir);
   void (*free)(gpointer s);
 };
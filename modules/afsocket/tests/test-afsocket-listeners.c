@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "testutils.h"
+#include "afsocket-source.h"
+#include "apphook.h"
+#include "plugin.h"
+#include "cfg-grammar.h"
+#include "config_parse_lib.h"
+#include "mainloop.h"
+
+#include <iv.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define LISTENERS 4
+#define CONNECTIONS 32
+
+static struct sockaddr_in
+_loopback_addr(gint port)
+{
+  struct sockaddr_in sin;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = htons(port);
+  return sin;
+}
+
+static gint
+_get_bound_port(gint sock)
+{
+  struct sockaddr_in sin;
+  socklen_t len = sizeof(sin);
+
+  assert_true(getsockname(sock, (struct sockaddr *) &sin, &len) == 0, "getsockname() failed");
+  return ntohs(sin.sin_port);
+}
+
+/* a socket bound to 127.0.0.1 without SO_REUSEPORT, @port 0 picks a free port */
+static gint
+_open_plain_socket(gint sock_type, gint port)
+{
+  struct sockaddr_in sin = _loopback_addr(port);
+  gint sock = socket(AF_INET, sock_type, 0);
+
+  assert_true(sock >= 0, "socket() failed");
+  assert_true(bind(sock, (struct sockaddr *) &sin, sizeof(sin)) == 0, "bind() failed");
+  return sock;
+}
+
+static gint
+_find_free_port(gint sock_type)
+{
+  gint sock = _open_plain_socket(sock_type, 0);
+  gint port = _get_bound_port(sock);
+
+  close(sock);
+  return port;
+}
+
+static AFSocketSourceDriver *
+_parse_source(const gchar *source_config)
+{
+  LogDriver *driver = NULL;
+
+  if (!parse_config(source_config, LL_CONTEXT_SOURCE, NULL, (gpointer *) &driver))
+    return NULL;
+
+  /* normally set up by log_src_driver_init_method() from the enclosing source {} block */
+  driver->group = g_strdup("s_listeners");
+  driver->id = g_strdup("s_listeners#0");
+  ((LogSrcDriver *) driver)->group_len = strlen(driver->group);
+  return (AFSocketSourceDriver *) driver;
+}
+
+static AFSocketSourceDriver *
+_init_source(const gchar *driver_name, gint port, const gchar *extra_options)
+{
+  gchar *source_config;
+  AFSocketSourceDriver *source;
+
+  source_config = g_strdup_printf("%s(ip(\"127.0.0.1\") port(%d) %s)", driver_name, port, extra_options);
+  source = _parse_source(source_config);
+  assert_not_null(source, "failed to parse %s", source_config);
+  assert_true(log_pipe_init(&source->super.super.super), "failed to initialize %s", source_config);
+  g_free(source_config);
+  return source;
+}
+
+static void
+_deinit_source(AFSocketSourceDriver *source)
+{
+  log_pipe_deinit(&source->super.super.super);
+  log_pipe_unref(&source->super.super.super);
+}
+
+static void
+test_listeners_grammar(void)
+{
+  AFSocketSourceDriver *source;
+
+  testcase_begin("%s", __FUNCTION__);
+
+  source = _parse_source("tcp(port(2000))");
+  assert_gint(source->num_listeners, 1, "a single listener is used by default");
+  log_pipe_unref(&source->super.super.super);
+
+  source = _parse_source("tcp(port(2000) listeners(4))");
+  assert_gint(source->num_listeners, 4, "listeners() is not applied to tcp()");
+  log_pipe_unref(&source->super.super.super);
+
+  source = _parse_source("udp(port(2000) so-reuseport(3))");
+  assert_gint(source->num_listeners, 3, "so-reuseport() is not an alias of listeners()");
+  log_pipe_unref(&source->super.super.super);
+
+  source = _parse_source("network(port(2000) transport(udp) listeners(2))");
+  assert_gint(source->num_listeners, 2, "listeners() is not applied to network()");
+  log_pipe_unref(&source->super.super.super);
+
+  assert_null(_parse_source("tcp(port(2000) listeners(0))"), "listeners(0) should be rejected");
+
+  testcase_end();
+}
+
+#ifdef SO_REUSEPORT
+
+static void
+test_stream_listeners_are_bound_to_the_same_port(void)
+{
+  gint port = _find_free_port(SOCK_STREAM);
+  AFSocketSourceDriver *source;
+  gint i, j;
+
+  testcase_begin("%s", __FUNCTION__);
+
+  source = _init_source("tcp", port, "listeners(4) keep-alive(no)");
+  assert_gint(source->num_listeners, LISTENERS, "the number of listeners changed");
+  for (i = 0; i < LISTENERS; i++)
+    {
+      gint fd = source->listeners[i].listen_fd.fd;
+
+      assert_true(fd != -1, "listener %d is not open", i);
+      assert_gint(_get_bound_port(fd), port, "listener %d is bound to another port", i);
+      for (j = 0; j < i; j++)
+        assert_true(source->listeners[j].listen_fd.fd != fd, "listeners %d and %d share a socket", j, i);
+    }
+  _deinit_source(source);
+
+  testcase_end();
+}
+
+static void
+test_stream_connections_are_accepted_on_every_listener(void)
+{
+  gint port = _find_free_port(SOCK_STREAM);
+  struct sockaddr_in sin = _loopback_addr(port);
+  gint clients[CONNECTIONS];
+  gint accepted[LISTENERS] = { 0 };
+  AFSocketSourceDriver *source;
+  gint i, total = 0;
+
+  testcase_begin("%s", __FUNCTION__);
+
+  source = _init_source("tcp", port, "listeners(4) keep-alive(no) max-connections(100)");
+
+  /* the kernel spreads connections among the listeners by the hash of
+   * the client address, 32 client ports leave none of 4 listeners idle */
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+      assert_true(connect(clients[i], (struct sockaddr *) &sin, sizeof(sin)) == 0, "connect() failed");
+    }
+
+  for (i = 0; i < LISTENERS; i++)
+    {
+      AFSocketSourceListener *listener = &source->listeners[i];
+      struct pollfd pfd = { .fd = listener->listen_fd.fd, .events = POLLIN };
+
+      while (poll(&pfd, 1, 0) == 1)
+        {
+          gint before = source->num_connections;
+
+          /* the same handler the main loop calls when the socket is readable */
+          listener->listen_fd.handler_in(listener->listen_fd.cookie);
+          assert_true(source->num_connections > before, "listener %d did not accept a pending connection", i);
+          accepted[i] += source->num_connections - before;
+        }
+      total += accepted[i];
+    }
+
+  assert_gint(total, CONNECTIONS, "not every connection was accepted");
+  for (i = 0; i < LISTENERS; i++)
+    assert_true(accepted[i] > 0, "listener %d accepted no connections", i);
+
+  _deinit_source(source);
+  for (i = 0; i < CONNECTIONS; i++)
+    close(clients[i]);
+
+  testcase_end();
+}
+
+static void
+test_dgram_listeners_are_bound_to_the_same_port(void)
+{
+  gint port = _find_free_port(SOCK_DGRAM);
+  AFSocketSourceDriver *source;
+
+  testcase_begin("%s", __FUNCTION__);
+
+  /* each datagram socket is a connection with its own reader */
+  source = _init_source("udp", port, "listeners(4)");
+  assert_gint(source->num_listeners, LISTENERS, "the number of listeners changed");
+  assert_gint(g_list_length(source->connections), LISTENERS, "not every datagram socket was opened");
+  _deinit_source(source);
+
+  testcase_end();
+}
+
+#endif
+
+/* emulates a socket passed by systemd, which is bound without SO_REUSEPORT */
+static gint acquired_socket_type;
+static gint acquired_socket_port;
+static gint acquired_socket;
+
+static gboolean
+_acquire_plain_socket(AFSocketSourceDriver *s, gint *fd)
+{
+  acquired_socket = _open_plain_socket(acquired_socket_type, acquired_socket_port);
+  *fd = acquired_socket;
+  return TRUE;
+}
+
+static void
+_assert_single_listener_fallback(const gchar *driver_name, gint sock_type, const gchar *extra_options)
+{
+  gchar *source_config;
+  AFSocketSourceDriver *source;
+
+  acquired_socket_type = sock_type;
+  acquired_socket_port = _find_free_port(sock_type);
+  acquired_socket = -1;
+
+  source_config = g_strdup_printf("%s(ip(\"127.0.0.1\") port(%d) listeners(4) %s)", driver_name, acquired_socket_port,
+                                  extra_options);
+  source = _parse_source(source_config);
+  assert_not_null(source, "failed to parse %s", source_config);
+  source->acquire_socket = _acquire_plain_socket;
+
+  assert_true(log_pipe_init(&source->super.super.super), "%s should fall back to a single listener", source_config);
+  assert_gint(source->num_listeners, 1, "%s should fall back to a single listener", source_config);
+  assert_true(acquired_socket != -1, "the socket was not acquired");
+  if (sock_type == SOCK_STREAM)
+    assert_gint(source->listeners[0].listen_fd.fd, acquired_socket, "the acquired socket is not used");
+  else
+    assert_gint(g_list_length(source->connections), 1, "only the acquired socket should be opened");
+
+  _deinit_source(source);
+  g_free(source_config);
+}
+
+static void
+test_single_listener_fallback_without_so_reuseport(void)
+{
+  testcase_begin("%s", __FUNCTION__);
+
+  _assert_single_listener_fallback("tcp", SOCK_STREAM, "keep-alive(no)");
+  _assert_single_listener_fallback("udp", SOCK_DGRAM, "");
+
+  testcase_end();
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  iv_init();
+  main_thread_handle = get_thread_id();
+
+  configuration = cfg_new(VERSION_VALUE);
+  plugin_load_module("afsocket", configuration, NULL);
+
+  test_listeners_grammar();
+#ifdef SO_REUSEPORT
+  test_stream_listeners_are_bound_to_the_same_port();
+  test_stream_connections_are_accepted_on_every_listener();
+  test_dgram_listeners_are_bound_to_the_same_port();
+#endif
+  test_single_listener_fallback_without_so_reuseport();
+
+  cfg_free(configuration);
+  iv_deinit();
+  app_shutdown();
+  return 0;
+}
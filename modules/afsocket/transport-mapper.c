@@ -68,6 +68,16 @@ transport_mapper_open_socket(TransportMapper *self,
   g_fd_set_nonblock(sock, TRUE);
   g_fd_set_cloexec(sock, TRUE);
 
+#ifdef SO_REUSEPORT
+  if (socket_options->so_reuseport &&
+      setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &socket_options->so_reuseport, sizeof(socket_options->so_reuseport)) < 0)
+    {
+      msg_error("Error setting SO_REUSEPORT on socket",
+                evt_tag_errno(EVT_TAG_OSERROR, errno));
+      goto error_close;
+    }
+#endif
+
   if (!transport_mapper_privileged_bind(sock, bind_addr))
     {
       gchar buf[256];
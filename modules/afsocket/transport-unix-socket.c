@@ -269,6 +269,8 @@ log_transport_unix_dgram_socket_new(gint fd)
 
   log_transport_dgram_socket_init_instance(self, fd);
   self->super.read = log_transport_unix_dgram_socket_read_method;
+  /* batched reads would lose the credentials passed along the datagrams */
+  self->super.read_batch = NULL;
 
   return &self->super;
 }
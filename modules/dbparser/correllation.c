@@ -24,18 +24,70 @@
 #include "correllation-key.h"
 #include "correllation-context.h"
 
+/* the shard takes over the reference of the caller, a context already
+ * stored with the same key is released */
+void
+correllation_state_shard_insert_context(CorrellationStateShard *self, CorrellationContext *context)
+{
+  g_hash_table_replace(self->state, &context->key, context);
+}
+
+/* removes the context only if it is still the one stored under its key,
+ * returns whether it was removed */
+gboolean
+correllation_state_shard_remove_context(CorrellationStateShard *self, CorrellationContext *context)
+{
+  if (g_hash_table_lookup(self->state, &context->key) != context)
+    return FALSE;
+  return g_hash_table_remove(self->state, &context->key);
+}
+
+gint
+correllation_state_get_shard_index(CorrellationState *self, const CorrellationKey *key)
+{
+  guint hash = correllation_key_hash(key);
+
+  /* the hash tables use the low bits of the same hash, fold the high bits
+   * in to keep the shards and the buckets within them independent */
+  hash ^= hash >> 16;
+  return hash % CORRELLATION_STATE_NUM_SHARDS;
+}
+
+CorrellationStateShard *
+correllation_state_get_shard(CorrellationState *self, const CorrellationKey *key)
+{
+  return &self->shards[correllation_state_get_shard_index(self, key)];
+}
+
 void
 correllation_state_init_instance(CorrellationState *self)
 {
-  self->state = g_hash_table_new_full(correllation_key_hash, correllation_key_equal, NULL,
-                                      (GDestroyNotify) correllation_context_unref);
+  gint i;
+
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      CorrellationStateShard *shard = &self->shards[i];
+
+      g_static_mutex_init(&shard->lock);
+      shard->state = g_hash_table_new_full(correllation_key_hash, correllation_key_equal, NULL,
+                                           (GDestroyNotify) correllation_context_unref);
+    }
 }
 
 void
 correllation_state_deinit_instance(CorrellationState *self)
 {
-  if (self->state)
-    g_hash_table_destroy(self->state);
+  gint i;
+
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      CorrellationStateShard *shard = &self->shards[i];
+
+      if (shard->state)
+        g_hash_table_destroy(shard->state);
+      shard->state = NULL;
+      g_static_mutex_free(&shard->lock);
+    }
 }
 
 CorrellationState *
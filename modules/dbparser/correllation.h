@@ -25,12 +25,49 @@
 
 #include "syslog-ng.h"
 #include "correllation-key.h"
+#include "correllation-context.h"
 
-typedef struct _CorrellationState
+/* The correllation state is split into shards by the hash of the context
+ * key, each with its own lock, so that messages belonging to different
+ * contexts can be correllated concurrently.  Users that serialize access
+ * to the whole state by other means may ignore the shard locks. */
+#define CORRELLATION_STATE_NUM_SHARDS 16
+
+typedef struct _CorrellationStateShard
 {
+  GStaticMutex lock;
   GHashTable *state;
+} CorrellationStateShard;
+
+typedef struct _CorrellationState
+{
+  CorrellationStateShard shards[CORRELLATION_STATE_NUM_SHARDS];
 } CorrellationState;
 
+static inline void
+correllation_state_shard_lock(CorrellationStateShard *self)
+{
+  g_static_mutex_lock(&self->lock);
+}
+
+static inline void
+correllation_state_shard_unlock(CorrellationStateShard *self)
+{
+  g_static_mutex_unlock(&self->lock);
+}
+
+static inline CorrellationContext *
+correllation_state_shard_lookup_context(CorrellationStateShard *self, const CorrellationKey *key)
+{
+  return (CorrellationContext *) g_hash_table_lookup(self->state, key);
+}
+
+void correllation_state_shard_insert_context(CorrellationStateShard *self, CorrellationContext *context);
+gboolean correllation_state_shard_remove_context(CorrellationStateShard *self, CorrellationContext *context);
+
+gint correllation_state_get_shard_index(CorrellationState *self, const CorrellationKey *key);
+CorrellationStateShard *correllation_state_get_shard(CorrellationState *self, const CorrellationKey *key);
+
 void correllation_state_init_instance(CorrellationState *self);
 void correllation_state_deinit_instance(CorrellationState *self);
 CorrellationState *correllation_state_new(void);
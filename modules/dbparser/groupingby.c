@@ -27,15 +27,42 @@
 #include "messages.h"
 #include "str-utils.h"
 #include "filter/filter-expr.h"
+#include "stats/stats-registry.h"
 #include <iv.h>
 
+/* Each shard of the correllation state is paired with a timer wheel and a
+ * lock of its own, so messages with keys that hash to different shards
+ * are grouped without contending with each other.  A context is always
+ * found in the same shard, its timer in the wheel of that shard and all
+ * accesses to both happen under the shard lock.
+ *
+ * The current time is shared by all shards: it is advanced with atomic
+ * operations by the incoming messages and the timer tick, then each
+ * timer wheel catches up with it under its shard lock.  As the time only
+ * moves in whole seconds, catching up every shard is rare.
+ *
+ * Synthetic messages are not emitted while a shard lock is held, as they
+ * may be forwarded synchronously to a pipeline that ends up in this parser
+ * again.  They are queued in the shard and emitted by
+ * grouping_by_shard_unlock(). */
+typedef struct _GroupingByShard
+{
+  GStaticMutex lock;
+  TimerWheel *timer_wheel;
+  GPtrArray *emitted_messages;
+  StatsCounterItem *live_contexts;
+  struct _GroupingBy *owner;
+  gint index;
+} GroupingByShard;
+
 typedef struct _GroupingBy
 {
   StatefulParser super;
-  GStaticMutex lock;
   struct iv_timer tick;
-  TimerWheel *timer_wheel;
+  volatile glong time;
+  volatile gint received_messages;
   GTimeVal last_tick;
+  GroupingByShard shards[CORRELLATION_STATE_NUM_SHARDS];
   CorrellationState *correllation;
   LogTemplate *key_template;
   gint timeout;
@@ -107,8 +134,75 @@ grouping_by_set_synthetic_message(LogParser *s, SyntheticMessage *message)
   self->synthetic_message = message;
 }
 
-/* NOTE: lock should be acquired for writing before calling this function. */
-void
+/* NOTE: the shard lock should be acquired before calling this function. */
+static void
+grouping_by_shard_catch_up(GroupingByShard *self)
+{
+  timer_wheel_set_time(self->timer_wheel, self->owner->time);
+}
+
+static void
+grouping_by_shard_unlock(GroupingByShard *self)
+{
+  GPtrArray *emitted_messages = NULL;
+  gint i;
+
+  if (self->emitted_messages->len > 0)
+    {
+      emitted_messages = self->emitted_messages;
+      self->emitted_messages = g_ptr_array_new();
+    }
+  g_static_mutex_unlock(&self->lock);
+
+  if (!emitted_messages)
+    return;
+
+  for (i = 0; i < emitted_messages->len; i++)
+    {
+      LogMessage *msg = (LogMessage *) g_ptr_array_index(emitted_messages, i);
+
+      stateful_parser_emit_synthetic(&self->owner->super, msg);
+      log_msg_unref(msg);
+    }
+  g_ptr_array_free(emitted_messages, TRUE);
+}
+
+static void
+grouping_by_catch_up_shards(GroupingBy *self)
+{
+  gint i;
+
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      GroupingByShard *shard = &self->shards[i];
+
+      g_static_mutex_lock(&shard->lock);
+      grouping_by_shard_catch_up(shard);
+      grouping_by_shard_unlock(shard);
+    }
+}
+
+/* Moves the current time forward to @new_time, returns FALSE if it was
+ * there already. */
+static gboolean
+grouping_by_advance_time(GroupingBy *self, glong new_time)
+{
+  glong current;
+
+  do
+    {
+      current = self->time;
+      if (new_time <= current)
+        return FALSE;
+    }
+  while (!__sync_bool_compare_and_swap(&self->time, current, new_time));
+
+  grouping_by_catch_up_shards(self);
+  return TRUE;
+}
+
+/* NOTE: no shard lock should be held when calling this function. */
+static void
 grouping_by_set_time(GroupingBy *self, const LogStamp *ls)
 {
   GTimeVal now;
@@ -119,14 +213,17 @@ grouping_by_set_time(GroupingBy *self, const LogStamp *ls)
    * correllation engine too much. */
 
   cached_g_current_time(&now);
-  self->last_tick = now;
+
+  /* avoid dirtying a shared cache line for every message */
+  if (!self->received_messages)
+    self->received_messages = TRUE;
 
   if (ls->tv_sec < now.tv_sec)
     now.tv_sec = ls->tv_sec;
 
-  timer_wheel_set_time(self->timer_wheel, now.tv_sec);
-  msg_debug("Advancing correllate() current time because of an incoming message",
-            evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)));
+  if (grouping_by_advance_time(self, now.tv_sec))
+    msg_debug("Advancing correllate() current time because of an incoming message",
+              evt_tag_long("utc", now.tv_sec));
 }
 
 /*
@@ -137,23 +234,32 @@ grouping_by_set_time(GroupingBy *self, const LogStamp *ls)
  * invocation.  See the timing comment at pattern_db_process() for more
  * information.
  */
-void
+static void
 _grouping_by_timer_tick(GroupingBy *self)
 {
   GTimeVal now;
   glong diff;
 
-  g_static_mutex_lock(&self->lock);
   cached_g_current_time(&now);
+
+  /* incoming messages move the time themselves, the idle time is
+   * measured from the first tick after the last message */
+  if (self->received_messages)
+    {
+      __sync_lock_test_and_set(&self->received_messages, FALSE);
+      self->last_tick = now;
+      return;
+    }
+
   diff = g_time_val_diff(&now, &self->last_tick);
 
   if (diff > 1e6)
     {
       glong diff_sec = diff / 1e6;
 
-      timer_wheel_set_time(self->timer_wheel, timer_wheel_get_time(self->timer_wheel) + diff_sec);
+      grouping_by_advance_time(self, self->time + diff_sec);
       msg_debug("Advancing correllate() current time because of timer tick",
-                evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)));
+                evt_tag_long("utc", self->time));
       /* update last_tick, take the fraction of the seconds not calculated into this update into account */
 
       self->last_tick = now;
@@ -167,7 +273,6 @@ _grouping_by_timer_tick(GroupingBy *self)
        */
       self->last_tick = now;
     }
-  g_static_mutex_unlock(&self->lock);
 }
 
 static void
@@ -192,8 +297,10 @@ _evaluate_having(GroupingBy *self, CorrellationContext *context)
                                        context->messages->len);
 }
 
+/* NOTE: the shard lock should be held, the message is emitted when it is
+ * released */
 static void
-grouping_by_emit_synthetic(GroupingBy *self, CorrellationContext *context)
+grouping_by_emit_synthetic(GroupingBy *self, GroupingByShard *shard, CorrellationContext *context)
 {
   LogMessage *msg;
 
@@ -202,8 +309,7 @@ grouping_by_emit_synthetic(GroupingBy *self, CorrellationContext *context)
       GString *buffer = g_string_sized_new(256);
 
       msg = synthetic_message_generate_with_context(self->synthetic_message, context, buffer);
-      stateful_parser_emit_synthetic(&self->super, msg);
-      log_msg_unref(msg);
+      g_ptr_array_add(shard->emitted_messages, msg);
       g_string_free(buffer, TRUE);
     }
   else
@@ -222,7 +328,8 @@ static void
 grouping_by_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
 {
   CorrellationContext *context = user_data;
-  GroupingBy *self = (GroupingBy *) timer_wheel_get_associated_data(wheel);
+  GroupingByShard *shard = (GroupingByShard *) timer_wheel_get_associated_data(wheel);
+  GroupingBy *self = shard->owner;
   gchar buf[256];
 
   msg_debug("Expiring correllate() correllation context",
@@ -231,8 +338,9 @@ grouping_by_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
             evt_tag_str("location",
                         log_expr_node_format_location(self->super.super.super.expr_node,
                             buf, sizeof(buf))));
-  grouping_by_emit_synthetic(self, context);
-  g_hash_table_remove(self->correllation->state, &context->key);
+  grouping_by_emit_synthetic(self, shard, context);
+  if (correllation_state_shard_remove_context(&self->correllation->shards[shard->index], context))
+    stats_counter_dec(shard->live_contexts);
 
   /* correllation_context_free is automatically called when returning from
      this function by the timerwheel code as a destroy notify
@@ -249,35 +357,57 @@ grouping_by_format_persist_name(GroupingBy *self)
   return persist_name;
 }
 
+static gchar *
+grouping_by_format_time_persist_name(GroupingBy *self)
+{
+  static gchar persist_name[512];
+
+  g_snprintf(persist_name, sizeof(persist_name), "correllation().time");
+  return persist_name;
+}
+
 static gboolean
 _perform_groupby(GroupingBy *self, LogMessage *msg)
 {
   GString *buffer = g_string_sized_new(32);
   CorrellationContext *context = NULL;
+  CorrellationStateShard *state;
+  GroupingByShard *shard;
   gchar buf[256];
 
-  g_static_mutex_lock(&self->lock);
-  grouping_by_set_time(self, &msg->timestamps[LM_TS_STAMP]);
   if (self->key_template)
     {
       CorrellationKey key;
+      gint index;
 
       log_template_format(self->key_template, msg, NULL, LTZ_LOCAL, 0, NULL, buffer);
       log_msg_set_value(msg, context_id_handle, buffer->str, -1);
 
       correllation_key_setup(&key, self->scope, msg, buffer->str);
-      context = g_hash_table_lookup(self->correllation->state, &key);
+
+      /* the shard lock serializes all access to the contexts and timers of
+       * the shard, the lock of the correllation state shard is not used */
+      index = correllation_state_get_shard_index(self->correllation, &key);
+      state = &self->correllation->shards[index];
+      shard = &self->shards[index];
+
+      grouping_by_set_time(self, &msg->timestamps[LM_TS_STAMP]);
+      g_static_mutex_lock(&shard->lock);
+      /* another thread may have moved the time without reaching this shard yet */
+      grouping_by_shard_catch_up(shard);
+      context = correllation_state_shard_lookup_context(state, &key);
       if (!context)
         {
           msg_debug("Correllation context lookup failure, starting a new context",
                     evt_tag_str("key", buffer->str),
                     evt_tag_int("timeout", self->timeout),
-                    evt_tag_int("expiration", timer_wheel_get_time(self->timer_wheel) + self->timeout),
+                    evt_tag_int("expiration", timer_wheel_get_time(shard->timer_wheel) + self->timeout),
                     evt_tag_str("location",
                                 log_expr_node_format_location(self->super.super.super.expr_node,
                                     buf, sizeof(buf))));
           context = correllation_context_new(&key);
-          g_hash_table_insert(self->correllation->state, &context->key, context);
+          correllation_state_shard_insert_context(state, context);
+          stats_counter_inc(shard->live_contexts);
           g_string_steal(buffer);
         }
       else
@@ -285,7 +415,7 @@ _perform_groupby(GroupingBy *self, LogMessage *msg)
           msg_debug("Correllation context lookup successful",
                     evt_tag_str("key", buffer->str),
                     evt_tag_int("timeout", self->timeout),
-                    evt_tag_int("expiration", timer_wheel_get_time(self->timer_wheel) + self->timeout),
+                    evt_tag_int("expiration", timer_wheel_get_time(shard->timer_wheel) + self->timeout),
                     evt_tag_int("num_messages", context->messages->len),
                     evt_tag_str("location",
                                 log_expr_node_format_location(self->super.super.super.expr_node,
@@ -306,30 +436,29 @@ _perform_groupby(GroupingBy *self, LogMessage *msg)
                                       buf, sizeof(buf))));
           /* close down state */
           if (context->timer)
-            timer_wheel_del_timer(self->timer_wheel, context->timer);
-          grouping_by_expire_entry(self->timer_wheel, timer_wheel_get_time(self->timer_wheel), context);
+            timer_wheel_del_timer(shard->timer_wheel, context->timer);
+          grouping_by_expire_entry(shard->timer_wheel, timer_wheel_get_time(shard->timer_wheel), context);
         }
       else
         {
 
           if (context->timer)
             {
-              timer_wheel_mod_timer(self->timer_wheel, context->timer, self->timeout);
+              timer_wheel_mod_timer(shard->timer_wheel, context->timer, self->timeout);
             }
           else
             {
-              context->timer = timer_wheel_add_timer(self->timer_wheel, self->timeout, grouping_by_expire_entry,
+              context->timer = timer_wheel_add_timer(shard->timer_wheel, self->timeout, grouping_by_expire_entry,
                                                      correllation_context_ref(context), (GDestroyNotify) correllation_context_unref);
             }
         }
+      grouping_by_shard_unlock(shard);
     }
   else
     {
       context = NULL;
     }
 
-  g_static_mutex_unlock(&self->lock);
-
   if (context)
     log_msg_write_protect(msg);
 
@@ -357,17 +486,104 @@ grouping_by_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *path_
   return TRUE;
 }
 
+static void
+grouping_by_register_shard_stats(GroupingBy *self)
+{
+  gchar location[256];
+  gchar instance[16];
+  gint i;
+
+  log_expr_node_format_location(self->super.super.super.expr_node, location, sizeof(location));
+  stats_lock();
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      GroupingByShard *shard = &self->shards[i];
+
+      g_snprintf(instance, sizeof(instance), "shard%d", i);
+      stats_register_counter(3, SCS_CORRELLATION, location, instance, SC_TYPE_STORED, &shard->live_contexts);
+      stats_counter_set(shard->live_contexts, g_hash_table_size(self->correllation->shards[i].state));
+    }
+  stats_unlock();
+}
+
+static void
+grouping_by_unregister_shard_stats(GroupingBy *self)
+{
+  gchar location[256];
+  gchar instance[16];
+  gint i;
+
+  log_expr_node_format_location(self->super.super.super.expr_node, location, sizeof(location));
+  stats_lock();
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      g_snprintf(instance, sizeof(instance), "shard%d", i);
+      stats_unregister_counter(SCS_CORRELLATION, location, instance, SC_TYPE_STORED, &self->shards[i].live_contexts);
+    }
+  stats_unlock();
+}
+
+/* contexts inherited from a previous configuration are persisted without
+ * their timers, which belonged to the timer wheels of the old instance.
+ * Start them over with a full timeout, counted from the persisted time. */
+static void
+grouping_by_shard_restore_timers(GroupingBy *self, GroupingByShard *shard)
+{
+  CorrellationStateShard *state = &self->correllation->shards[shard->index];
+  CorrellationContext *context;
+  GHashTableIter iter;
+
+  g_hash_table_iter_init(&iter, state->state);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &context))
+    {
+      if (!context->timer)
+        context->timer = timer_wheel_add_timer(shard->timer_wheel, self->timeout, grouping_by_expire_entry,
+                                               correllation_context_ref(context), (GDestroyNotify) correllation_context_unref);
+    }
+}
+
+static void
+grouping_by_shard_drop_timers(GroupingBy *self, GroupingByShard *shard)
+{
+  CorrellationStateShard *state = &self->correllation->shards[shard->index];
+  CorrellationContext *context;
+  GHashTableIter iter;
+
+  g_hash_table_iter_init(&iter, state->state);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &context))
+    {
+      if (context->timer)
+        {
+          timer_wheel_del_timer(shard->timer_wheel, context->timer);
+          context->timer = NULL;
+        }
+    }
+}
+
 static gboolean
 grouping_by_init(LogPipe *s)
 {
   GroupingBy *self = (GroupingBy *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  glong *persisted_time;
+  gint i;
 
   self->correllation = cfg_persist_config_fetch(cfg, grouping_by_format_persist_name(self));
   if (!self->correllation)
     {
       self->correllation = correllation_state_new();
     }
+  persisted_time = cfg_persist_config_fetch(cfg, grouping_by_format_time_persist_name(self));
+  if (persisted_time)
+    {
+      grouping_by_advance_time(self, *persisted_time);
+      g_free(persisted_time);
+    }
+  cached_g_current_time(&self->last_tick);
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    grouping_by_shard_restore_timers(self, &self->shards[i]);
+  grouping_by_register_shard_stats(self);
+
   iv_validate_now();
   IV_TIMER_INIT(&self->tick);
   self->tick.cookie = self;
@@ -384,15 +600,25 @@ grouping_by_deinit(LogPipe *s)
 {
   GroupingBy *self = (GroupingBy *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  glong *persisted_time;
+  gint i;
 
   if (iv_timer_registered(&self->tick))
     {
       iv_timer_unregister(&self->tick);
     }
 
+  grouping_by_unregister_shard_stats(self);
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    grouping_by_shard_drop_timers(self, &self->shards[i]);
+
   cfg_persist_config_add(cfg, grouping_by_format_persist_name(self), self->correllation,
                          (GDestroyNotify) correllation_state_free, FALSE);
   self->correllation = NULL;
+
+  persisted_time = g_new(glong, 1);
+  *persisted_time = self->time;
+  cfg_persist_config_add(cfg, grouping_by_format_time_persist_name(self), persisted_time, g_free, FALSE);
   return TRUE;
 }
 
@@ -413,12 +639,17 @@ static void
 grouping_by_free(LogPipe *s)
 {
   GroupingBy *self = (GroupingBy *) s;
+  gint i;
 
-  g_static_mutex_free(&self->lock);
   log_template_unref(self->key_template);
   if (self->synthetic_message)
     synthetic_message_free(self->synthetic_message);
-  timer_wheel_free(self->timer_wheel);
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      g_static_mutex_free(&self->shards[i].lock);
+      timer_wheel_free(self->shards[i].timer_wheel);
+      g_ptr_array_free(self->shards[i].emitted_messages, TRUE);
+    }
   stateful_parser_free_method(s);
 }
 
@@ -426,6 +657,7 @@ LogParser *
 grouping_by_new(GlobalConfig *cfg)
 {
   GroupingBy *self = g_new0(GroupingBy, 1);
+  gint i;
 
   stateful_parser_init_instance(&self->super, cfg);
   self->super.super.super.free_fn = grouping_by_free;
@@ -433,10 +665,18 @@ grouping_by_new(GlobalConfig *cfg)
   self->super.super.super.deinit = grouping_by_deinit;
   self->super.super.super.clone = grouping_by_clone;
   self->super.super.process = grouping_by_process;
-  g_static_mutex_init(&self->lock);
   self->scope = RCS_GLOBAL;
-  self->timer_wheel = timer_wheel_new();
-  timer_wheel_set_associated_data(self->timer_wheel, self, NULL);
+  for (i = 0; i < CORRELLATION_STATE_NUM_SHARDS; i++)
+    {
+      GroupingByShard *shard = &self->shards[i];
+
+      g_static_mutex_init(&shard->lock);
+      shard->owner = self;
+      shard->index = i;
+      shard->timer_wheel = timer_wheel_new();
+      timer_wheel_set_associated_data(shard->timer_wheel, shard, NULL);
+      shard->emitted_messages = g_ptr_array_new();
+    }
   cached_g_current_time(&self->last_tick);
   return &self->super.super;
 }
@@ -57,12 +57,25 @@ struct _PDBLookupParams
 
 struct _PatternDB
 {
+  /* held for reading while a message is processed, for writing when the
+   * ruleset is replaced or the state is dropped */
   GStaticRWLock lock;
   PDBRuleSet *ruleset;
   CorrellationState correllation;
+  GStaticMutex rate_limits_lock;
   GHashTable *rate_limits;
+
+  /* the current time of the correllation engine, see "Timing" below */
+  volatile glong time;
+  volatile gint timer_owner;
+  GStaticMutex timer_lock;
   TimerWheel *timer_wheel;
+  GPtrArray *expired_contexts;
+
+  volatile gint received_messages;
+  GStaticMutex tick_lock;
   GTimeVal last_tick;
+
   PatternDBEmitFunc emit;
   gpointer emit_data;
 };
@@ -98,8 +111,70 @@ struct _PatternDB
  *    2) process an incoming message stream on-line, expiring correllation
  *    states even if there are no incoming messages
  *
+ * Concurrency
+ * ===========
+ *
+ * Several threads may process messages at the same time.  The current
+ * time is advanced with atomic operations, most messages do not move it
+ * at all, so they do not need any lock for that.  The thread that moves
+ * the time forward ticks the timer wheel, unless another thread is already
+ * doing that, in which case that one catches up with the new time too.
+ * Expired contexts are collected under the timer lock and their timeout
+ * actions are run afterwards, holding only the lock of their shard in the
+ * correllation state.
+ *
+ * No lock is held while the emit callback runs: it may forward the
+ * messages synchronously, and that pipeline may end up in this PatternDB
+ * again.  The messages emitted while processing a message (or expiring
+ * contexts) are collected in PDBProcessResults and passed to the callback
+ * by _pattern_db_emit_messages(), after the locks are released.
+ *
+ * Locking order: PatternDB->lock (reader), correllation shard lock,
+ * timer_lock.  rate_limits_lock and tick_lock are never held while
+ * acquiring another lock.
+ *
  */
 
+/* The side effects of processing a message that are deferred until the
+ * locks are released: the contexts created by actions are added to the
+ * correllation state once the shard lock of the triggering context is
+ * released, the emitted messages are passed to the emit callback once the
+ * PatternDB lock is released too. */
+typedef struct _PDBProcessResults
+{
+  GPtrArray *new_contexts;
+  GArray *emitted_messages;
+} PDBProcessResults;
+
+typedef struct _PDBEmittedMessage
+{
+  LogMessage *msg;
+  gboolean synthetic;
+} PDBEmittedMessage;
+
+static void
+pdb_process_results_init(PDBProcessResults *self)
+{
+  self->new_contexts = g_ptr_array_new();
+  self->emitted_messages = g_array_new(FALSE, FALSE, sizeof(PDBEmittedMessage));
+}
+
+static void
+pdb_process_results_destroy(PDBProcessResults *self)
+{
+  g_ptr_array_free(self->new_contexts, TRUE);
+  g_array_free(self->emitted_messages, TRUE);
+}
+
+/* takes over the reference of @msg */
+static void
+pdb_process_results_add_emitted_message(PDBProcessResults *self, LogMessage *msg, gboolean synthetic)
+{
+  PDBEmittedMessage emitted = { msg, synthetic };
+
+  g_array_append_val(self->emitted_messages, emitted);
+}
+
 
 /**************************************************************************
  * PDBContext, represents a correllation state in the state hash table, is
@@ -186,6 +261,7 @@ pdb_check_action_rate_limit(PDBAction *self, PDBRule *rule, PatternDB *db, LogMe
   CorrellationKey key;
   PDBRateLimit *rl;
   guint64 now;
+  gboolean allowed = FALSE;
 
   if (self->rate == 0)
     return TRUE;
@@ -193,6 +269,7 @@ pdb_check_action_rate_limit(PDBAction *self, PDBRule *rule, PatternDB *db, LogMe
   g_string_printf(buffer, "%s:%d", rule->rule_id, self->id);
   correllation_key_setup(&key, rule->context.scope, msg, buffer->str);
 
+  g_static_mutex_lock(&db->rate_limits_lock);
   rl = g_hash_table_lookup(db->rate_limits, &key);
   if (!rl)
     {
@@ -200,7 +277,7 @@ pdb_check_action_rate_limit(PDBAction *self, PDBRule *rule, PatternDB *db, LogMe
       g_hash_table_insert(db->rate_limits, &rl->key, rl);
       g_string_steal(buffer);
     }
-  now = timer_wheel_get_time(db->timer_wheel);
+  now = db->time;
   if (rl->last_check == 0)
     {
       rl->last_check = now;
@@ -224,9 +301,10 @@ pdb_check_action_rate_limit(PDBAction *self, PDBRule *rule, PatternDB *db, LogMe
   if (rl->buckets)
     {
       rl->buckets--;
-      return TRUE;
+      allowed = TRUE;
     }
-  return FALSE;
+  g_static_mutex_unlock(&db->rate_limits_lock);
+  return allowed;
 }
 
 gboolean
@@ -262,20 +340,19 @@ pdb_generate_message(PDBAction *self, PDBContext *context, LogMessage *msg, GStr
 }
 
 void
-pdb_execute_action_message(PDBAction *self, PatternDB *db, PDBContext *context, LogMessage *msg, GString *buffer)
+pdb_execute_action_message(PDBAction *self, PatternDB *db, PDBContext *context, LogMessage *msg, GString *buffer,
+                           PDBProcessResults *results)
 {
-  LogMessage *genmsg;
-
-  genmsg = pdb_generate_message(self, context, msg, buffer);
-  db->emit(genmsg, TRUE, db->emit_data);
-  log_msg_unref(genmsg);
+  pdb_process_results_add_emitted_message(results, pdb_generate_message(self, context, msg, buffer), TRUE);
 }
 
-static void pattern_db_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data);
-
+/* Contexts created by actions are not added to the correllation state
+ * right away, as the shard lock of the triggering context may be held.
+ * They are collected in @results and added by
+ * _pattern_db_add_new_contexts() once that lock is released. */
 void
 pdb_execute_action_create_context(PDBAction *self, PatternDB *db, PDBRule *rule, PDBContext *triggering_context,
-                                  LogMessage *triggering_msg, GString *buffer)
+                                  LogMessage *triggering_msg, GString *buffer, PDBProcessResults *results)
 {
   CorrellationKey key;
   PDBContext *new_context;
@@ -304,33 +381,30 @@ pdb_execute_action_create_context(PDBAction *self, PatternDB *db, PDBRule *rule,
             evt_tag_str("rule", rule->rule_id),
             evt_tag_str("context", buffer->str),
             evt_tag_int("context_timeout", syn_context->timeout),
-            evt_tag_int("context_expiration", timer_wheel_get_time(db->timer_wheel) + syn_context->timeout));
+            evt_tag_int("context_expiration", db->time + syn_context->timeout));
 
   correllation_key_setup(&key, syn_context->scope, context_msg, buffer->str);
   new_context = pdb_context_new(&key);
-  g_hash_table_insert(db->correllation.state, &new_context->super.key, new_context);
   g_string_steal(buffer);
 
   g_ptr_array_add(new_context->super.messages, context_msg);
-
-  new_context->super.timer = timer_wheel_add_timer(db->timer_wheel, rule->context.timeout, pattern_db_expire_entry,
-                             correllation_context_ref(&new_context->super),
-                             (GDestroyNotify) correllation_context_unref);
   new_context->rule = pdb_rule_ref(rule);
+  g_ptr_array_add(results->new_contexts, new_context);
 }
 
 void
-pdb_execute_action(PDBAction *self, PatternDB *db, PDBRule *rule, PDBContext *context, LogMessage *msg, GString *buffer)
+pdb_execute_action(PDBAction *self, PatternDB *db, PDBRule *rule, PDBContext *context, LogMessage *msg, GString *buffer,
+                   PDBProcessResults *results)
 {
   switch (self->content_type)
     {
     case RAC_NONE:
       break;
     case RAC_MESSAGE:
-      pdb_execute_action_message(self, db, context, msg, buffer);
+      pdb_execute_action_message(self, db, context, msg, buffer, results);
       break;
     case RAC_CREATE_CONTEXT:
-      pdb_execute_action_create_context(self, db, rule, context, msg, buffer);
+      pdb_execute_action_create_context(self, db, rule, context, msg, buffer, results);
       break;
     default:
       g_assert_not_reached();
@@ -340,15 +414,15 @@ pdb_execute_action(PDBAction *self, PatternDB *db, PDBRule *rule, PDBContext *co
 
 void
 pdb_trigger_action(PDBAction *self, PatternDB *db, PDBRule *rule, PDBActionTrigger trigger, PDBContext *context,
-                   LogMessage *msg, GString *buffer)
+                   LogMessage *msg, GString *buffer, PDBProcessResults *results)
 {
   if (pdb_is_action_triggered(self, db, rule, trigger, context, msg, buffer))
-    pdb_execute_action(self, db, rule, context, msg, buffer);
+    pdb_execute_action(self, db, rule, context, msg, buffer, results);
 }
 
 void
 pdb_run_rule_actions(PDBRule *self, PatternDB *db, PDBActionTrigger trigger, PDBContext *context, LogMessage *msg,
-                     GString *buffer)
+                     GString *buffer, PDBProcessResults *results)
 {
   gint i;
 
@@ -358,7 +432,7 @@ pdb_run_rule_actions(PDBRule *self, PatternDB *db, PDBActionTrigger trigger, PDB
     {
       PDBAction *action = (PDBAction *) g_ptr_array_index(self->actions, i);
 
-      pdb_trigger_action(action, db, self, trigger, context, msg, buffer);
+      pdb_trigger_action(action, db, self, trigger, context, msg, buffer, results);
     }
 }
 
@@ -415,7 +489,10 @@ pdb_lookup_ruleset(PDBRuleSet *self, PDBLookupParams *lookup, GArray *dbg_list)
 
   program_value = log_msg_get_value(msg, lookup->program_handle, &program_len);
   prg_matches = g_array_new(FALSE, TRUE, sizeof(RParserMatch));
-  node = r_find_node(self->programs, (guint8 *) program_value, program_len, prg_matches);
+  if (self->compiled_programs)
+    node = r_find_node_compiled(self->compiled_programs, (guint8 *) program_value, program_len, prg_matches);
+  else
+    node = r_find_node(self->programs, (guint8 *) program_value, program_len, prg_matches);
 
   if (node)
     {
@@ -449,6 +526,8 @@ pdb_lookup_ruleset(PDBRuleSet *self, PDBLookupParams *lookup, GArray *dbg_list)
 
           if (G_UNLIKELY(dbg_list))
             msg_node = r_find_node_dbg(program->rules, (guint8 *) message, message_len, matches, dbg_list);
+          else if (program->compiled_rules)
+            msg_node = r_find_node_compiled(program->compiled_rules, (guint8 *) message, message_len, matches);
           else
             msg_node = r_find_node(program->rules, (guint8 *) message, message_len, matches);
 
@@ -495,33 +574,180 @@ pdb_lookup_ruleset(PDBRuleSet *self, PDBLookupParams *lookup, GArray *dbg_list)
  * PatternDB
  *********************************************************/
 
-/* NOTE: this function requires PatternDB reader/writer lock to be
- * write-locked.
- *
- * Currently, it is, as timer_wheel_set_time() is only called with that
- * precondition, and timer-wheel callbacks are only called from within
- * timer_wheel_set_time().
+/* NOTE: this function is called by the timer wheel with timer_lock held,
+ * the timeout actions are run later by _pattern_db_expire_contexts(), once
+ * the shard lock of the context can be acquired.
  */
-
 static void
 pattern_db_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
 {
   PDBContext *context = user_data;
   PatternDB *pdb = (PatternDB *) timer_wheel_get_associated_data(wheel);
+
+  /* the timer entry is freed by the timer wheel when we return */
+  context->super.timer = NULL;
+  g_ptr_array_add(pdb->expired_contexts, correllation_context_ref(&context->super));
+}
+
+static void
+_pattern_db_arm_context_timer(PatternDB *self, PDBContext *context, gint timeout)
+{
+  g_static_mutex_lock(&self->timer_lock);
+  if (context->super.timer)
+    {
+      timer_wheel_mod_timer(self->timer_wheel, context->super.timer, timeout);
+    }
+  else
+    {
+      context->super.timer = timer_wheel_add_timer(self->timer_wheel, timeout, pattern_db_expire_entry,
+                                                   correllation_context_ref(&context->super),
+                                                   (GDestroyNotify) correllation_context_unref);
+    }
+  g_static_mutex_unlock(&self->timer_lock);
+}
+
+/* NOTE: the shard lock of the context must be held */
+static gboolean
+_pattern_db_is_context_expired(PatternDB *self, PDBContext *context)
+{
+  gboolean expired;
+
+  g_static_mutex_lock(&self->timer_lock);
+  expired = (context->super.timer == NULL);
+  g_static_mutex_unlock(&self->timer_lock);
+  return expired;
+}
+
+static void
+_pattern_db_add_new_contexts(PatternDB *self, GPtrArray *new_contexts)
+{
+  gint i;
+
+  for (i = 0; i < new_contexts->len; i++)
+    {
+      PDBContext *context = (PDBContext *) g_ptr_array_index(new_contexts, i);
+      CorrellationStateShard *shard = correllation_state_get_shard(&self->correllation, &context->super.key);
+
+      correllation_state_shard_lock(shard);
+      correllation_state_shard_insert_context(shard, &context->super);
+      _pattern_db_arm_context_timer(self, context, context->rule->context.timeout);
+      correllation_state_shard_unlock(shard);
+    }
+  g_ptr_array_set_size(new_contexts, 0);
+}
+
+/* NOTE: no lock may be held, see "Concurrency" above */
+static void
+_pattern_db_emit_messages(PatternDB *self, PDBProcessResults *results)
+{
+  gint i;
+
+  for (i = 0; i < results->emitted_messages->len; i++)
+    {
+      PDBEmittedMessage *emitted = &g_array_index(results->emitted_messages, PDBEmittedMessage, i);
+
+      if (self->emit)
+        self->emit(emitted->msg, emitted->synthetic, self->emit_data);
+      log_msg_unref(emitted->msg);
+    }
+  g_array_set_size(results->emitted_messages, 0);
+}
+
+static void
+_pattern_db_expire_contexts(PatternDB *self, GPtrArray *expired, PDBProcessResults *results)
+{
   GString *buffer = g_string_sized_new(256);
-  LogMessage *msg = correllation_context_get_last_message(&context->super);
-
-  msg_debug("Expiring patterndb correllation context",
-            evt_tag_str("last_rule", context->rule->rule_id),
-            evt_tag_long("utc", timer_wheel_get_time(pdb->timer_wheel)));
-  if (pdb->emit)
-    pdb_run_rule_actions(context->rule, pdb, RAT_TIMEOUT, context, msg, buffer);
-  g_hash_table_remove(pdb->correllation.state, &context->super.key);
+  gint i;
+
+  for (i = 0; i < expired->len; i++)
+    {
+      PDBContext *context = (PDBContext *) g_ptr_array_index(expired, i);
+      CorrellationStateShard *shard = correllation_state_get_shard(&self->correllation, &context->super.key);
+
+      correllation_state_shard_lock(shard);
+
+      /* a message may have been added to the context since its timer
+       * fired, which armed the timer again */
+      if (_pattern_db_is_context_expired(self, context))
+        {
+          LogMessage *msg = correllation_context_get_last_message(&context->super);
+
+          msg_debug("Expiring patterndb correllation context",
+                    evt_tag_str("last_rule", context->rule->rule_id),
+                    evt_tag_long("utc", self->time));
+          if (self->emit)
+            pdb_run_rule_actions(context->rule, self, RAT_TIMEOUT, context, msg, buffer, results);
+          correllation_state_shard_remove_context(shard, &context->super);
+        }
+      correllation_state_shard_unlock(shard);
+
+      _pattern_db_add_new_contexts(self, results->new_contexts);
+      correllation_context_unref(&context->super);
+    }
+
+  g_ptr_array_free(expired, TRUE);
   g_string_free(buffer, TRUE);
+}
+
+/* NOTE: timer_lock must be held */
+static GPtrArray *
+_pattern_db_steal_expired_contexts(PatternDB *self)
+{
+  GPtrArray *expired = self->expired_contexts;
+
+  if (expired->len == 0)
+    return NULL;
+
+  self->expired_contexts = g_ptr_array_new();
+  return expired;
+}
+
+/* Moves the timer wheel to the current time.  Only one thread ticks the
+ * wheel at a time, if another one is doing that already, it will notice
+ * that the time has moved and catches up before giving up the ownership. */
+static void
+_pattern_db_tick_timer_wheel(PatternDB *self, PDBProcessResults *results)
+{
+  GPtrArray *expired;
+  glong now;
+
+  do
+    {
+      if (!__sync_bool_compare_and_swap(&self->timer_owner, FALSE, TRUE))
+        return;
+
+      now = self->time;
+      g_static_mutex_lock(&self->timer_lock);
+      timer_wheel_set_time(self->timer_wheel, now);
+      expired = _pattern_db_steal_expired_contexts(self);
+      g_static_mutex_unlock(&self->timer_lock);
+
+      /* a full barrier, the time is re-read below */
+      __sync_bool_compare_and_swap(&self->timer_owner, TRUE, FALSE);
+
+      if (expired)
+        _pattern_db_expire_contexts(self, expired, results);
+    }
+  while (self->time != now);
+}
+
+/* Moves the current time forward to @new_time, returns FALSE if it was
+ * there already. */
+static gboolean
+_pattern_db_advance_time(PatternDB *self, glong new_time, PDBProcessResults *results)
+{
+  glong current;
+
+  do
+    {
+      current = self->time;
+      if (new_time <= current)
+        return FALSE;
+    }
+  while (!__sync_bool_compare_and_swap(&self->time, current, new_time));
 
-  /* pdb_context_free is automatically called when returning from
-     this function by the timerwheel code as a destroy notify
-     callback. */
+  _pattern_db_tick_timer_wheel(self, results);
+  return TRUE;
 }
 
 /*
@@ -535,20 +761,34 @@ pattern_db_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
 void
 pattern_db_timer_tick(PatternDB *self)
 {
+  PDBProcessResults results;
   GTimeVal now;
   glong diff;
+  glong diff_sec = 0;
 
-  g_static_rw_lock_writer_lock(&self->lock);
+  pdb_process_results_init(&results);
+  g_static_rw_lock_reader_lock(&self->lock);
+  g_static_mutex_lock(&self->tick_lock);
   cached_g_current_time(&now);
+
+  /* incoming messages move the time themselves, the idle time is
+   * measured from the first tick after the last message */
+  if (self->received_messages)
+    {
+      __sync_lock_test_and_set(&self->received_messages, FALSE);
+      self->last_tick = now;
+      g_static_mutex_unlock(&self->tick_lock);
+      g_static_rw_lock_reader_unlock(&self->lock);
+      pdb_process_results_destroy(&results);
+      return;
+    }
+
   diff = g_time_val_diff(&now, &self->last_tick);
 
   if (diff > 1e6)
     {
-      glong diff_sec = diff / 1e6;
+      diff_sec = diff / 1e6;
 
-      timer_wheel_set_time(self->timer_wheel, timer_wheel_get_time(self->timer_wheel) + diff_sec);
-      msg_debug("Advancing patterndb current time because of timer tick",
-                evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)));
       /* update last_tick, take the fraction of the seconds not calculated into this update into account */
 
       self->last_tick = now;
@@ -562,12 +802,23 @@ pattern_db_timer_tick(PatternDB *self)
        */
       self->last_tick = now;
     }
-  g_static_rw_lock_writer_unlock(&self->lock);
+  g_static_mutex_unlock(&self->tick_lock);
+
+  if (diff_sec > 0)
+    {
+      _pattern_db_advance_time(self, self->time + diff_sec, &results);
+      msg_debug("Advancing patterndb current time because of timer tick",
+                evt_tag_long("utc", self->time));
+    }
+  g_static_rw_lock_reader_unlock(&self->lock);
+
+  _pattern_db_emit_messages(self, &results);
+  pdb_process_results_destroy(&results);
 }
 
-/* NOTE: lock should be acquired for writing before calling this function. */
-void
-pattern_db_set_time(PatternDB *self, const LogStamp *ls)
+/* NOTE: lock should be acquired for reading before calling this function. */
+static void
+pattern_db_set_time(PatternDB *self, const LogStamp *ls, PDBProcessResults *results)
 {
   GTimeVal now;
 
@@ -577,14 +828,33 @@ pattern_db_set_time(PatternDB *self, const LogStamp *ls)
    * correllation engine too much. */
 
   cached_g_current_time(&now);
-  self->last_tick = now;
+
+  /* avoid dirtying a shared cache line for every message */
+  if (!self->received_messages)
+    self->received_messages = TRUE;
 
   if (ls->tv_sec < now.tv_sec)
     now.tv_sec = ls->tv_sec;
 
-  timer_wheel_set_time(self->timer_wheel, now.tv_sec);
-  msg_debug("Advancing patterndb current time because of an incoming message",
-            evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)));
+  if (_pattern_db_advance_time(self, now.tv_sec, results))
+    msg_debug("Advancing patterndb current time because of an incoming message",
+              evt_tag_long("utc", now.tv_sec));
+}
+
+/* moves the current time forward by @timeout seconds, expiring the
+ * contexts whose timeout has passed */
+void
+pattern_db_advance_time(PatternDB *self, gint timeout)
+{
+  PDBProcessResults results;
+
+  pdb_process_results_init(&results);
+  g_static_rw_lock_reader_lock(&self->lock);
+  _pattern_db_advance_time(self, self->time + timeout, &results);
+  g_static_rw_lock_reader_unlock(&self->lock);
+
+  _pattern_db_emit_messages(self, &results);
+  pdb_process_results_destroy(&results);
 }
 
 gboolean
@@ -648,13 +918,13 @@ _pattern_db_is_empty(PatternDB *self)
 }
 
 static void
-_pattern_db_process_matching_rule(PatternDB *self, PDBRule *rule, LogMessage *msg)
+_pattern_db_process_matching_rule(PatternDB *self, PDBRule *rule, LogMessage *msg, PDBProcessResults *results)
 {
   PDBContext *context = NULL;
+  CorrellationStateShard *shard = NULL;
   GString *buffer = g_string_sized_new(32);
 
-  g_static_rw_lock_writer_lock(&self->lock);
-  pattern_db_set_time(self, &msg->timestamps[LM_TS_STAMP]);
+  pattern_db_set_time(self, &msg->timestamps[LM_TS_STAMP], results);
   if (rule->context.id_template)
     {
       CorrellationKey key;
@@ -663,16 +933,19 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBRule *rule, LogMessage *ms
       log_msg_set_value(msg, context_id_handle, buffer->str, -1);
 
       correllation_key_setup(&key, rule->context.scope, msg, buffer->str);
-      context = g_hash_table_lookup(self->correllation.state, &key);
+      shard = correllation_state_get_shard(&self->correllation, &key);
+      correllation_state_shard_lock(shard);
+
+      context = (PDBContext *) correllation_state_shard_lookup_context(shard, &key);
       if (!context)
         {
           msg_debug("Correllation context lookup failure, starting a new context",
                     evt_tag_str("rule", rule->rule_id),
                     evt_tag_str("context", buffer->str),
                     evt_tag_int("context_timeout", rule->context.timeout),
-                    evt_tag_int("context_expiration", timer_wheel_get_time(self->timer_wheel) + rule->context.timeout));
+                    evt_tag_int("context_expiration", self->time + rule->context.timeout));
           context = pdb_context_new(&key);
-          g_hash_table_insert(self->correllation.state, &context->super.key, context);
+          correllation_state_shard_insert_context(shard, &context->super);
           g_string_steal(buffer);
         }
       else
@@ -681,22 +954,13 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBRule *rule, LogMessage *ms
                     evt_tag_str("rule", rule->rule_id),
                     evt_tag_str("context", buffer->str),
                     evt_tag_int("context_timeout", rule->context.timeout),
-                    evt_tag_int("context_expiration", timer_wheel_get_time(self->timer_wheel) + rule->context.timeout),
+                    evt_tag_int("context_expiration", self->time + rule->context.timeout),
                     evt_tag_int("num_messages", context->super.messages->len));
         }
 
       g_ptr_array_add(context->super.messages, log_msg_ref(msg));
+      _pattern_db_arm_context_timer(self, context, rule->context.timeout);
 
-      if (context->super.timer)
-        {
-          timer_wheel_mod_timer(self->timer_wheel, context->super.timer, rule->context.timeout);
-        }
-      else
-        {
-          context->super.timer = timer_wheel_add_timer(self->timer_wheel, rule->context.timeout, pattern_db_expire_entry,
-                                 correllation_context_ref(&context->super),
-                                 (GDestroyNotify) correllation_context_unref);
-        }
       if (context->rule != rule)
         {
           if (context->rule)
@@ -709,16 +973,19 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBRule *rule, LogMessage *ms
       context = NULL;
     }
 
+  /* the actions access the messages of the context, the shard lock is
+   * held until they are finished */
   synthetic_message_apply(&rule->msg, &context->super, msg, buffer);
   if (self->emit)
     {
-      g_static_rw_lock_writer_unlock(&self->lock);
-      self->emit(msg, FALSE, self->emit_data);
-      pdb_run_rule_actions(rule, self, RAT_MATCH, context, msg, buffer);
-      g_static_rw_lock_writer_lock(&self->lock);
+      pdb_process_results_add_emitted_message(results, log_msg_ref(msg), FALSE);
+      pdb_run_rule_actions(rule, self, RAT_MATCH, context, msg, buffer, results);
     }
+  if (shard)
+    correllation_state_shard_unlock(shard);
+
+  _pattern_db_add_new_contexts(self, results->new_contexts);
   pdb_rule_unref(rule);
-  g_static_rw_lock_writer_unlock(&self->lock);
 
   if (context)
     log_msg_write_protect(msg);
@@ -727,18 +994,17 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBRule *rule, LogMessage *ms
 }
 
 static void
-_pattern_db_process_unmatching_rule(PatternDB *self, LogMessage *msg)
+_pattern_db_process_unmatching_rule(PatternDB *self, LogMessage *msg, PDBProcessResults *results)
 {
-  g_static_rw_lock_writer_lock(&self->lock);
-  pattern_db_set_time(self, &msg->timestamps[LM_TS_STAMP]);
-  g_static_rw_lock_writer_unlock(&self->lock);
+  pattern_db_set_time(self, &msg->timestamps[LM_TS_STAMP], results);
   if (self->emit)
-    self->emit(msg, FALSE, self->emit_data);
+    pdb_process_results_add_emitted_message(results, log_msg_ref(msg), FALSE);
 }
 
 static gboolean
 _pattern_db_process(PatternDB *self, PDBLookupParams *lookup, GArray *dbg_list)
 {
+  PDBProcessResults results;
   PDBRule *rule;
   LogMessage *msg = lookup->msg;
 
@@ -748,12 +1014,16 @@ _pattern_db_process(PatternDB *self, PDBLookupParams *lookup, GArray *dbg_list)
       g_static_rw_lock_reader_unlock(&self->lock);
       return FALSE;
     }
+  pdb_process_results_init(&results);
   rule = pdb_lookup_ruleset(self->ruleset, lookup, dbg_list);
-  g_static_rw_lock_reader_unlock(&self->lock);
   if (rule)
-    _pattern_db_process_matching_rule(self, rule, msg);
+    _pattern_db_process_matching_rule(self, rule, msg, &results);
   else
-    _pattern_db_process_unmatching_rule(self, msg);
+    _pattern_db_process_unmatching_rule(self, msg, &results);
+  g_static_rw_lock_reader_unlock(&self->lock);
+
+  _pattern_db_emit_messages(self, &results);
+  pdb_process_results_destroy(&results);
   return rule != NULL;
 }
 
@@ -799,9 +1069,22 @@ pattern_db_debug_ruleset(PatternDB *self, LogMessage *msg, GArray *dbg_list)
 void
 pattern_db_expire_state(PatternDB *self)
 {
-  g_static_rw_lock_writer_lock(&self->lock);
+  PDBProcessResults results;
+  GPtrArray *expired;
+
+  pdb_process_results_init(&results);
+  g_static_rw_lock_reader_lock(&self->lock);
+  g_static_mutex_lock(&self->timer_lock);
   timer_wheel_expire_all(self->timer_wheel);
-  g_static_rw_lock_writer_unlock(&self->lock);
+  expired = _pattern_db_steal_expired_contexts(self);
+  g_static_mutex_unlock(&self->timer_lock);
+
+  if (expired)
+    _pattern_db_expire_contexts(self, expired, &results);
+  g_static_rw_lock_reader_unlock(&self->lock);
+
+  _pattern_db_emit_messages(self, &results);
+  pdb_process_results_destroy(&results);
 }
 
 static void
@@ -810,8 +1093,10 @@ _init_state(PatternDB *self)
   self->rate_limits = g_hash_table_new_full(correllation_key_hash, correllation_key_equal, NULL,
                       (GDestroyNotify) pdb_rate_limit_free);
   correllation_state_init_instance(&self->correllation);
+  self->time = 0;
   self->timer_wheel = timer_wheel_new();
   timer_wheel_set_associated_data(self->timer_wheel, self, NULL);
+  self->expired_contexts = g_ptr_array_new();
 }
 
 static void
@@ -820,6 +1105,8 @@ _destroy_state(PatternDB *self)
   if (self->timer_wheel)
     timer_wheel_free(self->timer_wheel);
 
+  g_ptr_array_foreach(self->expired_contexts, (GFunc) correllation_context_unref, NULL);
+  g_ptr_array_free(self->expired_contexts, TRUE);
   g_hash_table_destroy(self->rate_limits);
   correllation_state_deinit_instance(&self->correllation);
 }
@@ -842,6 +1129,9 @@ pattern_db_new(void)
   _init_state(self);
   cached_g_current_time(&self->last_tick);
   g_static_rw_lock_init(&self->lock);
+  g_static_mutex_init(&self->rate_limits_lock);
+  g_static_mutex_init(&self->timer_lock);
+  g_static_mutex_init(&self->tick_lock);
   return self;
 }
 
@@ -852,6 +1142,9 @@ pattern_db_free(PatternDB *self)
     pdb_rule_set_free(self->ruleset);
   _destroy_state(self);
   g_static_rw_lock_free(&self->lock);
+  g_static_mutex_free(&self->rate_limits_lock);
+  g_static_mutex_free(&self->timer_lock);
+  g_static_mutex_free(&self->tick_lock);
   g_free(self);
 }
 
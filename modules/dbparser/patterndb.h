@@ -40,6 +40,7 @@ const gchar *pattern_db_get_ruleset_pub_date(PatternDB *self);
 gboolean pattern_db_reload_ruleset(PatternDB *self, GlobalConfig *cfg, const gchar *pdb_file);
 
 void pattern_db_timer_tick(PatternDB *self);
+void pattern_db_advance_time(PatternDB *self, gint timeout);
 gboolean pattern_db_process(PatternDB *self, LogMessage *msg);
 gboolean pattern_db_process_with_custom_message(PatternDB *self, LogMessage *msg, const gchar *message, gssize message_len);
 void pattern_db_debug_ruleset(PatternDB *self, LogMessage *msg, GArray *dbg_list);
@@ -1183,6 +1183,7 @@ pdb_rule_set_load(PDBRuleSet *self, GlobalConfig *cfg, const gchar *config, GLis
   if (state.load_examples)
     *examples = state.examples;
 
+  pdb_rule_set_compile(self);
   success = TRUE;
 
 error:
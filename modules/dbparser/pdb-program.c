@@ -53,6 +53,8 @@ pdb_program_unref(PDBProgram *s)
 
   if (--self->ref_cnt == 0)
     {
+      if (self->compiled_rules)
+        r_free_compiled_tree(self->compiled_rules);
       if (self->rules)
         r_free_node(self->rules, (void (*)(void *)) pdb_rule_unref);
 
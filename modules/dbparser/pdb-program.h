@@ -36,6 +36,8 @@ typedef struct _PDBProgram
 {
   guint ref_cnt;
   RNode *rules;
+  /* read-only copy of rules used for lookups, built once loading is finished */
+  RCompiledTree *compiled_rules;
 } PDBProgram;
 
 PDBProgram *pdb_program_new(void);
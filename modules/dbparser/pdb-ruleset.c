@@ -23,6 +23,38 @@
 #include "pdb-ruleset.h"
 #include "pdb-program.h"
 
+static void
+_compile_programs(RNode *node)
+{
+  PDBProgram *program = (PDBProgram *) node->value;
+  gint i;
+
+  /* the same program may be registered with several program names */
+  if (program && program->rules && !program->compiled_rules)
+    program->compiled_rules = r_compile_tree(program->rules);
+
+  for (i = 0; i < node->num_children; i++)
+    _compile_programs(node->children[i]);
+  for (i = 0; i < node->num_pchildren; i++)
+    _compile_programs(node->pchildren[i]);
+}
+
+/* build the compiled radix trees of the ruleset, it must not be changed
+ * afterwards */
+void
+pdb_rule_set_compile(PDBRuleSet *self)
+{
+  if (self->compiled_programs)
+    r_free_compiled_tree(self->compiled_programs);
+  self->compiled_programs = NULL;
+
+  if (!self->programs)
+    return;
+
+  _compile_programs(self->programs);
+  self->compiled_programs = r_compile_tree(self->programs);
+}
+
 PDBRuleSet *
 pdb_rule_set_new(void)
 {
@@ -35,6 +67,8 @@ pdb_rule_set_new(void)
 void
 pdb_rule_set_free(PDBRuleSet *self)
 {
+  if (self->compiled_programs)
+    r_free_compiled_tree(self->compiled_programs);
   if (self->programs)
     r_free_node(self->programs, (GDestroyNotify) pdb_program_unref);
   if (self->version)
@@ -42,6 +76,7 @@ pdb_rule_set_free(PDBRuleSet *self)
   if (self->pub_date)
     g_free(self->pub_date);
   self->programs = NULL;
+  self->compiled_programs = NULL;
   self->version = NULL;
   self->pub_date = NULL;
 
@@ -30,12 +30,15 @@
 typedef struct _PDBRuleSet
 {
   RNode *programs;
+  /* read-only copy of programs used for lookups, see pdb_rule_set_compile() */
+  RCompiledTree *compiled_programs;
   gchar *version;
   gchar *pub_date;
   gboolean is_empty;
 } PDBRuleSet;
 
 PDBRuleSet *pdb_rule_set_new(void);
+void pdb_rule_set_compile(PDBRuleSet *self);
 void pdb_rule_set_free(PDBRuleSet *self);
 
 #endif
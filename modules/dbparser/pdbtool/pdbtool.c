@@ -42,6 +42,7 @@
 #include "pathutils.h"
 #include "resolved-configurable-paths.h"
 #include "crypto.h"
+#include "timeutils.h"
 #include "compat/openssl_support.h"
 
 #include <stdio.h>
@@ -326,6 +327,7 @@ static gchar *template_string = NULL;
 static gchar *filter_string = NULL;
 static gboolean debug_pattern = FALSE;
 static gboolean debug_pattern_parse = FALSE;
+static gint benchmark_iterations = 0;
 
 gboolean
 pdbtool_match_values(NVHandle handle, const gchar *name, const gchar *value, gssize length, gpointer user_data)
@@ -372,6 +374,66 @@ pdbtool_pdb_emit(LogMessage *msg, gboolean synthetic, gpointer user_data)
     }
 }
 
+static RNode *
+pdbtool_benchmark_find_node(RNode *root, RCompiledTree *compiled_root, const gchar *key, gssize keylen,
+                            GArray *matches)
+{
+  RNode *node;
+  gint i;
+
+  g_array_set_size(matches, 1);
+  if (compiled_root)
+    node = r_find_node_compiled(compiled_root, (guint8 *) key, keylen, matches);
+  else
+    node = r_find_node(root, (guint8 *) key, keylen, matches);
+
+  for (i = 0; i < matches->len; i++)
+    g_free(g_array_index(matches, RParserMatch, i).match);
+  g_array_set_size(matches, 0);
+  return node;
+}
+
+/* look up the program and then the message of msg benchmark_iterations
+ * times, returns the elapsed time in nanoseconds */
+static glong
+pdbtool_benchmark_lookup(PDBRuleSet *ruleset, LogMessage *msg, gboolean compiled)
+{
+  GArray *matches = g_array_new(FALSE, TRUE, sizeof(RParserMatch));
+  struct timespec start, stop;
+  const gchar *program, *message;
+  gssize program_len, message_len;
+  RNode *node;
+  gint i;
+
+  program = log_msg_get_value(msg, LM_V_PROGRAM, &program_len);
+  message = log_msg_get_value(msg, LM_V_MESSAGE, &message_len);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < benchmark_iterations; i++)
+    {
+      node = pdbtool_benchmark_find_node(ruleset->programs, compiled ? ruleset->compiled_programs : NULL,
+                                         program, program_len, matches);
+      if (node && node->value)
+        {
+          PDBProgram *prg = (PDBProgram *) node->value;
+
+          pdbtool_benchmark_find_node(prg->rules, compiled ? prg->compiled_rules : NULL,
+                                      message, message_len, matches);
+        }
+    }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  g_array_free(matches, TRUE);
+  return timespec_diff_nsec(&stop, &start);
+}
+
+static void
+pdbtool_benchmark_print_rate(const gchar *name, gint64 lookups, gint64 elapsed_nsec)
+{
+  printf("%s: %" G_GINT64_FORMAT " lookups in %.3f seconds, %.0f lookups/sec\n",
+         name, lookups, elapsed_nsec / 1e9, elapsed_nsec ? lookups * 1e9 / elapsed_nsec : 0.0);
+}
+
 static gint
 pdbtool_match(int argc, char *argv[])
 {
@@ -394,6 +456,8 @@ pdbtool_match(int argc, char *argv[])
   LogProtoServerOptions proto_options;
   gboolean may_read = TRUE;
   gpointer args[4];
+  gint64 benchmark_lookups = 0;
+  gint64 benchmark_tree_time = 0, benchmark_compiled_time = 0;
 
   memset(&parse_options, 0, sizeof(parse_options));
 
@@ -579,6 +643,14 @@ pdbtool_match(int argc, char *argv[])
             pdbtool_pdb_emit(msg, FALSE, nulls);
           }
         }
+      else if (benchmark_iterations > 0)
+        {
+          PDBRuleSet *ruleset = pattern_db_get_ruleset(patterndb);
+
+          benchmark_tree_time += pdbtool_benchmark_lookup(ruleset, msg, FALSE);
+          benchmark_compiled_time += pdbtool_benchmark_lookup(ruleset, msg, TRUE);
+          benchmark_lookups += benchmark_iterations;
+        }
       else
         {
           pattern_db_process(patterndb, msg);
@@ -594,6 +666,11 @@ pdbtool_match(int argc, char *argv[])
           eof = TRUE;
         }
     }
+  if (benchmark_iterations > 0)
+    {
+      pdbtool_benchmark_print_rate("Radix tree", benchmark_lookups, benchmark_tree_time);
+      pdbtool_benchmark_print_rate("Compiled radix tree", benchmark_lookups, benchmark_compiled_time);
+    }
   pattern_db_expire_state(patterndb);
 error:
   if (proto)
@@ -648,6 +725,10 @@ static GOptionEntry match_options[] =
     "filter", 'F', 0, G_OPTION_ARG_STRING, &filter_string,
     "Only print messages matching the specified syslog-ng filter", "expr"
   },
+  {
+    "benchmark", 'B', 0, G_OPTION_ARG_INT, &benchmark_iterations,
+    "Measure the rate of pattern lookups with and without the compiled radix tree, repeating each lookup N times", "N"
+  },
   { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
 };
 
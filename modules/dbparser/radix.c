@@ -22,6 +22,7 @@
  */
 
 #include "radix.h"
+#include "regexp-jit.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -166,15 +167,14 @@ r_parser_pcre_compile_state(const gchar *expr)
       g_free(self);
       return NULL;
     }
-  self->extra = pcre_study(self->re, 0, &errptr);
+  self->extra = regexp_jit_study(self->re, &errptr);
   if (errptr)
     {
       msg_error("Error while optimizing regular expression",
                 evt_tag_str("regular_expression", expr),
                 evt_tag_str("error_message", errptr));
       pcre_free(self->re);
-      if (self->extra)
-        pcre_free(self->extra);
+      regexp_jit_free_study(self->extra);
       g_free(self);
       return NULL;
     }
@@ -188,8 +188,7 @@ r_parser_pcre_free_state(gpointer s)
 
   if (self->re)
     pcre_free(self->re);
-  if (self->extra)
-    pcre_free(self->extra);
+  regexp_jit_free_study(self->extra);
   g_free(self);
 }
 
@@ -875,10 +874,10 @@ r_find_pchild(RNode *parent, RParserNode *parser_node)
 }
 
 RNode *
-r_find_child_by_first_character(RNode *root, char key)
+r_find_child_by_first_character(RNode *root, guint8 key)
 {
   register gint l, u, idx;
-  register char k = key;
+  register guint8 k = key;
 
   l = 0;
   u = root->num_children;
@@ -1099,6 +1098,7 @@ typedef struct _RFindNodeState
   GArray *stored_matches;
   GArray *dbg_list;
   GPtrArray *applicable_nodes;
+  RCompiledTree *compiled;
 } RFindNodeState;
 
 static RNode *_find_node_recursively(RFindNodeState *state, RNode *root, guint8 *key, gint keylen);
@@ -1143,12 +1143,31 @@ _truncate_debug_info(RFindNodeState *state, gint truncated_size)
     g_array_set_size(state->dbg_list, truncated_size);
 }
 
+/* length of the common prefix of a and b, compared 8 bytes at a time, the
+ * result is rounded down to a multiple of 8 */
+static inline gint
+_find_common_prefix_by_words(const guint8 *a, const guint8 *b, gint len)
+{
+  guint64 wa, wb;
+  gint i = 0;
+
+  while (len - i >= (gint) sizeof(guint64))
+    {
+      memcpy(&wa, a + i, sizeof(wa));
+      memcpy(&wb, b + i, sizeof(wb));
+      if (wa != wb)
+        break;
+      i += sizeof(guint64);
+    }
+  return i;
+}
+
 static void
-_find_matching_literal_prefix(RNode *root, guint8 *key, gint keylen,
-                              gint *literal_prefix_inputlen,
-                              gint *literal_prefix_radixlen)
+_find_matching_literal_prefix_of_key(const guint8 *radix_key, gint radix_keylen, guint8 *key, gint keylen,
+                                     gint *literal_prefix_inputlen,
+                                     gint *literal_prefix_radixlen)
 {
-  gint current_node_key_length = root->keylen;
+  gint current_node_key_length = radix_keylen;
   gint input_length;
   gint radix_length;
 
@@ -1157,22 +1176,21 @@ _find_matching_literal_prefix(RNode *root, guint8 *key, gint keylen,
   else
     {
       /* this is a prefix match algorithm, we are interested how long the
-       * common part between key and root->key is.  Currently this uses a
-       * byte-by-byte comparison, using a 64/32/16 bit units would be
-       * better.  We had a PoC code to do that, and the performance
-       * difference wasn't big enough to offset the complexity so it was
-       * removed. We might want to rerun perf tests and see if we could
-       * speed things up, but db-parser() seems fast enough as it is.
+       * common part between key and radix_key is.  The identical head of
+       * the two strings is skipped using 64 bit units, the byte-by-byte
+       * loop only runs from the first differing word, where it also
+       * handles CRLF in the input matching a newline in the radix.
        */
-      input_length = radix_length = 0;
+      input_length = radix_length = _find_common_prefix_by_words(key, radix_key,
+                                                                 MIN(keylen, current_node_key_length));
       while (input_length < keylen && radix_length < current_node_key_length)
         {
-          if (key[input_length] == '\r' && root->key[radix_length] == '\n')
+          if (key[input_length] == '\r' && radix_key[radix_length] == '\n')
             {
               /* skip CR from input if the radix contains a newline */
               input_length++;
             }
-          if (key[input_length] != root->key[radix_length])
+          if (key[input_length] != radix_key[radix_length])
             break;
 
           input_length++;
@@ -1183,6 +1201,15 @@ _find_matching_literal_prefix(RNode *root, guint8 *key, gint keylen,
   *literal_prefix_radixlen = radix_length;
 }
 
+static void
+_find_matching_literal_prefix(RNode *root, guint8 *key, gint keylen,
+                              gint *literal_prefix_inputlen,
+                              gint *literal_prefix_radixlen)
+{
+  _find_matching_literal_prefix_of_key(root->key, root->keylen, key, keylen,
+                                       literal_prefix_inputlen, literal_prefix_radixlen);
+}
+
 static RNode *
 _find_child_by_remaining_key(RFindNodeState *state, RNode *root, guint8 *remaining_key, gint remaining_keylen)
 {
@@ -1480,6 +1507,304 @@ r_find_all_applicable_nodes(RNode *root, guint8 *key, gint keylen, RNodeGetValue
   return (gchar **) g_ptr_array_free(result, FALSE);
 }
 
+/**************************************************************
+ * Compiled, read-only radix tree.
+ *
+ * The tree built by r_insert_node() is a web of individually allocated
+ * nodes, each lookup step following a pointer to a child array, another
+ * one to the child and yet another one to its key.  Once loading is
+ * finished the tree is not changed anymore, so it is flattened into a
+ * single array of nodes in breadth-first order, where the literal and
+ * parser children of a node are stored next to each other and referenced
+ * by index.  Keys are copied to a contiguous pool.
+ *
+ * The first characters of the literal children of a node are stored in a
+ * small array that is scanned with memchr(), nodes with many literal
+ * children get a 256 entry table indexed by the next input character
+ * instead.  The character range accepted by parser children is copied
+ * next to them, so parsers that can't match are skipped without touching
+ * the RParserNode.  Parsers are tried in their original order, as the
+ * first matching parser determines the result.
+ **************************************************************/
+
+/* literal children above this count are looked up via a 256 entry table */
+#define R_COMPILED_DENSE_CHILDREN 8
+
+typedef struct _RCompiledNode
+{
+  const guint8 *key;
+  gint keylen;
+  gpointer value;
+  /* the node this one was compiled from, returned by lookups */
+  RNode *node;
+  /* initial character range of the parser, if this is a parser node */
+  guint8 first;
+  guint8 last;
+  guint16 num_children;
+  guint32 num_pchildren;
+  /* index of the first literal and parser child in nodes */
+  guint32 children;
+  guint32 pchildren;
+  /* offset of the first characters of literal children in child_chars */
+  guint32 child_chars;
+  /* index of the child table of dense nodes, -1 if there's none */
+  gint32 child_table;
+} RCompiledNode;
+
+struct _RCompiledTree
+{
+  RCompiledNode *nodes;
+  guint32 num_nodes;
+  guint8 *keys;
+  guint8 *child_chars;
+  /* R_COMPILED_TABLE_SIZE entries for each dense node, child index + 1 */
+  guint32 *child_tables;
+};
+
+#define R_COMPILED_TABLE_SIZE 256
+
+static void
+_compiled_node_append(GArray *nodes, GPtrArray *sources, GByteArray *keys, RNode *node)
+{
+  RCompiledNode cnode = { 0 };
+
+  cnode.keylen = node->keylen;
+  cnode.value = node->value;
+  cnode.node = node;
+  cnode.child_table = -1;
+  if (node->parser)
+    {
+      cnode.first = node->parser->first;
+      cnode.last = node->parser->last;
+    }
+
+  /* key is stored as an offset into the key pool until the pool is final */
+  if (node->key)
+    {
+      cnode.key = GUINT_TO_POINTER(keys->len);
+      g_byte_array_append(keys, node->key, node->keylen + 1);
+    }
+
+  g_array_append_val(nodes, cnode);
+  g_ptr_array_add(sources, node);
+}
+
+RCompiledTree *
+r_compile_tree(RNode *root)
+{
+  RCompiledTree *self = g_new0(RCompiledTree, 1);
+  GArray *nodes = g_array_new(FALSE, FALSE, sizeof(RCompiledNode));
+  GPtrArray *sources = g_ptr_array_new();
+  GByteArray *keys = g_byte_array_new();
+  GByteArray *child_chars = g_byte_array_new();
+  GArray *child_tables = g_array_new(FALSE, TRUE, sizeof(guint32));
+  guint32 ndx;
+  gint i;
+
+  _compiled_node_append(nodes, sources, keys, root);
+  for (ndx = 0; ndx < nodes->len; ndx++)
+    {
+      RNode *node = g_ptr_array_index(sources, ndx);
+      guint32 children = nodes->len;
+      guint32 pchildren;
+      RCompiledNode *cnode;
+
+      for (i = 0; i < node->num_children; i++)
+        _compiled_node_append(nodes, sources, keys, node->children[i]);
+      pchildren = nodes->len;
+      for (i = 0; i < node->num_pchildren; i++)
+        _compiled_node_append(nodes, sources, keys, node->pchildren[i]);
+
+      /* nodes may have been reallocated by the appends above */
+      cnode = &g_array_index(nodes, RCompiledNode, ndx);
+      cnode->num_children = node->num_children;
+      cnode->num_pchildren = node->num_pchildren;
+      cnode->children = children;
+      cnode->pchildren = pchildren;
+      cnode->child_chars = child_chars->len;
+      for (i = 0; i < node->num_children; i++)
+        g_byte_array_append(child_chars, node->children[i]->key, 1);
+
+      if (node->num_children > R_COMPILED_DENSE_CHILDREN)
+        {
+          guint32 table = child_tables->len;
+
+          cnode->child_table = table / R_COMPILED_TABLE_SIZE;
+          g_array_set_size(child_tables, table + R_COMPILED_TABLE_SIZE);
+          for (i = 0; i < node->num_children; i++)
+            g_array_index(child_tables, guint32, table + node->children[i]->key[0]) = children + i + 1;
+        }
+    }
+
+  self->num_nodes = nodes->len;
+  self->nodes = (RCompiledNode *) g_array_free(nodes, FALSE);
+  self->keys = g_byte_array_free(keys, FALSE);
+  self->child_chars = g_byte_array_free(child_chars, FALSE);
+  self->child_tables = (guint32 *) g_array_free(child_tables, FALSE);
+  for (ndx = 0; ndx < self->num_nodes; ndx++)
+    {
+      RCompiledNode *cnode = &self->nodes[ndx];
+
+      if (cnode->keylen >= 0)
+        cnode->key = self->keys + GPOINTER_TO_UINT(cnode->key);
+    }
+  g_ptr_array_free(sources, TRUE);
+  return self;
+}
+
+void
+r_free_compiled_tree(RCompiledTree *self)
+{
+  g_free(self->nodes);
+  g_free(self->keys);
+  g_free(self->child_chars);
+  g_free(self->child_tables);
+  g_free(self);
+}
+
+static RNode *_find_compiled_node_recursively(RFindNodeState *state, guint32 ndx, guint8 *key, gint keylen);
+
+static gint32
+_find_compiled_child_by_first_character(RCompiledTree *tree, const RCompiledNode *root, guint8 key)
+{
+  const guint8 *chars;
+  const guint8 *found;
+
+  if (root->child_table >= 0)
+    return (gint32) tree->child_tables[root->child_table * R_COMPILED_TABLE_SIZE + key] - 1;
+
+  chars = tree->child_chars + root->child_chars;
+  found = memchr(chars, key, root->num_children);
+  if (found)
+    return root->children + (found - chars);
+  return -1;
+}
+
+static RNode *
+_find_compiled_child_by_remaining_key(RFindNodeState *state, const RCompiledNode *root, guint8 *remaining_key,
+                                      gint remaining_keylen)
+{
+  gint32 candidate;
+
+  if (!root->num_children)
+    return NULL;
+
+  if (remaining_keylen >= 2 && remaining_key[0] == '\r' && remaining_key[1] == '\n')
+    {
+      remaining_key++;
+      remaining_keylen--;
+    }
+  candidate = _find_compiled_child_by_first_character(state->compiled, root, remaining_key[0]);
+  if (candidate >= 0)
+    return _find_compiled_node_recursively(state, candidate, remaining_key, remaining_keylen);
+  return NULL;
+}
+
+static RNode *
+_find_compiled_child_by_parser(RFindNodeState *state, const RCompiledNode *root, guint8 *remaining_key,
+                               gint remaining_keylen)
+{
+  gint matches_slot_index;
+  guint32 parser_ndx;
+  RNode *ret = NULL;
+
+  if (!root->num_pchildren)
+    return NULL;
+
+  matches_slot_index = _alloc_slot_in_matches(state);
+  for (parser_ndx = root->pchildren; !ret && parser_ndx < root->pchildren + root->num_pchildren; parser_ndx++)
+    {
+      const RCompiledNode *child = &state->compiled->nodes[parser_ndx];
+      RParserNode *parser_node;
+      RParserMatch *match_slot;
+      gint extracted_match_len;
+
+      if (remaining_key[0] < child->first || remaining_key[0] > child->last)
+        continue;
+
+      parser_node = child->node->parser;
+      match_slot = _clear_match_slot(state, matches_slot_index);
+      if (!parser_node->parse(remaining_key, &extracted_match_len, parser_node->param, parser_node->state, match_slot))
+        continue;
+
+      ret = _find_compiled_node_recursively(state, parser_ndx, remaining_key + extracted_match_len,
+                                            remaining_keylen - extracted_match_len);
+
+      /* see _try_parse_with_a_given_child() */
+      match_slot = _get_match_slot(state, matches_slot_index);
+      if (match_slot)
+        {
+          if (ret)
+            _fixup_match_offsets(state, parser_node, extracted_match_len, remaining_key, match_slot);
+          else
+            _clear_match_content(match_slot);
+        }
+    }
+  if (!ret && state->stored_matches)
+    _reset_matches_to_original_state(state, matches_slot_index);
+  return ret;
+}
+
+/* this mirrors _find_node_recursively(), see the comments there */
+static RNode *
+_find_compiled_node_recursively(RFindNodeState *state, guint32 ndx, guint8 *key, gint keylen)
+{
+  const RCompiledNode *root = &state->compiled->nodes[ndx];
+  gint literal_prefix_inputlen, literal_prefix_radixlen;
+
+  _find_matching_literal_prefix_of_key(root->key, root->keylen, key, keylen,
+                                       &literal_prefix_inputlen,
+                                       &literal_prefix_radixlen);
+
+  if (literal_prefix_inputlen == keylen && (literal_prefix_radixlen == root->keylen || root->keylen == -1))
+    {
+      if (root->value)
+        return root->node;
+    }
+  else if ((root->keylen < 1) || (literal_prefix_inputlen < keylen && literal_prefix_radixlen >= root->keylen))
+    {
+      RNode *ret;
+      guint8 *remaining_key = key + literal_prefix_inputlen;
+      gint remaining_keylen = keylen - literal_prefix_inputlen;
+
+      ret = _find_compiled_child_by_remaining_key(state, root, remaining_key, remaining_keylen);
+      if (!ret)
+        ret = _find_compiled_child_by_parser(state, root, remaining_key, remaining_keylen);
+
+      if (!ret && root->value)
+        {
+          if (!state->require_complete_match)
+            return root->node;
+          state->partial_match_found = TRUE;
+        }
+
+      return ret;
+    }
+
+  return NULL;
+}
+
+RNode *
+r_find_node_compiled(RCompiledTree *tree, guint8 *key, gint keylen, GArray *stored_matches)
+{
+  RFindNodeState state =
+  {
+    .whole_key = key,
+    .stored_matches = stored_matches,
+    .compiled = tree,
+  };
+  RNode *ret;
+
+  state.require_complete_match = TRUE;
+  ret = _find_compiled_node_recursively(&state, 0, key, keylen);
+  if (!ret && state.partial_match_found)
+    {
+      state.require_complete_match = FALSE;
+      ret = _find_compiled_node_recursively(&state, 0, key, keylen);
+    }
+  return ret;
+}
+
 /**
  * r_new_node:
  */
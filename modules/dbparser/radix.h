@@ -99,6 +99,9 @@ struct _RNode
   RNode **pchildren;
 };
 
+/* read-only, flattened copy of a radix tree for faster lookups, see r_compile_tree() */
+typedef struct _RCompiledTree RCompiledTree;
+
 typedef struct _RDebugInfo
 {
   RNode *node;
@@ -153,5 +156,9 @@ RNode *r_find_node(RNode *root, guint8 *key, gint keylen, GArray *matches);
 RNode *r_find_node_dbg(RNode *root, guint8 *key, gint keylen, GArray *matches, GArray *dbg_list);
 gchar **r_find_all_applicable_nodes(RNode *root, guint8 *key, gint keylen, RNodeGetValueFunc value_func);
 
+RCompiledTree *r_compile_tree(RNode *root);
+void r_free_compiled_tree(RCompiledTree *self);
+RNode *r_find_node_compiled(RCompiledTree *tree, guint8 *key, gint keylen, GArray *matches);
+
 #endif
 
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "testutils.h"
+#include "groupingby.h"
+#include "correllation.h"
+#include "synthetic-message.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+#include "logpipe.h"
+#include "stats/stats.h"
+#include "stats/stats-registry.h"
+
+#include <iv.h>
+#include <string.h>
+#include <time.h>
+
+#define TIMEOUT 10
+
+GPtrArray *messages;
+LogPipe *capture;
+/* messages are timestamped in the past, as the current time of
+ * grouping-by() is clamped to the system time */
+time_t base_time;
+
+static void
+_capture_synthetic_message(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  g_ptr_array_add(messages, msg);
+}
+
+static LogParser *
+_create_grouping_by(GlobalConfig *cfg)
+{
+  LogParser *parser = grouping_by_new(cfg);
+  SyntheticMessage *synthetic_message = synthetic_message_new();
+  LogTemplate *key_template = log_template_new(cfg, NULL);
+
+  log_template_compile(key_template, "$PROGRAM", NULL);
+  grouping_by_set_key_template(parser, key_template);
+  log_template_unref(key_template);
+  grouping_by_set_timeout(parser, TIMEOUT);
+
+  synthetic_message_add_value_template_string(synthetic_message, cfg, "KEY", "${.classifier.context_id}", NULL);
+  synthetic_message_add_value_template_string(synthetic_message, cfg, "MESSAGES", "${MESSAGE}@1,${MESSAGE}@0", NULL);
+  grouping_by_set_synthetic_message(parser, synthetic_message);
+
+  log_pipe_append(&parser->super, capture);
+  assert_true(log_pipe_init(&parser->super), "grouping-by() failed to initialize");
+  return parser;
+}
+
+static void
+_destroy_grouping_by(LogParser *parser)
+{
+  log_pipe_deinit(&parser->super);
+  log_pipe_unref(&parser->super);
+}
+
+static void
+_process(LogParser *parser, const gchar *key, const gchar *message, gint time_offset)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg = log_msg_new_empty();
+
+  log_msg_set_value(msg, LM_V_PROGRAM, key, -1);
+  log_msg_set_value(msg, LM_V_MESSAGE, message, -1);
+  msg->timestamps[LM_TS_STAMP].tv_sec = base_time + time_offset;
+
+  assert_true(log_parser_process_message(parser, &msg, &path_options), "grouping-by() failed to process message");
+  log_msg_unref(msg);
+}
+
+static LogMessage *
+_find_synthetic_message(const gchar *key)
+{
+  NVHandle key_handle = log_msg_get_value_handle("KEY");
+  gint i;
+
+  for (i = 0; i < messages->len; i++)
+    {
+      LogMessage *msg = (LogMessage *) g_ptr_array_index(messages, i);
+
+      if (strcmp(log_msg_get_value(msg, key_handle, NULL), key) == 0)
+        return msg;
+    }
+  return NULL;
+}
+
+static void
+_assert_context_expired(const gchar *key, const gchar *expected_messages)
+{
+  LogMessage *msg = _find_synthetic_message(key);
+
+  assert_not_null(msg, "no synthetic message was emitted for context %s", key);
+  assert_string(log_msg_get_value_by_name(msg, "MESSAGES", NULL), expected_messages,
+                "unexpected messages in context %s", key);
+}
+
+static void
+_reset_synthetic_messages(void)
+{
+  g_ptr_array_foreach(messages, (GFunc) log_msg_unref, NULL);
+  g_ptr_array_set_size(messages, 0);
+}
+
+/* the "stored" counter of the shard that @key is routed to */
+static gint
+_get_live_contexts_of_shard(const gchar *key)
+{
+  CorrellationState *dummy_state = correllation_state_new();
+  LogMessage *msg = log_msg_new_empty();
+  StatsCounterItem *counter = NULL;
+  CorrellationKey correllation_key;
+  gchar instance[16];
+  gint value;
+
+  correllation_key_setup(&correllation_key, RCS_GLOBAL, msg, (gchar *) key);
+  g_snprintf(instance, sizeof(instance), "shard%d",
+             correllation_state_get_shard_index(dummy_state, &correllation_key));
+
+  stats_lock();
+  stats_register_counter(3, SCS_CORRELLATION, "#unknown", instance, SC_TYPE_STORED, &counter);
+  value = stats_counter_get(counter);
+  stats_unregister_counter(SCS_CORRELLATION, "#unknown", instance, SC_TYPE_STORED, &counter);
+  stats_unlock();
+
+  log_msg_unref(msg);
+  correllation_state_free(dummy_state);
+  return value;
+}
+
+static void
+test_grouping_by_routes_messages_by_key(void)
+{
+  LogParser *parser = _create_grouping_by(configuration);
+
+  _process(parser, "key-a", "a1", 0);
+  _process(parser, "key-b", "b1", 1);
+  _process(parser, "key-a", "a2", 2);
+
+  assert_gint(messages->len, 0, "no context should expire before its timeout");
+  assert_gint(_get_live_contexts_of_shard("key-a"), 1, "key-a should be stored in its shard");
+  assert_gint(_get_live_contexts_of_shard("key-b"), 1, "key-b should be stored in its shard");
+
+  /* a message with any key moves the time of every shard */
+  _process(parser, "key-c", "c1", 2 + TIMEOUT + 1);
+
+  assert_gint(messages->len, 2, "both contexts should have expired");
+  _assert_context_expired("key-a", "a1,a2");
+  _assert_context_expired("key-b", ",b1");
+  assert_gint(_get_live_contexts_of_shard("key-a"), 0, "expired contexts should leave the shard of key-a");
+  assert_gint(_get_live_contexts_of_shard("key-b"), 0, "expired contexts should leave the shard of key-b");
+  assert_gint(_get_live_contexts_of_shard("key-c"), 1, "key-c should be stored in its shard");
+
+  _reset_synthetic_messages();
+  _destroy_grouping_by(parser);
+}
+
+static void
+test_grouping_by_time_does_not_move_backwards(void)
+{
+  LogParser *parser = _create_grouping_by(configuration);
+
+  _process(parser, "key-a", "a1", 100);
+  _process(parser, "key-b", "b1", 100 + TIMEOUT - 1);
+
+  /* an older message with another key must not hold back the expiration */
+  _process(parser, "key-c", "c1", 0);
+  _process(parser, "key-b", "b2", 100 + TIMEOUT + 1);
+
+  assert_gint(messages->len, 1, "only key-a should have expired");
+  _assert_context_expired("key-a", ",a1");
+
+  _reset_synthetic_messages();
+  _destroy_grouping_by(parser);
+}
+
+static void
+test_grouping_by_rearms_timers_of_persisted_contexts(void)
+{
+  GlobalConfig *old_cfg = cfg_new(VERSION_VALUE);
+  GlobalConfig *new_cfg = cfg_new(VERSION_VALUE);
+  LogParser *parser;
+
+  old_cfg->persist = persist_config_new();
+  parser = _create_grouping_by(old_cfg);
+  _process(parser, "key-a", "a1", 0);
+  _process(parser, "key-a", "a2", TIMEOUT - 1);
+  _destroy_grouping_by(parser);
+
+  assert_gint(messages->len, 0, "contexts should survive a reload");
+
+  cfg_persist_config_move(old_cfg, new_cfg);
+  parser = _create_grouping_by(new_cfg);
+  assert_gint(_get_live_contexts_of_shard("key-a"), 1, "the persisted context should be counted in its shard");
+
+  /* the timer starts over with a full timeout from the persisted time */
+  _process(parser, "key-b", "b1", TIMEOUT);
+  assert_gint(messages->len, 0, "the persisted context should not expire early");
+
+  _process(parser, "key-b", "b2", TIMEOUT - 1 + TIMEOUT + 1);
+  _assert_context_expired("key-a", "a1,a2");
+  assert_gint(_get_live_contexts_of_shard("key-a"), 0, "the expired context should leave its shard");
+
+  _reset_synthetic_messages();
+  _destroy_grouping_by(parser);
+  persist_config_free(new_cfg->persist);
+  new_cfg->persist = NULL;
+  cfg_free(old_cfg);
+  cfg_free(new_cfg);
+}
+
+int
+main(int argc, char *argv[])
+{
+  StatsOptions stats_options;
+
+  app_startup();
+  iv_init();
+
+  stats_options_defaults(&stats_options);
+  stats_options.level = 3;
+  stats_reinit(&stats_options);
+
+  configuration = cfg_new(VERSION_VALUE);
+  grouping_by_global_init();
+
+  messages = g_ptr_array_new();
+  capture = log_pipe_new(configuration);
+  capture->queue = _capture_synthetic_message;
+  log_pipe_init(capture);
+
+  base_time = time(NULL) - 3600;
+  test_grouping_by_routes_messages_by_key();
+  test_grouping_by_time_does_not_move_backwards();
+  test_grouping_by_rearms_timers_of_persisted_contexts();
+
+  log_pipe_deinit(capture);
+  log_pipe_unref(capture);
+  g_ptr_array_free(messages, TRUE);
+  cfg_free(configuration);
+
+  iv_deinit();
+  app_shutdown();
+  return 0;
+}
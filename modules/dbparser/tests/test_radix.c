@@ -89,11 +89,70 @@ insert_node(RNode *root, gchar *key)
   insert_node_with_value(root, key, NULL);
 }
 
+static void
+_free_matches(GArray *matches)
+{
+  for (gsize i = 0; i < matches->len; i++)
+    g_free(g_array_index(matches, RParserMatch, i).match);
+  g_array_free(matches, TRUE);
+}
+
+/* the compiled tree has to return the same node and matches as the tree
+ * it was compiled from */
+void
+test_compiled_search(RNode *root, gchar *key)
+{
+  RCompiledTree *compiled = r_compile_tree(root);
+  GArray *matches = g_array_new(FALSE, TRUE, sizeof(RParserMatch));
+  GArray *compiled_matches = g_array_new(FALSE, TRUE, sizeof(RParserMatch));
+  RNode *ret, *compiled_ret;
+
+  g_array_set_size(matches, 1);
+  g_array_set_size(compiled_matches, 1);
+  ret = r_find_node(root, key, strlen(key), matches);
+  compiled_ret = r_find_node_compiled(compiled, key, strlen(key), compiled_matches);
+
+  if (ret != compiled_ret)
+    {
+      printf("FAIL: compiled tree returned a different node: '%s' => '%s' <> '%s'\n", key,
+             ret ? (gchar *) ret->value : "none", compiled_ret ? (gchar *) compiled_ret->value : "none");
+      fail = TRUE;
+    }
+  else if (ret && matches->len != compiled_matches->len)
+    {
+      printf("FAIL: compiled tree returned a different number of matches: '%s' => %u <> %u\n", key,
+             matches->len, compiled_matches->len);
+      fail = TRUE;
+    }
+  else if (ret)
+    {
+      for (gsize i = 0; i < matches->len; i++)
+        {
+          RParserMatch *match = &g_array_index(matches, RParserMatch, i);
+          RParserMatch *compiled_match = &g_array_index(compiled_matches, RParserMatch, i);
+
+          if (match->handle != compiled_match->handle || match->type != compiled_match->type ||
+              match->ofs != compiled_match->ofs || match->len != compiled_match->len ||
+              g_strcmp0(match->match, compiled_match->match) != 0)
+            {
+              printf("FAIL: compiled tree returned a different match: '%s' => %" G_GSIZE_FORMAT ". match\n", key, i);
+              fail = TRUE;
+            }
+        }
+    }
+
+  _free_matches(matches);
+  _free_matches(compiled_matches);
+  r_free_compiled_tree(compiled);
+}
+
 void
 test_search_value(RNode *root, gchar *key, gchar *expected_value)
 {
   RNode *ret = r_find_node(root, key, strlen(key), NULL);
 
+  test_compiled_search(root, key);
+
   if (ret && expected_value)
     {
       if (strcmp(ret->value, expected_value) != 0)
@@ -136,6 +195,7 @@ test_search_matches(RNode *root, gchar *key, gchar *name1, ...)
   g_array_set_size(matches, 1);
   va_start(args, name1);
 
+  test_compiled_search(root, key);
   ret = r_find_node(root, key, strlen(key), matches);
   if (ret && !name1)
     {
@@ -296,6 +356,37 @@ test_literals(void)
   r_free_node(root, NULL);
 }
 
+void
+test_dense_literals(void)
+{
+  RNode *root = r_new_node("", NULL);
+  gchar key[] = "Xprefix-with-more-than-eight-bytes";
+  gchar c;
+
+  /* more children than R_COMPILED_DENSE_CHILDREN, including ones starting
+   * with non-ASCII characters */
+  for (c = 'a'; c <= 'p'; c++)
+    {
+      key[0] = c;
+      insert_node_with_value(root, key, g_strdup(key));
+    }
+  insert_node_with_value(root, "\xc3\xa1rv\xc3\xadz", g_strdup("\xc3\xa1rv\xc3\xadz"));
+  insert_node_with_value(root, "\xc3\xa9kezet", g_strdup("\xc3\xa9kezet"));
+  insert_node_with_value(root, "long literal prefix\nwith a newline", g_strdup("long literal prefix\nwith a newline"));
+
+  test_search_value(root, "bprefix-with-more-than-eight-bytes", "bprefix-with-more-than-eight-bytes");
+  test_search_value(root, "pprefix-with-more-than-eight-bytes", "pprefix-with-more-than-eight-bytes");
+  test_search_value(root, "pprefix-with-more-than-eight-bytes and some", "pprefix-with-more-than-eight-bytes");
+  test_search(root, "qprefix-with-more-than-eight-bytes", FALSE);
+  test_search(root, "bprefix-with-more-than-eight-byte", FALSE);
+  test_search(root, "\xc3\xa1rv\xc3\xadz", TRUE);
+  test_search(root, "\xc3\xa9kezet", TRUE);
+  test_search(root, "long literal prefix\nwith a newline", TRUE);
+  test_search_value(root, "long literal prefix\r\nwith a newline", "long literal prefix\nwith a newline");
+
+  r_free_node(root, g_free);
+}
+
 void
 test_parsers(void)
 {
@@ -909,6 +1000,7 @@ main(int argc, char *argv[])
   msg_init(TRUE);
 
   test_literals();
+  test_dense_literals();
   test_parsers();
 
   test_ip_matches();
@@ -76,6 +76,39 @@ disk_queue_options_mem_buf_length_set(DiskQueueOptions *self, gint mem_buf_lengt
   self->mem_buf_length = mem_buf_length;
 }
 
+void
+disk_queue_options_write_batch_size_set(DiskQueueOptions *self, gint write_batch_size)
+{
+  if (write_batch_size < 1)
+    {
+      msg_warning("WARNING: The configured write batch size is smaller than the minimum allowed",
+                  evt_tag_int("configured size", write_batch_size),
+                  evt_tag_int("minimum allowed size", 1),
+                  evt_tag_int("new size", 1));
+      write_batch_size = 1;
+    }
+  self->write_batch_size = write_batch_size;
+}
+
+void
+disk_queue_options_fsync_set(DiskQueueOptions *self, gboolean fsync)
+{
+  self->fsync = fsync;
+}
+
+void
+disk_queue_options_compression_set(DiskQueueOptions *self, gboolean compression)
+{
+#if !SYSLOG_NG_HAVE_ZLIB
+  if (compression)
+    {
+      msg_warning("WARNING: disk-buffer compression() requires zlib, syslog-ng was compiled without it, records are stored uncompressed");
+      compression = FALSE;
+    }
+#endif
+  self->compression = compression;
+}
+
 void
 disk_queue_options_check_plugin_settings(DiskQueueOptions *self)
 {
@@ -113,6 +146,9 @@ disk_queue_options_set_default_options(DiskQueueOptions *self)
   self->reliable = FALSE;
   self->mem_buf_size = -1;
   self->qout_size = -1;
+  self->write_batch_size = 1;
+  self->fsync = FALSE;
+  self->compression = FALSE;
   self->dir = g_strdup(get_installation_path_for(SYSLOG_NG_PATH_LOCALSTATEDIR));
 }
 
@@ -37,6 +37,12 @@ typedef struct _DiskQueueOptions
   gboolean reliable;
   gint mem_buf_size;
   gint mem_buf_length;
+  /* the number of records collected before they are written with a single
+   * pwrite(), it is a record count and not a time interval: a partial batch
+   * is written once the input thread finishes its batch of messages */
+  gint write_batch_size;
+  gboolean fsync;
+  gboolean compression;
   gchar *dir;
 } DiskQueueOptions;
 
@@ -45,6 +51,9 @@ void disk_queue_options_disk_buf_size_set(DiskQueueOptions *self, gint64 disk_bu
 void disk_queue_options_reliable_set(DiskQueueOptions *self, gboolean reliable);
 void disk_queue_options_mem_buf_size_set(DiskQueueOptions *self, gint mem_buf_size);
 void disk_queue_options_mem_buf_length_set(DiskQueueOptions *self, gint mem_buf_length);
+void disk_queue_options_write_batch_size_set(DiskQueueOptions *self, gint write_batch_size);
+void disk_queue_options_fsync_set(DiskQueueOptions *self, gboolean fsync);
+void disk_queue_options_compression_set(DiskQueueOptions *self, gboolean compression);
 void disk_queue_options_check_plugin_settings(DiskQueueOptions *self);
 void disk_queue_options_set_dir(DiskQueueOptions *self, const gchar *dir);
 void disk_queue_options_set_default_options(DiskQueueOptions *self);
@@ -37,6 +37,9 @@ static CfgLexerKeyword diskq_keywords[] =
   { "mem_buf_size",      KW_MEM_BUF_SIZE },
   { "qout_size",         KW_QOUT_SIZE },
   { "dir",               KW_DIR },
+  { "write_batch_size",  KW_WRITE_BATCH_SIZE },
+  { "fsync",             KW_FSYNC },
+  { "compression",       KW_COMPRESSION },
   { NULL }
 };
 
@@ -90,6 +90,7 @@ _acquire_queue(LogDestDriver *dd, const gchar *persist_name, gpointer user_data)
         }
     }
 
+  log_queue_disk_register_counters(queue);
   return queue;
 }
 
@@ -99,6 +100,7 @@ _release_queue(LogDestDriver *dd, LogQueue *queue, gpointer user_data)
   GlobalConfig *cfg = log_pipe_get_config(&dd->super.super);
   gboolean persistent;
 
+  log_queue_disk_unregister_counters(queue);
   log_queue_disk_save_queue(queue, &persistent);
   if (queue->persist_name)
     {
@@ -156,6 +156,32 @@ dqtool_cat(int argc, char *argv[])
 
 }
 
+/* reads all records of the queue file to find out how much space
+ * compression saves.  The messages of the qout and overflow sections are
+ * loaded into memory when the file is opened, they are counted in
+ * records, but they are never compressed, so only the records read from
+ * the disk part of the file are in the size stats. */
+static void
+print_record_stats(const gchar *filename, LogQueue *lq)
+{
+  LogPathOptions local_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *log_msg;
+  const QDiskRecordStats *stats;
+  guint64 records = 0;
+
+  while ((log_msg = log_queue_pop_head(lq, &local_options)) != NULL)
+    {
+      records++;
+      log_msg_unref(log_msg);
+    }
+
+  stats = qdisk_get_read_stats(((LogQueueDisk *) lq)->qdisk);
+  printf("%s: records=%" G_GUINT64_FORMAT ", disk_records=%" G_GUINT64_FORMAT ", compressed_records=%" G_GUINT64_FORMAT
+         ", size=%" G_GUINT64_FORMAT ", uncompressed_size=%" G_GUINT64_FORMAT ", compression_ratio=%d%%\n",
+         filename, records, stats->records, stats->compressed_records, stats->stored_bytes, stats->bytes,
+         stats->bytes ? (gint) (stats->stored_bytes * 100 / stats->bytes) : 100);
+}
+
 static gint
 dqtool_info(int argc, char *argv[])
 {
@@ -167,6 +193,7 @@ dqtool_info(int argc, char *argv[])
 
       if (!open_queue(argv[i], &lq, &options))
         continue;
+      print_record_stats(argv[i], lq);
       log_queue_unref(lq);
     }
   return 0;
@@ -55,6 +55,89 @@ _get_length(LogQueue *s)
   return qdisk_length;
 }
 
+static void
+_update_write_stats(LogQueueDisk *self)
+{
+  stats_counter_set(self->write_batch_size, qdisk_get_average_write_records(self->qdisk));
+  stats_counter_set(self->write_size, qdisk_get_average_write_size(self->qdisk));
+  stats_counter_set(self->compression_ratio, qdisk_get_compression_ratio(self->qdisk));
+}
+
+/* acknowledges the messages whose records are already written to disk,
+ * must be called with the lock held */
+static void
+_ack_written_messages(LogQueueDisk *self)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+
+  if (qdisk_initialized(self->qdisk) && qdisk_has_pending_writes(self->qdisk))
+    return;
+
+  while ((msg = g_queue_pop_head(self->qpending_acks)))
+    {
+      POINTER_TO_LOG_PATH_OPTIONS(g_queue_pop_head(self->qpending_acks), &path_options);
+      log_msg_ack(msg, &path_options, AT_PROCESSED);
+      log_msg_unref(msg);
+    }
+}
+
+static void
+_flush_writes(LogQueueDisk *self)
+{
+  if (qdisk_initialized(self->qdisk))
+    {
+      qdisk_flush(self->qdisk);
+      _update_write_stats(self);
+    }
+  _ack_written_messages(self);
+}
+
+/* group commit: the records pushed by an input thread are written once it
+ * finished its batch, registered as a batch callback by _schedule_flush() */
+static gpointer
+_flush_at_batch_end(gpointer user_data)
+{
+  LogQueueDisk *self = (LogQueueDisk *) user_data;
+  gint thread_id;
+
+  thread_id = main_loop_worker_get_thread_id();
+
+  g_assert(thread_id >= 0);
+
+  g_static_mutex_lock(&self->super.lock);
+  _flush_writes(self);
+  self->flush_threads[thread_id].flush_cb_registered = FALSE;
+  g_static_mutex_unlock(&self->super.lock);
+  log_queue_unref(&self->super);
+  return NULL;
+}
+
+/* must be called with the lock held */
+static void
+_schedule_flush(LogQueueDisk *self)
+{
+  gint thread_id;
+
+  thread_id = main_loop_worker_get_thread_id();
+
+  g_assert(thread_id < 0 || log_queue_max_threads > thread_id);
+
+  if (thread_id < 0)
+    {
+      /* not a worker thread, there's no batch to wait for */
+      _flush_writes(self);
+      return;
+    }
+
+  if (!self->flush_threads[thread_id].flush_cb_registered)
+    {
+      main_loop_worker_register_batch_callback(&self->flush_threads[thread_id].cb);
+      self->flush_threads[thread_id].flush_cb_registered = TRUE;
+      log_queue_ref(&self->super);
+    }
+}
+
 static void
 _push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
 {
@@ -67,8 +150,20 @@ _push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
         {
           log_queue_push_notify (&self->super);
           stats_counter_inc(self->super.stored_messages);
-          log_msg_ack(msg, &local_options, AT_PROCESSED);
-          log_msg_unref(msg);
+          if (qdisk_initialized(self->qdisk) && qdisk_has_pending_writes(self->qdisk))
+            {
+              /* the record is not on disk yet, keep the message until the batch is written */
+              g_queue_push_tail(self->qpending_acks, msg);
+              g_queue_push_tail(self->qpending_acks, LOG_PATH_OPTIONS_TO_POINTER(&local_options));
+              _schedule_flush(self);
+            }
+          else
+            {
+              _ack_written_messages(self);
+              log_msg_ack(msg, &local_options, AT_PROCESSED);
+              log_msg_unref(msg);
+            }
+          _update_write_stats(self);
           g_static_mutex_unlock(&self->super.lock);
           return;
         }
@@ -172,6 +267,10 @@ log_queue_disk_save_queue(LogQueue *s, gboolean *persistent)
       return TRUE;
     }
 
+  g_static_mutex_lock(&self->super.lock);
+  _flush_writes(self);
+  g_static_mutex_unlock(&self->super.lock);
+
   if (self->save_queue)
     return self->save_queue(self, persistent);
   return FALSE;
@@ -199,6 +298,36 @@ log_queue_disk_is_reliable(LogQueue *s)
   return FALSE;
 }
 
+void
+log_queue_disk_register_counters(LogQueue *s)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+
+  if (!s->persist_name)
+    return;
+
+  stats_lock();
+  stats_register_counter(0, SCS_DESTINATION, s->persist_name, NULL, SC_TYPE_BATCH_SIZE, &self->write_batch_size);
+  stats_register_counter(0, SCS_DESTINATION, s->persist_name, NULL, SC_TYPE_WRITE_SIZE, &self->write_size);
+  stats_register_counter(0, SCS_DESTINATION, s->persist_name, NULL, SC_TYPE_COMPRESSION_RATIO, &self->compression_ratio);
+  stats_unlock();
+}
+
+void
+log_queue_disk_unregister_counters(LogQueue *s)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+
+  if (!s->persist_name)
+    return;
+
+  stats_lock();
+  stats_unregister_counter(SCS_DESTINATION, s->persist_name, NULL, SC_TYPE_BATCH_SIZE, &self->write_batch_size);
+  stats_unregister_counter(SCS_DESTINATION, s->persist_name, NULL, SC_TYPE_WRITE_SIZE, &self->write_size);
+  stats_unregister_counter(SCS_DESTINATION, s->persist_name, NULL, SC_TYPE_COMPRESSION_RATIO, &self->compression_ratio);
+  stats_unlock();
+}
+
 const gchar *
 log_queue_disk_get_filename(LogQueue *s)
 {
@@ -215,6 +344,9 @@ _free(LogQueue *s)
     self->free_fn(self);
 
   qdisk_deinit(self->qdisk);
+  _ack_written_messages(self);
+  g_queue_free(self->qpending_acks);
+  g_free(self->flush_threads);
   qdisk_free(self->qdisk);
   g_free(self);
 }
@@ -311,6 +443,8 @@ _restart_diskq(LogQueueDisk *self, gboolean corrupted)
       rename(filename,new_file);
       g_free(new_file);
     }
+  /* records that could not be written are lost with the old file */
+  _ack_written_messages(self);
   if (self->start)
     {
       self->start(self, filename);
@@ -334,8 +468,18 @@ _restart_corrupted(LogQueueDisk *self)
 void
 log_queue_disk_init_instance(LogQueueDisk *self)
 {
+  gint i;
+
   log_queue_init_instance(&self->super,NULL);
   self->qdisk = qdisk_new();
+  self->qpending_acks = g_queue_new();
+  self->flush_threads = g_new0(LogQueueDiskFlushThread, log_queue_max_threads);
+  for (i = 0; i < log_queue_max_threads; i++)
+    {
+      worker_batch_callback_init(&self->flush_threads[i].cb);
+      self->flush_threads[i].cb.func = _flush_at_batch_end;
+      self->flush_threads[i].cb.user_data = self;
+    }
 
   self->super.get_length = _get_length;
   self->super.push_tail = _push_tail;
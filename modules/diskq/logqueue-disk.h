@@ -28,15 +28,31 @@
 #include "logqueue.h"
 #include "qdisk.h"
 #include "logmsg/logmsg-serialize.h"
+#include "mainloop-worker.h"
 
 typedef struct _LogQueueDisk LogQueueDisk;
 
+typedef struct _LogQueueDiskFlushThread
+{
+  WorkerBatchCallback cb;
+  gboolean flush_cb_registered;
+} LogQueueDiskFlushThread;
+
 #define LOG_PATH_OPTIONS_FOR_BACKLOG GINT_TO_POINTER(0x80000000)
 
 struct _LogQueueDisk
 {
   LogQueue super;
   QDisk *qdisk;         /* disk based queue */
+
+  /* messages whose records are still in the write buffer of qdisk, they
+   * are acknowledged once the batch is written to disk */
+  GQueue *qpending_acks;
+  LogQueueDiskFlushThread *flush_threads;
+  StatsCounterItem *write_batch_size;
+  StatsCounterItem *write_size;
+  StatsCounterItem *compression_ratio;
+
   gint64 (*get_length)(LogQueueDisk *s);
   gboolean (*push_tail)(LogQueueDisk *s, LogMessage *msg, LogPathOptions *local_options, const LogPathOptions *path_options);
   void (*push_head)(LogQueueDisk *s, LogMessage *msg, const LogPathOptions *path_options);
@@ -60,6 +76,8 @@ gboolean log_queue_disk_is_reliable(LogQueue *s);
 const gchar *log_queue_disk_get_filename(LogQueue *self);
 gboolean log_queue_disk_save_queue(LogQueue *self, gboolean *persistent);
 gboolean log_queue_disk_load_queue(LogQueue *self, const gchar *filename);
+void log_queue_disk_register_counters(LogQueue *self);
+void log_queue_disk_unregister_counters(LogQueue *self);
 void log_queue_disk_init_instance(LogQueueDisk *self);
 
 #endif
@@ -37,6 +37,10 @@
 #include <unistd.h>
 #include <sys/types.h>
 
+#if SYSLOG_NG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 /* MADV_RANDOM not defined on legacy Linux systems. Could be removed in the
  * future, when support for Glibc 2.1.X drops.*/
 #ifndef MADV_RANDOM
@@ -48,6 +52,16 @@
 
 #define PATH_QDISK              PATH_LOCALSTATEDIR
 
+/* flush the records collected for a single write once they reach this size */
+#define QDISK_MAX_WRITE_BUFFER_SIZE (1024 * 1024)
+
+#define QDISK_MAX_RECORD_SIZE (10 * 1024 * 1024)
+
+/* set in the length prefix of a record if the record is compressed, in
+ * that case the record consists of the original length (32 bits, big
+ * endian) followed by the zlib compressed serialized message */
+#define QDISK_RECORD_COMPRESSED 0x80000000
+
 typedef union _QDiskFileHeader
 {
   struct
@@ -87,6 +101,28 @@ struct _QDisk
   gint64 file_size;
   QDiskFileHeader *hdr;
   DiskQueueOptions *options;
+
+  /* records pushed but not yet written to the file, they belong to
+   * write_buffer_ofs and are written with a single pwrite() by
+   * qdisk_flush() */
+  GString *write_buffer;
+  gint64 write_buffer_ofs;
+  gint write_buffer_records;
+  /* the write head after the records in write_buffer.  hdr->write_head and
+   * hdr->length are mapped to the file, they only advance in qdisk_flush()
+   * once the records were written, so the header never refers to records
+   * that are not in the file after a crash */
+  gint64 write_head;
+
+  /* totals used to calculate the average size of a write */
+  guint64 writes;
+  guint64 written_records;
+  guint64 written_bytes;
+
+  /* scratch buffer for compressing/decompressing a single record */
+  GString *compress_buffer;
+  QDiskRecordStats write_stats;
+  QDiskRecordStats read_stats;
 };
 
 static gboolean
@@ -164,13 +200,13 @@ qdisk_initialized(QDisk *self)
 static inline gboolean
 _is_backlog_head_prevent_write_head(QDisk *self)
 {
-  return self->hdr->backlog_head <= self->hdr->write_head;
+  return self->hdr->backlog_head <= self->write_head;
 }
 
 static inline gboolean
 _is_write_head_less_than_max_size(QDisk *self)
 {
-  return self->hdr->write_head < self->options->disk_buf_size;
+  return self->write_head < self->options->disk_buf_size;
 }
 
 static inline gboolean
@@ -182,7 +218,7 @@ _is_able_to_reset_write_head_to_begining_of_qdisk(QDisk *self)
 static inline gboolean
 _is_free_space_between_write_head_and_backlog_head(QDisk *self, gint msg_len)
 {
-  return self->hdr->write_head + msg_len < self->hdr->backlog_head;
+  return self->write_head + msg_len < self->hdr->backlog_head;
 }
 
 
@@ -208,44 +244,240 @@ _truncate_file(QDisk *self, gint64 new_size)
       msg_error("Error truncating disk-queue file",
                 evt_tag_errno("error", errno),
                 evt_tag_str("filename", self->filename),
-                evt_tag_int("newsize",self->hdr->write_head),
+                evt_tag_int("newsize", new_size),
                 evt_tag_int("fd",self->fd));
     }
 
   return success;
 }
 
+static gboolean
+_sync_file(QDisk *self)
+{
+#ifdef SYSLOG_NG_HAVE_FDATASYNC
+  if (fdatasync(self->fd) < 0)
+#else
+  if (fsync(self->fd) < 0)
+#endif
+    {
+      msg_error("Error syncing disk-queue file",
+                evt_tag_str("filename", self->filename),
+                evt_tag_errno("error", errno));
+      return FALSE;
+    }
+  return TRUE;
+}
+
 gboolean
-qdisk_push_tail(QDisk *self, GString *record)
+qdisk_has_pending_writes(QDisk *self)
+{
+  return self->write_buffer->len > 0;
+}
+
+/*
+ * Writes the records collected by qdisk_push_tail() to the file, and
+ * (with fsync(yes)) syncs it, then advances the write head and the length
+ * in the header.  If the write fails, the records are kept and the write
+ * is retried on the next flush.
+ */
+gboolean
+qdisk_flush(QDisk *self)
+{
+  if (!qdisk_has_pending_writes(self))
+    return TRUE;
+
+  if (!pwrite_strict(self->fd, self->write_buffer->str, self->write_buffer->len, self->write_buffer_ofs))
+    {
+      msg_error("Error writing disk-queue file",
+                evt_tag_str("filename", self->filename),
+                evt_tag_errno("error", errno));
+      return FALSE;
+    }
+  if (self->options->fsync && !_sync_file(self))
+    return FALSE;
+
+  self->hdr->write_head = self->write_head;
+  self->hdr->length += self->write_buffer_records;
+
+  self->writes++;
+  self->written_records += self->write_buffer_records;
+  self->written_bytes += self->write_buffer->len;
+
+  g_string_truncate(self->write_buffer, 0);
+  self->write_buffer_records = 0;
+  return TRUE;
+}
+
+gint
+qdisk_get_average_write_records(QDisk *self)
+{
+  return self->writes ? self->written_records / self->writes : 0;
+}
+
+gint
+qdisk_get_average_write_size(QDisk *self)
+{
+  return self->writes ? self->written_bytes / self->writes : 0;
+}
+
+/* the size of the stored records in percent of their uncompressed size */
+gint
+qdisk_get_compression_ratio(QDisk *self)
+{
+  if (self->write_stats.bytes == 0)
+    return 100;
+  return self->write_stats.stored_bytes * 100 / self->write_stats.bytes;
+}
+
+const QDiskRecordStats *
+qdisk_get_write_stats(QDisk *self)
+{
+  return &self->write_stats;
+}
+
+const QDiskRecordStats *
+qdisk_get_read_stats(QDisk *self)
+{
+  return &self->read_stats;
+}
+
+static void
+_update_record_stats(QDiskRecordStats *stats, gsize record_len, gsize stored_len, gboolean compressed)
+{
+  stats->records++;
+  if (compressed)
+    stats->compressed_records++;
+  stats->bytes += record_len;
+  stats->stored_bytes += stored_len;
+}
+
+#if SYSLOG_NG_HAVE_ZLIB
+
+/* compresses record into compress_buffer, returns FALSE if the record
+ * should be stored as is, e.g. because it does not get any smaller */
+static gboolean
+_compress_record(QDisk *self, GString *record)
 {
   guint32 n = GUINT32_TO_BE(record->len);
+  uLongf compressed_len = compressBound(record->len);
+
+  g_string_set_size(self->compress_buffer, sizeof(n) + compressed_len);
+  memcpy(self->compress_buffer->str, &n, sizeof(n));
+  if (compress2((Bytef *) self->compress_buffer->str + sizeof(n), &compressed_len,
+                (const Bytef *) record->str, record->len, Z_BEST_SPEED) != Z_OK)
+    return FALSE;
+  g_string_truncate(self->compress_buffer, sizeof(n) + compressed_len);
+
+  return self->compress_buffer->len < record->len;
+}
+
+/* decompresses the record in compress_buffer into record */
+static gboolean
+_decompress_record(QDisk *self, GString *record)
+{
+  guint32 n;
+  uLongf record_len;
+
+  if (self->compress_buffer->len <= sizeof(n))
+    return FALSE;
+
+  memcpy(&n, self->compress_buffer->str, sizeof(n));
+  n = GUINT32_FROM_BE(n);
+  if (n == 0 || n > QDISK_MAX_RECORD_SIZE)
+    return FALSE;
+
+  g_string_set_size(record, n);
+  record_len = n;
+  if (uncompress((Bytef *) record->str, &record_len,
+                 (const Bytef *) self->compress_buffer->str + sizeof(n), self->compress_buffer->len - sizeof(n)) != Z_OK ||
+      record_len != n)
+    return FALSE;
+
+  return TRUE;
+}
+
+#else
+
+static gboolean
+_compress_record(QDisk *self, GString *record)
+{
+  return FALSE;
+}
+
+/* a queue file written by a build with zlib, we cannot read its compressed records */
+static gboolean
+_decompress_record(QDisk *self, GString *record)
+{
+  msg_error("Disk-queue file contains compressed records, but syslog-ng was compiled without zlib support",
+            evt_tag_str("filename", self->filename));
+  return FALSE;
+}
+
+#endif
+
+static gboolean
+_is_write_buffer_full(QDisk *self)
+{
+  return self->write_buffer_records >= self->options->write_batch_size ||
+         self->write_buffer->len >= QDISK_MAX_WRITE_BUFFER_SIZE;
+}
+
+gboolean
+qdisk_push_tail(QDisk *self, GString *record)
+{
+  GString *stored = record;
+  guint32 flags = 0;
+  guint32 n;
+
+  if (record->len == 0)
+    {
+      msg_error("Error writing empty message into the disk-queue file");
+      return FALSE;
+    }
+
+  if (self->options->compression && _compress_record(self, record))
+    {
+      stored = self->compress_buffer;
+      flags = QDISK_RECORD_COMPRESSED;
+    }
+  n = GUINT32_TO_BE(stored->len | flags);
 
   /* write follows read (e.g. we are appending to the file) OR
    * there's enough space between write and read.
    *
    * If write follows read we need to check two things:
-   *   - either we are below the maximum limit (GINT64_FROM_BE(self->hdr->write_head) < self->options->disk_buf_size)
+   *   - either we are below the maximum limit (self->write_head < self->options->disk_buf_size)
    *   - or we can wrap around (GINT64_FROM_BE(self->hdr->read_head) != QDISK_RESERVED_SPACE)
    * If neither of the above is true, the buffer is full.
    */
-  if (!qdisk_is_space_avail(self, record->len))
+  if (!qdisk_is_space_avail(self, stored->len))
     return FALSE;
 
-  if (n == 0)
-    {
-      msg_error("Error writing empty message into the disk-queue file");
-      return FALSE;
-    }
+  /* the write buffer covers a contiguous range of the file, flush it if
+   * the write head has wrapped around since the last record */
+  if (qdisk_has_pending_writes(self) &&
+      self->write_buffer_ofs + self->write_buffer->len != self->write_head &&
+      !qdisk_flush(self))
+    return FALSE;
+
+  if (!qdisk_has_pending_writes(self))
+    self->write_buffer_ofs = self->write_head;
 
-  if (!pwrite_strict(self->fd, (gchar *) &n, sizeof(n), self->hdr->write_head) ||
-      !pwrite_strict(self->fd, record->str, record->len, self->hdr->write_head + sizeof(n)))
+  g_string_append_len(self->write_buffer, (gchar *) &n, sizeof(n));
+  g_string_append_len(self->write_buffer, stored->str, stored->len);
+  self->write_buffer_records++;
+  self->write_head = self->write_head + stored->len + sizeof(n);
+
+  if (_is_write_buffer_full(self) && !qdisk_flush(self))
     {
-      msg_error("Error writing disk-queue file",
-                evt_tag_errno("error", errno));
+      /* drop the record we failed to write, earlier ones are kept for a retry */
+      g_string_truncate(self->write_buffer, self->write_buffer->len - stored->len - sizeof(n));
+      self->write_buffer_records--;
+      self->write_head = self->write_head - stored->len - sizeof(n);
       return FALSE;
     }
 
-  self->hdr->write_head = self->hdr->write_head + record->len + sizeof(n);
+  _update_record_stats(&self->write_stats, record->len + sizeof(n), stored->len + sizeof(n), flags != 0);
 
 
   /* NOTE: we only wrap around if the read head is before the write,
@@ -269,17 +501,17 @@ qdisk_push_tail(QDisk *self, GString *record)
    * */
 
   /* NOTE: if these were equal, that'd mean the queue is empty, so we spoiled something */
-  g_assert(self->hdr->write_head != self->hdr->backlog_head);
+  g_assert(self->write_head != self->hdr->backlog_head);
 
-  if (self->hdr->write_head > MAX(self->hdr->backlog_head,self->hdr->read_head))
+  if (self->write_head > MAX(self->hdr->backlog_head,self->hdr->read_head))
     {
-      if (self->file_size > self->hdr->write_head)
+      if (self->file_size > self->write_head)
         {
-          _truncate_file(self, self->hdr->write_head);
+          _truncate_file(self, self->write_head);
         }
-      self->file_size = self->hdr->write_head;
+      self->file_size = self->write_head;
 
-      if (self->hdr->write_head > self->options->disk_buf_size && self->hdr->backlog_head  != QDISK_RESERVED_SPACE)
+      if (self->write_head > self->options->disk_buf_size && self->hdr->backlog_head  != QDISK_RESERVED_SPACE)
         {
           /* we were appending to the file, we are over the limit, and space
            * is available before the read head. truncate and wrap.
@@ -287,18 +519,24 @@ qdisk_push_tail(QDisk *self, GString *record)
            * Otherwise we let the write_head over size limits for a bit and
            * for the next message, the condition at the beginning of this
            * function will cause the push to fail */
-          self->hdr->write_head = QDISK_RESERVED_SPACE;
+          self->write_head = QDISK_RESERVED_SPACE;
+          if (!qdisk_has_pending_writes(self))
+            self->hdr->write_head = self->write_head;
         }
     }
-  self->hdr->length++;
   return TRUE;
 }
 
 gboolean
 qdisk_pop_head(QDisk *self, GString *record)
 {
+  if (!qdisk_flush(self))
+    return FALSE;
+
   if (self->hdr->read_head != self->hdr->write_head)
     {
+      GString *stored = record;
+      gboolean compressed;
       guint32 n;
       gssize res;
       res = pread(self->fd, (gchar *) &n, sizeof(n), self->hdr->read_head);
@@ -318,7 +556,9 @@ qdisk_pop_head(QDisk *self, GString *record)
         }
 
       n = GUINT32_FROM_BE(n);
-      if (n > 10 * 1024 * 1024)
+      compressed = !!(n & QDISK_RECORD_COMPRESSED);
+      n &= ~QDISK_RECORD_COMPRESSED;
+      if (n > QDISK_MAX_RECORD_SIZE)
         {
           msg_warning("Disk-queue file contains possibly invalid record-length",
                       evt_tag_int("rec_length", n),
@@ -333,8 +573,11 @@ qdisk_pop_head(QDisk *self, GString *record)
           return FALSE;
         }
 
-      g_string_set_size(record, n);
-      res = pread(self->fd, record->str, n, self->hdr->read_head + sizeof(n));
+      if (compressed)
+        stored = self->compress_buffer;
+
+      g_string_set_size(stored, n);
+      res = pread(self->fd, stored->str, n, self->hdr->read_head + sizeof(n));
       if (res != n)
         {
           msg_error("Error reading disk-queue file",
@@ -344,7 +587,16 @@ qdisk_pop_head(QDisk *self, GString *record)
           return FALSE;
         }
 
-      self->hdr->read_head = self->hdr->read_head + record->len + sizeof(n);
+      if (compressed && !_decompress_record(self, record))
+        {
+          msg_error("Error decompressing record in disk-queue file",
+                    evt_tag_str("filename", self->filename),
+                    evt_tag_int("rec_length", n));
+          return FALSE;
+        }
+      _update_record_stats(&self->read_stats, record->len + sizeof(n), n + sizeof(n), compressed);
+
+      self->hdr->read_head = self->hdr->read_head + n + sizeof(n);
 
       if (self->hdr->read_head > self->hdr->write_head)
         {
@@ -363,6 +615,7 @@ qdisk_pop_head(QDisk *self, GString *record)
                     evt_tag_str("filename", self->filename));
           self->hdr->read_head = QDISK_RESERVED_SPACE;
           self->hdr->write_head = QDISK_RESERVED_SPACE;
+          self->write_head = self->hdr->write_head;
           if (!self->options->reliable)
             {
               self->hdr->backlog_head = self->hdr->read_head;
@@ -602,6 +855,9 @@ qdisk_save_state(QDisk *self, GQueue *qout, GQueue *qbacklog, GQueue *qoverflow)
   gint32 qoverflow_len = 0;
   gint32 qoverflow_count = 0;
 
+  if (!qdisk_flush(self))
+    return FALSE;
+
   if (!self->options->reliable)
     {
       qout_count = qout->length / 2;
@@ -802,6 +1058,7 @@ qdisk_start(QDisk *self, const gchar *filename, GQueue *qout, GQueue *qbacklog,
         }
 
     }
+  self->write_head = self->hdr->write_head;
   return TRUE;
 }
 
@@ -825,6 +1082,11 @@ qdisk_init(QDisk *self, DiskQueueOptions *options)
 void
 qdisk_deinit(QDisk *self)
 {
+  if (self->fd != -1)
+    qdisk_flush(self);
+  g_string_truncate(self->write_buffer, 0);
+  self->write_buffer_records = 0;
+
   if (self->filename)
     {
       g_free(self->filename);
@@ -853,6 +1115,9 @@ gssize
 qdisk_read_from_backlog(QDisk *self, gpointer buffer, gsize bytes_to_read)
 {
   gssize res;
+
+  if (!qdisk_flush(self))
+    return -1;
   res = pread(self->fd, buffer, bytes_to_read, self->hdr->backlog_head);
   if (res == 0)
     {
@@ -876,6 +1141,9 @@ gssize
 qdisk_read(QDisk *self, gpointer buffer, gsize bytes_to_read, gint64 position)
 {
   gssize res;
+
+  if (!qdisk_flush(self))
+    return -1;
   res = pread(self->fd, buffer, bytes_to_read, position);
   if (res <= 0)
     {
@@ -892,7 +1160,7 @@ qdisk_skip_record(QDisk *self, guint64 position)
   guint64 new_position = position;
   guint32 s;
   qdisk_read (self, (gchar *) &s, sizeof(s), position);
-  s = GUINT32_FROM_BE(s);
+  s = GUINT32_FROM_BE(s) & ~QDISK_RECORD_COMPRESSED;
   new_position += s + sizeof(s);
   if (new_position > self->hdr->write_head)
     {
@@ -910,25 +1178,27 @@ qdisk_set_backlog_count(QDisk *self, gint64 new_value)
 void
 qdisk_reset_file_if_possible(QDisk *self)
 {
-  if (self->hdr->length == 0 && self->hdr->backlog_len == 0)
+  if (self->hdr->length == 0 && self->hdr->backlog_len == 0 && !qdisk_has_pending_writes(self))
     {
       self->hdr->read_head = QDISK_RESERVED_SPACE;
       self->hdr->write_head = QDISK_RESERVED_SPACE;
+      self->write_head = self->hdr->write_head;
       self->hdr->backlog_head = QDISK_RESERVED_SPACE;
       _truncate_file (self, QDISK_RESERVED_SPACE);
     }
 }
 
+/* includes the records that are not written to the file yet */
 gint64
 qdisk_get_length(QDisk *self)
 {
-  return self->hdr->length;
+  return self->hdr->length + self->write_buffer_records;
 }
 
 void
 qdisk_set_length(QDisk *self, gint64 new_value)
 {
-  self->hdr->length = new_value;
+  self->hdr->length = new_value - self->write_buffer_records;
 }
 
 gint64
@@ -946,7 +1216,7 @@ qdisk_get_filename(QDisk *self)
 gint64
 qdisk_get_writer_head(QDisk *self)
 {
-  return self->hdr->write_head;
+  return self->write_head;
 }
 
 gint64
@@ -1006,6 +1276,8 @@ qdisk_is_read_only(QDisk *self)
 void
 qdisk_free(QDisk *self)
 {
+  g_string_free(self->write_buffer, TRUE);
+  g_string_free(self->compress_buffer, TRUE);
   g_free(self);
 }
 
@@ -1013,6 +1285,9 @@ QDisk *
 qdisk_new()
 {
   QDisk *self = g_new0(QDisk, 1);
+
+  self->write_buffer = g_string_sized_new(4096);
+  self->compress_buffer = g_string_sized_new(4096);
   return self;
 }
 
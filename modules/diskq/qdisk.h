@@ -38,11 +38,29 @@
 
 typedef struct _QDisk QDisk;
 
+/* counts the records pushed to or popped from a QDisk, bytes is the size
+ * the records would occupy in the file uncompressed, stored_bytes is the
+ * size they actually occupy */
+typedef struct _QDiskRecordStats
+{
+  guint64 records;
+  guint64 compressed_records;
+  guint64 bytes;
+  guint64 stored_bytes;
+} QDiskRecordStats;
+
 QDisk *qdisk_new();
 
 gboolean qdisk_is_space_avail(QDisk *self, gint at_least);
 gboolean qdisk_push_tail(QDisk *self, GString *record);
 gboolean qdisk_pop_head(QDisk *self, GString *record);
+gboolean qdisk_flush(QDisk *self);
+gboolean qdisk_has_pending_writes(QDisk *self);
+gint qdisk_get_average_write_records(QDisk *self);
+gint qdisk_get_average_write_size(QDisk *self);
+gint qdisk_get_compression_ratio(QDisk *self);
+const QDiskRecordStats *qdisk_get_write_stats(QDisk *self);
+const QDiskRecordStats *qdisk_get_read_stats(QDisk *self);
 gboolean qdisk_start(QDisk *self, const gchar *filename, GQueue *qout, GQueue *qbacklog, GQueue *qoverflow);
 void qdisk_init(QDisk *self, DiskQueueOptions *options);
 void qdisk_deinit(QDisk *self);
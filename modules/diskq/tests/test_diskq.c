@@ -25,6 +25,7 @@
 #include "logqueue-fifo.h"
 #include "logqueue-disk.h"
 #include "logqueue-disk-reliable.h"
+#include "logqueue-disk-non-reliable.h"
 #include "diskq.h"
 #include "logpipe.h"
 #include "apphook.h"
@@ -39,6 +40,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <iv.h>
 #include <iv_thread.h>
 
@@ -119,6 +121,58 @@ testcase_zero_diskbuf_alternating_send_acks()
   disk_queue_options_destroy(&options);
 }
 
+static void
+testcase_compressed_records()
+{
+  LogQueue *q;
+  LogQueueDisk *disk_queue;
+  LogMessage *msg;
+  gint i;
+  GString *filename;
+  DiskQueueOptions options = {0};
+
+  _construct_options(&options, 10000000, 0, FALSE);
+  options.compression = TRUE;
+
+  q = log_queue_disk_non_reliable_new(&options);
+  disk_queue = (LogQueueDisk *) q;
+
+  filename = g_string_sized_new(32);
+  g_string_sprintf(filename,"test-compressed.qf");
+  unlink(filename->str);
+  log_queue_disk_load_queue(q,filename->str);
+
+  fed_messages = 0;
+  feed_some_messages(q, 100, &parse_options);
+
+  assert_guint64(qdisk_get_write_stats(disk_queue->qdisk)->compressed_records, 100,
+                 "%s: records were not compressed", __FUNCTION__);
+  assert_true(qdisk_get_compression_ratio(disk_queue->qdisk) < 100,
+              "%s: compression did not save space, ratio=%d%%", __FUNCTION__,
+              qdisk_get_compression_ratio(disk_queue->qdisk));
+
+  for (i = 0; i < fed_messages; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      gchar expected_msg[64];
+
+      msg = log_queue_pop_head(q, &path_options);
+      assert_not_null(msg, "%s: message %d was not read back", __FUNCTION__, i);
+
+      g_snprintf(expected_msg, sizeof(expected_msg), "árvíztűrőtükörfúrógép ID :%08d", i);
+      assert_string(log_msg_get_value(msg, LM_V_MESSAGE, NULL), expected_msg,
+                    "%s: message %d was not decompressed properly", __FUNCTION__, i);
+      log_msg_unref(msg);
+    }
+  assert_guint64(qdisk_get_read_stats(disk_queue->qdisk)->compressed_records, 100,
+                 "%s: records were not read as compressed", __FUNCTION__);
+
+  log_queue_unref(q);
+  unlink(filename->str);
+  g_string_free(filename,TRUE);
+  disk_queue_options_destroy(&options);
+}
+
 static void
 testcase_ack_and_rewind_messages()
 {
@@ -156,6 +210,77 @@ testcase_ack_and_rewind_messages()
   disk_queue_options_destroy(&options);
 }
 
+static gint64
+_get_file_size(const gchar *filename)
+{
+  struct stat st;
+
+  assert_gint(stat(filename, &st), 0, "stat() failed on %s", filename);
+  return st.st_size;
+}
+
+static gpointer
+threaded_feed_in_one_batch(gpointer args)
+{
+  LogQueue *q = (LogQueue *) args;
+  const gchar *filename = qdisk_get_filename(((LogQueueDisk *) q)->qdisk);
+  gint64 initial_size = _get_file_size(filename);
+
+  main_loop_worker_thread_start(NULL);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  feed_some_messages(q, 10, &parse_options);
+
+  /* the batch is not over yet: nothing is written and nothing is acked */
+  assert_gint(log_queue_get_length(q), 10, "%s: pushed messages are not counted", __FUNCTION__);
+  assert_gint64(_get_file_size(filename), initial_size,
+                "%s: records were written before the end of the batch", __FUNCTION__);
+  assert_gint(acked_messages, 0, "%s: messages were acked before they were written", __FUNCTION__);
+
+  main_loop_worker_invoke_batch_callbacks();
+
+  assert_true(_get_file_size(filename) > initial_size, "%s: records were not written at the end of the batch",
+              __FUNCTION__);
+  assert_gint(acked_messages, 10, "%s: messages were not acked after they were written", __FUNCTION__);
+
+  main_loop_worker_thread_stop();
+  return NULL;
+}
+
+static void
+testcase_flush_at_the_end_of_worker_batch()
+{
+  LogQueue *q;
+  GThread *thread_feed;
+  GString *filename;
+  DiskQueueOptions options = {0};
+
+  _construct_options(&options, 10000000, 0, TRUE);
+  options.write_batch_size = 100;
+
+  log_queue_set_max_threads(1);
+  q = log_queue_disk_reliable_new(&options);
+  log_queue_set_use_backlog(q, TRUE);
+
+  filename = g_string_sized_new(32);
+  g_string_sprintf(filename,"test-worker_batch.qf");
+  unlink(filename->str);
+  log_queue_disk_load_queue(q,filename->str);
+
+  thread_feed = g_thread_create(threaded_feed_in_one_batch, q, TRUE, NULL);
+  g_thread_join(thread_feed);
+
+  send_some_messages(q, fed_messages);
+  app_ack_some_messages(q, fed_messages);
+  assert_gint(log_queue_get_length(q), 0, "%s: messages were not read back", __FUNCTION__);
+
+  log_queue_unref(q);
+  unlink(filename->str);
+  g_string_free(filename,TRUE);
+  disk_queue_options_destroy(&options);
+}
+
 #define FEEDERS 1
 #define MESSAGES_PER_FEEDER 10000
 #define MESSAGES_SUM (FEEDERS * MESSAGES_PER_FEEDER)
@@ -251,7 +376,7 @@ threaded_consume(gpointer st)
 
 
 static void
-testcase_with_threads()
+testcase_with_threads(gint write_batch_size)
 {
   LogQueue *q;
   GThread *thread_feed[FEEDERS], *thread_consume;
@@ -264,6 +389,7 @@ testcase_with_threads()
       DiskQueueOptions options = {0};
 
       _construct_options(&options, 10000000, 100000, TRUE);
+      options.write_batch_size = write_batch_size;
 
       q = log_queue_disk_reliable_new(&options);
       filename = g_string_sized_new(32);
@@ -290,7 +416,9 @@ testcase_with_threads()
       disk_queue_options_destroy(&options);
 
     }
-  fprintf(stderr, "Feed speed: %.2lf\n", (double) TEST_RUNS * MESSAGES_SUM * 1000000 / sum_time);
+  fprintf(stderr, "Feed speed (write_batch_size=%d): %.2lf\n", write_batch_size,
+          (double) TEST_RUNS * MESSAGES_SUM * 1000000 / sum_time);
+  sum_time = 0;
 }
 
 int
@@ -313,7 +441,12 @@ main()
   msg_format_options_init(&parse_options, configuration);
 
   testcase_ack_and_rewind_messages();
-  testcase_with_threads();
+#if SYSLOG_NG_HAVE_ZLIB
+  testcase_compressed_records();
+#endif
+  testcase_flush_at_the_end_of_worker_batch();
+  testcase_with_threads(1);
+  testcase_with_threads(64);
 
   testcase_zero_diskbuf_alternating_send_acks();
   testcase_zero_diskbuf_and_normal_acks();
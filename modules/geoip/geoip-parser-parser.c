@@ -34,6 +34,8 @@ static CfgLexerKeyword geoip_parser_keywords[] =
   { "geoip",          KW_GEOIP },
   { "database",       KW_DATABASE },
   { "prefix",         KW_PREFIX },
+  { "cache_size",     KW_CACHE_SIZE },
+  { "field",          KW_FIELD },
   { NULL }
 };
 
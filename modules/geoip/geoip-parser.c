@@ -23,25 +23,345 @@
 
 #include "geoip-parser.h"
 #include "parser/parser-expr.h"
-#include "scratch-buffers.h"
+#include "messages.h"
+#include "tls-support.h"
+#include "atomic.h"
 
 #include <GeoIPCity.h>
+#if SYSLOG_NG_HAVE_MAXMINDDB
+#include <maxminddb.h>
+#endif
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+/* the fields every database provides, the ones added by field() follow
+ * them */
+enum
+{
+  GEOIP_FIELD_COUNTRY_CODE,
+  GEOIP_FIELD_LATITUDE,
+  GEOIP_FIELD_LONGITUDE,
+  GEOIP_NUM_BUILTIN_FIELDS,
+};
+
+typedef struct _GeoIPField
+{
+  /* name of the value without the prefix */
+  gchar *name;
+  /* dot separated path of the value in a MaxMind DB record */
+  gchar *path;
+  gchar **lookup_path;
+  NVHandle handle;
+} GeoIPField;
+
+/* number of caches of a parser, each thread uses one of them, they are
+ * only shared if there are more threads than this, must be a power of 2 */
+#define GEOIP_CACHE_SLOTS 16
+
+typedef struct _GeoIPCacheKey
+{
+  gint family;
+  guint8 addr[16];
+} GeoIPCacheKey;
 
-typedef struct
+/* the values of the fields, as they are set in the message, NULL if the
+ * database has no value for a field */
+typedef struct _GeoIPCacheEntry
+{
+  GeoIPCacheKey key;
+  GList lru;
+  gchar *values[];
+} GeoIPCacheEntry;
+
+/* a bounded LRU cache of lookup results, keyed by the binary address */
+typedef struct _GeoIPCache
+{
+  GStaticMutex lock;
+  GHashTable *entries;
+  GQueue lru;
+} GeoIPCache;
+
+typedef struct _GeoIPParser GeoIPParser;
+
+struct _GeoIPParser
 {
   LogParser super;
   GeoIP *gi;
+#if SYSLOG_NG_HAVE_MAXMINDDB
+  MMDB_s mmdb;
+  gboolean mmdb_open;
+#endif
 
   gchar *database;
   gchar *prefix;
+  gint cache_size;
+
+  GArray *fields;
+  GeoIPCache caches[GEOIP_CACHE_SLOTS];
+  /* number of database lookups, the cache hits are not counted */
+  GAtomicCounter lookups;
+
+  void (*lookup)(GeoIPParser *self, const gchar *input, const GeoIPCacheKey *key, gchar **values);
+};
+
+TLS_BLOCK_START
+{
+  gint geoip_cache_slot;
+}
+TLS_BLOCK_END;
+
+#define geoip_cache_slot __tls_deref(geoip_cache_slot)
+
+static GAtomicCounter geoip_next_cache_slot;
+
+static gint
+_get_cache_slot(void)
+{
+  if (G_UNLIKELY(!geoip_cache_slot))
+    geoip_cache_slot = (g_atomic_counter_exchange_and_add(&geoip_next_cache_slot, 1) & (GEOIP_CACHE_SLOTS - 1)) + 1;
+  return geoip_cache_slot - 1;
+}
+
+static guint
+_cache_key_hash(gconstpointer k)
+{
+  const GeoIPCacheKey *key = (const GeoIPCacheKey *) k;
+  guint hash = key->family;
+  gint i;
+
+  for (i = 0; i < sizeof(key->addr); i++)
+    hash = (hash << 5) - hash + key->addr[i];
+  return hash;
+}
+
+static gboolean
+_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+  const GeoIPCacheKey *key_a = (const GeoIPCacheKey *) a;
+  const GeoIPCacheKey *key_b = (const GeoIPCacheKey *) b;
+
+  return key_a->family == key_b->family && memcmp(key_a->addr, key_b->addr, sizeof(key_a->addr)) == 0;
+}
+
+static gboolean
+_cache_key_parse(GeoIPCacheKey *key, const gchar *input)
+{
+  memset(key, 0, sizeof(*key));
+  if (inet_pton(AF_INET, input, key->addr) == 1)
+    {
+      key->family = AF_INET;
+      return TRUE;
+    }
+  if (inet_pton(AF_INET6, input, key->addr) == 1)
+    {
+      key->family = AF_INET6;
+      return TRUE;
+    }
+  return FALSE;
+}
+
+static void
+_lookup(GeoIPParser *self, const gchar *input, const GeoIPCacheKey *key, gchar **values)
+{
+  g_atomic_counter_inc(&self->lookups);
+  self->lookup(self, input, key, values);
+}
+
+static void
+_free_values(GeoIPParser *self, gchar **values)
+{
+  gint i;
+
+  for (i = 0; i < self->fields->len; i++)
+    g_free(values[i]);
+}
+
+static void
+_clear_caches(GeoIPParser *self)
+{
+  gint i;
+
+  for (i = 0; i < GEOIP_CACHE_SLOTS; i++)
+    {
+      GeoIPCache *cache = &self->caches[i];
+      GList *l;
+
+      if (!cache->entries)
+        continue;
+
+      while ((l = g_queue_pop_head_link(&cache->lru)))
+        {
+          GeoIPCacheEntry *entry = (GeoIPCacheEntry *) l->data;
+
+          _free_values(self, entry->values);
+          g_free(entry);
+        }
+      g_hash_table_destroy(cache->entries);
+      cache->entries = NULL;
+    }
+}
+
+/* NOTE: the cache lock must be held, the entry returned is only valid
+ * until it is released */
+static GeoIPCacheEntry *
+_cache_lookup(GeoIPParser *self, GeoIPCache *cache, const gchar *input, const GeoIPCacheKey *key)
+{
+  GeoIPCacheEntry *entry;
+
+  if (!cache->entries)
+    cache->entries = g_hash_table_new(_cache_key_hash, _cache_key_equal);
+
+  entry = g_hash_table_lookup(cache->entries, key);
+  if (entry)
+    {
+      g_queue_unlink(&cache->lru, &entry->lru);
+      g_queue_push_head_link(&cache->lru, &entry->lru);
+      return entry;
+    }
+
+  if (cache->lru.length >= self->cache_size)
+    {
+      GList *l = g_queue_pop_tail_link(&cache->lru);
+
+      entry = (GeoIPCacheEntry *) l->data;
+      g_hash_table_remove(cache->entries, &entry->key);
+      _free_values(self, entry->values);
+      memset(entry->values, 0, sizeof(gchar *) * self->fields->len);
+    }
+  else
+    {
+      entry = g_malloc0(sizeof(GeoIPCacheEntry) + sizeof(gchar *) * self->fields->len);
+      entry->lru.data = entry;
+    }
+
+  entry->key = *key;
+  _lookup(self, input, key, entry->values);
+  g_hash_table_insert(cache->entries, &entry->key, entry);
+  g_queue_push_head_link(&cache->lru, &entry->lru);
+  return entry;
+}
+
+static void
+_set_values(GeoIPParser *self, LogMessage *msg, gchar **values)
+{
+  gint i;
+
+  for (i = 0; i < self->fields->len; i++)
+    {
+      if (values[i])
+        log_msg_set_value(msg, g_array_index(self->fields, GeoIPField, i).handle, values[i], -1);
+    }
+}
+
+static void
+_lookup_geoip(GeoIPParser *self, const gchar *input, const GeoIPCacheKey *key, gchar **values)
+{
+  GeoIPRecord *record;
+
+  record = GeoIP_record_by_name(self->gi, input);
+  if (!record)
+    {
+      const char *country;
+
+      country = GeoIP_country_code_by_name(self->gi, input);
+      if (country)
+        values[GEOIP_FIELD_COUNTRY_CODE] = g_strdup(country);
+      return;
+    }
+
+  if (record->country_code)
+    values[GEOIP_FIELD_COUNTRY_CODE] = g_strdup(record->country_code);
+  values[GEOIP_FIELD_LATITUDE] = g_strdup_printf("%f", record->latitude);
+  values[GEOIP_FIELD_LONGITUDE] = g_strdup_printf("%f", record->longitude);
+
+  GeoIPRecord_delete(record);
+}
+
+#if SYSLOG_NG_HAVE_MAXMINDDB
+
+static gchar *
+_format_mmdb_entry_data(MMDB_entry_data_s *entry_data)
+{
+  switch (entry_data->type)
+    {
+      case MMDB_DATA_TYPE_UTF8_STRING:
+        return g_strndup(entry_data->utf8_string, entry_data->data_size);
+      case MMDB_DATA_TYPE_DOUBLE:
+        return g_strdup_printf("%f", entry_data->double_value);
+      case MMDB_DATA_TYPE_FLOAT:
+        return g_strdup_printf("%f", entry_data->float_value);
+      case MMDB_DATA_TYPE_UINT16:
+        return g_strdup_printf("%u", entry_data->uint16);
+      case MMDB_DATA_TYPE_UINT32:
+        return g_strdup_printf("%u", entry_data->uint32);
+      case MMDB_DATA_TYPE_INT32:
+        return g_strdup_printf("%d", entry_data->int32);
+      case MMDB_DATA_TYPE_UINT64:
+        return g_strdup_printf("%" G_GUINT64_FORMAT, (guint64) entry_data->uint64);
+      case MMDB_DATA_TYPE_BOOLEAN:
+        return g_strdup(entry_data->boolean ? "true" : "false");
+      default:
+        /* maps, arrays and binary data have no textual form */
+        return NULL;
+    }
+}
+
+static void
+_lookup_mmdb(GeoIPParser *self, const gchar *input, const GeoIPCacheKey *key, gchar **values)
+{
+  MMDB_lookup_result_s result;
+  int mmdb_error;
+  gint i;
+
+  if (key)
+    {
+      struct sockaddr_storage ss;
+
+      memset(&ss, 0, sizeof(ss));
+      if (key->family == AF_INET)
+        {
+          struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
+
+          sin->sin_family = AF_INET;
+          memcpy(&sin->sin_addr, key->addr, sizeof(sin->sin_addr));
+        }
+      else
+        {
+          struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &ss;
+
+          sin6->sin6_family = AF_INET6;
+          memcpy(&sin6->sin6_addr, key->addr, sizeof(sin6->sin6_addr));
+        }
+      result = MMDB_lookup_sockaddr(&self->mmdb, (struct sockaddr *) &ss, &mmdb_error);
+    }
+  else
+    {
+      int gai_error;
+
+      result = MMDB_lookup_string(&self->mmdb, input, &gai_error, &mmdb_error);
+      if (gai_error != 0)
+        return;
+    }
+
+  if (mmdb_error != MMDB_SUCCESS || !result.found_entry)
+    return;
+
+  for (i = 0; i < self->fields->len; i++)
+    {
+      GeoIPField *field = &g_array_index(self->fields, GeoIPField, i);
+      MMDB_entry_data_s entry_data;
+
+      if (MMDB_aget_value(&result.entry, &entry_data, (const char *const *) field->lookup_path) != MMDB_SUCCESS ||
+          !entry_data.has_data)
+        continue;
 
-  struct
-  {
-    gchar *country_code;
-    gchar *longitude;
-    gchar *latitude;
-  } dest;
-} GeoIPParser;
+      values[i] = _format_mmdb_entry_data(&entry_data);
+    }
+}
+
+#endif
 
 void
 geoip_parser_set_prefix(LogParser *s, const gchar *prefix)
@@ -55,14 +375,17 @@ geoip_parser_set_prefix(LogParser *s, const gchar *prefix)
 static void
 geoip_parser_reset_fields(GeoIPParser *self)
 {
-  g_free(self->dest.country_code);
-  self->dest.country_code = g_strdup_printf("%scountry_code", self->prefix);
+  GString *name = g_string_sized_new(32);
+  gint i;
 
-  g_free(self->dest.longitude);
-  self->dest.longitude = g_strdup_printf("%slongitude", self->prefix);
+  for (i = 0; i < self->fields->len; i++)
+    {
+      GeoIPField *field = &g_array_index(self->fields, GeoIPField, i);
 
-  g_free(self->dest.latitude);
-  self->dest.latitude = g_strdup_printf("%slatitude", self->prefix);
+      g_string_printf(name, "%s%s", self->prefix, field->name);
+      field->handle = log_msg_get_value_handle(name->str);
+    }
+  g_string_free(name, TRUE);
 }
 
 void
@@ -74,57 +397,71 @@ geoip_parser_set_database(LogParser *s, const gchar *database)
   self->database = g_strdup(database);
 }
 
-static gboolean
-geoip_parser_process(LogParser *s, LogMessage **pmsg,
-                     const LogPathOptions *path_options,
-                     const gchar *input, gsize input_len)
+void
+geoip_parser_set_cache_size(LogParser *s, gint cache_size)
 {
   GeoIPParser *self = (GeoIPParser *) s;
-  LogMessage *msg = log_msg_make_writable(pmsg, path_options);
-  GeoIPRecord *record;
-  SBGString *value;
 
-  if (!self->dest.country_code &&
-      !self->dest.latitude &&
-      !self->dest.longitude)
-    return TRUE;
+  self->cache_size = cache_size;
+}
 
-  record = GeoIP_record_by_name(self->gi, input);
+gint
+geoip_parser_get_num_lookups(LogParser *s)
+{
+  GeoIPParser *self = (GeoIPParser *) s;
 
-  if (!record)
-    {
-      const char *country;
+  return g_atomic_counter_get(&self->lookups);
+}
 
-      country = GeoIP_country_code_by_name(self->gi, input);
-      if (country)
-        log_msg_set_value_by_name(msg, self->dest.country_code,
-                                  country,
-                                  strlen(country));
+void
+geoip_parser_add_field(LogParser *s, const gchar *name, const gchar *path)
+{
+  GeoIPParser *self = (GeoIPParser *) s;
+  GeoIPField field;
 
-      return TRUE;
-    }
+  field.name = g_strdup(name);
+  field.path = g_strdup(path);
+  field.lookup_path = path ? g_strsplit(path, ".", -1) : NULL;
+  field.handle = 0;
+  g_array_append_val(self->fields, field);
+}
 
-  if (record->country_code)
-    log_msg_set_value_by_name(msg, self->dest.country_code,
-                              record->country_code,
-                              strlen(record->country_code));
+static gboolean
+_is_mmdb_database(GeoIPParser *self)
+{
+  return self->database && g_str_has_suffix(self->database, ".mmdb");
+}
 
-  value = sb_gstring_acquire();
+static gboolean
+geoip_parser_process(LogParser *s, LogMessage **pmsg,
+                     const LogPathOptions *path_options,
+                     const gchar *input, gsize input_len)
+{
+  GeoIPParser *self = (GeoIPParser *) s;
+  LogMessage *msg = log_msg_make_writable(pmsg, path_options);
+  GeoIPCacheKey key;
+  gboolean have_key;
 
-  g_string_printf(sb_gstring_string(value), "%f",
-                  record->latitude);
-  log_msg_set_value_by_name(msg, self->dest.latitude,
-                            sb_gstring_string(value)->str,
-                            sb_gstring_string(value)->len);
+  have_key = _cache_key_parse(&key, input);
+  if (have_key && self->cache_size > 0)
+    {
+      GeoIPCache *cache = &self->caches[_get_cache_slot()];
+      GeoIPCacheEntry *entry;
 
-  g_string_printf(sb_gstring_string(value), "%f",
-                  record->longitude);
-  log_msg_set_value_by_name(msg, self->dest.longitude,
-                            sb_gstring_string(value)->str,
-                            sb_gstring_string(value)->len);
+      g_static_mutex_lock(&cache->lock);
+      entry = _cache_lookup(self, cache, input, &key);
+      _set_values(self, msg, entry->values);
+      g_static_mutex_unlock(&cache->lock);
+    }
+  else
+    {
+      gchar **values = g_newa(gchar *, self->fields->len);
 
-  GeoIPRecord_delete(record);
-  sb_gstring_release(value);
+      memset(values, 0, sizeof(gchar *) * self->fields->len);
+      _lookup(self, input, have_key ? &key : NULL, values);
+      _set_values(self, msg, values);
+      _free_values(self, values);
+    }
 
   return TRUE;
 }
@@ -134,39 +471,98 @@ geoip_parser_clone(LogPipe *s)
 {
   GeoIPParser *self = (GeoIPParser *) s;
   GeoIPParser *cloned;
+  gint i;
 
   cloned = (GeoIPParser *) geoip_parser_new(s->cfg);
 
   geoip_parser_set_database(&cloned->super, self->database);
   geoip_parser_set_prefix(&cloned->super, self->prefix);
+  geoip_parser_set_cache_size(&cloned->super, self->cache_size);
+  for (i = GEOIP_NUM_BUILTIN_FIELDS; i < self->fields->len; i++)
+    {
+      GeoIPField *field = &g_array_index(self->fields, GeoIPField, i);
+
+      geoip_parser_add_field(&cloned->super, field->name, field->path);
+    }
   log_parser_set_template(&cloned->super, log_template_ref(self->super.template));
   geoip_parser_reset_fields(cloned);
 
   return &cloned->super.super;
 }
 
+static void
+geoip_parser_close_database(GeoIPParser *self)
+{
+  if (self->gi)
+    GeoIP_delete(self->gi);
+  self->gi = NULL;
+#if SYSLOG_NG_HAVE_MAXMINDDB
+  if (self->mmdb_open)
+    MMDB_close(&self->mmdb);
+  self->mmdb_open = FALSE;
+#endif
+}
+
 static void
 geoip_parser_free(LogPipe *s)
 {
   GeoIPParser *self = (GeoIPParser *) s;
+  gint i;
+
+  _clear_caches(self);
+  for (i = 0; i < GEOIP_CACHE_SLOTS; i++)
+    g_static_mutex_free(&self->caches[i].lock);
 
-  g_free(self->dest.country_code);
-  g_free(self->dest.latitude);
-  g_free(self->dest.longitude);
+  for (i = 0; i < self->fields->len; i++)
+    {
+      GeoIPField *field = &g_array_index(self->fields, GeoIPField, i);
+
+      g_free(field->name);
+      g_free(field->path);
+      g_strfreev(field->lookup_path);
+    }
+  g_array_free(self->fields, TRUE);
   g_free(self->database);
   g_free(self->prefix);
 
-  GeoIP_delete(self->gi);
+  geoip_parser_close_database(self);
 
   log_parser_free_method(s);
 }
 
 static gboolean
-geoip_parser_init(LogPipe *s)
+geoip_parser_open_mmdb(GeoIPParser *self)
 {
-  GeoIPParser *self = (GeoIPParser *) s;
+#if SYSLOG_NG_HAVE_MAXMINDDB
+  gint status;
 
-  geoip_parser_reset_fields(self);
+  status = MMDB_open(self->database, MMDB_MODE_MMAP, &self->mmdb);
+  if (status != MMDB_SUCCESS)
+    {
+      msg_error("geoip: error opening MaxMind DB database",
+                evt_tag_str("database", self->database),
+                evt_tag_str("error", MMDB_strerror(status)));
+      return FALSE;
+    }
+  self->mmdb_open = TRUE;
+  self->lookup = _lookup_mmdb;
+  return TRUE;
+#else
+  msg_error("geoip: MaxMind DB databases are not supported, syslog-ng was compiled without libmaxminddb",
+            evt_tag_str("database", self->database));
+  return FALSE;
+#endif
+}
+
+static gboolean
+geoip_parser_open_geoip(GeoIPParser *self)
+{
+  if (self->fields->len > GEOIP_NUM_BUILTIN_FIELDS)
+    {
+      msg_error("geoip: field() is only supported with MaxMind DB (.mmdb) databases",
+                evt_tag_str("database", self->database ? : "default"));
+      return FALSE;
+    }
 
   if (self->database)
     self->gi = GeoIP_open(self->database, GEOIP_MMAP_CACHE);
@@ -175,6 +571,29 @@ geoip_parser_init(LogPipe *s)
 
   if (!self->gi)
     return FALSE;
+  self->lookup = _lookup_geoip;
+  return TRUE;
+}
+
+static gboolean
+geoip_parser_init(LogPipe *s)
+{
+  GeoIPParser *self = (GeoIPParser *) s;
+
+  geoip_parser_reset_fields(self);
+
+  /* the database may have changed since the last init */
+  geoip_parser_close_database(self);
+  _clear_caches(self);
+
+  if (_is_mmdb_database(self))
+    {
+      if (!geoip_parser_open_mmdb(self))
+        return FALSE;
+    }
+  else if (!geoip_parser_open_geoip(self))
+    return FALSE;
+
   return log_parser_init_method(s);
 }
 
@@ -182,6 +601,7 @@ LogParser *
 geoip_parser_new(GlobalConfig *cfg)
 {
   GeoIPParser *self = g_new0(GeoIPParser, 1);
+  gint i;
 
   log_parser_init_instance(&self->super, cfg);
   self->super.super.init = geoip_parser_init;
@@ -189,6 +609,18 @@ geoip_parser_new(GlobalConfig *cfg)
   self->super.super.clone = geoip_parser_clone;
   self->super.process = geoip_parser_process;
 
+  for (i = 0; i < GEOIP_CACHE_SLOTS; i++)
+    {
+      g_static_mutex_init(&self->caches[i].lock);
+      g_queue_init(&self->caches[i].lru);
+    }
+  self->cache_size = 4096;
+
+  self->fields = g_array_new(FALSE, TRUE, sizeof(GeoIPField));
+  geoip_parser_add_field(&self->super, "country_code", "country.iso_code");
+  geoip_parser_add_field(&self->super, "latitude", "location.latitude");
+  geoip_parser_add_field(&self->super, "longitude", "location.longitude");
+
   geoip_parser_set_prefix(&self->super, ".geoip.");
 
   return &self->super;
@@ -29,5 +29,8 @@
 LogParser *geoip_parser_new(GlobalConfig *cfg);
 void geoip_parser_set_database(LogParser *s, const gchar *database);
 void geoip_parser_set_prefix(LogParser *s, const gchar *prefix);
+void geoip_parser_set_cache_size(LogParser *s, gint cache_size);
+void geoip_parser_add_field(LogParser *s, const gchar *name, const gchar *path);
+gint geoip_parser_get_num_lookups(LogParser *s);
 
 #endif
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+#############################################################################
+# Copyright (c) 2017 Balabit
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#
+# As an additional exemption you are allowed to compile & link against the
+# OpenSSL libraries as published by the OpenSSL project. See the file
+# COPYING for details.
+#
+#############################################################################
+#
+# Generates test-city.mmdb, the MaxMind DB fixture of test_geoip_parser.
+# The records follow the layout of the GeoIP2 City databases (and the
+# addresses of the MaxMind test databases), a "test" map holds a value of
+# each scalar type.
+#
+# Usage: gen-test-mmdb.py test-city.mmdb
+#
+
+import struct
+import sys
+
+TYPE_POINTER, TYPE_STRING, TYPE_DOUBLE, TYPE_BYTES, TYPE_UINT16, TYPE_UINT32, TYPE_MAP = range(1, 8)
+TYPE_INT32, TYPE_UINT64, TYPE_UINT128, TYPE_ARRAY, TYPE_CONTAINER, TYPE_END, TYPE_BOOLEAN, TYPE_FLOAT = range(8, 16)
+
+
+class Float(float):
+    pass
+
+
+class Double(float):
+    pass
+
+
+class UInt16(int):
+    pass
+
+
+class UInt32(int):
+    pass
+
+
+class UInt64(int):
+    pass
+
+
+class Int32(int):
+    pass
+
+
+def encode_control(data_type, size):
+    if size < 29:
+        size_bits, extra = size, b''
+    elif size < 29 + 256:
+        size_bits, extra = 29, struct.pack('>B', size - 29)
+    elif size < 285 + 65536:
+        size_bits, extra = 30, struct.pack('>H', size - 285)
+    else:
+        size_bits, extra = 31, struct.pack('>I', size - 65821)[1:]
+
+    if data_type <= TYPE_MAP:
+        return struct.pack('>B', (data_type << 5) | size_bits) + extra
+    return struct.pack('>BB', size_bits, data_type - 7) + extra
+
+
+def encode_uint(data_type, value):
+    payload = b''
+    while value:
+        payload = struct.pack('>B', value & 0xff) + payload
+        value >>= 8
+    return encode_control(data_type, len(payload)) + payload
+
+
+def encode(value):
+    if isinstance(value, bool):
+        return encode_control(TYPE_BOOLEAN, int(value))
+    if isinstance(value, dict):
+        return encode_control(TYPE_MAP, len(value)) + \
+            b''.join(encode(k) + encode(value[k]) for k in sorted(value))
+    if isinstance(value, list):
+        return encode_control(TYPE_ARRAY, len(value)) + b''.join(encode(v) for v in value)
+    if isinstance(value, Float):
+        return encode_control(TYPE_FLOAT, 4) + struct.pack('>f', value)
+    if isinstance(value, Double):
+        return encode_control(TYPE_DOUBLE, 8) + struct.pack('>d', value)
+    if isinstance(value, Int32):
+        return encode_control(TYPE_INT32, 4) + struct.pack('>i', value)
+    if isinstance(value, UInt16):
+        return encode_uint(TYPE_UINT16, value)
+    if isinstance(value, UInt32):
+        return encode_uint(TYPE_UINT32, value)
+    if isinstance(value, UInt64):
+        return encode_uint(TYPE_UINT64, value)
+    if isinstance(value, bytes):
+        return encode_control(TYPE_BYTES, len(value)) + value
+    data = value.encode('utf-8')
+    return encode_control(TYPE_STRING, len(data)) + data
+
+
+def city(country_code, country_name, city_name, latitude, longitude, subdivision=None):
+    record = {
+        'city': {'names': {'en': city_name}},
+        'country': {'iso_code': country_code, 'names': {'en': country_name}},
+        'location': {
+            'latitude': Double(latitude),
+            'longitude': Double(longitude),
+            'accuracy_radius': UInt16(100),
+        },
+    }
+    if subdivision:
+        record['subdivisions'] = [{'iso_code': subdivision}]
+    return record
+
+
+NETWORKS = [
+    ('81.2.69.0', 24, dict(city('GB', 'United Kingdom', 'London', 51.5142, -0.0931),
+                           test={
+                               'uint16': UInt16(100),
+                               'uint32': UInt32(268435456),
+                               'uint64': UInt64(1152921504606846976),
+                               'int32': Int32(-268435456),
+                               'float': Float(1.5),
+                               'double': Double(42.123456),
+                               'boolean': True,
+                               'bytes': b'\x00\x00\x00\x2a',
+                               'array': [UInt32(1), UInt32(2), UInt32(3)],
+                               'map': {'key': 'value'},
+                           })),
+    ('2.125.160.0', 24, city('GB', 'United Kingdom', 'Boxford', 51.75, -1.25)),
+    ('216.160.83.0', 24, city('US', 'United States', 'Milton', 47.2513, -122.3149, subdivision='WA')),
+]
+
+METADATA = {
+    'binary_format_major_version': UInt16(2),
+    'binary_format_minor_version': UInt16(0),
+    'build_epoch': UInt64(1483228800),
+    'database_type': 'syslog-ng-Test-City',
+    'description': {'en': 'syslog-ng geoip-parser test database'},
+    'ip_version': UInt16(4),
+    'languages': ['en'],
+    'record_size': UInt16(24),
+}
+
+
+def build_tree(networks):
+    # each node is a [left, right] pair, an int is a node index, a tuple
+    # holds the index of a record in the data section, None is empty
+    nodes = [[None, None]]
+
+    for index, (address, prefix_len, _) in enumerate(networks):
+        bits = struct.unpack('>I', struct.pack('>BBBB', *[int(x) for x in address.split('.')]))[0]
+        node = 0
+        for depth in range(prefix_len):
+            bit = (bits >> (31 - depth)) & 1
+            if depth == prefix_len - 1:
+                nodes[node][bit] = (index,)
+            else:
+                if nodes[node][bit] is None:
+                    nodes.append([None, None])
+                    nodes[node][bit] = len(nodes) - 1
+                node = nodes[node][bit]
+    return nodes
+
+
+def main():
+    data_section = b''
+    data_offsets = []
+    for _, _, record in NETWORKS:
+        data_offsets.append(len(data_section))
+        data_section += encode(record)
+
+    nodes = build_tree(NETWORKS)
+    node_count = len(nodes)
+
+    def record_value(record):
+        if record is None:
+            return node_count
+        if isinstance(record, tuple):
+            return node_count + 16 + data_offsets[record[0]]
+        return record
+
+    tree = b''
+    for left, right in nodes:
+        tree += struct.pack('>I', record_value(left))[1:] + struct.pack('>I', record_value(right))[1:]
+
+    metadata = dict(METADATA, node_count=UInt32(node_count))
+
+    with open(sys.argv[1], 'wb') as f:
+        f.write(tree)
+        f.write(b'\x00' * 16)
+        f.write(data_section)
+        f.write(b'\xab\xcd\xefMaxMind.com')
+        f.write(encode(metadata))
+
+
+if __name__ == '__main__':
+    main()
@@ -21,7 +21,12 @@
 #include "testutils.h"
 #include "geoip-parser.h"
 #include "apphook.h"
+#include "plugin.h"
+#include "cfg-grammar.h"
 #include "msg_parse_lib.h"
+#include "config_parse_lib.h"
+
+#include <stdlib.h>
 
 #define geoip_parser_testcase_begin(func, args)             \
   do                                                            \
@@ -48,6 +53,7 @@
   } while(0)
 
 LogParser *geoip_parser;
+gchar *mmdb_database;
 
 static LogMessage *
 parse_geoip_into_log_message_no_check(const gchar *input)
@@ -111,19 +117,282 @@ test_geoip_parser_uses_template_to_parse_input(void)
   log_msg_unref(msg);
 }
 
+static LogMessage *
+parse_geoip_with_parser(LogParser *parser, const gchar *input)
+{
+  LogMessage *msg;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+  msg = log_msg_new_empty();
+  log_msg_set_value(msg, LM_V_MESSAGE, input, -1);
+  assert_true(log_parser_process_message(parser, &msg, &path_options),
+              "expected geoip-parser success and it returned failure, input=%s", input);
+  return msg;
+}
+
+static void
+_assert_lookup(LogParser *parser, const gchar *input, const gchar *expected_country_code, gint expected_lookups)
+{
+  LogMessage *msg;
+
+  msg = parse_geoip_with_parser(parser, input);
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.country_code"), expected_country_code);
+  assert_gint(geoip_parser_get_num_lookups(parser), expected_lookups,
+              "unexpected number of database lookups after looking up %s", input);
+  log_msg_unref(msg);
+}
+
+static void
+test_geoip_parser_caches_lookups(void)
+{
+  LogParser *cloned_parser;
+
+  /* a single entry per slot, so alternating addresses keep evicting each other */
+  geoip_parser_set_cache_size(geoip_parser, 1);
+  cloned_parser = (LogParser *) log_pipe_clone(&geoip_parser->super);
+  log_pipe_init(&cloned_parser->super);
+
+  _assert_lookup(cloned_parser, "217.20.130.99", "HU", 1);
+  _assert_lookup(cloned_parser, "217.20.130.99", "HU", 1);
+  _assert_lookup(cloned_parser, "127.0.0.1", NULL, 2);
+  _assert_lookup(cloned_parser, "127.0.0.1", NULL, 2);
+  _assert_lookup(cloned_parser, "217.20.130.99", "HU", 3);
+
+  /* host names are not cached */
+  _assert_lookup(cloned_parser, "localhost", NULL, 4);
+  _assert_lookup(cloned_parser, "localhost", NULL, 5);
+
+  log_pipe_deinit(&cloned_parser->super);
+  log_pipe_unref(&cloned_parser->super);
+}
+
+static void
+test_geoip_parser_cache_can_be_disabled(void)
+{
+  LogParser *cloned_parser;
+
+  geoip_parser_set_cache_size(geoip_parser, 0);
+  cloned_parser = (LogParser *) log_pipe_clone(&geoip_parser->super);
+  log_pipe_init(&cloned_parser->super);
+
+  _assert_lookup(cloned_parser, "217.20.130.99", "HU", 1);
+  _assert_lookup(cloned_parser, "217.20.130.99", "HU", 2);
+
+  log_pipe_deinit(&cloned_parser->super);
+  log_pipe_unref(&cloned_parser->super);
+}
+
+static void
+test_geoip_parser_field_requires_an_mmdb_database(void)
+{
+  geoip_parser_add_field(geoip_parser, "city", "city.names.en");
+  assert_false(log_pipe_init(&geoip_parser->super),
+               "field() should be rejected with a legacy GeoIP database");
+}
+
+#if SYSLOG_NG_HAVE_MAXMINDDB
+
+static void
+test_geoip_parser_mmdb_basics(void)
+{
+  LogMessage *msg;
+
+  geoip_parser_set_database(geoip_parser, mmdb_database);
+
+  msg = parse_geoip_into_log_message("81.2.69.142");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.country_code"), "GB");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.latitude"), "51.514200");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.longitude"), "-0.093100");
+  log_msg_unref(msg);
+
+  msg = parse_geoip_into_log_message("2.125.160.216");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.country_code"), "GB");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.latitude"), "51.750000");
+  log_msg_unref(msg);
+
+  msg = parse_geoip_into_log_message("127.0.0.1");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.country_code"), NULL);
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.latitude"), NULL);
+  log_msg_unref(msg);
+
+  /* not cached, looked up by MMDB_lookup_string(), which only accepts numeric addresses */
+  msg = parse_geoip_into_log_message("localhost");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.country_code"), NULL);
+  log_msg_unref(msg);
+}
+
+static void
+test_geoip_parser_mmdb_fields(void)
+{
+  LogMessage *msg;
+
+  geoip_parser_set_database(geoip_parser, mmdb_database);
+  geoip_parser_add_field(geoip_parser, "city", "city.names.en");
+  geoip_parser_add_field(geoip_parser, "subdivision", "subdivisions.0.iso_code");
+  geoip_parser_add_field(geoip_parser, "no_such_value", "city.names.xx");
+
+  msg = parse_geoip_into_log_message("216.160.83.56");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.country_code"), "US");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.city"), "Milton");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.subdivision"), "WA");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.no_such_value"), NULL);
+  log_msg_unref(msg);
+
+  msg = parse_geoip_into_log_message("81.2.69.142");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.city"), "London");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.subdivision"), NULL);
+  log_msg_unref(msg);
+}
+
+static void
+test_geoip_parser_mmdb_formats_data_types(void)
+{
+  LogMessage *msg;
+
+  geoip_parser_set_database(geoip_parser, mmdb_database);
+  geoip_parser_set_prefix(geoip_parser, ".test.");
+  geoip_parser_add_field(geoip_parser, "uint16", "test.uint16");
+  geoip_parser_add_field(geoip_parser, "uint32", "test.uint32");
+  geoip_parser_add_field(geoip_parser, "uint64", "test.uint64");
+  geoip_parser_add_field(geoip_parser, "int32", "test.int32");
+  geoip_parser_add_field(geoip_parser, "float", "test.float");
+  geoip_parser_add_field(geoip_parser, "double", "test.double");
+  geoip_parser_add_field(geoip_parser, "boolean", "test.boolean");
+  geoip_parser_add_field(geoip_parser, "bytes", "test.bytes");
+  geoip_parser_add_field(geoip_parser, "array", "test.array");
+  geoip_parser_add_field(geoip_parser, "array_item", "test.array.1");
+  geoip_parser_add_field(geoip_parser, "map", "test.map");
+  geoip_parser_add_field(geoip_parser, "map_item", "test.map.key");
+
+  msg = parse_geoip_into_log_message("81.2.69.142");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.uint16"), "100");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.uint32"), "268435456");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.uint64"), "1152921504606846976");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.int32"), "-268435456");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.float"), "1.500000");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.double"), "42.123456");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.boolean"), "true");
+  /* values without a textual form are not set */
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.bytes"), NULL);
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.array"), NULL);
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.map"), NULL);
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.array_item"), "2");
+  assert_log_message_value(msg, log_msg_get_value_handle(".test.map_item"), "value");
+  log_msg_unref(msg);
+}
+
+static void
+test_geoip_parser_mmdb_caches_lookups(void)
+{
+  LogParser *cloned_parser;
+  LogMessage *msg;
+
+  geoip_parser_set_database(geoip_parser, mmdb_database);
+  geoip_parser_add_field(geoip_parser, "city", "city.names.en");
+  cloned_parser = (LogParser *) log_pipe_clone(&geoip_parser->super);
+  log_pipe_init(&cloned_parser->super);
+
+  _assert_lookup(cloned_parser, "81.2.69.142", "GB", 1);
+  _assert_lookup(cloned_parser, "2.125.160.216", "GB", 2);
+
+  /* every field of the entry is cached, not just the builtin ones */
+  msg = parse_geoip_with_parser(cloned_parser, "81.2.69.142");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.city"), "London");
+  assert_gint(geoip_parser_get_num_lookups(cloned_parser), 2, "the second lookup should be a cache hit");
+  log_msg_unref(msg);
+
+  log_pipe_deinit(&cloned_parser->super);
+  log_pipe_unref(&cloned_parser->super);
+}
+
+#endif
+
+static LogParser *
+_parse_geoip_config(const gchar *config)
+{
+  LogParser *parser = NULL;
+
+  if (!parse_config(config, LL_CONTEXT_PARSER, NULL, (gpointer *) &parser))
+    return NULL;
+  return parser;
+}
+
+static void
+test_geoip_parser_grammar(void)
+{
+  LogParser *parser;
+#if SYSLOG_NG_HAVE_MAXMINDDB
+  LogMessage *msg;
+#endif
+
+  testcase_begin("%s", __FUNCTION__);
+
+  parser = _parse_geoip_config("geoip(\"${MESSAGE}\" cache-size(0))");
+  assert_not_null(parser, "cache-size(0) should be accepted");
+  assert_true(log_pipe_init(&parser->super), "geoip() failed to initialize");
+  _assert_lookup(parser, "217.20.130.99", "HU", 1);
+  _assert_lookup(parser, "217.20.130.99", "HU", 2);
+  log_pipe_deinit(&parser->super);
+  log_pipe_unref(&parser->super);
+
+  parser = _parse_geoip_config("geoip(\"${MESSAGE}\" cache-size(-1))");
+  assert_null(parser, "a negative cache-size() should be rejected");
+
+  parser = _parse_geoip_config("geoip(\"${MESSAGE}\" field(\"city\" \"city.names.en\"))");
+  assert_not_null(parser, "field() should be accepted");
+  assert_false(log_pipe_init(&parser->super), "field() should be rejected with a legacy GeoIP database");
+  log_pipe_unref(&parser->super);
+
+#if SYSLOG_NG_HAVE_MAXMINDDB
+  parser = _parse_geoip_config("geoip(\"${MESSAGE}\" field(\"city\" \"city.names.en\") field(\"subdivision\" \"subdivisions.0.iso_code\"))");
+  assert_not_null(parser, "multiple field() options should be accepted");
+  geoip_parser_set_database(parser, mmdb_database);
+  assert_true(log_pipe_init(&parser->super), "geoip() failed to initialize");
+  msg = parse_geoip_with_parser(parser, "216.160.83.56");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.city"), "Milton");
+  assert_log_message_value(msg, log_msg_get_value_handle(".geoip.subdivision"), "WA");
+  log_msg_unref(msg);
+  log_pipe_deinit(&parser->super);
+  log_pipe_unref(&parser->super);
+#endif
+
+  testcase_end();
+}
+
 static void
 test_geoip_parser(void)
 {
   KV_PARSER_TESTCASE(test_geoip_parser_basics);
   KV_PARSER_TESTCASE(test_geoip_parser_uses_template_to_parse_input);
+  KV_PARSER_TESTCASE(test_geoip_parser_caches_lookups);
+  KV_PARSER_TESTCASE(test_geoip_parser_cache_can_be_disabled);
+  KV_PARSER_TESTCASE(test_geoip_parser_field_requires_an_mmdb_database);
+#if SYSLOG_NG_HAVE_MAXMINDDB
+  KV_PARSER_TESTCASE(test_geoip_parser_mmdb_basics);
+  KV_PARSER_TESTCASE(test_geoip_parser_mmdb_fields);
+  KV_PARSER_TESTCASE(test_geoip_parser_mmdb_formats_data_types);
+  KV_PARSER_TESTCASE(test_geoip_parser_mmdb_caches_lookups);
+#endif
+  test_geoip_parser_grammar();
 }
 
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
+  char *top_srcdir = getenv("top_srcdir");
+
   app_startup();
 
+  assert_not_null(top_srcdir, "The $top_srcdir environment variable MUST NOT be empty!");
+  mmdb_database = g_strdup_printf("%s/modules/geoip/tests/test-city.mmdb", top_srcdir);
+
+  configuration = cfg_new(VERSION_VALUE);
+  plugin_load_module("geoip", configuration, NULL);
+
   test_geoip_parser();
+
+  cfg_free(configuration);
+  g_free(mmdb_database);
   app_shutdown();
   return 0;
 }
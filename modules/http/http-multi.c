@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "http-multi.h"
+#include "messages.h"
+#include "timeutils.h"
+
+#include <iv.h>
+
+struct _HTTPMulti
+{
+  CURLM *multi;
+  struct iv_timer timer;
+  GList *sockets;
+
+  HTTPMultiTransferDoneFunc transfer_done;
+  HTTPMultiAllDoneFunc all_done;
+  gpointer user_data;
+};
+
+typedef struct
+{
+  HTTPMulti *owner;
+  struct iv_fd fd;
+} HTTPMultiSocket;
+
+static void
+_check_finished_transfers(HTTPMulti *self)
+{
+  CURLMsg *message;
+  int pending;
+  gboolean finished = FALSE;
+
+  while ((message = curl_multi_info_read(self->multi, &pending)))
+    {
+      if (message->msg != CURLMSG_DONE)
+        continue;
+
+      CURL *handle = message->easy_handle;
+      CURLcode result = message->data.result;
+
+      curl_multi_remove_handle(self->multi, handle);
+      self->transfer_done(handle, result, self->user_data);
+      finished = TRUE;
+    }
+
+  if (finished)
+    self->all_done(self->user_data);
+}
+
+static void
+_socket_action(HTTPMulti *self, curl_socket_t fd, int ev_bitmask)
+{
+  int running;
+
+  curl_multi_socket_action(self->multi, fd, ev_bitmask, &running);
+  _check_finished_transfers(self);
+}
+
+static void
+_socket_in(void *cookie)
+{
+  HTTPMultiSocket *socket = (HTTPMultiSocket *) cookie;
+
+  _socket_action(socket->owner, socket->fd.fd, CURL_CSELECT_IN);
+}
+
+static void
+_socket_out(void *cookie)
+{
+  HTTPMultiSocket *socket = (HTTPMultiSocket *) cookie;
+
+  _socket_action(socket->owner, socket->fd.fd, CURL_CSELECT_OUT);
+}
+
+static void
+_socket_free(HTTPMultiSocket *socket)
+{
+  iv_fd_unregister(&socket->fd);
+  g_free(socket);
+}
+
+static int
+_socket_cb(CURL *handle, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+  HTTPMulti *self = (HTTPMulti *) userp;
+  HTTPMultiSocket *socket = (HTTPMultiSocket *) socketp;
+
+  if (what == CURL_POLL_REMOVE)
+    {
+      if (socket)
+        {
+          self->sockets = g_list_remove(self->sockets, socket);
+          _socket_free(socket);
+        }
+      return 0;
+    }
+
+  if (!socket)
+    {
+      socket = g_new0(HTTPMultiSocket, 1);
+      socket->owner = self;
+      IV_FD_INIT(&socket->fd);
+      socket->fd.fd = fd;
+      socket->fd.cookie = socket;
+      iv_fd_register(&socket->fd);
+
+      self->sockets = g_list_prepend(self->sockets, socket);
+      curl_multi_assign(self->multi, fd, socket);
+    }
+
+  iv_fd_set_handler_in(&socket->fd, (what & CURL_POLL_IN) ? _socket_in : NULL);
+  iv_fd_set_handler_out(&socket->fd, (what & CURL_POLL_OUT) ? _socket_out : NULL);
+  return 0;
+}
+
+static void
+_timer_expired(void *cookie)
+{
+  HTTPMulti *self = (HTTPMulti *) cookie;
+
+  _socket_action(self, CURL_SOCKET_TIMEOUT, 0);
+}
+
+static int
+_timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+  HTTPMulti *self = (HTTPMulti *) userp;
+
+  if (iv_timer_registered(&self->timer))
+    iv_timer_unregister(&self->timer);
+
+  if (timeout_ms >= 0)
+    {
+      iv_validate_now();
+      self->timer.expires = iv_now;
+      timespec_add_msec(&self->timer.expires, timeout_ms);
+      iv_timer_register(&self->timer);
+    }
+  return 0;
+}
+
+gboolean
+http_multi_add_transfer(HTTPMulti *self, CURL *handle)
+{
+  CURLMcode ret = curl_multi_add_handle(self->multi, handle);
+
+  if (ret != CURLM_OK)
+    {
+      msg_error("curl: error starting HTTP request",
+                evt_tag_str("error", curl_multi_strerror(ret)));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+void
+http_multi_remove_transfer(HTTPMulti *self, CURL *handle)
+{
+  curl_multi_remove_handle(self->multi, handle);
+}
+
+HTTPMulti *
+http_multi_new(glong max_connections, HTTPMultiTransferDoneFunc transfer_done,
+               HTTPMultiAllDoneFunc all_done, gpointer user_data)
+{
+  HTTPMulti *self = g_new0(HTTPMulti, 1);
+
+  self->transfer_done = transfer_done;
+  self->all_done = all_done;
+  self->user_data = user_data;
+
+  IV_TIMER_INIT(&self->timer);
+  self->timer.cookie = self;
+  self->timer.handler = _timer_expired;
+
+  self->multi = curl_multi_init();
+  curl_multi_setopt(self->multi, CURLMOPT_SOCKETFUNCTION, _socket_cb);
+  curl_multi_setopt(self->multi, CURLMOPT_SOCKETDATA, self);
+  curl_multi_setopt(self->multi, CURLMOPT_TIMERFUNCTION, _timer_cb);
+  curl_multi_setopt(self->multi, CURLMOPT_TIMERDATA, self);
+  curl_multi_setopt(self->multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_connections);
+
+  return self;
+}
+
+void
+http_multi_free(HTTPMulti *self)
+{
+  GList *l;
+
+  /* curl does not necessarily report the sockets it closes on cleanup, and
+   * the fds have to be unregistered while they are still open: detach them
+   * from curl first, so that a late CURL_POLL_REMOVE finds no socket */
+  for (l = self->sockets; l; l = l->next)
+    {
+      HTTPMultiSocket *socket = (HTTPMultiSocket *) l->data;
+
+      curl_multi_assign(self->multi, socket->fd.fd, NULL);
+      _socket_free(socket);
+    }
+  g_list_free(self->sockets);
+  self->sockets = NULL;
+
+  curl_multi_cleanup(self->multi);
+
+  if (iv_timer_registered(&self->timer))
+    iv_timer_unregister(&self->timer);
+
+  g_free(self);
+}
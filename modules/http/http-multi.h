@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef HTTP_MULTI_H_INCLUDED
+#define HTTP_MULTI_H_INCLUDED 1
+
+#include "syslog-ng.h"
+
+#include <curl/curl.h>
+
+/*
+ * HTTPMulti drives a set of concurrent curl transfers from the ivykis main
+ * loop of the calling thread, using curl's multi_socket API.
+ *
+ * transfer_done() is called for each finished transfer, it must not add
+ * or remove transfers.  all_done() is called once the finished transfers
+ * of an event have been reported, it may do both.
+ */
+typedef struct _HTTPMulti HTTPMulti;
+
+typedef void (*HTTPMultiTransferDoneFunc)(CURL *handle, CURLcode result, gpointer user_data);
+typedef void (*HTTPMultiAllDoneFunc)(gpointer user_data);
+
+gboolean http_multi_add_transfer(HTTPMulti *self, CURL *handle);
+void http_multi_remove_transfer(HTTPMulti *self, CURL *handle);
+
+HTTPMulti *http_multi_new(glong max_connections, HTTPMultiTransferDoneFunc transfer_done,
+                          HTTPMultiAllDoneFunc all_done, gpointer user_data);
+void http_multi_free(HTTPMulti *self);
+
+#endif
@@ -38,6 +38,11 @@ static CfgLexerKeyword http_keywords[] =
   { "headers",      KW_HEADERS },
   { "method",       KW_METHOD },
   { "body",         KW_BODY },
+  { "body_prefix",  KW_BODY_PREFIX },
+  { "body_suffix",  KW_BODY_SUFFIX },
+  { "delimiter",    KW_DELIMITER },
+  { "batch_bytes",  KW_BATCH_BYTES },
+  { "concurrent_requests", KW_CONCURRENT_REQUESTS },
   { NULL }
 };
 
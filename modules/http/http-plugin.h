@@ -29,10 +29,11 @@
 
 #include "logthrdestdrv.h"
 
+#include <curl/curl.h>
+
 typedef struct
 {
   LogThrDestDriver super;
-  gchar *curl;
   gchar *url;
   gchar *user;
   gchar *password;
@@ -40,6 +41,11 @@ typedef struct
   gchar *user_agent;
   short int method_type;
   LogTemplate *body_template;
+  gchar *body_prefix;
+  gchar *body_suffix;
+  gchar *delimiter;
+  gsize batch_bytes;
+  gint concurrent_requests;
   LogTemplateOptions template_options;
 } HTTPDestinationDriver;
 
@@ -53,6 +59,11 @@ void http_dd_set_method(LogDriver *d, const gchar *method);
 void http_dd_set_user_agent(LogDriver *d, const gchar *user_agent);
 void http_dd_set_headers(LogDriver *d, GList *headers);
 void http_dd_set_body(LogDriver *d, LogTemplate *body);
+void http_dd_set_body_prefix(LogDriver *d, const gchar *body_prefix);
+void http_dd_set_body_suffix(LogDriver *d, const gchar *body_suffix);
+void http_dd_set_delimiter(LogDriver *d, const gchar *delimiter);
+void http_dd_set_batch_bytes(LogDriver *d, gsize batch_bytes);
+void http_dd_set_concurrent_requests(LogDriver *d, gint concurrent_requests);
 LogTemplateOptions *http_dd_get_template_options(LogDriver *d);
 
 #endif
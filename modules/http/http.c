@@ -20,10 +20,9 @@
  *
  */
 
-#include <curl/curl.h>
-
 #include "syslog-names.h"
 #include "http-plugin.h"
+#include "http-multi.h"
 
 static const gchar *
 _format_persist_name(const LogPipe *s)
@@ -58,31 +57,269 @@ _http_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
   return nmemb * size;
 }
 
+/* a single HTTP request, along with the curl handle that sends it */
+typedef struct
+{
+  CURL *curl;
+  GString *body;
+  struct curl_slist *headers;
+  gint batch_size;
+  gboolean completed;
+  worker_insert_result_t result;
+} HTTPRequest;
+
+/* per-worker state, each worker thread has its own connections */
+typedef struct
+{
+  HTTPDestinationDriver *owner;
+  /* the request being assembled */
+  HTTPRequest *request;
+  /* with concurrent-requests(), submitted requests in submission order, and
+   * the ones that can be reused */
+  HTTPMulti *multi;
+  GQueue *inflight_requests;
+  GQueue *idle_requests;
+} HTTPDestinationWorker;
+
+static HTTPDestinationWorker *
+_get_worker(HTTPDestinationDriver *self)
+{
+  return log_threaded_dest_worker_get_user_data(log_threaded_dest_driver_get_worker(&self->super));
+}
+
+static void
+_set_static_curl_opts(HTTPDestinationDriver *self, CURL *curl)
+{
+  curl_easy_reset(curl);
+
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _http_write_cb);
+
+  curl_easy_setopt(curl, CURLOPT_URL, self->url);
+
+  if (self->user)
+    curl_easy_setopt(curl, CURLOPT_USERNAME, self->user);
+
+  if (self->password)
+    curl_easy_setopt(curl, CURLOPT_PASSWORD, self->password);
+
+  if (self->user_agent)
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, self->user_agent);
+
+  /* the handle is reused for every request, so libcurl keeps the
+   * connection to the server open between them */
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+  if (self->method_type == METHOD_TYPE_PUT)
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+}
+
+static HTTPRequest *
+_request_new(HTTPDestinationDriver *self)
+{
+  HTTPRequest *request;
+  CURL *curl;
+
+  if (!(curl = curl_easy_init()))
+    {
+      msg_error("curl: cannot initialize libcurl",
+                evt_tag_str("driver", self->super.super.super.id));
+      return NULL;
+    }
+
+  request = g_new0(HTTPRequest, 1);
+  request->curl = curl;
+  request->body = g_string_sized_new(self->batch_bytes ? self->batch_bytes : 1024);
+
+  _set_static_curl_opts(self, curl);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+
+  return request;
+}
+
+static void
+_request_reset(HTTPRequest *request)
+{
+  g_string_truncate(request->body, 0);
+  curl_slist_free_all(request->headers);
+  request->headers = NULL;
+  request->batch_size = 0;
+  request->completed = FALSE;
+}
+
+static void
+_request_free(HTTPRequest *request)
+{
+  curl_slist_free_all(request->headers);
+  g_string_free(request->body, TRUE);
+  curl_easy_cleanup(request->curl);
+  g_free(request);
+}
+
+static HTTPRequest *
+_acquire_request(HTTPDestinationWorker *worker)
+{
+  HTTPRequest *request = g_queue_pop_head(worker->idle_requests);
+
+  if (request)
+    return request;
+
+  return _request_new(worker->owner);
+}
+
+static void
+_release_request(HTTPDestinationWorker *worker, HTTPRequest *request)
+{
+  _request_reset(request);
+  g_queue_push_head(worker->idle_requests, request);
+}
+
+/* server errors, request timeouts and rate limiting are worth retrying,
+ * any other status is permanent */
+static gboolean
+_is_transient_http_error(glong http_code)
+{
+  return http_code / 100 == 5 || http_code == 408 || http_code == 429;
+}
+
+static worker_insert_result_t
+_evaluate_response(HTTPDestinationDriver *self, HTTPRequest *request, CURLcode ret)
+{
+  glong http_code = 0;
+
+  if (ret != CURLE_OK)
+    {
+      msg_error("curl: error sending HTTP request",
+                evt_tag_str("error", curl_easy_strerror(ret)),
+                evt_tag_int("batch_size", request->batch_size));
+      return WORKER_INSERT_RESULT_ERROR;
+    }
+
+  curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code / 100 == 2)
+    return WORKER_INSERT_RESULT_SUCCESS;
+
+  if (_is_transient_http_error(http_code))
+    {
+      msg_error("http: server returned a temporary error, retrying the batch",
+                evt_tag_str("url", self->url),
+                evt_tag_int("status_code", http_code),
+                evt_tag_int("batch_size", request->batch_size));
+      return WORKER_INSERT_RESULT_ERROR;
+    }
+
+  /* sending the same request again would be rejected again */
+  msg_error("http: server rejected the request, the batch is not retried",
+            evt_tag_str("url", self->url),
+            evt_tag_int("status_code", http_code),
+            evt_tag_int("batch_size", request->batch_size));
+  return WORKER_INSERT_RESULT_SUCCESS;
+}
+
+/* called by HTTPMulti for each finished transfer */
+static void
+_transfer_done(CURL *curl, CURLcode ret, gpointer user_data)
+{
+  HTTPDestinationWorker *worker = (HTTPDestinationWorker *) user_data;
+  HTTPRequest *request = NULL;
+
+  curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &request);
+
+  request->result = _evaluate_response(worker->owner, request, ret);
+  request->completed = TRUE;
+}
+
+/* Requests may finish in any order, but their messages are acknowledged
+ * in the order they were submitted, so a request is only reported once
+ * every request before it has finished.  A failure rewinds and abandons
+ * the requests that are still in flight, see _disconnect(). */
+static void
+_all_done(gpointer user_data)
+{
+  HTTPDestinationWorker *worker = (HTTPDestinationWorker *) user_data;
+  HTTPRequest *request;
+
+  while ((request = g_queue_peek_head(worker->inflight_requests)) && request->completed)
+    {
+      gint batch_size = request->batch_size;
+      worker_insert_result_t result = request->result;
+
+      g_queue_pop_head(worker->inflight_requests);
+      _release_request(worker, request);
+
+      log_threaded_dest_driver_batch_completed(&worker->owner->super, batch_size, result);
+    }
+}
+
 static void
 _thread_init(LogThrDestDriver *s)
 {
   HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  HTTPDestinationWorker *worker = g_new0(HTTPDestinationWorker, 1);
 
-  curl_version_info_data *curl_info = curl_version_info(CURLVERSION_NOW);
-  if (!self->user_agent)
-    self->user_agent = g_strdup_printf("syslog-ng %s/libcurl %s",
-                                       SYSLOG_NG_VERSION, curl_info->version);
+  worker->owner = self;
+  worker->request = _request_new(self);
+  worker->inflight_requests = g_queue_new();
+  worker->idle_requests = g_queue_new();
+
+  if (self->concurrent_requests > 1)
+    worker->multi = http_multi_new(self->concurrent_requests, _transfer_done, _all_done, worker);
+
+  log_threaded_dest_worker_set_user_data(log_threaded_dest_driver_get_worker(s), worker);
+}
+
+static void
+_disconnect(LogThrDestDriver *s)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  HTTPDestinationWorker *worker = _get_worker(self);
+  HTTPRequest *request;
+
+  /* the framework rewinds the messages of these requests */
+  while ((request = g_queue_pop_head(worker->inflight_requests)))
+    {
+      http_multi_remove_transfer(worker->multi, request->curl);
+      _release_request(worker, request);
+    }
+
+  if (worker->request)
+    _request_reset(worker->request);
 }
 
 static void
 _thread_deinit(LogThrDestDriver *s)
 {
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  HTTPDestinationWorker *worker = _get_worker(self);
+
+  _disconnect(s);
+  if (worker->multi)
+    http_multi_free(worker->multi);
+
+  g_queue_foreach(worker->idle_requests, (GFunc) _request_free, NULL);
+  g_queue_free(worker->idle_requests);
+  g_queue_free(worker->inflight_requests);
+  if (worker->request)
+    _request_free(worker->request);
+  g_free(worker);
+  log_threaded_dest_worker_set_user_data(log_threaded_dest_driver_get_worker(s), NULL);
 }
 
 static gboolean
 _connect(LogThrDestDriver *s)
 {
-  return TRUE;
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  HTTPDestinationWorker *worker = _get_worker(self);
+
+  if (!worker->request)
+    worker->request = _request_new(self);
+
+  return worker->request != NULL;
 }
 
-static void
-_disconnect(LogThrDestDriver *s)
+static gboolean
+_is_batching_enabled(HTTPDestinationDriver *self)
 {
+  return self->super.batch.lines > 1 || self->batch_bytes > 0;
 }
 
 static struct curl_slist *
@@ -111,6 +348,11 @@ _get_curl_headers(HTTPDestinationDriver *self, LogMessage *msg)
              "X-Syslog-Level: %s", syslog_name_lookup_name_by_value(msg->pri & LOG_PRIMASK, sl_levels));
   curl_headers = curl_slist_append(curl_headers, header_level);
 
+  /* avoid the extra round trip of "Expect: 100-continue" on large batched
+   * bodies, single messages are sent as before */
+  if (_is_batching_enabled(self))
+    curl_headers = curl_slist_append(curl_headers, "Expect:");
+
   header = self->headers;
   while (header != NULL)
     {
@@ -121,79 +363,122 @@ _get_curl_headers(HTTPDestinationDriver *self, LogMessage *msg)
   return curl_headers;
 }
 
-static GString *
-_get_body_rendered(HTTPDestinationDriver *self, LogMessage *msg)
+static void
+_append_body(HTTPDestinationDriver *self, HTTPRequest *request, LogMessage *msg)
 {
-  GString *body_rendered = NULL;
-
   if (self->body_template)
     {
-      body_rendered = g_string_new(NULL);
-      log_template_format(self->body_template, msg, &self->template_options, LTZ_SEND,
-                          self->super.seq_num, NULL, body_rendered);
+      log_template_append_format(self->body_template, msg, &self->template_options, LTZ_SEND,
+                                 self->super.seq_num, NULL, request->body);
+    }
+  else
+    {
+      gssize len;
+      const gchar *value = log_msg_get_value(msg, LM_V_MESSAGE, &len);
+
+      g_string_append_len(request->body, value, len);
     }
-  return body_rendered;
 }
 
 static void
-_set_curl_opt(HTTPDestinationDriver *self, LogMessage *msg, struct curl_slist *curl_headers, GString *body_rendered)
+_add_message_to_request(HTTPDestinationDriver *self, HTTPRequest *request, LogMessage *msg)
 {
-  curl_easy_reset(self->curl);
+  /* the first message of the batch determines the X-Syslog-* headers */
+  if (log_threaded_dest_driver_get_batch_size(&self->super) == 1)
+    {
+      _request_reset(request);
+      request->headers = _get_curl_headers(self, msg);
+      if (self->body_prefix)
+        g_string_append(request->body, self->body_prefix);
+    }
+  else if (self->delimiter)
+    {
+      g_string_append(request->body, self->delimiter);
+    }
 
-  curl_easy_setopt(self->curl, CURLOPT_WRITEFUNCTION, _http_write_cb);
+  _append_body(self, request, msg);
+}
 
-  curl_easy_setopt(self->curl, CURLOPT_URL, self->url);
+static gboolean
+_request_size_limit_reached(LogThrDestDriver *s)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
 
-  if (self->user)
-    curl_easy_setopt(self->curl, CURLOPT_USERNAME, self->user);
+  return self->batch_bytes > 0 && _get_worker(self)->request->body->len >= self->batch_bytes;
+}
 
-  if (self->password)
-    curl_easy_setopt(self->curl, CURLOPT_PASSWORD, self->password);
+static void
+_finish_request(HTTPDestinationDriver *self, HTTPRequest *request)
+{
+  if (self->body_suffix)
+    g_string_append(request->body, self->body_suffix);
 
-  if (self->user_agent)
-    curl_easy_setopt(self->curl, CURLOPT_USERAGENT, self->user_agent);
+  request->batch_size = log_threaded_dest_driver_get_batch_size(&self->super);
 
+  curl_easy_setopt(request->curl, CURLOPT_HTTPHEADER, request->headers);
+  curl_easy_setopt(request->curl, CURLOPT_POSTFIELDS, request->body->str);
+  curl_easy_setopt(request->curl, CURLOPT_POSTFIELDSIZE, (long) request->body->len);
+}
 
-  curl_easy_setopt(self->curl, CURLOPT_HTTPHEADER, curl_headers);
+static worker_insert_result_t
+_send_request(HTTPDestinationDriver *self, HTTPRequest *request)
+{
+  worker_insert_result_t result;
 
-  const gchar *body = body_rendered ? body_rendered->str : log_msg_get_value(msg, LM_V_MESSAGE, NULL);
+  result = _evaluate_response(self, request, curl_easy_perform(request->curl));
+  _request_reset(request);
 
-  curl_easy_setopt(self->curl, CURLOPT_POSTFIELDS, body);
-  if (self->method_type == METHOD_TYPE_PUT)
-    curl_easy_setopt(self->curl, CURLOPT_CUSTOMREQUEST, "PUT");
+  return result;
 }
 
+/* hand the request over to HTTPMulti, its outcome is reported by _all_done() */
 static worker_insert_result_t
-_insert(LogThrDestDriver *s, LogMessage *msg)
+_submit_request(HTTPDestinationDriver *self, HTTPDestinationWorker *worker)
 {
-  CURLcode ret;
+  HTTPRequest *next_request = _acquire_request(worker);
 
-  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  if (!next_request)
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
 
-  struct curl_slist *curl_headers = _get_curl_headers(self, msg);
-  GString *body_rendered = _get_body_rendered(self, msg);
+  if (!http_multi_add_transfer(worker->multi, worker->request->curl))
+    {
+      _release_request(worker, next_request);
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
 
-  _set_curl_opt(self, msg, curl_headers, body_rendered);
+  g_queue_push_tail(worker->inflight_requests, worker->request);
+  worker->request = next_request;
 
-  if ((ret = curl_easy_perform(self->curl)) != CURLE_OK)
-    {
-      msg_error("curl: error sending HTTP request",
-                evt_tag_str("error", curl_easy_strerror(ret)));
+  return WORKER_INSERT_RESULT_QUEUED;
+}
 
-      if (body_rendered)
-        g_string_free(body_rendered, TRUE);
+static worker_insert_result_t
+_flush(LogThrDestDriver *s)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  HTTPDestinationWorker *worker = _get_worker(self);
 
-      curl_slist_free_all(curl_headers);
+  _finish_request(self, worker->request);
 
-      return WORKER_INSERT_RESULT_ERROR;
-    }
+  if (worker->multi)
+    return _submit_request(self, worker);
+
+  return _send_request(self, worker->request);
+}
 
-  if (body_rendered)
-    g_string_free(body_rendered, TRUE);
+static worker_insert_result_t
+_insert(LogThrDestDriver *s, LogMessage *msg)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) s;
+  HTTPDestinationWorker *worker = _get_worker(self);
 
-  curl_slist_free_all(curl_headers);
+  _add_message_to_request(self, worker->request, msg);
 
-  return WORKER_INSERT_RESULT_SUCCESS;
+  /* batches are closed by the framework, see _request_size_limit_reached() */
+  if (_is_batching_enabled(self) || worker->multi)
+    return WORKER_INSERT_RESULT_QUEUED;
+
+  return _flush(s);
 }
 
 void
@@ -274,6 +559,49 @@ http_dd_set_body(LogDriver *d, LogTemplate *body)
   self->body_template = log_template_ref(body);
 }
 
+void
+http_dd_set_body_prefix(LogDriver *d, const gchar *body_prefix)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) d;
+
+  g_free(self->body_prefix);
+  self->body_prefix = g_strdup(body_prefix);
+}
+
+void
+http_dd_set_body_suffix(LogDriver *d, const gchar *body_suffix)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) d;
+
+  g_free(self->body_suffix);
+  self->body_suffix = g_strdup(body_suffix);
+}
+
+void
+http_dd_set_delimiter(LogDriver *d, const gchar *delimiter)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) d;
+
+  g_free(self->delimiter);
+  self->delimiter = g_strdup(delimiter);
+}
+
+void
+http_dd_set_batch_bytes(LogDriver *d, gsize batch_bytes)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) d;
+
+  self->batch_bytes = batch_bytes;
+}
+
+void
+http_dd_set_concurrent_requests(LogDriver *d, gint concurrent_requests)
+{
+  HTTPDestinationDriver *self = (HTTPDestinationDriver *) d;
+
+  self->concurrent_requests = concurrent_requests;
+}
+
 LogTemplateOptions *
 http_dd_get_template_options(LogDriver *d)
 {
@@ -298,6 +626,26 @@ http_dd_init(LogPipe *s)
       self->url = g_strdup(HTTP_DEFAULT_URL);
     }
 
+  if (!self->user_agent)
+    {
+      curl_version_info_data *curl_info = curl_version_info(CURLVERSION_NOW);
+
+      self->user_agent = g_strdup_printf("syslog-ng %s/libcurl %s",
+                                         SYSLOG_NG_VERSION, curl_info->version);
+    }
+
+  if (self->concurrent_requests > 1)
+    {
+      self->super.batch.max_inflight = self->concurrent_requests;
+      /* without batching, every message is sent in a request of its own */
+      if (!_is_batching_enabled(self))
+        self->super.batch.lines = 1;
+    }
+  else
+    {
+      self->super.batch.max_inflight = 0;
+    }
+
   return log_threaded_dest_driver_start(s);
 }
 
@@ -312,14 +660,18 @@ http_dd_free(LogPipe *s)
 {
   HTTPDestinationDriver *self = (HTTPDestinationDriver *)s;
 
-  curl_easy_cleanup(self->curl);
   curl_global_cleanup();
 
   g_free(self->url);
   g_free(self->user);
   g_free(self->password);
   g_free(self->user_agent);
+  g_free(self->body_prefix);
+  g_free(self->body_suffix);
+  g_free(self->delimiter);
   g_list_free_full(self->headers, g_free);
+  log_template_unref(self->body_template);
+  log_template_options_destroy(&self->template_options);
 
   log_threaded_dest_driver_free(s);
 }
@@ -339,19 +691,18 @@ http_dd_new(GlobalConfig *cfg)
   self->super.worker.connect = _connect;
   self->super.worker.disconnect = _disconnect;
   self->super.worker.insert = _insert;
+  self->super.worker.flush = _flush;
+  self->super.worker.batch_full = _request_size_limit_reached;
   self->super.super.super.super.generate_persist_name = _format_persist_name;
   self->super.format.stats_instance = _format_stats_instance;
   self->super.stats_source = SCS_HTTP;
   self->super.super.super.super.free_fn = http_dd_free;
 
-  curl_global_init(CURL_GLOBAL_ALL);
+  self->delimiter = g_strdup("\n");
 
-  if (!(self->curl = curl_easy_init()))
-    {
-      msg_error("curl: cannot initialize libcurl", NULL);
+  self->super.workers.supported = TRUE;
 
-      return NULL;
-    }
+  curl_global_init(CURL_GLOBAL_ALL);
 
   return &self->super.super.super;
 }
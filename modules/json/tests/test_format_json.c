@@ -80,6 +80,10 @@ test_format_json_key(void)
   assert_template_format("$(format-json --key MSG)", "{\"MSG\":\"árvíztűrőtükörfúrógép\"}");
   assert_template_format("$(format-json --key DATE)", "{\"DATE\":\"Feb 11 10:34:56\"}");
   assert_template_format("$(format-json --key PRI)", "{\"PRI\":\"155\"}");
+  assert_template_format("$(format-json --key no-such-value)", "{}");
+  assert_template_format("$(format-json --key HOST HOST=override)", "{\"HOST\":\"override\"}");
+  assert_template_format("$(format-json --scope rfc3164 --exclude DATE --exclude P*)",
+                         "{\"MESSAGE\":\"árvíztűrőtükörfúrógép\",\"HOST\":\"bzorp\",\"FACILITY\":\"local3\"}");
 }
 
 void
@@ -89,6 +93,54 @@ test_format_json_rekey(void)
                          "{\"_msg\":{\"text\":\"dotted\"}}");
 }
 
+void
+test_format_json_rekey_with_exclude(void)
+{
+  assert_template_format("$(format-json --scope rfc3164 --exclude DATE --exclude P* --rekey H* --add-prefix src.)",
+                         "{\"src\":{\"HOST\":\"bzorp\"},\"MESSAGE\":\"árvíztűrőtükörfúrógép\",\"FACILITY\":\"local3\"}");
+  assert_template_format("$(format-json --key HOST --key PID --exclude PID --rekey HOST --replace-prefix HOST=host.name)",
+                         "{\"host\":{\"name\":\"bzorp\"}}");
+}
+
+void
+test_format_json_nested_containers(void)
+{
+  /* more than one container is closed and opened between two keys */
+  assert_template_format("$(format-json x.y.z=1 x.w=2 v.u.t=3)",
+                         "{\"x\":{\"y\":{\"z\":\"1\"},\"w\":\"2\"},\"v\":{\"u\":{\"t\":\"3\"}}}");
+  assert_template_format("$(format-json a.b.c.d=1 a.e=2 a.b.f=3 g=4)",
+                         "{\"g\":\"4\",\"a\":{\"e\":\"2\",\"b\":{\"f\":\"3\",\"c\":{\"d\":\"1\"}}}}");
+}
+
+void
+test_format_json_key_registered_after_compile(void)
+{
+  LogTemplate *template;
+  LogMessage *msg;
+  GString *res = g_string_sized_new(128);
+  gchar name[64];
+  gint i;
+
+  /* the plan is compiled with the handle of a name that is not set
+   * anywhere yet, then the registry grows before the message is formatted */
+  template = compile_template("$(format-json --key late.registered.name --key HOST)", FALSE);
+  for (i = 0; i < 256; i++)
+    {
+      g_snprintf(name, sizeof(name), "plan.registry.grows.%d", i);
+      log_msg_get_value_handle(name);
+    }
+
+  msg = create_sample_message();
+  log_msg_set_value_by_name(msg, "late.registered.name", "value", -1);
+  log_template_format(template, msg, NULL, LTZ_LOCAL, 0, NULL, res);
+  assert_string(res->str, "{\"late\":{\"registered\":{\"name\":\"value\"}},\"HOST\":\"bzorp\"}",
+                "format-json did not pick up a value registered after compiling the template");
+
+  log_template_unref(template);
+  log_msg_unref(msg);
+  g_string_free(res, TRUE);
+}
+
 void
 test_format_json_with_type_hints(void)
 {
@@ -159,6 +211,9 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   test_format_json();
   test_format_json_key();
   test_format_json_rekey();
+  test_format_json_rekey_with_exclude();
+  test_format_json_nested_containers();
+  test_format_json_key_registered_after_compile();
   test_format_json_with_type_hints();
   test_format_json_on_error();
   test_format_json_with_utf8();
@@ -52,6 +52,9 @@ typedef struct
   GString *param2_str;
 
   redisContext *c;
+  /* number of commands appended to the output buffer of the context,
+   * whose replies have not been read yet */
+  gint pending_commands;
 } RedisDriver;
 
 /*
@@ -148,8 +151,9 @@ redis_dd_connect(RedisDriver *self, gboolean reconnect)
 
       if (!self->c->err)
         return TRUE;
-      else
-        self->c = redisConnect(self->host, self->port);
+
+      redisFree(self->c);
+      self->c = redisConnect(self->host, self->port);
     }
   else
     self->c = redisConnect(self->host, self->port);
@@ -177,26 +181,23 @@ redis_dd_disconnect(LogThrDestDriver *s)
   if (self->c)
     redisFree(self->c);
   self->c = NULL;
+  self->pending_commands = 0;
 }
 
 /*
  * Worker thread
  */
 
-static worker_insert_result_t
-redis_worker_insert(LogThrDestDriver *s, LogMessage *msg)
+static gboolean
+redis_dd_is_pipelining(RedisDriver *self)
 {
-  RedisDriver *self = (RedisDriver *)s;
-  redisReply *reply;
-  const char *argv[5];
-  size_t argvlen[5];
-  int argc = 2;
-
-  if (!redis_dd_connect(self, TRUE))
-    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+  return self->super.batch.lines > 1;
+}
 
-  if (self->c->err)
-    return WORKER_INSERT_RESULT_ERROR;
+static int
+redis_worker_format_command(RedisDriver *self, LogMessage *msg, const char *argv[], size_t argvlen[])
+{
+  int argc = 2;
 
   log_template_format(self->key, msg, &self->template_options, LTZ_SEND,
                       self->super.seq_num, NULL, self->key_str);
@@ -227,6 +228,60 @@ redis_worker_insert(LogThrDestDriver *s, LogMessage *msg)
       argc++;
     }
 
+  return argc;
+}
+
+static worker_insert_result_t
+redis_worker_append(RedisDriver *self, LogMessage *msg)
+{
+  const char *argv[5];
+  size_t argvlen[5];
+  int argc;
+
+  /* the connection is only checked when a batch is started, a PING
+   * would get its reply mixed up with the ones of the pending commands */
+  if (self->pending_commands == 0 && !redis_dd_connect(self, TRUE))
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  argc = redis_worker_format_command(self, msg, argv, argvlen);
+
+  if (redisAppendCommandArgv(self->c, argc, argv, argvlen) != REDIS_OK)
+    {
+      msg_error("REDIS error while appending command to the pipeline, suspending",
+                evt_tag_str("driver", self->super.super.super.id),
+                evt_tag_str("command", self->command->str),
+                evt_tag_str("error", self->c->errstr),
+                evt_tag_int("time_reopen", self->super.time_reopen));
+      /* the commands already in the output buffer are part of the batch,
+       * which is either rewound or dropped as a whole */
+      redis_dd_disconnect(&self->super);
+      return WORKER_INSERT_RESULT_ERROR;
+    }
+
+  self->pending_commands++;
+  return WORKER_INSERT_RESULT_QUEUED;
+}
+
+static worker_insert_result_t
+redis_worker_insert(LogThrDestDriver *s, LogMessage *msg)
+{
+  RedisDriver *self = (RedisDriver *)s;
+  redisReply *reply;
+  const char *argv[5];
+  size_t argvlen[5];
+  int argc;
+
+  if (redis_dd_is_pipelining(self))
+    return redis_worker_append(self, msg);
+
+  if (!redis_dd_connect(self, TRUE))
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  if (self->c->err)
+    return WORKER_INSERT_RESULT_ERROR;
+
+  argc = redis_worker_format_command(self, msg, argv, argvlen);
+
   reply = redisCommandArgv(self->c, argc, argv, argvlen);
 
   if (!reply)
@@ -253,6 +308,65 @@ redis_worker_insert(LogThrDestDriver *s, LogMessage *msg)
   return WORKER_INSERT_RESULT_SUCCESS;
 }
 
+/* Sends the pipelined commands and reads their replies, which arrive in
+ * the order of the messages in the batch.  A command rejected by the
+ * server (e.g. WRONGTYPE) would fail the same way when retried, so only
+ * its message is dropped.  When the connection breaks, the messages
+ * answered so far are acknowledged and the rest of the batch is retried. */
+static worker_insert_result_t
+redis_worker_flush(LogThrDestDriver *s)
+{
+  RedisDriver *self = (RedisDriver *)s;
+  redisReply *reply;
+  gint num_commands = self->pending_commands;
+  gint accepted = 0;
+  gint i;
+
+  if (num_commands == 0)
+    return WORKER_INSERT_RESULT_SUCCESS;
+
+  self->pending_commands = 0;
+  for (i = 0; i < num_commands; i++)
+    {
+      if (redisGetReply(self->c, (void **) &reply) != REDIS_OK)
+        {
+          msg_error("REDIS server error, suspending",
+                    evt_tag_str("driver", self->super.super.super.id),
+                    evt_tag_str("command", self->command->str),
+                    evt_tag_str("error", self->c->errstr),
+                    evt_tag_int("unanswered_commands", num_commands - i),
+                    evt_tag_int("time_reopen", self->super.time_reopen));
+          log_threaded_dest_driver_batch_ack_messages(s, accepted, FALSE);
+          redis_dd_disconnect(s);
+          return WORKER_INSERT_RESULT_ERROR;
+        }
+
+      if (reply->type == REDIS_REPLY_ERROR)
+        {
+          msg_error("REDIS command failed, dropping message",
+                    evt_tag_str("driver", self->super.super.super.id),
+                    evt_tag_str("command", self->command->str),
+                    evt_tag_str("error", reply->str));
+          log_threaded_dest_driver_batch_ack_messages(s, accepted, FALSE);
+          log_threaded_dest_driver_batch_ack_messages(s, 1, TRUE);
+          accepted = 0;
+        }
+      else
+        {
+          accepted++;
+        }
+      freeReplyObject(reply);
+    }
+
+  msg_debug("REDIS pipeline flushed",
+            evt_tag_str("driver", self->super.super.super.id),
+            evt_tag_str("command", self->command->str),
+            evt_tag_int("commands", num_commands));
+
+  /* the rest of the batch consists of the accepted messages */
+  return WORKER_INSERT_RESULT_SUCCESS;
+}
+
 static void
 redis_worker_thread_init(LogThrDestDriver *d)
 {
@@ -337,6 +451,7 @@ redis_dd_new(GlobalConfig *cfg)
   self->super.worker.thread_deinit = redis_worker_thread_deinit;
   self->super.worker.disconnect = redis_dd_disconnect;
   self->super.worker.insert = redis_worker_insert;
+  self->super.worker.flush = redis_worker_flush;
 
   self->super.format.stats_instance = redis_dd_format_stats_instance;
   self->super.stats_source = SCS_REDIS;
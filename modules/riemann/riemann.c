@@ -161,9 +161,7 @@ riemann_dd_set_field_attributes(LogDriver *d, ValuePairs *vp)
 void
 riemann_dd_set_flush_lines(LogDriver *d, gint lines)
 {
-  RiemannDestDriver *self = (RiemannDestDriver *)d;
-
-  self->event.batch_size_max = lines;
+  log_threaded_dest_driver_set_batch_lines(d, lines);
 }
 
 gboolean
@@ -353,8 +351,7 @@ riemann_worker_init(LogPipe *s)
 
   _value_pairs_always_exclude_properties(self);
 
-  if (self->event.batch_size_max <= 0)
-    self->event.batch_size_max = 1;
+  self->event.batch_size_max = MAX(self->super.batch.lines, 1);
   self->event.list = (riemann_event_t **)malloc (sizeof (riemann_event_t *) *
                      self->event.batch_size_max);
 
@@ -486,22 +483,46 @@ riemann_add_ttl_to_event(RiemannDestDriver *self, riemann_event_t *event, LogMes
   return FALSE;
 }
 
-static void
+static gboolean
 _append_event(RiemannDestDriver *self, riemann_event_t *event)
 {
+  gboolean appended = FALSE;
+
   g_static_mutex_lock(&self->event.lock);
 
-  self->event.list[self->event.n] = event;
-  self->event.n++;
+  if (self->event.n < self->event.batch_size_max)
+    {
+      self->event.list[self->event.n] = event;
+      self->event.n++;
+      appended = TRUE;
+    }
 
   g_static_mutex_unlock(&self->event.lock);
+
+  if (!appended)
+    msg_error("Riemann event batch is full, dropping event",
+              evt_tag_str("driver", self->super.super.super.id),
+              evt_tag_int("batch_size_max", self->event.batch_size_max));
+  return appended;
 }
 
-static worker_insert_result_t
+static void
+_free_pending_events(RiemannDestDriver *self)
+{
+  gint i;
+
+  g_static_mutex_lock(&self->event.lock);
+  for (i = 0; i < self->event.n; i++)
+    riemann_event_free(self->event.list[i]);
+  self->event.n = 0;
+  g_static_mutex_unlock(&self->event.lock);
+}
+
+static gboolean
 riemann_worker_insert_one(RiemannDestDriver *self, LogMessage *msg)
 {
   riemann_event_t *event;
-  gboolean success = TRUE, need_drop = FALSE;
+  gboolean need_drop = FALSE;
   SBGString *str;
 
   event = riemann_event_new();
@@ -550,28 +571,34 @@ riemann_worker_insert_one(RiemannDestDriver *self, LogMessage *msg)
                             msg, self->super.seq_num, LTZ_SEND,
                             &self->template_options, event);
 
-      _append_event(self, event);
+      if (!_append_event(self, event))
+        need_drop = TRUE;
     }
 
-  sb_gstring_release(str);
-
   if (need_drop)
-    return WORKER_INSERT_RESULT_DROP;
+    riemann_event_free(event);
 
-  if (success)
-    return WORKER_INSERT_RESULT_SUCCESS;
-  else
-    return WORKER_INSERT_RESULT_ERROR;
+  sb_gstring_release(str);
+
+  return !need_drop;
 }
 
 static worker_insert_result_t
-riemann_worker_batch_flush(RiemannDestDriver *self)
+riemann_worker_batch_flush(LogThrDestDriver *s)
 {
+  RiemannDestDriver *self = (RiemannDestDriver *)s;
   riemann_message_t *message;
   int r;
 
+  if (self->event.n == 0)
+    return WORKER_INSERT_RESULT_SUCCESS;
+
   if (!riemann_dd_connect(self, TRUE))
-    return WORKER_INSERT_RESULT_ERROR;
+    {
+      /* the batch is rewound, its events are recreated on the next attempt */
+      _free_pending_events(self);
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
 
   message = riemann_message_new();
 
@@ -582,8 +609,9 @@ riemann_worker_batch_flush(RiemannDestDriver *self)
 
   /*
    * riemann_client_send_message_oneshot() will free self->event.list,
-   * whether the send succeeds or fails. So we need to reallocate it,
-   * and save as many messages as possible.
+   * whether the send succeeds or fails. So we need to reallocate it; on
+   * failure the whole batch is rewound and the events are recreated from
+   * the queue on the next attempt.
    */
   self->event.n = 0;
   self->event.list = (riemann_event_t **)malloc (sizeof (riemann_event_t *) *
@@ -591,7 +619,12 @@ riemann_worker_batch_flush(RiemannDestDriver *self)
   g_static_mutex_unlock(&self->event.lock);
 
   if (r != 0)
-    return WORKER_INSERT_RESULT_DROP;
+    {
+      msg_error("Error sending events to Riemann",
+                evt_tag_str("driver", self->super.super.super.id),
+                evt_tag_int("batch_size", log_threaded_dest_driver_get_batch_size(&self->super)));
+      return WORKER_INSERT_RESULT_ERROR;
+    }
   else
     return WORKER_INSERT_RESULT_SUCCESS;
 }
@@ -600,17 +633,29 @@ static worker_insert_result_t
 riemann_worker_insert(LogThrDestDriver *s, LogMessage *msg)
 {
   RiemannDestDriver *self = (RiemannDestDriver *)s;
-  worker_insert_result_t result;
 
-  result = riemann_worker_insert_one(self, msg);
+  /* a message that cannot be turned into an event is dropped on its own:
+   * the events of the batch preceding it are sent and acknowledged first,
+   * so that the drop applies to this message only */
+  if (!riemann_worker_insert_one(self, msg))
+    {
+      gint pending = log_threaded_dest_driver_get_batch_size(s) - 1;
 
-  if (self->event.n < self->event.batch_size_max)
-    return result;
+      if (pending > 0)
+        {
+          worker_insert_result_t result = riemann_worker_batch_flush(s);
+
+          if (result != WORKER_INSERT_RESULT_SUCCESS)
+            return result;
+          log_threaded_dest_driver_batch_ack_messages(s, pending, FALSE);
+        }
+      return WORKER_INSERT_RESULT_DROP;
+    }
 
-  if (result != WORKER_INSERT_RESULT_SUCCESS)
-    return result;
+  if (self->event.batch_size_max > 1)
+    return WORKER_INSERT_RESULT_QUEUED;
 
-  return riemann_worker_batch_flush(self);
+  return riemann_worker_batch_flush(s);
 }
 
 static void
@@ -618,7 +663,9 @@ riemann_worker_thread_deinit(LogThrDestDriver *s)
 {
   RiemannDestDriver *self = (RiemannDestDriver *)s;
 
-  riemann_worker_batch_flush(self);
+  /* the batch is flushed by LogThrDestDriver before this is called, these
+   * are events of a batch that could not be sent */
+  _free_pending_events(self);
 }
 
 /*
@@ -664,6 +711,7 @@ riemann_dd_new(GlobalConfig *cfg)
 
   self->super.worker.disconnect = riemann_dd_disconnect;
   self->super.worker.insert = riemann_worker_insert;
+  self->super.worker.flush = riemann_worker_batch_flush;
   self->super.worker.thread_deinit = riemann_worker_thread_deinit;
 
   self->super.format.stats_instance = riemann_dd_format_stats_instance;
@@ -39,6 +39,42 @@ static const char aix_fwd_string[] = "Message forwarded from ";
 static const char repeat_msg_string[] = "last message repeated";
 static NVHandle is_synced;
 static NVHandle cisco_seqid;
+static NVHandle raw_message;
+
+/*
+ * With LP_STORE_RAW_MESSAGE the whole line is stored as RAWMSG, values
+ * that are verbatim substrings of it are stored as references instead of
+ * a second copy.  Returns FALSE if the caller has to copy the value.
+ */
+static gboolean
+log_msg_reference_raw_message(LogMessage *self, NVHandle handle, const MsgFormatOptions *parse_options,
+                              const guchar *raw, const guchar *value, gsize value_len)
+{
+  gssize raw_len;
+
+  if ((parse_options->flags & LP_STORE_RAW_MESSAGE) == 0)
+    return FALSE;
+
+  /* RAWMSG is not stored in full if the message exceeds the maximum
+   * payload size */
+  log_msg_get_value(self, raw_message, &raw_len);
+  if ((gssize) ((value - raw) + value_len) > raw_len)
+    return FALSE;
+
+  log_msg_set_value_indirect(self, handle, raw_message, 0, value - raw, value_len);
+  return TRUE;
+}
+
+static void
+log_msg_parse_store_message(LogMessage *self, const MsgFormatOptions *parse_options,
+                            const guchar *raw, const guchar *src, gint left)
+{
+  /* LP_NO_MULTI_LINE rewrites $MSG in place, which must not affect RAWMSG */
+  if ((parse_options->flags & LP_NO_MULTI_LINE) && find_cr_or_lf((gchar *) src, left))
+    log_msg_set_value(self, LM_V_MESSAGE, (gchar *) src, left);
+  else if (!log_msg_reference_raw_message(self, LM_V_MESSAGE, parse_options, raw, src, left))
+    log_msg_set_value(self, LM_V_MESSAGE, (gchar *) src, left);
+}
 
 static gboolean
 log_msg_parse_pri(LogMessage *self, const guchar **data, gint *length, guint flags, guint16 default_pri)
@@ -714,7 +750,8 @@ sd_step_and_store(LogMessage *self, const guchar **data, gint *left)
  * in @self.values and dup the SD string. Parsing is affected by the bits set @flags argument.
  **/
 static gboolean
-log_msg_parse_sd(LogMessage *self, const guchar **data, gint *length, const MsgFormatOptions *options)
+log_msg_parse_sd(LogMessage *self, const guchar **data, gint *length, const MsgFormatOptions *options,
+                 const guchar *raw)
 {
   /*
    * STRUCTURED-DATA = NILVALUE / 1*SD-ELEMENT
@@ -742,6 +779,8 @@ log_msg_parse_sd(LogMessage *self, const guchar **data, gint *length, const MsgF
   /* UTF-8 string */
   gchar sd_param_value[options->sdata_param_value_max + 1];
   gsize sd_param_value_len;
+  const guchar *sd_param_value_start;
+  gboolean sd_param_value_escaped;
   gchar sd_value_name[66];
 
   guint open_sd = 0;
@@ -850,12 +889,15 @@ log_msg_parse_sd(LogMessage *self, const guchar **data, gint *length, const MsgF
                   /* opening quote */
                   sd_step_and_store(self, &src, &left);
                   pos = 0;
+                  sd_param_value_start = src;
+                  sd_param_value_escaped = FALSE;
 
                   while (left && (*src != '"' || quote))
                     {
                       if (!quote && *src == '\\')
                         {
                           quote = TRUE;
+                          sd_param_value_escaped = TRUE;
                         }
                       else
                         {
@@ -890,7 +932,11 @@ log_msg_parse_sd(LogMessage *self, const guchar **data, gint *length, const MsgF
                   goto error;
                 }
 
-              log_msg_set_value_by_name(self, sd_value_name, sd_param_value, sd_param_value_len);
+              /* values without escaping and truncation can be referenced in RAWMSG */
+              if (sd_param_value_escaped || sd_param_value_len != (gsize) ((src - 1) - sd_param_value_start) ||
+                  !log_msg_reference_raw_message(self, log_msg_get_value_handle(sd_value_name), options,
+                                                 raw, sd_param_value_start, sd_param_value_len))
+                log_msg_set_value_by_name(self, sd_value_name, sd_param_value, sd_param_value_len);
             }
 
           if (left && *src == ']')
@@ -1045,7 +1091,7 @@ log_msg_parse_legacy(const MsgFormatOptions *parse_options,
     }
   else
     {
-      log_msg_set_value(self, LM_V_MESSAGE, (gchar *) src, left);
+      log_msg_parse_store_message(self, parse_options, data, src, left);
 
       /* we don't need revalidation if sanitize already said it was valid utf8 */
       if ((parse_options->flags & LP_VALIDATE_UTF8) &&
@@ -1130,7 +1176,7 @@ log_msg_parse_syslog_proto(const MsgFormatOptions *parse_options, const guchar *
     return FALSE;
 
   /* structured data part */
-  if (!log_msg_parse_sd(self, &src, &left, parse_options))
+  if (!log_msg_parse_sd(self, &src, &left, parse_options, data))
     return FALSE;
 
   /* checking if there are remaining data in log message */
@@ -1157,7 +1203,7 @@ log_msg_parse_syslog_proto(const MsgFormatOptions *parse_options, const guchar *
     {
       self->flags |= LF_UTF8;
     }
-  log_msg_set_value(self, LM_V_MESSAGE, (gchar *) src, left);
+  log_msg_parse_store_message(self, parse_options, data, src, left);
   return TRUE;
 }
 
@@ -1173,9 +1219,12 @@ syslog_format_handler(const MsgFormatOptions *parse_options,
   while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\0'))
     length--;
 
+  if (parse_options->flags & LP_STORE_RAW_MESSAGE)
+    log_msg_set_value(self, raw_message, (gchar *) data, length);
+
   if (parse_options->flags & LP_NOPARSE)
     {
-      log_msg_set_value(self, LM_V_MESSAGE, (gchar *) data, length);
+      log_msg_parse_store_message(self, parse_options, data, data, length);
       self->pri = parse_options->default_pri;
       return;
     }
@@ -1223,6 +1272,7 @@ syslog_format_init(void)
     {
       is_synced = log_msg_get_value_handle(".SDATA.timeQuality.isSynced");
       cisco_seqid = log_msg_get_value_handle(".SDATA.meta.sequenceId");
+      raw_message = log_msg_get_value_handle("RAWMSG");
       handles_initialized = TRUE;
     }
 
@@ -30,7 +30,7 @@ import messagegen
 syslogng_pid = 0
 
 
-def start_syslogng(conf, keep_persist=False, verbose=False):
+def start_syslogng(conf, keep_persist=False, verbose=False, extra_args=()):
     global syslogng_pid
 
     os.system('rm -f test-*.log test-*.lgs test-*.db wildcard/* log-file')
@@ -53,7 +53,7 @@ def start_syslogng(conf, keep_persist=False, verbose=False):
     if syslogng_pid == 0:
         os.putenv("RANDFILE", "rnd")
         module_path = get_module_path()
-        rc = os.execl(get_syslog_ng_binary(), get_syslog_ng_binary(), '-f', 'test.conf', '--fd-limit', '1024', '-F', verbose_opt, '-p', 'syslog-ng.pid', '-R', 'syslog-ng.persist', '--no-caps', '--enable-core', '--seed', '--module-path', module_path)
+        rc = os.execl(get_syslog_ng_binary(), get_syslog_ng_binary(), '-f', 'test.conf', '--fd-limit', '1024', '-F', verbose_opt, '-p', 'syslog-ng.pid', '-R', 'syslog-ng.persist', '--no-caps', '--enable-core', '--seed', '--module-path', module_path, *extra_args)
         sys.exit(rc)
     time.sleep(5)
     print_user("Syslog-ng started")
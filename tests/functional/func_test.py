@@ -85,8 +85,9 @@ import test_input_drivers
 import test_performance
 import test_sql
 import test_python
+import test_event_loop
 
-tests = (test_input_drivers, test_sql, test_file_source, test_filters, test_performance, test_python)
+tests = (test_input_drivers, test_sql, test_file_source, test_filters, test_performance, test_python, test_event_loop)
 
 init_env()
 seed_rnd()
@@ -113,7 +114,7 @@ try:
             print_start(test_name)
 
 
-            if not start_syslogng(test_module.config, verbose):
+            if not start_syslogng(test_module.config, verbose, extra_args=getattr(test_module, "syslogng_args", ())):
                 sys.exit(1)
 
             print_user("Starting test case...")
@@ -0,0 +1,70 @@
+#############################################################################
+# Copyright (c) 2017 Balabit
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#
+# As an additional exemption you are allowed to compile & link against the
+# OpenSSL libraries as published by the OpenSSL project. See the file
+# COPYING for details.
+#
+#############################################################################
+
+import os, signal, threading, time
+
+from globals import *
+from log import *
+from messagegen import *
+from messagecheck import *
+import control
+
+config = """@version: 3.9
+
+options { ts_format(iso); chain_hostnames(no); keep_hostname(yes); threaded(yes); };
+
+source s_tcp { tcp(port(%(port_number)d) listen-backlog(64)); };
+
+# the templated file name makes the destination open its writer using a
+# blocking main_loop_call() from the event loop thread feeding it
+destination d_event_loop { file("test-event-loop-${FACILITY}.log"); };
+
+log { source(s_tcp); destination(d_event_loop); };
+""" % locals()
+
+# accepted connections are polled and processed by event loop threads
+syslogng_args = ('--event-loop-threads', '2')
+
+def _send_in_background(sender, message, expected):
+    def send():
+        expected.extend(sender.sendMessages(message))
+
+    thread = threading.Thread(target=send)
+    thread.start()
+    return thread
+
+def test_reload_while_event_loop_feeds_file_destination():
+    expected = []
+
+    s = SocketSender(AF_INET, ('localhost', port_number), dgram=0, repeat=20000)
+    sender = _send_in_background(s, 'event_loop', expected)
+    for i in range(0, 5):
+        time.sleep(0.2)
+        print_user("Sending syslog-ng the HUP signal while messages are being processed")
+        os.kill(control.syslogng_pid, signal.SIGHUP)
+    sender.join()
+
+    # syslog-ng still accepts and processes new connections after the reloads
+    s = SocketSender(AF_INET, ('localhost', port_number), dgram=0, repeat=100)
+    expected.extend(s.sendMessages('event_loop'))
+
+    return check_file_expected("test-event-loop-kern", expected, settle_time=6)
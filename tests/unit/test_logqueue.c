@@ -24,11 +24,13 @@
 
 #include "logqueue.h"
 #include "logqueue-fifo.h"
+#include "logqueue-mpsc.h"
 #include "logpipe.h"
 #include "apphook.h"
 #include "plugin.h"
 #include "mainloop.h"
 #include "mainloop-io-worker.h"
+#include "stats/stats-histogram.h"
 #include "libtest/queue_utils_lib.h"
 #include "msg_parse_lib.h"
 
@@ -264,3 +266,352 @@ Test(logqueue, test_with_threads)
     }
   fprintf(stderr, "Feed speed: %.2lf\n", (double) TEST_RUNS * MESSAGES_SUM * 1000000 / sum_time);
 }
+
+Test(logqueue, test_mpsc_normal_acks)
+{
+  LogQueue *q;
+  gint i;
+
+  q = log_queue_mpsc_new(OVERFLOW_SIZE, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  for (i = 0; i < 10; i++)
+    feed_some_messages(q, 10, &parse_options);
+
+  cr_assert_eq(log_queue_get_length(q), fed_messages, "queue length mismatch");
+  send_some_messages(q, fed_messages);
+  app_ack_some_messages(q, fed_messages);
+
+  cr_assert_eq(fed_messages, acked_messages,
+               "did not receive enough acknowledgements: fed_messages=%d, acked_messages=%d",
+               fed_messages, acked_messages);
+
+  log_queue_unref(q);
+}
+
+Test(logqueue, test_mpsc_rewind_backlog)
+{
+  LogQueue *q;
+
+  q = log_queue_mpsc_new(OVERFLOW_SIZE, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  feed_some_messages(q, 10, &parse_options);
+
+  send_some_messages(q, 10);
+  cr_assert_eq(log_queue_get_length(q), 0, "all messages should be in the backlog");
+
+  app_rewind_some_messages(q, 5);
+  cr_assert_eq(log_queue_get_length(q), 5, "rewound messages should be back in the queue");
+
+  /* rewound messages are sent before the ones still in the ring */
+  feed_some_messages(q, 10, &parse_options);
+  send_some_messages(q, 15);
+  rewind_messages(q);
+  cr_assert_eq(log_queue_get_length(q), 20, "the whole backlog should be back in the queue");
+
+  send_some_messages(q, 20);
+  app_ack_some_messages(q, 20);
+  cr_assert_eq(acked_messages, fed_messages,
+               "did not receive enough acknowledgements: fed_messages=%d, acked_messages=%d",
+               fed_messages, acked_messages);
+
+  log_queue_unref(q);
+}
+
+Test(logqueue, test_mpsc_drops_messages_when_full)
+{
+  LogQueue *q;
+
+  q = log_queue_mpsc_new(8, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  feed_some_messages(q, 10, &parse_options);
+
+  cr_assert_eq(log_queue_get_length(q), 8, "the queue should be limited to log_fifo_size");
+  cr_assert_eq(acked_messages, 2, "dropped messages should be acked");
+
+  send_some_messages(q, 8);
+  app_ack_some_messages(q, 8);
+  cr_assert_eq(acked_messages, fed_messages, "all messages should be acked");
+
+  log_queue_unref(q);
+}
+
+Test(logqueue, test_mpsc_spills_over_the_ring)
+{
+  LogQueue *q;
+
+  /* the ring is rounded down to 8 slots, the rest is spilled over */
+  q = log_queue_mpsc_new(12, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  feed_some_messages(q, 14, &parse_options);
+
+  cr_assert_eq(log_queue_get_length(q), 12, "the queue should be limited to log_fifo_size, not the ring size");
+  cr_assert_eq(acked_messages, 2, "dropped messages should be acked");
+
+  send_some_messages(q, 10);
+  app_rewind_some_messages(q, 4);
+  cr_assert_eq(log_queue_get_length(q), 6, "rewound messages should be back in the queue");
+
+  feed_some_messages(q, 4, &parse_options);
+  cr_assert_eq(log_queue_get_length(q), 10, "new messages should be queued behind the spilled ones");
+
+  send_some_messages(q, 10);
+  cr_assert_eq(log_queue_get_length(q), 0, "all messages should have been sent");
+  app_ack_some_messages(q, 16);
+  cr_assert_eq(acked_messages, fed_messages, "all messages should be acked");
+
+  log_queue_unref(q);
+}
+
+Test(logqueue, test_mpsc_records_queue_latency)
+{
+  StatsCounterItem queue_latency = { 0 };
+  LogQueue *q;
+
+  queue_latency.histogram = stats_histogram_new();
+
+  /* the ring is rounded down to 8 slots, the rest is spilled over */
+  q = log_queue_mpsc_new(12, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+  log_queue_set_latency_counters(q, NULL, &queue_latency);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  feed_some_messages(q, 12, &parse_options);
+
+  send_some_messages(q, 12);
+  cr_assert_eq(stats_histogram_get_count(queue_latency.histogram), 12,
+               "messages popped from the ring and the spill list should be recorded");
+
+  app_rewind_some_messages(q, 4);
+  send_some_messages(q, 4);
+  cr_assert_eq(stats_histogram_get_count(queue_latency.histogram), 16,
+               "rewound messages should be recorded again");
+
+  app_ack_some_messages(q, 12);
+  log_queue_unref(q);
+  stats_histogram_free(queue_latency.histogram);
+}
+
+Test(logqueue, test_mpsc_with_threads)
+{
+  LogQueue *q;
+  GThread *thread_feed[FEEDERS], *thread_consume;
+  gint i, j;
+
+  log_queue_set_max_threads(FEEDERS);
+  for (i = 0; i < TEST_RUNS; i++)
+    {
+      q = log_queue_mpsc_new(MESSAGES_SUM, NULL);
+      log_queue_set_use_backlog(q, TRUE);
+
+      for (j = 0; j < FEEDERS; j++)
+        thread_feed[j] = g_thread_create(_threaded_feed, q, TRUE, NULL);
+
+      thread_consume = g_thread_create(_threaded_consume, q, TRUE, NULL);
+
+      for (j = 0; j < FEEDERS; j++)
+        g_thread_join(thread_feed[j]);
+      cr_assert_null(g_thread_join(thread_consume), "consumer thread failed");
+
+      log_queue_unref(q);
+    }
+}
+
+#define MPSC_FEEDERS 4
+#define MPSC_MESSAGES_PER_FEEDER 20000
+/* the ring is rounded down to 64 slots, the rest is spilled over */
+#define MPSC_QUEUE_SIZE 120
+#define MPSC_BATCH_SIZE 16
+#define MPSC_REWIND_SIZE (MPSC_BATCH_SIZE / 2)
+/* the queue length checked by the feeders may grow by a message from each
+ * feeder and by a rewound batch, staying below this nothing is dropped */
+#define MPSC_FEED_LIMIT (MPSC_QUEUE_SIZE - 2 * (MPSC_FEEDERS + MPSC_BATCH_SIZE))
+
+typedef struct _MpscFeeder
+{
+  LogQueue *queue;
+  gint id;
+} MpscFeeder;
+
+typedef struct _MpscItem
+{
+  gint feeder;
+  gint seq;
+} MpscItem;
+
+static void
+_mpsc_ack(LogMessage *msg, AckType ack_type)
+{
+  g_atomic_int_inc(&acked_messages);
+}
+
+static gpointer
+_mpsc_feed(gpointer user_data)
+{
+  MpscFeeder *feeder = (MpscFeeder *) user_data;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint i;
+
+  iv_init();
+  main_loop_worker_thread_start(NULL);
+
+  path_options.ack_needed = TRUE;
+  for (i = 0; i < MPSC_MESSAGES_PER_FEEDER; i++)
+    {
+      LogMessage *msg;
+      gchar value[32];
+
+      while (log_queue_get_length(feeder->queue) >= MPSC_FEED_LIMIT)
+        g_thread_yield();
+
+      msg = log_msg_new_empty();
+      g_snprintf(value, sizeof(value), "%d %d", feeder->id, i);
+      log_msg_set_value(msg, LM_V_MESSAGE, value, -1);
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = _mpsc_ack;
+      log_queue_push_tail(feeder->queue, msg, &path_options);
+
+      if ((i & 0xF) == 0)
+        main_loop_worker_invoke_batch_callbacks();
+    }
+  main_loop_worker_invoke_batch_callbacks();
+
+  main_loop_worker_thread_stop();
+  iv_deinit();
+  return NULL;
+}
+
+static void
+_mpsc_parse_item(LogMessage *msg, MpscItem *item)
+{
+  const gchar *value = log_msg_get_value(msg, LM_V_MESSAGE, NULL);
+
+  cr_assert_eq(sscanf(value, "%d %d", &item->feeder, &item->seq), 2, "unexpected message: %s", value);
+  cr_assert(item->feeder >= 0 && item->feeder < MPSC_FEEDERS, "unexpected message: %s", value);
+}
+
+/* acks the backlog, the messages of each feeder must come in the order
+ * they were pushed, without duplicates */
+static gint
+_mpsc_ack_backlog(LogQueue *q, MpscItem *backlog, gint backlog_len, gint *last_seq)
+{
+  gint i;
+
+  log_queue_ack_backlog(q, backlog_len);
+  for (i = 0; i < backlog_len; i++)
+    {
+      MpscItem *item = &backlog[i];
+
+      cr_assert_gt(item->seq, last_seq[item->feeder],
+                   "messages of feeder %d reordered or duplicated: seq=%d after seq=%d",
+                   item->feeder, item->seq, last_seq[item->feeder]);
+      last_seq[item->feeder] = item->seq;
+    }
+  return backlog_len;
+}
+
+Test(logqueue, test_mpsc_keeps_the_order_of_each_feeder_without_losing_messages)
+{
+  LogQueue *q;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  StatsCounterItem dropped_messages = { 0 };
+  MpscFeeder feeders[MPSC_FEEDERS];
+  GThread *feeder_threads[MPSC_FEEDERS];
+  MpscItem backlog[MPSC_BATCH_SIZE], rewound[MPSC_REWIND_SIZE];
+  gint last_seq[MPSC_FEEDERS];
+  gint backlog_len = 0, rewound_pos = MPSC_REWIND_SIZE;
+  gint consumed = 0, batches = 0, idle = 0;
+  gint i;
+
+  log_queue_set_max_threads(MPSC_FEEDERS);
+  q = log_queue_mpsc_new(MPSC_QUEUE_SIZE, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+  log_queue_set_counters(q, NULL, &dropped_messages);
+  acked_messages = 0;
+
+  for (i = 0; i < MPSC_FEEDERS; i++)
+    {
+      last_seq[i] = -1;
+      feeders[i].queue = q;
+      feeders[i].id = i;
+      feeder_threads[i] = g_thread_create(_mpsc_feed, &feeders[i], TRUE, NULL);
+    }
+
+  while (consumed < MPSC_FEEDERS * MPSC_MESSAGES_PER_FEEDER)
+    {
+      LogMessage *msg = log_queue_pop_head(q, &path_options);
+      MpscItem item;
+
+      if (!msg)
+        {
+          struct timespec ns = { 0, 1000000 };
+
+          /* the feeders may be done, ack what is left in the backlog */
+          consumed += _mpsc_ack_backlog(q, backlog, backlog_len, last_seq);
+          backlog_len = 0;
+
+          cr_assert_lt(idle, 10000, "the wait for messages took too much time, consumed=%d", consumed);
+          nanosleep(&ns, NULL);
+          idle++;
+          continue;
+        }
+      idle = 0;
+
+      _mpsc_parse_item(msg, &item);
+      log_msg_unref(msg);
+
+      if (rewound_pos < MPSC_REWIND_SIZE)
+        {
+          MpscItem *expected = &rewound[rewound_pos++];
+
+          cr_assert(item.feeder == expected->feeder && item.seq == expected->seq,
+                    "rewound messages should be redelivered first, expected=%d/%d, got=%d/%d",
+                    expected->feeder, expected->seq, item.feeder, item.seq);
+        }
+
+      backlog[backlog_len++] = item;
+      if (backlog_len < MPSC_BATCH_SIZE)
+        continue;
+
+      if (++batches % 3 == 0)
+        {
+          /* rewind the second half of the batch, as a destination would
+           * after a partial failure */
+          memcpy(rewound, &backlog[MPSC_BATCH_SIZE - MPSC_REWIND_SIZE], sizeof(rewound));
+          rewound_pos = 0;
+          log_queue_rewind_backlog(q, MPSC_REWIND_SIZE);
+          backlog_len -= MPSC_REWIND_SIZE;
+        }
+      else
+        {
+          consumed += _mpsc_ack_backlog(q, backlog, backlog_len, last_seq);
+          backlog_len = 0;
+        }
+    }
+
+  for (i = 0; i < MPSC_FEEDERS; i++)
+    {
+      g_thread_join(feeder_threads[i]);
+      cr_assert_eq(last_seq[i], MPSC_MESSAGES_PER_FEEDER - 1,
+                   "not every message of feeder %d was delivered, last_seq=%d", i, last_seq[i]);
+    }
+
+  cr_assert_eq(stats_counter_get(&dropped_messages), 0, "no message should have been dropped");
+  cr_assert_eq(log_queue_get_length(q), 0, "the queue should be empty");
+  cr_assert_eq(acked_messages, MPSC_FEEDERS * MPSC_MESSAGES_PER_FEEDER,
+               "every message should be acked exactly once, acked_messages=%d", acked_messages);
+
+  log_queue_unref(q);
+}
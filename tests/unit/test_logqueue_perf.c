@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+/*
+ * Microbenchmark comparing the LogQueue implementations: a number of input
+ * threads push messages to the same queue, while an output thread pops
+ * them.  The throughput is printed for each implementation and each
+ * number of input threads.
+ *
+ * It is not run by "make check", run tests/unit/test_logqueue_perf by hand.
+ * The correctness of the queues is covered by test_logqueue.
+ */
+
+#include <criterion/criterion.h>
+
+#include "logqueue.h"
+#include "logqueue-fifo.h"
+#include "logqueue-mpsc.h"
+#include "apphook.h"
+#include "mainloop-worker.h"
+
+#include <iv.h>
+
+#define MAX_FEEDERS 8
+#define MESSAGES_PER_FEEDER 100000
+#define QUEUE_SIZE 100000
+
+typedef LogQueue *(*LogQueueConstructor)(gint qoverflow_size, const gchar *persist_name);
+
+typedef struct _BenchmarkState
+{
+  LogQueue *queue;
+  gint messages_to_consume;
+  gint dropped;
+} BenchmarkState;
+
+static gpointer
+_feed_messages(gpointer user_data)
+{
+  BenchmarkState *state = (BenchmarkState *) user_data;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *template_msg;
+  gint i;
+
+  iv_init();
+  main_loop_worker_thread_start(NULL);
+
+  /* a message can only be queued by one thread at a time, clone them like a source would produce them */
+  template_msg = log_msg_new_empty();
+  for (i = 0; i < MESSAGES_PER_FEEDER; i++)
+    {
+      log_queue_push_tail(state->queue, log_msg_clone_cow(template_msg, &path_options), &path_options);
+
+      /* emulate the batches of a source reading log_fetch_limit messages */
+      if ((i & 0xFF) == 0)
+        main_loop_worker_invoke_batch_callbacks();
+    }
+  main_loop_worker_invoke_batch_callbacks();
+  log_msg_unref(template_msg);
+
+  main_loop_worker_thread_stop();
+  iv_deinit();
+  return NULL;
+}
+
+static gpointer
+_consume_messages(gpointer user_data)
+{
+  BenchmarkState *state = (BenchmarkState *) user_data;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gint consumed = 0;
+
+  while (consumed + g_atomic_int_get(&state->dropped) < state->messages_to_consume)
+    {
+      msg = log_queue_pop_head(state->queue, &path_options);
+      if (!msg)
+        {
+          g_thread_yield();
+          continue;
+        }
+      log_msg_unref(msg);
+      consumed++;
+    }
+  return NULL;
+}
+
+static gdouble
+_run_benchmark(LogQueueConstructor construct, gint feeders)
+{
+  BenchmarkState state;
+  GThread *feeder_threads[MAX_FEEDERS], *consumer_thread;
+  StatsCounterItem dropped_messages = { 0 };
+  GTimeVal start, end;
+  gint i;
+
+  log_queue_set_max_threads(feeders);
+  state.queue = construct(QUEUE_SIZE, NULL);
+  state.messages_to_consume = feeders * MESSAGES_PER_FEEDER;
+  state.dropped = 0;
+  log_queue_set_counters(state.queue, NULL, &dropped_messages);
+
+  g_get_current_time(&start);
+  consumer_thread = g_thread_create(_consume_messages, &state, TRUE, NULL);
+  for (i = 0; i < feeders; i++)
+    feeder_threads[i] = g_thread_create(_feed_messages, &state, TRUE, NULL);
+  for (i = 0; i < feeders; i++)
+    g_thread_join(feeder_threads[i]);
+
+  /* messages dropped because the consumer fell behind won't be consumed */
+  g_atomic_int_add(&state.dropped, stats_counter_get(&dropped_messages));
+  g_thread_join(consumer_thread);
+  g_get_current_time(&end);
+
+  log_queue_unref(state.queue);
+  return (gdouble) state.messages_to_consume * G_USEC_PER_SEC / g_time_val_diff(&end, &start);
+}
+
+static void
+setup(void)
+{
+  app_startup();
+}
+
+static void
+teardown(void)
+{
+  app_shutdown();
+}
+
+TestSuite(logqueue_perf, .init = setup, .fini = teardown);
+
+Test(logqueue_perf, test_fifo_vs_mpsc_throughput)
+{
+  gint feeders;
+
+  for (feeders = 1; feeders <= MAX_FEEDERS; feeders *= 2)
+    {
+      gdouble fifo_rate = _run_benchmark(log_queue_fifo_new, feeders);
+      gdouble mpsc_rate = _run_benchmark(log_queue_mpsc_new, feeders);
+
+      printf("      input threads: %d, fifo: %12.3f msg/sec, mpsc: %12.3f msg/sec\n",
+             feeders, fifo_rate, mpsc_rate);
+      cr_assert_gt(fifo_rate, 0);
+      cr_assert_gt(mpsc_rate, 0);
+    }
+}
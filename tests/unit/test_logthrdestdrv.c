@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2017 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include <criterion/criterion.h>
+
+#include "logthrdestdrv.h"
+#include "logqueue-fifo.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "stats/stats-registry.h"
+#include "libtest/queue_utils_lib.h"
+#include "msg_parse_lib.h"
+
+#include <string.h>
+
+MsgFormatOptions parse_options;
+
+LogThrDestDriver *driver;
+LogThrDestWorker *worker;
+
+/* the worker state is set up by hand, the same way
+ * log_threaded_dest_driver_start() would, without starting its thread:
+ * outside of a worker thread every call is routed to the first worker */
+static void
+_setup_driver(void)
+{
+  driver = g_new0(LogThrDestDriver, 1);
+  log_threaded_dest_driver_init_instance(driver, configuration);
+  driver->seq_num = 1;
+
+  worker = g_new0(LogThrDestWorker, 1);
+  worker->owner = driver;
+  worker->queue = log_queue_fifo_new(1000, NULL);
+  log_queue_set_use_backlog(worker->queue, TRUE);
+
+  driver->workers.list = g_new0(LogThrDestWorker *, 1);
+  driver->workers.list[0] = worker;
+
+  stats_lock();
+  stats_register_counter(0, SCS_DESTINATION, "test_logthrdestdrv", NULL, SC_TYPE_DROPPED,
+                         &worker->dropped_messages);
+  stats_unlock();
+}
+
+static void
+_teardown_driver(void)
+{
+  stats_lock();
+  stats_unregister_counter(SCS_DESTINATION, "test_logthrdestdrv", NULL, SC_TYPE_DROPPED,
+                           &worker->dropped_messages);
+  stats_unlock();
+
+  log_queue_unref(worker->queue);
+  log_pipe_unref(&driver->super.super.super);
+}
+
+/* what the worker thread does while it builds a batch of n messages */
+static void
+_fill_batch(gint n)
+{
+  send_some_messages(worker->queue, n);
+  worker->batch.size = n;
+}
+
+static void
+_assert_next_message_is(gint id)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gchar expected[32];
+
+  g_snprintf(expected, sizeof(expected), "ID :%08d", id);
+  msg = log_queue_pop_head(worker->queue, &path_options);
+  cr_assert_not_null(msg, "the queue should not be empty, expected message: %s", expected);
+  cr_assert_not_null(strstr(log_msg_get_value(msg, LM_V_MESSAGE, NULL), expected),
+                     "unexpected message at the head of the queue, expected: %s, message: %s",
+                     expected, log_msg_get_value(msg, LM_V_MESSAGE, NULL));
+  log_msg_unref(msg);
+  log_queue_rewind_backlog(worker->queue, 1);
+}
+
+void
+setup(void)
+{
+  app_startup();
+  init_and_load_syslogformat_module();
+  _setup_driver();
+
+  fed_messages = 0;
+  acked_messages = 0;
+}
+
+void
+teardown(void)
+{
+  _teardown_driver();
+  deinit_syslogformat_module();
+  app_shutdown();
+}
+
+TestSuite(logthrdestdrv, .init = setup, .fini = teardown);
+
+Test(logthrdestdrv, test_batch_ack_messages_acks_the_head_of_the_batch)
+{
+  feed_some_messages(worker->queue, 10, &parse_options);
+  _fill_batch(5);
+  worker->retries_counter = 2;
+
+  log_threaded_dest_driver_batch_ack_messages(driver, 2, FALSE);
+
+  cr_assert_eq(acked_messages, 2, "the head of the batch should be acked, acked_messages=%d", acked_messages);
+  cr_assert_eq(worker->batch.size, 3, "the acked messages should leave the batch, batch.size=%d",
+               worker->batch.size);
+  cr_assert_eq(driver->seq_num, 3, "the sequence number should step once per acked message, seq_num=%d",
+               driver->seq_num);
+  cr_assert_eq(worker->retries_counter, 0, "a successful ack should reset the retries counter");
+  cr_assert_eq(stats_counter_get(worker->dropped_messages), 0);
+}
+
+Test(logthrdestdrv, test_partial_ack_then_rewinding_the_rest_redelivers_only_the_rest)
+{
+  feed_some_messages(worker->queue, 10, &parse_options);
+  _fill_batch(5);
+
+  log_threaded_dest_driver_batch_ack_messages(driver, 2, FALSE);
+
+  /* flush() returning WORKER_INSERT_RESULT_REWIND rewinds the rest of the batch */
+  log_queue_rewind_backlog(worker->queue, worker->batch.size);
+  worker->batch.size = 0;
+
+  cr_assert_eq(log_queue_get_length(worker->queue), 8,
+               "only the unacked part of the batch should be back in the queue, length=%d",
+               log_queue_get_length(worker->queue));
+  _assert_next_message_is(2);
+
+  _fill_batch(8);
+  log_threaded_dest_driver_batch_ack_messages(driver, 8, FALSE);
+
+  cr_assert_eq(log_queue_get_length(worker->queue), 0);
+  cr_assert_eq(worker->batch.size, 0);
+  cr_assert_eq(acked_messages, fed_messages,
+               "every message should be acked exactly once, fed_messages=%d, acked_messages=%d",
+               fed_messages, acked_messages);
+}
+
+Test(logthrdestdrv, test_batch_ack_messages_counts_dropped_messages)
+{
+  feed_some_messages(worker->queue, 5, &parse_options);
+  _fill_batch(5);
+  worker->retries_counter = 2;
+
+  log_threaded_dest_driver_batch_ack_messages(driver, 3, TRUE);
+
+  cr_assert_eq(acked_messages, 3, "dropped messages are acked too, acked_messages=%d", acked_messages);
+  cr_assert_eq(worker->batch.size, 2);
+  cr_assert_eq(stats_counter_get(worker->dropped_messages), 3);
+  cr_assert_eq(worker->retries_counter, 2, "dropping messages should not reset the retries counter");
+
+  log_queue_rewind_backlog(worker->queue, worker->batch.size);
+  worker->batch.size = 0;
+  _assert_next_message_is(3);
+}
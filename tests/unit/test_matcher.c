@@ -27,6 +27,8 @@
 #include "plugin.h"
 #include "cfg.h"
 #include "msg_parse_lib.h"
+#include "stats/stats.h"
+#include "stats/stats-registry.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -266,3 +268,51 @@ Test(matcher, pcre812_incompatibility, .description = "tests a pcre 8.12 incompa
   testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: wikiwiki",
                    "([[:digit:]]{1,3}\\.){3}[[:digit:]]{1,3}", "foo", "wikiwiki", _construct_matcher(LMF_GLOBAL, log_matcher_pcre_re_new));
 }
+
+Test(matcher, pcre_named_substrings, .description = "named subpatterns are stored as name-value pairs")
+{
+  LogMatcher *m = _construct_matcher(LMF_STORE_MATCHES, log_matcher_pcre_re_new);
+  LogMessage *msg = _create_log_message("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: user=alice uid=1000");
+
+  log_matcher_compile(m, "user=(?<user>[a-z]+) uid=(?<uid>[0-9]+)", NULL);
+  cr_assert(log_matcher_match(m, msg, LM_V_MESSAGE, log_msg_get_value(msg, LM_V_MESSAGE, NULL), -1));
+  cr_assert_str_eq(log_msg_get_value_by_name(msg, "user", NULL), "alice");
+  cr_assert_str_eq(log_msg_get_value_by_name(msg, "uid", NULL), "1000");
+  cr_assert_str_eq(log_msg_get_value_by_name(msg, "1", NULL), "alice");
+
+  log_matcher_unref(m);
+  log_msg_unref(msg);
+}
+
+Test(matcher, pcre_evaluation_stats, .description = "regexp evaluations are counted at stats-level 3")
+{
+  static StatsOptions stats_options;
+  StatsCounterItem *evaluations = NULL;
+  StatsCounterItem *eval_time = NULL;
+  const gchar *pattern = "wi(ki)";
+  LogMatcher *m;
+
+  stats_options_defaults(&stats_options);
+  stats_options.level = 3;
+  stats_reinit(&stats_options);
+
+  m = _construct_matcher(0, log_matcher_pcre_re_new);
+  log_matcher_compile(m, pattern, NULL);
+  cr_assert(log_matcher_match(m, NULL, LM_V_NONE, "wikiwiki", -1));
+  cr_assert_not(log_matcher_match(m, NULL, LM_V_NONE, "wakawaka", -1));
+
+  stats_lock();
+  stats_register_counter(3, SCS_REGEXP, pattern, NULL, SC_TYPE_PROCESSED, &evaluations);
+  stats_register_counter(3, SCS_REGEXP, pattern, NULL, SC_TYPE_EVAL_TIME, &eval_time);
+  stats_unlock();
+
+  cr_assert_eq(stats_counter_get(evaluations), 2);
+  cr_assert_gt(stats_counter_get(eval_time), 0);
+
+  stats_lock();
+  stats_unregister_counter(SCS_REGEXP, pattern, NULL, SC_TYPE_PROCESSED, &evaluations);
+  stats_unregister_counter(SCS_REGEXP, pattern, NULL, SC_TYPE_EVAL_TIME, &eval_time);
+  stats_unlock();
+
+  log_matcher_unref(m);
+}
@@ -1088,3 +1088,83 @@ Test(msgparse, test_simple_message)
   };
   run_parameterized_test(params);
 }
+
+Test(msgparse, test_store_raw_message)
+{
+  struct sdata_pair expected_sd_pairs[] =
+  {
+    { ".SDATA.exampleSDID@0.iut", "3"},
+    { ".SDATA.exampleSDID@0.eventSource", "Application"},
+    { ".SDATA.exampleSDID@0.escaped", "a\"b"},
+    { ".SDATA.examplePriority@0.class", "high"},
+    {  NULL , NULL}
+  };
+
+  struct msgparse_params params[] =
+  {
+    {
+      "<7>1 2006-10-29T01:59:59.156+01:00 mymachine.example.com evntslog 1234 ID47 [exampleSDID@0 iut=\"3\" eventSource=\"Application\" escaped=\"a\\\"b\"][examplePriority@0 class=\"high\"] An application event log entry...",
+      LP_SYSLOG_PROTOCOL | LP_STORE_RAW_MESSAGE, NULL,
+      7,             // pri
+      1162083599, 156000, 3600,    // timestamp (sec/usec/zone)
+      "mymachine.example.com",        // host
+      "evntslog", //app
+      "An application event log entry...", // msg
+      "[exampleSDID@0 iut=\"3\" eventSource=\"Application\" escaped=\"a\\\"b\"][examplePriority@0 class=\"high\"]", //sd_str
+      "1234",//processid
+      "ID47",//msgid
+      expected_sd_pairs
+    },
+    {
+      "<15>Jan  1 01:00:00 bzorp openvpn[2499]: PTHREAD support initialized",
+      LP_EXPECT_HOSTNAME | LP_STORE_RAW_MESSAGE, NULL,
+      15,             // pri
+      _get_epoch_with_bsd_year(0, 1, 1, 0, 0), 0, 3600,        // timestamp (sec/usec/zone)
+      "bzorp",        // host
+      "openvpn", //app
+      "PTHREAD support initialized", // msg
+      NULL, "2499", NULL, ignore_sdata_pairs
+    },
+    {NULL}
+  };
+
+  run_parameterized_test(params);
+}
+
+Test(msgparse, test_store_raw_message_references_values_instead_of_copying)
+{
+  gchar *raw = "<7>1 2006-10-29T01:59:59.156+01:00 mymachine evntslog - - [a i=\"value\" e=\"a\\\\b\"] message text";
+  LogMessage *msg = _parse_log_message(raw, LP_SYSLOG_PROTOCOL | LP_STORE_RAW_MESSAGE, NULL);
+  const gchar *rawmsg, *value;
+  gssize rawmsg_len, value_len;
+
+  rawmsg = log_msg_get_value_by_name(msg, "RAWMSG", &rawmsg_len);
+  cr_assert_eq(rawmsg_len, strlen(raw));
+  cr_assert_str_eq(rawmsg, raw);
+
+  value = log_msg_get_value(msg, LM_V_MESSAGE, &value_len);
+  cr_assert_str_eq(value, "message text");
+  cr_assert_eq(value, rawmsg + rawmsg_len - value_len, "$MSG is expected to point into RAWMSG");
+
+  value = log_msg_get_value_by_name(msg, ".SDATA.a.i", &value_len);
+  cr_assert_eq(value_len, 5);
+  cr_assert_eq(value, strstr(rawmsg, "value"), "unescaped SDATA values are expected to point into RAWMSG");
+
+  value = log_msg_get_value_by_name(msg, ".SDATA.a.e", &value_len);
+  cr_assert_eq(value_len, 3);
+  cr_assert(value < rawmsg || value >= rawmsg + rawmsg_len, "escaped SDATA values are expected to be copied");
+  cr_assert_eq(strncmp(value, "a\\b", value_len), 0);
+
+  log_msg_unref(msg);
+}
+
+Test(msgparse, test_store_raw_message_is_not_affected_by_no_multi_line)
+{
+  gchar *raw = "<7>1 2006-10-29T01:59:59.156+01:00 mymachine evntslog - - - multi\nline";
+  LogMessage *msg = _parse_log_message(raw, LP_SYSLOG_PROTOCOL | LP_STORE_RAW_MESSAGE | LP_NO_MULTI_LINE, NULL);
+
+  assert_log_message_value(msg, LM_V_MESSAGE, "multi line");
+  assert_log_message_value(msg, log_msg_get_value_handle("RAWMSG"), raw);
+
+  log_msg_unref(msg);
+}